@@ -1,25 +1,111 @@
 #import <Foundation/Foundation.h>
 #import <AudioToolbox/AudioToolbox.h>
+#import "../../Common/MyAudioKernels.h"
 
 #define SAMPLE_RATE 44100	// 1
 #define DURATION 5.0	// 2
-// #define FILENAME_FORMAT @"%0.3f-square.aif"
-// #define FILENAME_FORMAT @"%0.3f-saw.aif"
-#define FILENAME_FORMAT @"%0.3f-sine.aif"
+#define FILENAME_FORMAT @"%0.3f-%s.aif"
+#define BLOCK_SIZE_FRAMES 32768	// frames rendered per AudioFileWriteBytes() call
+#define WAVETABLE_SIZE 4096	// must be a power of 2
+
+typedef enum MyWaveform {
+	MyWaveformSine = 0,
+	MyWaveformSquare,
+	MyWaveformSaw
+} MyWaveform;
+
+typedef struct MyToneGenerator {
+	MyWaveform	waveform;
+	double		phase;			// position in current cycle, 0.0 <= phase < 1.0
+	double		phaseIncrement;	// cycles per sample (hz / sample rate)
+	float		sineTable[WAVETABLE_SIZE + 1];	// one extra guard point for interpolation
+} MyToneGenerator;
+
+#pragma mark - tone generator -
+
+static const char *MyWaveformName (MyWaveform waveform) {
+	switch (waveform) {
+		case MyWaveformSquare:	return "square";
+		case MyWaveformSaw:		return "saw";
+		default:				return "sine";
+	}
+}
+
+static void MyToneGeneratorInit (MyToneGenerator *generator, MyWaveform waveform, double hz) {
+	generator->waveform = waveform;
+	generator->phase = 0.0;
+	generator->phaseIncrement = hz / SAMPLE_RATE;
+	for (int i = 0; i <= WAVETABLE_SIZE; i++)
+		generator->sineTable[i] = (float) sin (2 * M_PI * ((double) i / WAVETABLE_SIZE));
+}
+
+// render a whole block of big-endian samples, ready to be written to the file as-is
+static void MyToneGeneratorRender (MyToneGenerator *generator, SInt16 *outSamples, UInt32 frameCount) {
+	double phase = generator->phase;
+	double increment = generator->phaseIncrement;
+
+	switch (generator->waveform) {
+		case MyWaveformSquare:
+			for (UInt32 i = 0; i < frameCount; i++) {
+				outSamples[i] = phase < 0.5 ? SHRT_MAX : SHRT_MIN;
+				phase += increment;
+				phase -= (int) phase;
+			}
+			break;
+		case MyWaveformSaw:
+			for (UInt32 i = 0; i < frameCount; i++) {
+				outSamples[i] = (SInt16) ((phase * SHRT_MAX * 2) - SHRT_MAX);
+				phase += increment;
+				phase -= (int) phase;
+			}
+			break;
+		default:
+			// sine: linear interpolation in the wavetable instead of one sin() per sample
+			for (UInt32 i = 0; i < frameCount; i++) {
+				double position = phase * WAVETABLE_SIZE;
+				int index = (int) position;
+				float fraction = (float) (position - index);
+				float a = generator->sineTable[index];
+				float b = generator->sineTable[index + 1];
+				outSamples[i] = (SInt16) (SHRT_MAX * (a + (b - a) * fraction));
+				phase += increment;
+				phase -= (int) phase;
+			}
+			break;
+	}
+	generator->phase = phase;
+
+	// AIFF wants big-endian samples. do the swap over the whole block at once
+#if __LITTLE_ENDIAN__
+	MySwapInt16 ((UInt16*) outSamples, frameCount);
+#endif
+}
 
 int main (int argc, const char * argv[]) {
     NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
 	
 	if (argc < 2) {
-		printf ("Usage: CAToneFileGenerator n\n(where n is tone in Hz)");
+		printf ("Usage: CAToneFileGenerator n [sine|square|saw]\n(where n is tone in Hz)");
 		return -1;
 	} // 1
 	
 	double hz = atof(argv[1]);	// 2
 	assert (hz > 0);
-	NSLog (@"generating %f hz tone", hz);
 	
-	NSString *fileName = [NSString stringWithFormat:FILENAME_FORMAT, hz];
+	MyWaveform waveform = MyWaveformSine;
+	if (argc > 2) {
+		if (strcmp (argv[2], "square") == 0)
+			waveform = MyWaveformSquare;
+		else if (strcmp (argv[2], "saw") == 0)
+			waveform = MyWaveformSaw;
+		else if (strcmp (argv[2], "sine") != 0) {
+			printf ("Unknown waveform %s (use sine, square or saw)\n", argv[2]);
+			return -1;
+		}
+	}
+	NSLog (@"generating %f hz %s tone", hz, MyWaveformName(waveform));
+	
+	NSString *fileName = [NSString stringWithFormat:FILENAME_FORMAT, hz, MyWaveformName(waveform)];
 	NSString *filePath = [[[NSFileManager defaultManager] currentDirectoryPath]
 						  stringByAppendingPathComponent: fileName];
 	NSURL *fileURL = [NSURL fileURLWithPath: filePath];
@@ -50,57 +136,34 @@ int main (int argc, const char * argv[]) {
 	// start writing samples
 	long maxSampleCount = SAMPLE_RATE * DURATION;
 	long sampleCount = 0;
-	UInt32 bytesToWrite = 2;
 	double wavelengthInSamples = SAMPLE_RATE / hz;
 	NSLog (@"wavelengthInSamples = %f", wavelengthInSamples);
 	
+	MyToneGenerator *generator = (MyToneGenerator*) malloc (sizeof(MyToneGenerator));
+	MyToneGeneratorInit (generator, waveform, hz);
+	SInt16 *samples = (SInt16*) malloc (BLOCK_SIZE_FRAMES * asbd.mBytesPerFrame);
+	
+	// render a block at a time and write each one with a single call, rather
+	// than paying for an AudioFileWriteBytes() on every 2-byte sample
 	while (sampleCount < maxSampleCount) {
-		for (int i=0; i<wavelengthInSamples; i++) {
-			/*
-			 // square wave
-			 SInt16 sample;
-			 if (i < wavelengthInSamples/2) {
-			 sample = CFSwapInt16HostToBig (SHRT_MAX);
-			 } else {
-			 sample = CFSwapInt16HostToBig (SHRT_MIN);
-			 }
-			 audioErr = AudioFileWriteBytes(audioFile,
-			 false,
-			 sampleCount*2, 
-			 &bytesToWrite,
-			 &sample);
-			 assert (audioErr == noErr);
-			 */
-			
-			/*
-			 // saw wave
-			 SInt16 sample = CFSwapInt16HostToBig (((i / wavelengthInSamples) * SHRT_MAX *2) -
-			 SHRT_MAX);
-			 audioErr = AudioFileWriteBytes(audioFile,
-			 false,
-			 sampleCount*2, 
-			 &bytesToWrite,
-			 &sample);
-			 assert (audioErr == noErr);
-			 sampleCount++;
-			 */
-			// sine wave
-			SInt16 sample = CFSwapInt16HostToBig ((SInt16) SHRT_MAX *
-												  sin (2 * M_PI * 
-													   (i / wavelengthInSamples)));
-			
-			
-			audioErr = AudioFileWriteBytes(audioFile,
-										   false,
-										   sampleCount*2, 
-										   &bytesToWrite,
-										   &sample);
-			assert (audioErr == noErr);
-			sampleCount++;
-			
-			
-		}
+		UInt32 framesToWrite = BLOCK_SIZE_FRAMES;
+		if (maxSampleCount - sampleCount < framesToWrite)
+			framesToWrite = (UInt32) (maxSampleCount - sampleCount);
+		
+		MyToneGeneratorRender (generator, samples, framesToWrite);
+		
+		UInt32 bytesToWrite = framesToWrite * asbd.mBytesPerFrame;
+		audioErr = AudioFileWriteBytes(audioFile,
+									   false,
+									   sampleCount * asbd.mBytesPerFrame,
+									   &bytesToWrite,
+									   samples);
+		assert (audioErr == noErr);
+		sampleCount += framesToWrite;
 	}
+	free (samples);
+	free (generator);
+	
 	audioErr = AudioFileClose(audioFile);
 	assert (audioErr == noErr);
 	NSLog (@"wrote %ld samples", sampleCount);
@@ -1,12 +1,55 @@
 #include <AudioToolbox/AudioToolbox.h>
+#include <libkern/OSAtomic.h>
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <pthread.h>
+#include <unistd.h> // for usleep()
+#include "../../Common/MyBufferPolicy.h"
 
-#define kNumberRecordBuffers	3
+#define kRecordTargetLatency	1.5	// seconds of queue buffers to hand the audio queue
+#define kInitialWriteTimeGuess	0.05	// seconds we assume a file write takes, until we've measured some
+#define kNumberWriteQueueSlots	32	// filled buffers waiting to be written. must be a power of 2
+#define kMaxSlotsPerWrite		8	// most queued buffers the writer combines into one write
+#define kSimulatedWriteDelayMicroseconds	0	// make this nonzero to simulate a slow disk
 
 
+// a copy of one filled queue buffer, waiting for the writer thread
+typedef struct MyWriteSlot {
+	void						*data;
+	UInt32						dataByteSize;
+	AudioStreamPacketDescription *packetDescs;
+	UInt32						numPackets;
+	Boolean						hasPacketDescs; // false for CBR formats
+	UInt64						enqueueHostTime; // mach_absolute_time() when the callback queued it
+} MyWriteSlot;
+
 typedef struct MyRecorder {
 	AudioFileID					recordFile; // reference to your output file
-	SInt64						recordPacket; // current packet index in output file
+	SInt64						recordPacket; // current packet index in output file (writer thread only)
 	Boolean						running; // recording state
+	
+	// the callback copies each filled buffer into the next slot and advances writeIndex; the
+	// writer thread writes slots to the file and advances readIndex. with exactly one thread
+	// on each side, neither needs a lock
+	MyWriteSlot					writeSlots[kNumberWriteQueueSlots];
+	UInt32						slotByteCapacity;
+	UInt32						slotPacketCapacity;
+	volatile UInt32				writeIndex;
+	volatile UInt32				readIndex;
+	semaphore_t					writerSemaphore; // signalled by the callback when it queues a slot
+	pthread_t					writerThread;
+	volatile Boolean			writerShouldExit;
+	void						*writeBuffer; // where the writer combines slots into one write
+	AudioStreamPacketDescription *writePacketDescs;
+	
+	// statistics
+	UInt32						queueHighWaterMark; // deepest the queue got (callback only)
+	UInt32						droppedBuffers; // buffers lost because the queue was full (callback only)
+	UInt32						writeCount; // calls to AudioFileWritePackets() (writer only)
+	UInt32						slotsWritten; // (writer only)
+	UInt64						totalWriterLatency; // host time from queueing to written, summed (writer only)
+	UInt64						maxWriterLatency; // (writer only)
+	UInt64						maxWriteTime; // longest AudioFileWritePackets() call, with any simulated delay, host time (writer only)
 } MyRecorder;
 
 
@@ -62,39 +105,18 @@ OSStatus MyGetDefaultInputDeviceSampleRate(Float64 *outSampleRate)
 }
 
 
-// Determine the size, in bytes, of a buffer necessary to represent the supplied number
-// of seconds of audio data.
-static int MyComputeRecordBufferSize(const AudioStreamBasicDescription *format, AudioQueueRef queue, float seconds)
+// The largest packet the queue can record in format, for MyComputeBufferPolicy().
+static UInt32 MyGetRecordMaxPacketSize(const AudioStreamBasicDescription *format, AudioQueueRef queue)
 {
-	int packets, frames, bytes;
-	
-	frames = (int)ceil(seconds * format->mSampleRate);
+	if (format->mBytesPerPacket > 0)
+		return format->mBytesPerPacket;
 	
-	if (format->mBytesPerFrame > 0)						// 1
-		bytes = frames * format->mBytesPerFrame;
-	else
-	{
-		UInt32 maxPacketSize;
-		if (format->mBytesPerPacket > 0)				// 2
-			maxPacketSize = format->mBytesPerPacket;
-		else
-		{
-			// get the largest single packet size possible
-			UInt32 propertySize = sizeof(maxPacketSize);	// 3
-			CheckError(AudioQueueGetProperty(queue, kAudioConverterPropertyMaximumOutputPacketSize, &maxPacketSize,
-											 &propertySize), "couldn't get queue's maximum output packet size");
-		}
-		if (format->mFramesPerPacket > 0)
-			packets = frames / format->mFramesPerPacket;	 // 4
-		else
-			// worst-case scenario: 1 frame in a packet
-			packets = frames;							// 5
-		
-		if (packets == 0)		// sanity check
-			packets = 1;
-		bytes = packets * maxPacketSize;				// 6
-	}
-	return bytes;
+	// get the largest single packet size possible
+	UInt32 maxPacketSize;
+	UInt32 propertySize = sizeof(maxPacketSize);
+	CheckError(AudioQueueGetProperty(queue, kAudioConverterPropertyMaximumOutputPacketSize, &maxPacketSize,
+									 &propertySize), "couldn't get queue's maximum output packet size");
+	return maxPacketSize;
 }
 
 // Copy a queue's encoder's magic cookie to an audio file.
@@ -120,6 +142,140 @@ static void MyCopyEncoderCookieToFile(AudioQueueRef queue, AudioFileID theFile)
 	}
 }
 
+#pragma mark - writer thread -
+
+// write everything the callback has queued so far, combining up to kMaxSlotsPerWrite
+// queued buffers into each AudioFileWritePackets() call
+static void MyDrainWriteQueue(MyRecorder *recorder)
+{
+	UInt32 available;
+	while ((available = recorder->writeIndex - recorder->readIndex) > 0)
+	{
+		// make sure we see the slot contents the callback wrote before advancing writeIndex
+		OSMemoryBarrier();
+		
+		UInt32 slotCount = available < kMaxSlotsPerWrite ? available : kMaxSlotsPerWrite;
+		UInt32 byteCount = 0;
+		UInt32 packetCount = 0;
+		Boolean hasPacketDescs = FALSE;
+		UInt32 i;
+		for (i = 0; i < slotCount; i++)
+		{
+			MyWriteSlot *slot = &recorder->writeSlots[(recorder->readIndex + i) & (kNumberWriteQueueSlots - 1)];
+			memcpy((Byte *)recorder->writeBuffer + byteCount, slot->data, slot->dataByteSize);
+			if (slot->hasPacketDescs)
+			{
+				// packet offsets are relative to the start of the combined buffer now
+				UInt32 p;
+				for (p = 0; p < slot->numPackets; p++)
+				{
+					recorder->writePacketDescs[packetCount + p] = slot->packetDescs[p];
+					recorder->writePacketDescs[packetCount + p].mStartOffset += byteCount;
+				}
+				hasPacketDescs = TRUE;
+			}
+			byteCount += slot->dataByteSize;
+			packetCount += slot->numPackets;
+		}
+		
+		// time the simulated delay too, so the policy sees the slow disk
+		UInt64 writeStart = mach_absolute_time();
+		if (kSimulatedWriteDelayMicroseconds > 0)
+			usleep(kSimulatedWriteDelayMicroseconds);
+		
+		UInt32 ioNumPackets = packetCount;
+		CheckError(AudioFileWritePackets(recorder->recordFile, FALSE, byteCount,
+										 hasPacketDescs ? recorder->writePacketDescs : NULL,
+										 recorder->recordPacket, &ioNumPackets,
+										 recorder->writeBuffer), "AudioFileWritePackets failed");
+		recorder->recordPacket += ioNumPackets;
+		
+		UInt64 now = mach_absolute_time();
+		if (now - writeStart > recorder->maxWriteTime)
+			recorder->maxWriteTime = now - writeStart;
+		for (i = 0; i < slotCount; i++)
+		{
+			MyWriteSlot *slot = &recorder->writeSlots[(recorder->readIndex + i) & (kNumberWriteQueueSlots - 1)];
+			UInt64 latency = now - slot->enqueueHostTime;
+			recorder->totalWriterLatency += latency;
+			if (latency > recorder->maxWriterLatency)
+				recorder->maxWriterLatency = latency;
+		}
+		recorder->writeCount++;
+		recorder->slotsWritten += slotCount;
+		
+		// hand the slots back to the callback
+		OSMemoryBarrier();
+		recorder->readIndex += slotCount;
+	}
+}
+
+static void *MyWriterThread(void *inUserData)
+{
+	MyRecorder *recorder = (MyRecorder *)inUserData;
+	while (1)
+	{
+		semaphore_wait(recorder->writerSemaphore);
+		// check for exit before draining, so the final drain picks up everything
+		Boolean exiting = recorder->writerShouldExit;
+		MyDrainWriteQueue(recorder);
+		if (exiting)
+			break;
+	}
+	return NULL;
+}
+
+static void MyStartWriterThread(MyRecorder *recorder, UInt32 bufferByteSize, UInt32 maxPacketsPerBuffer)
+{
+	recorder->slotByteCapacity = bufferByteSize;
+	recorder->slotPacketCapacity = maxPacketsPerBuffer;
+	int slotIndex;
+	for (slotIndex = 0; slotIndex < kNumberWriteQueueSlots; ++slotIndex)
+	{
+		recorder->writeSlots[slotIndex].data = malloc(bufferByteSize);
+		recorder->writeSlots[slotIndex].packetDescs = (AudioStreamPacketDescription *)malloc(maxPacketsPerBuffer * sizeof(AudioStreamPacketDescription));
+	}
+	recorder->writeBuffer = malloc(kMaxSlotsPerWrite * bufferByteSize);
+	recorder->writePacketDescs = (AudioStreamPacketDescription *)malloc(kMaxSlotsPerWrite * maxPacketsPerBuffer * sizeof(AudioStreamPacketDescription));
+	
+	CheckError(semaphore_create(mach_task_self(), &recorder->writerSemaphore, SYNC_POLICY_FIFO, 0),
+			   "semaphore_create failed");
+	if (pthread_create(&recorder->writerThread, NULL, MyWriterThread, recorder) != 0)
+	{
+		fprintf(stderr, "Error: couldn't create writer thread\n");
+		exit(1);
+	}
+}
+
+// call only after the queue has stopped, so no more buffers can arrive
+static void MyStopWriterThread(MyRecorder *recorder)
+{
+	recorder->writerShouldExit = TRUE;
+	semaphore_signal(recorder->writerSemaphore);
+	pthread_join(recorder->writerThread, NULL);
+	semaphore_destroy(mach_task_self(), recorder->writerSemaphore);
+	
+	int slotIndex;
+	for (slotIndex = 0; slotIndex < kNumberWriteQueueSlots; ++slotIndex)
+	{
+		free(recorder->writeSlots[slotIndex].data);
+		free(recorder->writeSlots[slotIndex].packetDescs);
+	}
+	free(recorder->writeBuffer);
+	free(recorder->writePacketDescs);
+	
+	mach_timebase_info_data_t timebase;
+	mach_timebase_info(&timebase);
+	Float64 nanosPerTick = (Float64)timebase.numer / timebase.denom;
+	printf("writer: %u buffers in %u writes, average latency %.2f ms, max %.2f ms\n",
+		   (unsigned int)recorder->slotsWritten, (unsigned int)recorder->writeCount,
+		   recorder->slotsWritten ? recorder->totalWriterLatency * nanosPerTick / recorder->slotsWritten / 1000000.0 : 0.0,
+		   recorder->maxWriterLatency * nanosPerTick / 1000000.0);
+	printf("queue: high water mark %u of %d slots, %u buffers dropped\n",
+		   (unsigned int)recorder->queueHighWaterMark, kNumberWriteQueueSlots,
+		   (unsigned int)recorder->droppedBuffers);
+}
+
 #pragma mark - audio queue -
 
 // Audio Queue callback function, called when an input buffer has been filled.
@@ -135,12 +291,34 @@ static void MyAQInputCallback(void *inUserData, AudioQueueRef inQueue,
 	// in the format we specified (AAC)
 	if (inNumPackets > 0)
 	{
-		// write packets to file
-		CheckError(AudioFileWritePackets(recorder->recordFile, FALSE, inBuffer->mAudioDataByteSize,
-										 inPacketDesc, recorder->recordPacket, &inNumPackets, 
-										 inBuffer->mAudioData), "AudioFileWritePackets failed");
-		// increment packet index
-		recorder->recordPacket += inNumPackets;
+		// don't write to the file here: a slow disk would hold up the buffer's return to
+		// the queue. just copy the packets for the writer thread, and never wait for it
+		UInt32 writeIndex = recorder->writeIndex;
+		UInt32 depth = writeIndex - recorder->readIndex;
+		if (depth >= kNumberWriteQueueSlots ||
+			inBuffer->mAudioDataByteSize > recorder->slotByteCapacity ||
+			inNumPackets > recorder->slotPacketCapacity)
+		{
+			recorder->droppedBuffers++;
+		}
+		else
+		{
+			MyWriteSlot *slot = &recorder->writeSlots[writeIndex & (kNumberWriteQueueSlots - 1)];
+			memcpy(slot->data, inBuffer->mAudioData, inBuffer->mAudioDataByteSize);
+			slot->dataByteSize = inBuffer->mAudioDataByteSize;
+			slot->numPackets = inNumPackets;
+			slot->hasPacketDescs = (inPacketDesc != NULL);
+			if (inPacketDesc)
+				memcpy(slot->packetDescs, inPacketDesc, inNumPackets * sizeof(AudioStreamPacketDescription));
+			slot->enqueueHostTime = mach_absolute_time();
+			
+			// publish the slot only after its contents are in place
+			OSMemoryBarrier();
+			recorder->writeIndex = writeIndex + 1;
+			if (depth + 1 > recorder->queueHighWaterMark)
+				recorder->queueHighWaterMark = depth + 1;
+			semaphore_signal(recorder->writerSemaphore);
+		}
 	}
 	
 	// if we're not stopping, re-enqueue the buffer so that it gets filled again
@@ -206,9 +384,29 @@ int	main(int argc, const char *argv[])
 	MyCopyEncoderCookieToFile(queue, recorder.recordFile);
 	
 	// allocate and enqueue buffers
-	int bufferByteSize = MyComputeRecordBufferSize(&recordFormat, queue, 0.5);	// enough bytes for half a second
+	UInt32 maxPacketSize = MyGetRecordMaxPacketSize(&recordFormat, queue);
+	MyBufferPolicy bufferPolicy = {0};
+	bufferPolicy.targetLatency = kRecordTargetLatency;
+	bufferPolicy.ioServiceTime = kInitialWriteTimeGuess;
+	MyComputeBufferPolicy(&bufferPolicy, &recordFormat, maxPacketSize);
+	int bufferByteSize = bufferPolicy.bufferByteSize;
+	printf("recording into %u buffers of %u bytes (%.2f sec each)\n",
+		   (unsigned int)bufferPolicy.bufferCount, (unsigned int)bufferPolicy.bufferByteSize,
+		   bufferPolicy.bufferDuration);
+	
+	// start the thread that writes the buffers to the file. CBR buffers hold a known number
+	// of packets; for VBR, allow twice the packets we sized for, plus a little. a buffer
+	// with more than that is counted as dropped rather than overflowing its slot
+	UInt32 maxPacketsPerBuffer;
+	if (recordFormat.mBytesPerPacket > 0)
+		maxPacketsPerBuffer = bufferPolicy.packetsPerBuffer;
+	else if (recordFormat.mFramesPerPacket > 0)
+		maxPacketsPerBuffer = 2 * (bufferPolicy.packetsPerBuffer + 1);
+	else
+		maxPacketsPerBuffer = bufferByteSize;
+	MyStartWriterThread(&recorder, bufferByteSize, maxPacketsPerBuffer);
 	int bufferIndex;
-    for (bufferIndex = 0; bufferIndex < kNumberRecordBuffers; ++bufferIndex)
+    for (bufferIndex = 0; bufferIndex < bufferPolicy.bufferCount; ++bufferIndex)
 	{
 		AudioQueueBufferRef buffer;
 		CheckError(AudioQueueAllocateBuffer(queue, bufferByteSize, &buffer),
@@ -231,6 +429,24 @@ int	main(int argc, const char *argv[])
 	recorder.running = FALSE;
 	CheckError(AudioQueueStop(queue, TRUE), "AudioQueueStop failed");
 	
+	// the queue has stopped synchronously, so all its buffers have been through the
+	// callback. let the writer finish with them before touching the file again
+	MyStopWriterThread(&recorder);
+	
+	// now that we've timed real writes to this file, see if the policy would choose
+	// differently for the next recording
+	if (recorder.maxWriteTime > 0)
+	{
+		mach_timebase_info_data_t timebase;
+		mach_timebase_info(&timebase);
+		MyBufferPolicy nextPolicy = bufferPolicy;
+		nextPolicy.ioServiceTime = recorder.maxWriteTime * ((Float64)timebase.numer / timebase.denom) / 1000000000.0;
+		MyComputeBufferPolicy(&nextPolicy, &recordFormat, maxPacketSize);
+		printf("longest write took %.1f ms; next time would use %u buffers of %u bytes\n",
+			   nextPolicy.ioServiceTime * 1000.0,
+			   (unsigned int)nextPolicy.bufferCount, (unsigned int)nextPolicy.bufferByteSize);
+	}
+	
 	// a codec may update its magic cookie at the end of an encoding session
 	// so reapply it to the file now
 	MyCopyEncoderCookieToFile(queue, recorder.recordFile);
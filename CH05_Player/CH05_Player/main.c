@@ -1,4 +1,7 @@
 #include <AudioToolbox/AudioToolbox.h>
+#include <pthread.h>
+#include "../../Common/MyBufferPolicy.h"
+#include "../../Common/MyPacketIndex.h"
 
 #define kPlaybackFileLocation	CFSTR("/Insert/Path/To/Audio/File.xxx")
 //#define kPlaybackFileLocation	CFSTR("/Users/cadamson/Library/Developer/Xcode/DerivedData/CH04_Recorder-dvninfofohfiwcgyndnhzarhsipp/Build/Products/Debug/output.caf")
@@ -6,19 +9,46 @@
 //#define kPlaybackFileLocation	CFSTR("/Volumes/Sephiroth/Tunes/The Tubes/Tubes World Tour 2001/Wild Women of Wongo.m4p")
 //#define kPlaybackFileLocation	CFSTR("/Volumes/Sephiroth/Tunes//菅野よう子/ESCAFLOWNE - ORIGINAL MOVIE SOUNDTRACK/We're flying.m4a")
 
-void CalculateBytesForTime (AudioFileID inAudioFile, AudioStreamBasicDescription inDesc, Float64 inSeconds, UInt32 *outBufferSize, UInt32 *outNumPackets);
+#define kPlaybackTargetLatency	1.5	// seconds of audio to keep enqueued
+#define kInitialReadTimeGuess	0.05	// seconds we assume a disk read takes, until we've measured some
+#define kPrefetchSeconds		5.0	// how much audio the prefetch thread tries to keep read ahead of playback
+#define kPlaybackStartSeconds	0.0	// where in the file to start playing
 
+// one buffer's worth of packets, read from the file ahead of time
+typedef struct MyPrefetchChunk {
+	void						*data;
+	UInt32						numBytes;
+	UInt32						numPackets;
+	AudioStreamPacketDescription *packetDescs; // NULL for CBR formats
+} MyPrefetchChunk;
 
-#define kNumberPlaybackBuffers	3
 typedef struct MyPlayer {
-	// AudioQueueRef				queue; // the audio queue object
+	AudioQueueRef				queue; // the audio queue object
 	// AudioStreamBasicDescription dataFormat; // file's data stream description
 	AudioFileID					playbackFile; // reference to your output file
-	SInt64						packetPosition; // current packet index in output file
+	SInt64						packetPosition; // next packet the prefetch thread will read from the file
+	MyPacketIndex				packetIndex; // where packetPosition's bytes are, without walking the file to find them
 	UInt32						numPacketsToRead; // number of packets to read from file
-	AudioStreamPacketDescription *packetDescs; // array of packet descriptions for read buffer
+	MyBufferPolicy				bufferPolicy;
 	// AudioQueueBufferRef			buffers[kNumberPlaybackBuffers];
 	Boolean						isDone; // playback has completed
+	
+	// the prefetch thread reads chunks into this ring ahead of playback, so that the queue
+	// callback only has to copy them. everything below is protected by prefetchMutex
+	MyPrefetchChunk				*chunks;
+	UInt32						chunkCapacity;
+	UInt32						chunkHead; // oldest chunk ready to play
+	UInt32						chunkCount; // number of chunks ready to play
+	AudioQueueBufferRef			starvedBuffers[kMyBufferPolicyMaxBuffers]; // buffers waiting for the prefetch thread
+	UInt32						starvedCount;
+	Boolean						endOfFile; // prefetch thread has read the whole file
+	Boolean						prefetchShouldExit;
+	pthread_mutex_t				prefetchMutex;
+	pthread_cond_t				prefetchCond; // signalled whenever the ring or starvedBuffers changes
+	pthread_t					prefetchThread;
+	UInt32						prefetchHits; // callbacks that found a chunk ready
+	UInt32						prefetchMisses; // callbacks that had to leave their buffer for the prefetch thread
+	Float64						maxReadTime; // longest MyPacketIndexReadPackets() call so far, in seconds
 } MyPlayer;
 
 
@@ -44,46 +74,6 @@ static void CheckError(OSStatus error, const char *operation)
 	exit(1);
 }
 
-// we only use time here as a guideline
-// we're really trying to get somewhere between 16K and 64K buffers, but not allocate too much if we don't need it
-void CalculateBytesForTime (AudioFileID inAudioFile, AudioStreamBasicDescription inDesc, Float64 inSeconds, UInt32 *outBufferSize, UInt32 *outNumPackets)
-{
-	
-	// we need to calculate how many packets we read at a time, and how big a buffer we need.
-	// we base this on the size of the packets in the file and an approximate duration for each buffer.
-	//
-	// first check to see what the max size of a packet is, if it is bigger than our default
-	// allocation size, that needs to become larger
-	UInt32 maxPacketSize;
-	UInt32 propSize = sizeof(maxPacketSize);
-	CheckError(AudioFileGetProperty(inAudioFile, kAudioFilePropertyPacketSizeUpperBound,
-									&propSize, &maxPacketSize), "couldn't get file's max packet size");
-	
-	static const int maxBufferSize = 0x10000; // limit size to 64K
-	static const int minBufferSize = 0x4000; // limit size to 16K
-	
-	if (inDesc.mFramesPerPacket) {
-		Float64 numPacketsForTime = inDesc.mSampleRate / inDesc.mFramesPerPacket * inSeconds;
-		*outBufferSize = numPacketsForTime * maxPacketSize;
-	} else {
-		// if frames per packet is zero, then the codec has no predictable packet == time
-		// so we can't tailor this (we don't know how many Packets represent a time period
-		// we'll just return a default buffer size
-		*outBufferSize = maxBufferSize > maxPacketSize ? maxBufferSize : maxPacketSize;
-	}
-	
-	// we're going to limit our size to our default
-	if (*outBufferSize > maxBufferSize && *outBufferSize > maxPacketSize)
-		*outBufferSize = maxBufferSize;
-	else {
-		// also make sure we're not too small - we don't want to go the disk for too small chunks
-		if (*outBufferSize < minBufferSize)
-			*outBufferSize = minBufferSize;
-	}
-	*outNumPackets = *outBufferSize / maxPacketSize;
-}
-
-
 // many encoded formats require a 'magic cookie'. if the file has a cookie we get it
 // and configure the queue with it
 static void MyCopyEncoderCookieToQueue(AudioFileID theFile, AudioQueueRef queue ) {
@@ -99,6 +89,144 @@ static void MyCopyEncoderCookieToQueue(AudioFileID theFile, AudioQueueRef queue
 }
 
 
+#pragma mark - prefetch thread -
+
+// copy the oldest prefetched chunk into buffer and enqueue it. call with prefetchMutex held
+static void MyEnqueueNextChunk(MyPlayer *aqp, AudioQueueRef inAQ, AudioQueueBufferRef buffer)
+{
+	MyPrefetchChunk *chunk = &aqp->chunks[aqp->chunkHead];
+	memcpy(buffer->mAudioData, chunk->data, chunk->numBytes);
+	buffer->mAudioDataByteSize = chunk->numBytes;
+	AudioQueueEnqueueBuffer(inAQ,
+							buffer,
+							(chunk->packetDescs ? chunk->numPackets : 0),
+							chunk->packetDescs);
+	aqp->chunkHead = (aqp->chunkHead + 1) % aqp->chunkCapacity;
+	aqp->chunkCount--;
+}
+
+static void *MyPrefetchThread(void *inUserData)
+{
+	MyPlayer *aqp = (MyPlayer*)inUserData;
+	pthread_mutex_lock(&aqp->prefetchMutex);
+	while (! aqp->prefetchShouldExit)
+	{
+		// first, fill any buffers the callback had to leave with us, oldest first
+		while (aqp->starvedCount > 0 && aqp->chunkCount > 0)
+		{
+			MyEnqueueNextChunk(aqp, aqp->queue, aqp->starvedBuffers[0]);
+			aqp->starvedCount--;
+			memmove(&aqp->starvedBuffers[0], &aqp->starvedBuffers[1], aqp->starvedCount * sizeof(AudioQueueBufferRef));
+		}
+		
+		if (aqp->endOfFile || aqp->chunkCount == aqp->chunkCapacity)
+		{
+			// nothing left to play for buffers still waiting on us: we're done
+			if (aqp->endOfFile && aqp->chunkCount == 0 && aqp->starvedCount > 0 && ! aqp->isDone)
+			{
+				CheckError(AudioQueueStop(aqp->queue, false), "AudioQueueStop failed");
+				aqp->isDone = true;
+			}
+			pthread_cond_wait(&aqp->prefetchCond, &aqp->prefetchMutex);
+			continue;
+		}
+		
+		// read the next chunk without holding the lock. the slot after the last ready
+		// chunk isn't touched by the callback until we publish it by bumping chunkCount
+		MyPrefetchChunk *chunk = &aqp->chunks[(aqp->chunkHead + aqp->chunkCount) % aqp->chunkCapacity];
+		pthread_mutex_unlock(&aqp->prefetchMutex);
+		
+		UInt32 numBytes = aqp->bufferPolicy.bufferByteSize;
+		UInt32 nPackets = aqp->numPacketsToRead;
+		CFAbsoluteTime readStart = CFAbsoluteTimeGetCurrent();
+		CheckError(MyPacketIndexReadPackets(&aqp->packetIndex,
+											aqp->playbackFile,
+											false,
+											&numBytes,
+											chunk->packetDescs,
+											aqp->packetPosition,
+											&nPackets,
+											chunk->data),
+				   "MyPacketIndexReadPackets failed");
+		Float64 readTime = CFAbsoluteTimeGetCurrent() - readStart;
+		
+		pthread_mutex_lock(&aqp->prefetchMutex);
+		if (readTime > aqp->maxReadTime)
+			aqp->maxReadTime = readTime;
+		// if nPackets == 0 it means we are EOF (all data has been read from file)
+		if (nPackets > 0)
+		{
+			chunk->numBytes = numBytes;
+			chunk->numPackets = nPackets;
+			aqp->packetPosition += nPackets;
+			aqp->chunkCount++;
+		}
+		else
+			aqp->endOfFile = true;
+		pthread_cond_broadcast(&aqp->prefetchCond);
+	}
+	pthread_mutex_unlock(&aqp->prefetchMutex);
+	return NULL;
+}
+
+// allocate the ring, start the prefetch thread, and wait for it to fill the ring (or
+// read the whole file) so that the queue starts with data ready to go
+static void MyStartPrefetchThread(MyPlayer *aqp, AudioStreamBasicDescription dataFormat, UInt32 bufferByteSize, Boolean isFormatVBR)
+{
+	Float64 secondsPerChunk = 0.5;
+	if (dataFormat.mFramesPerPacket > 0 && dataFormat.mSampleRate > 0)
+		secondsPerChunk = aqp->numPacketsToRead * dataFormat.mFramesPerPacket / dataFormat.mSampleRate;
+	aqp->chunkCapacity = (UInt32)ceil(kPrefetchSeconds / secondsPerChunk);
+	if (aqp->chunkCapacity < aqp->bufferPolicy.bufferCount + 1)
+		aqp->chunkCapacity = aqp->bufferPolicy.bufferCount + 1;
+	
+	aqp->chunks = (MyPrefetchChunk*)calloc(aqp->chunkCapacity, sizeof(MyPrefetchChunk));
+	UInt32 i;
+	for (i = 0; i < aqp->chunkCapacity; ++i)
+	{
+		aqp->chunks[i].data = malloc(bufferByteSize);
+		// we don't provide packet descriptions for constant bit rate formats (like linear PCM)
+		if (isFormatVBR)
+			aqp->chunks[i].packetDescs = (AudioStreamPacketDescription*)malloc(sizeof(AudioStreamPacketDescription) * aqp->numPacketsToRead);
+	}
+	
+	pthread_mutex_init(&aqp->prefetchMutex, NULL);
+	pthread_cond_init(&aqp->prefetchCond, NULL);
+	if (pthread_create(&aqp->prefetchThread, NULL, MyPrefetchThread, aqp) != 0)
+	{
+		fprintf(stderr, "Error: couldn't create prefetch thread\n");
+		exit(1);
+	}
+	
+	pthread_mutex_lock(&aqp->prefetchMutex);
+	while (aqp->chunkCount < aqp->chunkCapacity && ! aqp->endOfFile)
+		pthread_cond_wait(&aqp->prefetchCond, &aqp->prefetchMutex);
+	pthread_mutex_unlock(&aqp->prefetchMutex);
+}
+
+static void MyStopPrefetchThread(MyPlayer *aqp)
+{
+	pthread_mutex_lock(&aqp->prefetchMutex);
+	aqp->prefetchShouldExit = true;
+	pthread_cond_broadcast(&aqp->prefetchCond);
+	pthread_mutex_unlock(&aqp->prefetchMutex);
+	pthread_join(aqp->prefetchThread, NULL);
+	
+	printf("prefetch: %u hits, %u misses (%u chunks, %.1f seconds ahead)\n",
+		   (unsigned int)aqp->prefetchHits, (unsigned int)aqp->prefetchMisses,
+		   (unsigned int)aqp->chunkCapacity, kPrefetchSeconds);
+	
+	UInt32 i;
+	for (i = 0; i < aqp->chunkCapacity; ++i)
+	{
+		free(aqp->chunks[i].data);
+		free(aqp->chunks[i].packetDescs);
+	}
+	free(aqp->chunks);
+	pthread_cond_destroy(&aqp->prefetchCond);
+	pthread_mutex_destroy(&aqp->prefetchMutex);
+}
+
 #pragma mark - audio queue -
 
 static void MyAQOutputCallback(void *inUserData, AudioQueueRef inAQ, AudioQueueBufferRef inCompleteAQBuffer) 
@@ -106,34 +234,28 @@ static void MyAQOutputCallback(void *inUserData, AudioQueueRef inAQ, AudioQueueB
 	MyPlayer *aqp = (MyPlayer*)inUserData;
 	if (aqp->isDone) return;
 	
-	// read audio data from file into supplied buffer
-	UInt32 numBytes;
-	UInt32 nPackets = aqp->numPacketsToRead;	
-	CheckError(AudioFileReadPackets(aqp->playbackFile,
-									false,
-									&numBytes,
-									aqp->packetDescs,
-									aqp->packetPosition,
-									&nPackets,
-									inCompleteAQBuffer->mAudioData),
-			   "AudioFileReadPackets failed");
-	
-	// enqueue buffer into the Audio Queue
-	// if nPackets == 0 it means we are EOF (all data has been read from file)
-	if (nPackets > 0)
+	// no file I/O here: copy the next chunk the prefetch thread has already read
+	pthread_mutex_lock(&aqp->prefetchMutex);
+	if (aqp->starvedCount == 0 && aqp->chunkCount > 0)
 	{
-		inCompleteAQBuffer->mAudioDataByteSize = numBytes;		
-		AudioQueueEnqueueBuffer(inAQ,
-								inCompleteAQBuffer,
-								(aqp->packetDescs ? nPackets : 0),
-								aqp->packetDescs);
-		aqp->packetPosition += nPackets;
+		aqp->prefetchHits++;
+		MyEnqueueNextChunk(aqp, inAQ, inCompleteAQBuffer);
 	}
-	else
+	else if (aqp->endOfFile && aqp->chunkCount == 0)
 	{
+		// all data has been read from file and played
 		CheckError(AudioQueueStop(inAQ, false), "AudioQueueStop failed");
 		aqp->isDone = true;
 	}
+	else
+	{
+		// the prefetch thread has fallen behind (or other buffers are already waiting,
+		// and this one mustn't jump ahead of them). it'll fill and enqueue this buffer
+		aqp->prefetchMisses++;
+		aqp->starvedBuffers[aqp->starvedCount++] = inCompleteAQBuffer;
+	}
+	pthread_cond_broadcast(&aqp->prefetchCond);
+	pthread_mutex_unlock(&aqp->prefetchMutex);
 }
 
 int	main(int argc, const char *argv[])
@@ -153,6 +275,20 @@ int	main(int argc, const char *argv[])
 	CheckError(AudioFileGetProperty(player.playbackFile, kAudioFilePropertyDataFormat,
 									&propSize, &dataFormat), "couldn't get file's data format");
 	
+	// find every packet in the file once (or load what we found last time), so reads
+	// and the start position go straight to their bytes
+	char playbackPath[PATH_MAX];
+	CFStringGetFileSystemRepresentation(kPlaybackFileLocation, playbackPath, sizeof(playbackPath));
+	// the index only speeds up reading, so if it can't be built, play without it
+	if (MyPacketIndexOpen(&player.packetIndex, player.playbackFile, playbackPath) != noErr) {
+		printf("packet index: couldn't build one, reading packets from the file\n");
+		CheckError(MyPacketIndexOpenUnindexed(&player.packetIndex, player.playbackFile),
+				   "couldn't get file's packet count");
+	} else if (player.packetIndex.bytesPerPacket == 0)
+		printf("packet index: %s %lld packets in %.1f ms\n",
+			   player.packetIndex.wasBuilt ? "built" : "loaded",
+			   (long long)player.packetIndex.header.packetCount, player.packetIndex.openSeconds * 1000.0);
+	
 	// create a output (playback) queue
 	AudioQueueRef queue;
 	CheckError(AudioQueueNewOutput(&dataFormat, // ASBD
@@ -163,30 +299,46 @@ int	main(int argc, const char *argv[])
 								   0, // flags (always 0)
 								   &queue), // output: reference to AudioQueue object
 			   "AudioQueueNewOutput failed");
+	player.queue = queue;
 	
 	
-	// adjust buffer size to represent about a half second (0.5) of audio based on this format
- 	UInt32 bufferByteSize;
-	CalculateBytesForTime(player.playbackFile, dataFormat,  0.5, &bufferByteSize, &player.numPacketsToRead);
+	// pick the number and size of buffers based on this format
+	UInt32 maxPacketSize;
+	propSize = sizeof(maxPacketSize);
+	CheckError(AudioFileGetProperty(player.playbackFile, kAudioFilePropertyPacketSizeUpperBound,
+									&propSize, &maxPacketSize), "couldn't get file's max packet size");
+	player.bufferPolicy.targetLatency = kPlaybackTargetLatency;
+	player.bufferPolicy.ioServiceTime = kInitialReadTimeGuess;
+	// packets without a fixed duration still have an average one
+	if (dataFormat.mFramesPerPacket == 0 && player.packetIndex.header.packetCount > 0 && dataFormat.mSampleRate > 0)
+		player.bufferPolicy.packetDuration = player.packetIndex.header.frameCount /
+			(Float64)player.packetIndex.header.packetCount / dataFormat.mSampleRate;
+	MyComputeBufferPolicy(&player.bufferPolicy, &dataFormat, maxPacketSize);
+ 	UInt32 bufferByteSize = player.bufferPolicy.bufferByteSize;
+	player.numPacketsToRead = player.bufferPolicy.packetsPerBuffer;
+	printf("using %u buffers of %u bytes (%.2f sec each)\n",
+		   (unsigned int)player.bufferPolicy.bufferCount, (unsigned int)bufferByteSize,
+		   player.bufferPolicy.bufferDuration);
 	
 	// check if we are dealing with a VBR file. ASBDs for VBR files always have 
 	// mBytesPerPacket and mFramesPerPacket as 0 since they can fluctuate at any time.
 	// If we are dealing with a VBR file, we allocate memory to hold the packet descriptions
 	bool isFormatVBR = (dataFormat.mBytesPerPacket == 0 || dataFormat.mFramesPerPacket == 0);
-	if (isFormatVBR)
-		player.packetDescs = (AudioStreamPacketDescription*)malloc(sizeof(AudioStreamPacketDescription) * player.numPacketsToRead);
-	else
-		player.packetDescs = NULL; // we don't provide packet descriptions for constant bit rate formats (like linear PCM)
 	
 	// get magic cookie from file and set on queue
 	MyCopyEncoderCookieToQueue(player.playbackFile, queue);
 	
-	// allocate the buffers and prime the queue with some data before starting
-	AudioQueueBufferRef	buffers[kNumberPlaybackBuffers];
+	// start reading ahead. the prefetch thread allocates packet descriptions for each
+	// chunk it reads if we are dealing with a VBR file
 	player.isDone = false;
-	player.packetPosition = 0;
+	player.packetPosition = MyPacketIndexTimeToPacket(&player.packetIndex, dataFormat.mSampleRate,
+													  kPlaybackStartSeconds, NULL);
+	MyStartPrefetchThread(&player, dataFormat, bufferByteSize, isFormatVBR);
+	
+	// allocate the buffers and prime the queue with some data before starting
+	AudioQueueBufferRef	buffers[kMyBufferPolicyMaxBuffers];
 	int i;
-	for (i = 0; i < kNumberPlaybackBuffers; ++i)
+	for (i = 0; i < player.bufferPolicy.bufferCount; ++i)
 	{
 		CheckError(AudioQueueAllocateBuffer(queue, bufferByteSize, &buffers[i]), "AudioQueueAllocateBuffer failed");
 		
@@ -213,16 +365,29 @@ int	main(int argc, const char *argv[])
 	} while (!player.isDone /*|| gIsRunning*/);
 	
 	// isDone represents the state of the Audio File enqueuing. This does not mean the
-	// Audio Queue is actually done playing yet. Since we have 3 half-second buffers in-flight
+	// Audio Queue is actually done playing yet. Since we have up to targetLatency of buffers in-flight
 	// run for continue to run for a short additional time so they can be processed
-	CFRunLoopRunInMode(kCFRunLoopDefaultMode, 2, false);
+	CFRunLoopRunInMode(kCFRunLoopDefaultMode, player.bufferPolicy.bufferCount * player.bufferPolicy.bufferDuration + 0.5, false);
 	
 	// end playback
 	player.isDone = true;
 	CheckError(AudioQueueStop(queue, TRUE), "AudioQueueStop failed");
+	MyStopPrefetchThread(&player);
+	
+	// now that we know how long reads from this file really take, see if the policy would
+	// choose differently next time
+	if (player.maxReadTime > 0) {
+		MyBufferPolicy nextPolicy = player.bufferPolicy;
+		nextPolicy.ioServiceTime = player.maxReadTime;
+		MyComputeBufferPolicy(&nextPolicy, &dataFormat, maxPacketSize);
+		printf("longest read took %.1f ms; next time would use %u buffers of %u bytes\n",
+			   player.maxReadTime * 1000.0,
+			   (unsigned int)nextPolicy.bufferCount, (unsigned int)nextPolicy.bufferByteSize);
+	}
 	
 cleanup:
 	AudioQueueDispose(queue, TRUE);
+	MyPacketIndexClose(&player.packetIndex);
 	AudioFileClose(player.playbackFile);
 	
 	return 0;
@@ -1,4 +1,9 @@
 #include <AudioToolbox/AudioToolbox.h>
+#include <dispatch/dispatch.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../../Common/MyBatchConversion.h"
+#include "../../Common/MyPacketIndex.h"
 
 #ifndef MAC_OS_X_VERSION_10_7
 // CoreServices defines eofErr, replaced in 10.7 by kAudioFileEndOfFileError
@@ -19,12 +24,16 @@ typedef struct MyAudioConverterSettings
 	AudioFileID					outputFile; // reference to your output file
 	
 	UInt64						inputFilePacketIndex; // current packet index in input file
+	MyPacketIndex				inputFileIndex; // where each input packet's bytes are
 	UInt64						inputFilePacketCount; // total number of packts in input file
 	UInt32						inputFilePacketMaxSize; // maximum size a packet in the input file can be
 	AudioStreamPacketDescription *inputFilePacketDescriptions; // array of packet descriptions for read buffer
 	
-	// KEVIN: sourceBuffer is never used outside of the callback. why couldn't it be a local there?
+	// read buffer for the callback. it lives here rather than in the callback so it can be
+	// reused from one call to the next, and is only reallocated when a bigger read comes along
 	void *sourceBuffer;
+	UInt32						sourceBufferSize; // current capacity of sourceBuffer, in bytes
+	UInt32						sourceBufferAllocations; // times sourceBuffer had to be (re)allocated
 	
 } MyAudioConverterSettings;
 
@@ -34,30 +43,8 @@ OSStatus MyAudioConverterCallback(AudioConverterRef inAudioConverter,
 								  AudioBufferList *ioData,
 								  AudioStreamPacketDescription **outDataPacketDescription,
 								  void *inUserData);
-void Convert(MyAudioConverterSettings *mySettings);
-
-
-#pragma mark - utility functions -
-
-// generic error handler - if result is nonzero, prints error message and exits program.
-static void CheckResult(OSStatus result, const char *operation)
-{
-	if (result == noErr) return;
-	
-	char errorString[20];
-	// see if it appears to be a 4-char-code
-	*(UInt32 *)(errorString + 1) = CFSwapInt32HostToBig(result);
-	if (isprint(errorString[1]) && isprint(errorString[2]) && isprint(errorString[3]) && isprint(errorString[4])) {
-		errorString[0] = errorString[5] = '\'';
-		errorString[6] = '\0';
-	} else
-		// no, format it as an integer
-		sprintf(errorString, "%d", (int)result);
-	
-	fprintf(stderr, "Error: %s (%s)\n", operation, errorString);
-	
-	exit(1);
-}
+OSStatus Convert(const MyConversionJob *job, MyAudioConverterSettings *mySettings);
+Boolean ConvertFile(MyConversionJob *job);
 
 
 #pragma mark - audio converter -
@@ -81,22 +68,31 @@ OSStatus MyAudioConverterCallback(AudioConverterRef inAudioConverter,
 	if(*ioDataPacketCount == 0)
         return noErr;
     
-    if (audioConverterSettings->sourceBuffer != NULL)
+    // grow the read buffer only if this request is bigger than any before it. no need
+    // to zero it: MyPacketIndexReadPackets() tells us how many bytes it actually filled
+    UInt32 sourceBytesNeeded = *ioDataPacketCount * audioConverterSettings->inputFilePacketMaxSize;
+    if (sourceBytesNeeded > audioConverterSettings->sourceBufferSize)
     {
         free(audioConverterSettings->sourceBuffer);
-        audioConverterSettings->sourceBuffer = NULL;
+        audioConverterSettings->sourceBuffer = malloc(sourceBytesNeeded);
+        if (audioConverterSettings->sourceBuffer == NULL)
+        {
+            audioConverterSettings->sourceBufferSize = 0;
+            return kAudio_MemFullError;
+        }
+        audioConverterSettings->sourceBufferSize = sourceBytesNeeded;
+        audioConverterSettings->sourceBufferAllocations++;
     }
-    
-    audioConverterSettings->sourceBuffer = (void *)calloc(1, *ioDataPacketCount * audioConverterSettings->inputFilePacketMaxSize);        
 	
-    UInt32 outByteCount = 0;
-	OSStatus result = AudioFileReadPackets(audioConverterSettings->inputFile, 
-										   true, 
-										   &outByteCount, 
-										   audioConverterSettings->inputFilePacketDescriptions, 
-										   audioConverterSettings->inputFilePacketIndex,
-										   ioDataPacketCount, 
-										   audioConverterSettings->sourceBuffer);
+    UInt32 outByteCount = audioConverterSettings->sourceBufferSize;
+	OSStatus result = MyPacketIndexReadPackets(&audioConverterSettings->inputFileIndex,
+											   audioConverterSettings->inputFile, 
+											   true, 
+											   &outByteCount, 
+											   audioConverterSettings->inputFilePacketDescriptions, 
+											   audioConverterSettings->inputFilePacketIndex,
+											   ioDataPacketCount, 
+											   audioConverterSettings->sourceBuffer);
     
 	// it's not an error if we just read the remainder of the file
 #ifdef MAC_OS_X_VERSION_10_7
@@ -129,12 +125,14 @@ OSStatus MyAudioConverterCallback(AudioConverterRef inAudioConverter,
     return result;	
 }
 
-void Convert(MyAudioConverterSettings *mySettings)
+// convert the whole of job's input. a failure is reported, and returned
+OSStatus Convert(const MyConversionJob *job, MyAudioConverterSettings *mySettings)
 {
 	// create audioConverter object
 	AudioConverterRef	audioConverter;
-    CheckResult (AudioConverterNew(&mySettings->inputFormat, &mySettings->outputFormat, &audioConverter),
-				 "AudioConveterNew failed");
+	OSStatus result = AudioConverterNew(&mySettings->inputFormat, &mySettings->outputFormat, &audioConverter);
+	if (MyBatchCheckResult(job, result, "AudioConveterNew failed"))
+		return result;
 	
 	// allocate packet descriptions if the input file is VBR
 	UInt32 packetsPerBuffer = 0;
@@ -143,8 +141,12 @@ void Convert(MyAudioConverterSettings *mySettings)
 	if (sizePerPacket == 0)
 	{
 		UInt32 size = sizeof(sizePerPacket);
-        CheckResult(AudioConverterGetProperty(audioConverter, kAudioConverterPropertyMaximumOutputPacketSize, &size, &sizePerPacket),
-					"Couldn't get kAudioConverterPropertyMaximumOutputPacketSize");
+		result = AudioConverterGetProperty(audioConverter, kAudioConverterPropertyMaximumOutputPacketSize, &size, &sizePerPacket);
+		if (MyBatchCheckResult(job, result, "Couldn't get kAudioConverterPropertyMaximumOutputPacketSize"))
+		{
+			AudioConverterDispose(audioConverter);
+			return result;
+		}
 		
         // make sure the buffer is large enough to hold at least one packet
 		if (sizePerPacket > outputBufferSize)
@@ -175,13 +177,14 @@ void Convert(MyAudioConverterSettings *mySettings)
 		// now call the audioConverter to transcode the data. This function will call
 		// the callback function as many times as required to fulfill the request.
 		UInt32 ioOutputDataPackets = packetsPerBuffer;
-		OSStatus error = AudioConverterFillComplexBuffer(audioConverter, 
-														 MyAudioConverterCallback, 
-														 mySettings, 
-														 &ioOutputDataPackets, 
-														 &convertedData, 
-														 (mySettings->inputFilePacketDescriptions ? mySettings->inputFilePacketDescriptions : nil));
-		if (error || !ioOutputDataPackets)
+		result = AudioConverterFillComplexBuffer(audioConverter, 
+												 MyAudioConverterCallback, 
+												 mySettings, 
+												 &ioOutputDataPackets, 
+												 &convertedData, 
+												 (mySettings->inputFilePacketDescriptions ? mySettings->inputFilePacketDescriptions : nil));
+		// the callback hands back no packets, and noErr, at the end of the file, so an error is a real failure
+		if (MyBatchCheckResult(job, result, "AudioConverterFillComplexBuffer failed") || !ioOutputDataPackets)
 		{
 			//		fprintf(stderr, "err: %ld, packets: %ld\n", err, ioOutputDataPackets);
 			break;	// this is our termination condition
@@ -189,46 +192,76 @@ void Convert(MyAudioConverterSettings *mySettings)
 		
 		// write the converted data to the output file
 		// KEVIN: QUESTION: 3rd arg seems like it should be a byte count, not packets. why does this work?
-		CheckResult (AudioFileWritePackets(mySettings->outputFile,
-										   FALSE,
-										   ioOutputDataPackets,
-										   NULL,
-										   outputFilePacketPosition / mySettings->outputFormat.mBytesPerPacket, 
-										   &ioOutputDataPackets,
-										   convertedData.mBuffers[0].mData),
-					 "Couldn't write packets to file");
+		result = AudioFileWritePackets(mySettings->outputFile,
+									   FALSE,
+									   ioOutputDataPackets,
+									   NULL,
+									   outputFilePacketPosition / mySettings->outputFormat.mBytesPerPacket, 
+									   &ioOutputDataPackets,
+									   convertedData.mBuffers[0].mData);
+		if (MyBatchCheckResult(job, result, "Couldn't write packets to file"))
+			break;
 		
 		// advance the output file write location
 		outputFilePacketPosition += (ioOutputDataPackets * mySettings->outputFormat.mBytesPerPacket);
 	}
 	
 	AudioConverterDispose(audioConverter);
+	
+	// once the read buffer has grown to fit the converter's requests, the callback
+	// shouldn't need to allocate again, so this should be a small number
+	printf("input callback allocated its read buffer %u time(s), %u bytes\n",
+		   (unsigned int)mySettings->sourceBufferAllocations,
+		   (unsigned int)mySettings->sourceBufferSize);
+	
+	free(outputBuffer);
+	free(mySettings->sourceBuffer);
+	mySettings->sourceBuffer = NULL;
+	mySettings->sourceBufferSize = 0;
+	return result;
 }
 
-int	main(int argc, const char *argv[])
+#pragma mark - batch conversion -
+
+// open job->inputPath, convert it to 16-bit stereo AIFF at job->outputPath, and fill in
+// the job's statistics. returns FALSE (rather than exiting) if any step fails, so one
+// stray file doesn't stop a whole batch. a half-written output file is deleted
+Boolean ConvertFile(MyConversionJob *job)
 {
  	MyAudioConverterSettings audioConverterSettings = {0};
+	CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+	Boolean succeeded = FALSE;
+	UInt32 propSize;
+	CFURLRef outputFileURL;
 	
 	// open the input audio file
-	CFURLRef inputFileURL = CFURLCreateWithFileSystemPath(kCFAllocatorDefault, kInputFileLocation, kCFURLPOSIXPathStyle, false);
-    CheckResult (AudioFileOpenURL(inputFileURL, kAudioFileReadPermission , 0, &audioConverterSettings.inputFile),
-				 "AudioFileOpenURL failed");
+	CFURLRef inputFileURL = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)job->inputPath, strlen(job->inputPath), false);
+	OSStatus result = AudioFileOpenURL(inputFileURL, kAudioFileReadPermission , 0, &audioConverterSettings.inputFile);
 	CFRelease(inputFileURL);
+	if (MyBatchCheckResult(job, result, "AudioFileOpenURL failed"))
+		return FALSE;
 	
 	// get the audio data format from the file
-	UInt32 propSize = sizeof(audioConverterSettings.inputFormat);
-    CheckResult (AudioFileGetProperty(audioConverterSettings.inputFile, kAudioFilePropertyDataFormat, &propSize, &audioConverterSettings.inputFormat),
-				 "couldn't get file's data format");
+	propSize = sizeof(audioConverterSettings.inputFormat);
+	result = AudioFileGetProperty(audioConverterSettings.inputFile, kAudioFilePropertyDataFormat, &propSize, &audioConverterSettings.inputFormat);
+	if (MyBatchCheckResult(job, result, "couldn't get file's data format"))
+		goto cleanup;
 	
-	// get the total number of packets in the file
-	propSize = sizeof(audioConverterSettings.inputFilePacketCount);
-    CheckResult (AudioFileGetProperty(audioConverterSettings.inputFile, kAudioFilePropertyAudioDataPacketCount, &propSize, &audioConverterSettings.inputFilePacketCount),
-				 "couldn't get file's packet count");
+	// find every packet in the file, or load the index saved the last time this file was
+	// converted. this also gives us the total number of packets. the index only speeds
+	// up reading, so if it can't be built, read the packets from the file as they come
+	result = MyPacketIndexOpen(&audioConverterSettings.inputFileIndex, audioConverterSettings.inputFile, job->inputPath);
+	if (result != noErr)
+		result = MyPacketIndexOpenUnindexed(&audioConverterSettings.inputFileIndex, audioConverterSettings.inputFile);
+	if (MyBatchCheckResult(job, result, "couldn't get file's packet count"))
+		goto cleanup;
+	audioConverterSettings.inputFilePacketCount = audioConverterSettings.inputFileIndex.header.packetCount;
 	
 	// get size of the largest possible packet
 	propSize = sizeof(audioConverterSettings.inputFilePacketMaxSize);
-    CheckResult(AudioFileGetProperty(audioConverterSettings.inputFile, kAudioFilePropertyMaximumPacketSize, &propSize, &audioConverterSettings.inputFilePacketMaxSize),
-				"couldn't get file's max packet size");
+	result = AudioFileGetProperty(audioConverterSettings.inputFile, kAudioFilePropertyMaximumPacketSize, &propSize, &audioConverterSettings.inputFilePacketMaxSize);
+	if (MyBatchCheckResult(job, result, "couldn't get file's max packet size"))
+		goto cleanup;
 	
 	// define the ouput format. AudioConverter requires that one of the data formats be LPCM
     audioConverterSettings.outputFormat.mSampleRate = 44100.0;
@@ -241,18 +274,74 @@ int	main(int argc, const char *argv[])
 	audioConverterSettings.outputFormat.mBitsPerChannel = 16;
 	
 	// create output file
-	// KEVIN: TODO: this fails if file exists. isn't there an overwrite flag we can use?
-	CFURLRef outputFileURL = CFURLCreateWithFileSystemPath(kCFAllocatorDefault, CFSTR("output.aif"), kCFURLPOSIXPathStyle, false);
-	CheckResult (AudioFileCreateWithURL(outputFileURL, kAudioFileAIFFType, &audioConverterSettings.outputFormat, kAudioFileFlags_EraseFile, &audioConverterSettings.outputFile),
-				 "AudioFileCreateWithURL failed");
+	outputFileURL = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)job->outputPath, strlen(job->outputPath), false);
+	result = AudioFileCreateWithURL(outputFileURL, kAudioFileAIFFType, &audioConverterSettings.outputFormat, kAudioFileFlags_EraseFile, &audioConverterSettings.outputFile);
     CFRelease(outputFileURL);
+	if (MyBatchCheckResult(job, result, "AudioFileCreateWithURL failed"))
+		goto cleanup;
 	
-	fprintf(stdout, "Converting...\n");
-	Convert(&audioConverterSettings);
+	succeeded = Convert(job, &audioConverterSettings) == noErr;
 	
 cleanup:
+	if (succeeded)
+	{
+		struct stat inputStat;
+		if (stat(job->inputPath, &inputStat) == 0)
+			job->inputFileBytes = inputStat.st_size;
+		if (audioConverterSettings.inputFormat.mSampleRate > 0)
+			job->audioSeconds = (Float64)audioConverterSettings.inputFileIndex.header.frameCount / audioConverterSettings.inputFormat.mSampleRate;
+		job->elapsedSeconds = CFAbsoluteTimeGetCurrent() - startTime;
+		job->succeeded = TRUE;
+		MyBatchPrintJob(job);
+		if (audioConverterSettings.inputFileIndex.wasBuilt)
+			printf("\tpacket index built in %.1f ms\n", audioConverterSettings.inputFileIndex.openSeconds * 1000.0);
+	}
+	MyPacketIndexClose(&audioConverterSettings.inputFileIndex);
 	AudioFileClose(audioConverterSettings.inputFile);
-	AudioFileClose(audioConverterSettings.outputFile);
+	if (audioConverterSettings.outputFile)
+	{
+		AudioFileClose(audioConverterSettings.outputFile);
+		if (! succeeded)
+			unlink(job->outputPath);
+	}
+	free(audioConverterSettings.inputFilePacketDescriptions);
+	return succeeded;
+}
+
+int	main(int argc, const char *argv[])
+{
+	MyConversionJob *jobs = NULL;
+	UInt32 jobCount = 0;
+	
+	if (argc < 2)
+	{
+		// no arguments: convert kInputFileLocation to output.aif, as before
+		jobs = (MyConversionJob *)calloc(1, sizeof(MyConversionJob));
+		CFStringGetFileSystemRepresentation(kInputFileLocation, jobs[0].inputPath, sizeof(jobs[0].inputPath));
+		strlcpy(jobs[0].outputPath, "output.aif", sizeof(jobs[0].outputPath));
+		jobCount = 1;
+	}
+	else
+	{
+		// batch mode: convert every file named on the command line, or found in a named directory
+		MyBatchCollectJobs(argc, argv, &jobs, &jobCount);
+		MyBatchChooseOutputPaths(jobs, jobCount);
+	}
+	
+	fprintf(stdout, "Converting %u file(s)...\n", (unsigned int)jobCount);
+	CFAbsoluteTime batchStartTime = CFAbsoluteTimeGetCurrent();
+	
+	// each conversion is independent, so let GCD spread them over all the cores.
+	// dispatch_apply() doesn't return until every job is done
+	dispatch_apply(jobCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+		ConvertFile(&jobs[i]);
+	});
+	
+	// aggregate statistics
+	MyBatchPrintSummary(jobs, jobCount, CFAbsoluteTimeGetCurrent() - batchStartTime);
+	
+cleanup:
+	free(jobs);
 	printf("Done\r");
 	return 0;
 }
@@ -1,4 +1,8 @@
 #include <AudioToolbox/AudioToolbox.h>
+#include <dispatch/dispatch.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../../Common/MyBatchConversion.h"
 
 #define kInputFileLocation	CFSTR("/Insert/Path/To/Audio/File.xxx")
 // #define kInputFileLocation	CFSTR("/Users/kevin/Desktop/tmp_storage/audio_tests/cdsd_scratch.aiff")
@@ -15,34 +19,14 @@ typedef struct MyAudioConverterSettings
 		
 } MyAudioConverterSettings;
 
-void Convert(MyAudioConverterSettings *mySettings);
-
-#pragma mark - utility functions -
-
-// generic error handler - if result is nonzero, prints error message and exits program.
-static void CheckResult(OSStatus result, const char *operation)
-{
-	if (result == noErr) return;
-	
-	char errorString[20];
-	// see if it appears to be a 4-char-code
-	*(UInt32 *)(errorString + 1) = CFSwapInt32HostToBig(result);
-	if (isprint(errorString[1]) && isprint(errorString[2]) && isprint(errorString[3]) && isprint(errorString[4])) {
-		errorString[0] = errorString[5] = '\'';
-		errorString[6] = '\0';
-	} else
-		// no, format it as an integer
-		sprintf(errorString, "%d", (int)result);
-	
-	fprintf(stderr, "Error: %s (%s)\n", operation, errorString);
-	
-	exit(1);
-}
-
+OSStatus Convert(const MyConversionJob *job, MyAudioConverterSettings *mySettings);
+Boolean ConvertFile(MyConversionJob *job);
 
 #pragma mark - audio converter -
-void Convert(MyAudioConverterSettings *mySettings)
+// convert the whole of job's input. a failure is reported, and returned
+OSStatus Convert(const MyConversionJob *job, MyAudioConverterSettings *mySettings)
 {	
+	OSStatus result = noErr;
 	
 	UInt32 outputBufferSize = 32 * 1024; // 32 KB is a good starting point
 	UInt32 sizePerPacket = mySettings->outputFormat.mBytesPerPacket;	
@@ -64,42 +48,56 @@ void Convert(MyAudioConverterSettings *mySettings)
 		UInt32 frameCount = packetsPerBuffer;
 		
 		// read from the extaudiofile
-		CheckResult(ExtAudioFileRead(mySettings->inputFile,
-									 &frameCount,
-									 &convertedData),
-					"Couldn't read from input file");
+		result = ExtAudioFileRead(mySettings->inputFile,
+								  &frameCount,
+								  &convertedData);
+		if (MyBatchCheckResult(job, result, "Couldn't read from input file"))
+			break;
 		
-		if (frameCount == 0) {
-			printf ("done reading from file");
-			return;
-		}
+		if (frameCount == 0)
+			break;	// done reading from file
 		
 		// write the converted data to the output file
-		CheckResult (AudioFileWritePackets(mySettings->outputFile,
-										   FALSE,
-										   frameCount,
-										   NULL,
-										   outputFilePacketPosition / mySettings->outputFormat.mBytesPerPacket, 
-										   &frameCount,
-										   convertedData.mBuffers[0].mData),
-					 "Couldn't write packets to file");
+		result = AudioFileWritePackets(mySettings->outputFile,
+									   FALSE,
+									   frameCount,
+									   NULL,
+									   outputFilePacketPosition / mySettings->outputFormat.mBytesPerPacket, 
+									   &frameCount,
+									   convertedData.mBuffers[0].mData);
+		if (MyBatchCheckResult(job, result, "Couldn't write packets to file"))
+			break;
 		
 		// advance the output file write location
 		outputFilePacketPosition += (frameCount * mySettings->outputFormat.mBytesPerPacket);
 	}
 	
-	// AudioConverterDispose(audioConverter);
+	free(outputBuffer);
+	return result;
 }
 
-int	main(int argc, const char *argv[])
+#pragma mark - batch conversion -
+
+// open job->inputPath, convert it to 16-bit stereo AIFF at job->outputPath, and fill in
+// the job's statistics. returns FALSE (rather than exiting) if any step fails, so one
+// stray file doesn't stop a whole batch. a half-written output file is deleted
+Boolean ConvertFile(MyConversionJob *job)
 {
  	MyAudioConverterSettings audioConverterSettings = {0};
+	CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+	Boolean succeeded = FALSE;
+	SInt64 fileLengthFrames = 0;
+	AudioStreamBasicDescription fileFormat = {0};
+	UInt32 propSize;
+	CFURLRef outputFileURL;
 	
 	// open the input with ExtAudioFile
-	CFURLRef inputFileURL = CFURLCreateWithFileSystemPath(kCFAllocatorDefault, kInputFileLocation, kCFURLPOSIXPathStyle, false);
-	CheckResult(ExtAudioFileOpenURL(inputFileURL, 
-									&audioConverterSettings.inputFile),
-				"ExtAudioFileOpenURL failed");
+	CFURLRef inputFileURL = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)job->inputPath, strlen(job->inputPath), false);
+	OSStatus result = ExtAudioFileOpenURL(inputFileURL,
+										  &audioConverterSettings.inputFile);
+	CFRelease(inputFileURL);
+	if (MyBatchCheckResult(job, result, "ExtAudioFileOpenURL failed"))
+		return FALSE;
 	
 	// define the ouput format. AudioConverter requires that one of the data formats be LPCM
     audioConverterSettings.outputFormat.mSampleRate = 44100.0;
@@ -112,24 +110,94 @@ int	main(int argc, const char *argv[])
 	audioConverterSettings.outputFormat.mBitsPerChannel = 16;
 	
 	// create output file
-	CFURLRef outputFileURL = CFURLCreateWithFileSystemPath(kCFAllocatorDefault, CFSTR("output.aif"), kCFURLPOSIXPathStyle, false);
-	CheckResult (AudioFileCreateWithURL(outputFileURL, kAudioFileAIFFType, &audioConverterSettings.outputFormat, kAudioFileFlags_EraseFile, &audioConverterSettings.outputFile),
-				 "AudioFileCreateWithURL failed");
+	outputFileURL = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)job->outputPath, strlen(job->outputPath), false);
+	result = AudioFileCreateWithURL(outputFileURL, kAudioFileAIFFType, &audioConverterSettings.outputFormat, kAudioFileFlags_EraseFile, &audioConverterSettings.outputFile);
     CFRelease(outputFileURL);
+	if (MyBatchCheckResult(job, result, "AudioFileCreateWithURL failed"))
+		goto cleanup;
 	
 	// set the PCM format as the client format on the input ext audio file
-	CheckResult(ExtAudioFileSetProperty(audioConverterSettings.inputFile,
-										kExtAudioFileProperty_ClientDataFormat,
-										sizeof (AudioStreamBasicDescription),
-										&audioConverterSettings.outputFormat),
-				"Couldn't set client data format on input ext file");
+	result = ExtAudioFileSetProperty(audioConverterSettings.inputFile,
+									 kExtAudioFileProperty_ClientDataFormat,
+									 sizeof (AudioStreamBasicDescription),
+									 &audioConverterSettings.outputFormat);
+	if (MyBatchCheckResult(job, result, "Couldn't set client data format on input ext file"))
+		goto cleanup;
+	
+	// get the input's length and native format, for the statistics
+	propSize = sizeof(fileLengthFrames);
+	result = ExtAudioFileGetProperty(audioConverterSettings.inputFile,
+									 kExtAudioFileProperty_FileLengthFrames,
+									 &propSize,
+									 &fileLengthFrames);
+	if (MyBatchCheckResult(job, result, "Couldn't get length of input ext file"))
+		goto cleanup;
+	propSize = sizeof(fileFormat);
+	result = ExtAudioFileGetProperty(audioConverterSettings.inputFile,
+									 kExtAudioFileProperty_FileDataFormat,
+									 &propSize,
+									 &fileFormat);
+	if (MyBatchCheckResult(job, result, "Couldn't get data format of input ext file"))
+		goto cleanup;
 	
-	fprintf(stdout, "Converting...\n");
-	Convert(&audioConverterSettings);
+	succeeded = Convert(job, &audioConverterSettings) == noErr;
 	
 cleanup:
-	// AudioFileClose(audioConverterSettings.inputFile);
 	ExtAudioFileDispose(audioConverterSettings.inputFile);
-	AudioFileClose(audioConverterSettings.outputFile);
+	if (audioConverterSettings.outputFile)
+	{
+		AudioFileClose(audioConverterSettings.outputFile);
+		if (! succeeded)
+			unlink(job->outputPath);
+	}
+	if (! succeeded)
+		return FALSE;
+	
+	struct stat inputStat;
+	if (stat(job->inputPath, &inputStat) == 0)
+		job->inputFileBytes = inputStat.st_size;
+	if (fileFormat.mSampleRate > 0)
+		job->audioSeconds = fileLengthFrames / fileFormat.mSampleRate;
+	job->elapsedSeconds = CFAbsoluteTimeGetCurrent() - startTime;
+	job->succeeded = TRUE;
+	MyBatchPrintJob(job);
+	return TRUE;
+}
+
+int	main(int argc, const char *argv[])
+{
+	MyConversionJob *jobs = NULL;
+	UInt32 jobCount = 0;
+	
+	if (argc < 2)
+	{
+		// no arguments: convert kInputFileLocation to output.aif, as before
+		jobs = (MyConversionJob *)calloc(1, sizeof(MyConversionJob));
+		CFStringGetFileSystemRepresentation(kInputFileLocation, jobs[0].inputPath, sizeof(jobs[0].inputPath));
+		strlcpy(jobs[0].outputPath, "output.aif", sizeof(jobs[0].outputPath));
+		jobCount = 1;
+	}
+	else
+	{
+		// batch mode: convert every file named on the command line, or found in a named directory
+		MyBatchCollectJobs(argc, argv, &jobs, &jobCount);
+		MyBatchChooseOutputPaths(jobs, jobCount);
+	}
+	
+	fprintf(stdout, "Converting %u file(s)...\n", (unsigned int)jobCount);
+	CFAbsoluteTime batchStartTime = CFAbsoluteTimeGetCurrent();
+	
+	// each conversion is independent, so let GCD spread them over all the cores.
+	// dispatch_apply() doesn't return until every job is done
+	dispatch_apply(jobCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+		ConvertFile(&jobs[i]);
+	});
+	
+	// aggregate statistics
+	MyBatchPrintSummary(jobs, jobCount, CFAbsoluteTimeGetCurrent() - batchStartTime);
+	
+cleanup:
+	free(jobs);
+	printf("Done\r");
 	return 0;
 }
@@ -1,10 +1,42 @@
 #include <AudioToolbox/AudioToolbox.h>
 #include <unistd.h> // for usleep()
+#include <sys/resource.h> // for getrusage()
+#include "../../Common/MyScheduledFilePlayer.h"
+#include "../../Common/MyPacketIndex.h"
 
 #define kInputFileLocation CFSTR ("/Users/abdullahbakhach/Documents/abbasWuHussein.mp3")
 // #define kInputFileLocation	CFSTR("/Volumes/Galactica/Music/Dubee - its the crest.mp3")
 // #define kInputFileLocation CFSTR("/Volumes/Sephiroth/Tunes/Amazon MP3/Metric/Fantasies/06 - Gimme Sympathy.mp3")
 
+#define useMyFilePlayer 0 // our own scheduled file player, instead of AUAudioFilePlayer
+#define playLoopCount 0 // extra times through the file
+#define ringSeconds 0.5 // how far ahead the decode thread gets
+#define useMyPacketIndex 0 // decode with AudioFile and an AudioConverter, seeking through our packet index, instead of ExtAudioFile
+#define prerollPackets 2 // decoded and thrown away before the packet a seek lands in
+
+// measuring seeks, with a file path argument
+#define measurePlayers 64
+#define measureSeconds 60 // of audio, per player
+#define measureSliceFrames 512
+#define measureSeekInterval 1.0 // seconds of audio between each player's seeks
+
+// a MyFilePlayerSource that finds packets with a MyPacketIndex and decodes them
+// with an AudioConverter
+typedef struct MyIndexedFile
+{
+	AudioFileID					audioFile;
+	MyPacketIndex				packetIndex;
+	AudioStreamBasicDescription fileFormat;
+	AudioStreamBasicDescription clientFormat; // non-interleaved float, the file's rate and channels
+	AudioConverterRef			converter;
+	SInt64						nextPacket; // the next one the converter will be given
+	UInt32						framesToSkip; // decoded frames still to throw away since the last seek
+	void						*packetBuffer;
+	UInt32						packetBufferSize; // bytes
+	AudioStreamPacketDescription *packetDescriptions;
+	UInt32						bufferPackets; // how many packetBuffer holds
+} MyIndexedFile;
+
 typedef struct MyAUGraphPlayer
 {
 	AudioStreamBasicDescription inputFormat; // input file's data stream description
@@ -13,10 +45,20 @@ typedef struct MyAUGraphPlayer
 	AUGraph graph;
 	AudioUnit fileAU;
 	
+	// useMyFilePlayer plays through these instead of fileAU
+	ExtAudioFileRef				extAudioFile;
+	MyIndexedFile				indexedFile; // or this, with useMyPacketIndex
+	MyFilePlayer				filePlayer;
+	
 } MyAUGraphPlayer;
 
 void CreateMyAUGraph(MyAUGraphPlayer *player);
 double PrepareFileAU(MyAUGraphPlayer *player);
+void PrepareMyFilePlayer(MyAUGraphPlayer *player);
+OSStatus MyIndexedFileOpen(MyIndexedFile *file, const char *path);
+void MyIndexedFileClose(MyIndexedFile *file);
+OSStatus MyFilePlayerInitWithIndexedFile(MyFilePlayer *player, MyIndexedFile *file, Float64 seconds);
+void MeasureSeeks(const char *path);
 
 #pragma mark - utility functions -
 
@@ -60,6 +102,27 @@ void CreateMyAUGraph(MyAUGraphPlayer *player)
 	CheckError(AUGraphAddNode(player->graph, &outputcd, &outputNode),
 			   "AUGraphAddNode[kAudioUnitSubType_DefaultOutput] failed");
 	
+#if useMyFilePlayer
+	// the output unit pulls our player's render callback
+	CheckError(AUGraphOpen(player->graph),
+			   "AUGraphOpen failed");
+	
+	AudioUnit outputUnit;
+	CheckError(AUGraphNodeInfo(player->graph, outputNode, NULL, &outputUnit),
+			   "AUGraphNodeInfo failed");
+	
+	AudioStreamBasicDescription streamFormat;
+	MyFilePlayerGetStreamFormat(&player->filePlayer, &streamFormat);
+	CheckError(AudioUnitSetProperty(outputUnit, kAudioUnitProperty_StreamFormat,
+									kAudioUnitScope_Input, 0, &streamFormat, sizeof(streamFormat)),
+			   "AudioUnitSetProperty[kAudioUnitProperty_StreamFormat] failed");
+	
+	AURenderCallbackStruct callback = {0};
+	callback.inputProc = MyFilePlayerRenderProc;
+	callback.inputProcRefCon = &player->filePlayer;
+	CheckError(AUGraphSetNodeInputCallback(player->graph, outputNode, 0, &callback),
+			   "AUGraphSetNodeInputCallback failed");
+#else
 	// generate description that will match a generator AU of type: audio file player
 	AudioComponentDescription fileplayercd = {0};
 	fileplayercd.componentType = kAudioUnitType_Generator;
@@ -82,6 +145,7 @@ void CreateMyAUGraph(MyAUGraphPlayer *player)
 	// connect the output source of the file player AU to the input source of the output node
 	CheckError(AUGraphConnectNodeInput(player->graph, fileNode, 0, outputNode, 0),
 			   "AUGraphConnectNodeInput");
+#endif
 	
 	// now initialize the graph (causes resources to be allocated)
 	CheckError(AUGraphInitialize(player->graph),
@@ -137,12 +201,354 @@ double PrepareFileAU(MyAUGraphPlayer *player)
 	return (nPackets * player->inputFormat.mFramesPerPacket) / player->inputFormat.mSampleRate;
 }
 
+#pragma mark - indexed file source -
+
+static OSStatus MyIndexedFileInputProc(AudioConverterRef inAudioConverter,
+									   UInt32 *ioNumberDataPackets,
+									   AudioBufferList *ioData,
+									   AudioStreamPacketDescription **outDataPacketDescription,
+									   void *inUserData)
+{
+	MyIndexedFile *file = (MyIndexedFile *)inUserData;
+	if (*ioNumberDataPackets > file->bufferPackets)
+		*ioNumberDataPackets = file->bufferPackets;
+	
+	// straight to the packet's bytes, wherever the last seek left us
+	UInt32 numBytes = file->packetBufferSize;
+	OSStatus err = MyPacketIndexReadPackets(&file->packetIndex, file->audioFile, false, &numBytes,
+											file->packetDescriptions, file->nextPacket,
+											ioNumberDataPackets, file->packetBuffer);
+	if (err)
+		return err;
+	file->nextPacket += *ioNumberDataPackets;
+	
+	ioData->mBuffers[0].mData = file->packetBuffer;
+	ioData->mBuffers[0].mDataByteSize = numBytes;
+	ioData->mBuffers[0].mNumberChannels = file->fileFormat.mChannelsPerFrame;
+	if (outDataPacketDescription)
+		*outDataPacketDescription = file->packetDescriptions;
+	return noErr;
+}
+
+// decode at most *ioFrames frames into ioData, which has room for that many
+static OSStatus MyIndexedFileDecode(MyIndexedFile *file, UInt32 *ioFrames, AudioBufferList *ioData)
+{
+	UInt32 buffer;
+	for (buffer = 0; buffer < ioData->mNumberBuffers; buffer++)
+		ioData->mBuffers[buffer].mDataByteSize = *ioFrames * sizeof(Float32);
+	return AudioConverterFillComplexBuffer(file->converter, MyIndexedFileInputProc, file,
+										   ioFrames, ioData, NULL);
+}
+
+// start decoding a few packets before the one holding frame, so the decoder has
+// settled (and an MP3's bit reservoir is filled) by the time frame comes out
+static OSStatus MyIndexedFileSeek(void *refCon, SInt64 frame)
+{
+	MyIndexedFile *file = (MyIndexedFile *)refCon;
+	UInt32 frameInPacket;
+	SInt64 packet = MyPacketIndexFrameToPacket(&file->packetIndex, frame, &frameInPacket);
+	SInt64 firstPacket = packet > prerollPackets ? packet - prerollPackets : 0;
+	file->framesToSkip = (UInt32)(MyPacketIndexPacketToFrame(&file->packetIndex, packet) -
+								  MyPacketIndexPacketToFrame(&file->packetIndex, firstPacket)) + frameInPacket;
+	file->nextPacket = firstPacket;
+	return AudioConverterReset(file->converter);
+}
+
+static OSStatus MyIndexedFileRead(void *refCon, UInt32 *ioFrames, AudioBufferList *ioData)
+{
+	MyIndexedFile *file = (MyIndexedFile *)refCon;
+	// the frames before the one seeked to are decoded into ioData too, then written over
+	while (file->framesToSkip > 0) {
+		UInt32 frames = file->framesToSkip < *ioFrames ? file->framesToSkip : *ioFrames;
+		OSStatus err = MyIndexedFileDecode(file, &frames, ioData);
+		if (err)
+			return err;
+		if (frames == 0) {
+			*ioFrames = 0;
+			return noErr;
+		}
+		file->framesToSkip -= frames;
+	}
+	return MyIndexedFileDecode(file, ioFrames, ioData);
+}
+
+// open path, index its packets (or map the index saved last time), and set up
+// a converter from its format to non-interleaved float
+OSStatus MyIndexedFileOpen(MyIndexedFile *file, const char *path)
+{
+	memset(file, 0, sizeof(MyIndexedFile));
+	CFURLRef fileURL = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault,
+															   (const UInt8*)path,
+															   strlen(path),
+															   false);
+	OSStatus err = AudioFileOpenURL(fileURL, kAudioFileReadPermission, 0, &file->audioFile);
+	CFRelease(fileURL);
+	if (err)
+		return err;
+	
+	UInt32 propSize = sizeof(file->fileFormat);
+	err = AudioFileGetProperty(file->audioFile, kAudioFilePropertyDataFormat, &propSize, &file->fileFormat);
+	if (err)
+		return err;
+	// the index only speeds up seeking, so if it can't be built, read without it
+	err = MyPacketIndexOpen(&file->packetIndex, file->audioFile, path);
+	if (err)
+		err = MyPacketIndexOpenUnindexed(&file->packetIndex, file->audioFile);
+	if (err)
+		return err;
+	
+	file->clientFormat.mSampleRate = file->fileFormat.mSampleRate;
+	file->clientFormat.mFormatID = kAudioFormatLinearPCM;
+	file->clientFormat.mFormatFlags = kAudioFormatFlagIsFloat | kAudioFormatFlagIsPacked | kAudioFormatFlagIsNonInterleaved;
+	file->clientFormat.mChannelsPerFrame = file->fileFormat.mChannelsPerFrame;
+	file->clientFormat.mFramesPerPacket = 1;
+	file->clientFormat.mBitsPerChannel = 32;
+	file->clientFormat.mBytesPerFrame = sizeof(Float32);
+	file->clientFormat.mBytesPerPacket = sizeof(Float32);
+	err = AudioConverterNew(&file->fileFormat, &file->clientFormat, &file->converter);
+	if (err)
+		return err;
+	
+	// many encoded formats need the file's magic cookie to decode
+	UInt32 cookieSize;
+	if (AudioFileGetPropertyInfo(file->audioFile, kAudioFilePropertyMagicCookieData, &cookieSize, NULL) == noErr &&
+		cookieSize > 0) {
+		void *cookie = malloc(cookieSize);
+		err = AudioFileGetProperty(file->audioFile, kAudioFilePropertyMagicCookieData, &cookieSize, cookie);
+		if (err == noErr)
+			err = AudioConverterSetProperty(file->converter, kAudioConverterDecompressionMagicCookie, cookieSize, cookie);
+		free(cookie);
+		if (err)
+			return err;
+	}
+	
+	// room for about a slice's worth of packets at a time
+	UInt32 maxPacketSize;
+	propSize = sizeof(maxPacketSize);
+	err = AudioFileGetProperty(file->audioFile, kAudioFilePropertyPacketSizeUpperBound, &propSize, &maxPacketSize);
+	if (err)
+		return err;
+	file->bufferPackets = file->fileFormat.mFramesPerPacket ? 4096 / file->fileFormat.mFramesPerPacket + 1 : 16;
+	file->packetBufferSize = file->bufferPackets * maxPacketSize;
+	file->packetBuffer = malloc(file->packetBufferSize);
+	file->packetDescriptions = (AudioStreamPacketDescription *)malloc(file->bufferPackets * sizeof(AudioStreamPacketDescription));
+	return noErr;
+}
+
+void MyIndexedFileClose(MyIndexedFile *file)
+{
+	if (file->converter)
+		AudioConverterDispose(file->converter);
+	MyPacketIndexClose(&file->packetIndex);
+	if (file->audioFile)
+		AudioFileClose(file->audioFile);
+	free(file->packetBuffer);
+	free(file->packetDescriptions);
+}
+
+// like MyFilePlayerInitWithExtAudioFile(), decoding up to seconds ahead
+OSStatus MyFilePlayerInitWithIndexedFile(MyFilePlayer *player, MyIndexedFile *file, Float64 seconds)
+{
+	MyFilePlayerSource source;
+	source.seek = MyIndexedFileSeek;
+	source.read = MyIndexedFileRead;
+	source.refCon = file;
+	source.frameCount = file->packetIndex.header.frameCount;
+	return MyFilePlayerInit(player, file->clientFormat.mSampleRate, file->clientFormat.mChannelsPerFrame, &source,
+							(UInt32)(seconds * file->clientFormat.mSampleRate));
+}
+
+#pragma mark - scheduled file player -
+
+// the same whole-file region PrepareFileAU() schedules, looped playLoopCount times
+void PrepareMyFilePlayer(MyAUGraphPlayer *player)
+{
+	MyFilePlayerRegion region = {0};
+	region.startTime = 0;
+	region.startFrame = 0;
+	region.framesToPlay = player->filePlayer.source.frameCount;
+	region.loopCount = playLoopCount;
+	CheckError(MyFilePlayerScheduleRegion(&player->filePlayer, &region),
+			   "MyFilePlayerScheduleRegion failed");
+}
+
+// no output device: render measurePlayers players of the same file as fast as
+// their decode threads allow, each seeking somewhere random every
+// measureSeekInterval, then show the CPU each stream took and how long seeks took
+void MeasureSeeks(const char *path)
+{
+	MyFilePlayer *players = (MyFilePlayer *)calloc(measurePlayers, sizeof(MyFilePlayer));
+	int i;
+#if useMyPacketIndex
+	// the first player finds the packets (unless an earlier run did), the rest map its index
+	MyIndexedFile *files = (MyIndexedFile *)calloc(measurePlayers, sizeof(MyIndexedFile));
+	Float64 mapSeconds = 0.0;
+	for (i = 0; i < measurePlayers; i++) {
+		CheckError(MyIndexedFileOpen(&files[i], path),
+				   "MyIndexedFileOpen failed");
+		CheckError(MyFilePlayerInitWithIndexedFile(&players[i], &files[i], ringSeconds),
+				   "MyFilePlayerInitWithIndexedFile failed");
+		if (i > 0)
+			mapSeconds += files[i].packetIndex.openSeconds;
+	}
+	printf ("packet index: %lld packets, %.1f KB, %s in %.1f ms, then loaded in %.3f ms\n",
+			(long long)files[0].packetIndex.header.packetCount, files[0].packetIndex.memorySize / 1024.0,
+			files[0].packetIndex.wasBuilt ? "built" : "loaded", files[0].packetIndex.openSeconds * 1000.0,
+			measurePlayers > 1 ? mapSeconds * 1000.0 / (measurePlayers - 1) : 0.0);
+#else
+	CFURLRef fileURL = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault,
+															   (const UInt8*)path,
+															   strlen(path),
+															   false);
+	ExtAudioFileRef files[measurePlayers];
+	for (i = 0; i < measurePlayers; i++) {
+		CheckError(ExtAudioFileOpenURL(fileURL, &files[i]),
+				   "ExtAudioFileOpenURL failed");
+		CheckError(MyFilePlayerInitWithExtAudioFile(&players[i], files[i], ringSeconds),
+				   "MyFilePlayerInitWithExtAudioFile failed");
+	}
+	CFRelease(fileURL);
+#endif
+	
+	// one slice's worth of buffers, shared by every player
+	UInt32 channelCount = players[0].channelCount;
+	AudioBufferList *buffers = (AudioBufferList *)calloc(1, offsetof(AudioBufferList, mBuffers) +
+														 channelCount * sizeof(AudioBuffer));
+	buffers->mNumberBuffers = channelCount;
+	UInt32 channel;
+	for (channel = 0; channel < channelCount; channel++) {
+		buffers->mBuffers[channel].mNumberChannels = 1;
+		buffers->mBuffers[channel].mDataByteSize = measureSliceFrames * sizeof(Float32);
+		buffers->mBuffers[channel].mData = calloc(measureSliceFrames, sizeof(Float32));
+	}
+	
+	Float64 sampleRate = players[0].sampleRate;
+	SInt64 frameCount = players[0].source.frameCount;
+	UInt32 slices = (UInt32)(measureSeconds * sampleRate / measureSliceFrames);
+	UInt32 slicesPerSeek = (UInt32)(measureSeekInterval * sampleRate / measureSliceFrames);
+	if (slicesPerSeek == 0)
+		slicesPerSeek = 1;
+	
+	struct rusage usageBefore, usageAfter;
+	getrusage(RUSAGE_SELF, &usageBefore);
+	UInt64 start = MyFilePlayerClock();
+	UInt32 slice;
+	for (slice = 0; slice < slices; slice++) {
+		for (i = 0; i < measurePlayers; i++) {
+			MyFilePlayer *player = &players[i];
+			// spread the players' seeks out, so they don't all land on the same slice
+			if (slice % slicesPerSeek == (UInt32)i % slicesPerSeek)
+				CheckError(MyFilePlayerSeek(player, (SInt64)(frameCount * (random() / (Float64)0x7FFFFFFF)) % frameCount),
+						   "MyFilePlayerSeek failed");
+			// the device would just play silence until a seek is ready. wait for it instead,
+			// asleep, so the CPU measured is the decoding and rendering
+			MyFilePlayerWaitForGeneration(player);
+			if (player->renderGeneration != player->decodeGeneration)
+				MyFilePlayerRender(player, 0, buffers);
+			MyFilePlayerWaitForFrames(player, measureSliceFrames);
+			MyFilePlayerRender(player, measureSliceFrames, buffers);
+		}
+	}
+	Float64 wallSeconds = MyFilePlayerClockSeconds(MyFilePlayerClock() - start);
+	getrusage(RUSAGE_SELF, &usageAfter);
+	Float64 cpuSeconds = (usageAfter.ru_utime.tv_sec - usageBefore.ru_utime.tv_sec) +
+		(usageAfter.ru_utime.tv_usec - usageBefore.ru_utime.tv_usec) / 1000000.0 +
+		(usageAfter.ru_stime.tv_sec - usageBefore.ru_stime.tv_sec) +
+		(usageAfter.ru_stime.tv_usec - usageBefore.ru_stime.tv_usec) / 1000000.0;
+	Float64 audioSeconds = (Float64)slices * measureSliceFrames / sampleRate;
+	
+	printf ("%d players, %.1f seconds of a %.1f minute file each, in %.2f seconds\n",
+			measurePlayers, audioSeconds, frameCount / sampleRate / 60.0, wallSeconds);
+	printf ("%.3f%% of a core per stream\n", 100.0 * cpuSeconds / (audioSeconds * measurePlayers));
+	
+	UInt32 seekCount = 0, underruns = 0;
+	UInt64 seekTime = 0, maxSeekTime = 0;
+	for (i = 0; i < measurePlayers; i++) {
+		seekCount += players[i].seekCount;
+		seekTime += players[i].seekTime;
+		if (players[i].maxSeekTime > maxSeekTime)
+			maxSeekTime = players[i].maxSeekTime;
+		underruns += players[i].underruns;
+		MyFilePlayerDispose(&players[i]);
+#if useMyPacketIndex
+		MyIndexedFileClose(&files[i]);
+#else
+		ExtAudioFileDispose(files[i]);
+#endif
+	}
+	if (seekCount > 0)
+		printf ("seeks: %u, %.3f ms average, %.3f ms longest\n", (unsigned)seekCount,
+				MyFilePlayerClockSeconds(seekTime) * 1000.0 / seekCount,
+				MyFilePlayerClockSeconds(maxSeekTime) * 1000.0);
+	printf ("underruns: %u\n", (unsigned)underruns);
+	
+	for (channel = 0; channel < channelCount; channel++)
+		free(buffers->mBuffers[channel].mData);
+	free(buffers);
+	free(players);
+#if useMyPacketIndex
+	free(files);
+#endif
+}
+
 #pragma mark - main - 
+// with a file path argument, measures seeking in that file instead of playing
 int	main(int argc, const char *argv[])
 {
+	if (argc > 1)
+	{
+		MeasureSeeks(argv[1]);
+		return 0;
+	}
+	
 	CFURLRef inputFileURL = CFURLCreateWithFileSystemPath(kCFAllocatorDefault, kInputFileLocation, kCFURLPOSIXPathStyle, false);
  	MyAUGraphPlayer player = {0};
 	
+#if useMyFilePlayer && useMyPacketIndex
+	char inputPath[PATH_MAX];
+	CFStringGetFileSystemRepresentation(kInputFileLocation, inputPath, sizeof(inputPath));
+	CFRelease(inputFileURL);
+	CheckError(MyIndexedFileOpen(&player.indexedFile, inputPath),
+			   "MyIndexedFileOpen failed");
+	printf ("packet index: %s in %.1f ms\n", player.indexedFile.packetIndex.wasBuilt ? "built" : "loaded",
+			player.indexedFile.packetIndex.openSeconds * 1000.0);
+	
+	CheckError(MyFilePlayerInitWithIndexedFile(&player.filePlayer, &player.indexedFile, ringSeconds),
+			   "MyFilePlayerInitWithIndexedFile failed");
+#elif useMyFilePlayer
+	CheckError(ExtAudioFileOpenURL(inputFileURL, &player.extAudioFile),
+			   "ExtAudioFileOpenURL failed");
+	CFRelease(inputFileURL);
+	
+	CheckError(MyFilePlayerInitWithExtAudioFile(&player.filePlayer, player.extAudioFile, ringSeconds),
+			   "MyFilePlayerInitWithExtAudioFile failed");
+#endif
+#if useMyFilePlayer
+	
+	// build a fileplayer->speakers graph
+	CreateMyAUGraph(&player);
+	PrepareMyFilePlayer(&player);
+	
+	CheckError(AUGraphStart(player.graph),
+			   "AUGraphStart failed");
+	
+	// every frame is accounted for, so wait for the player rather than the clock
+	while (!MyFilePlayerIsIdle(&player.filePlayer))
+		usleep (100 * 1000);
+	
+	AUGraphStop (player.graph);
+	MyFilePlayerPrintStats(&player.filePlayer, stdout);
+	AUGraphUninitialize (player.graph);
+	AUGraphClose(player.graph);
+	MyFilePlayerDispose(&player.filePlayer);
+#if useMyPacketIndex
+	MyIndexedFileClose(&player.indexedFile);
+#else
+	ExtAudioFileDispose(player.extAudioFile);
+#endif
+	return 0;
+#endif
+	
 	// open the input audio file
 	CheckError(AudioFileOpenURL(inputFileURL, kAudioFileReadPermission, 0, &player.inputFile),
 			   "AudioFileOpenURL failed");
@@ -0,0 +1,208 @@
+//
+//  MyOscillatorBank.h
+//  CH07_AUGraphSineWave
+//
+//  Copyright 2026 Subsequently and Furthermore, Inc. All rights reserved.
+//
+
+// Any number of wavetable oscillators, summed into one mono signal. A waveform
+// is stored as a set of tables, one per octave. Each table holds only the
+// harmonics that stay under Nyquist at the highest pitch it is used for, so
+// square and sawtooth voices don't alias. A voice steps through its table with a
+// 32-bit phase accumulator (which wraps by itself) and linear interpolation,
+// then is added into the mix with MyMixWithGainRamp().
+//
+// Voices never jump to a new frequency or amplitude. MyOscillatorBankSetVoice()
+// only sets a target, and the render side glides toward it, with a time
+// constant of kMyOscillatorSmoothingTime. Amplitude is ramped every frame.
+// Frequency changes once per block, which is short enough not to be heard.
+
+#ifndef CH07_AUGraphSineWave_MyOscillatorBank_h
+#define CH07_AUGraphSineWave_MyOscillatorBank_h
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../../Common/MyAudioKernels.h"
+
+#define kMyWavetableBits			11
+#define kMyWavetableSize			(1 << kMyWavetableBits)
+#define kMyWavetableCount			10 // table i has harmonics 1 ... kMyWavetableMaxHarmonic >> i
+#define kMyWavetableMaxHarmonic		512
+#define kMyOscillatorBlockFrames	256 // frames rendered per voice at a time
+#define kMyOscillatorSmoothingTime	0.01 // seconds
+
+typedef enum MyWaveform {
+	kMyWaveformSine,
+	kMyWaveformTriangle,
+	kMyWaveformSquare,
+	kMyWaveformSawtooth
+} MyWaveform;
+
+typedef struct MyOscillatorVoice {
+	// written by MyOscillatorBankSetVoice(), from any thread
+	volatile Float32	targetFrequency;
+	volatile Float32	targetAmplitude;
+	// render thread only
+	UInt32				phase; // a full cycle is 2^32
+	Float32				frequency;
+	Float32				amplitude;
+} MyOscillatorVoice;
+
+typedef struct MyOscillatorBank {
+	Float64				sampleRate;
+	Float32				*tables; // kMyWavetableCount tables of kMyWavetableSize + 1 samples
+	MyOscillatorVoice	*voices;
+	UInt32				voiceCount;
+	Float32				scratch[kMyOscillatorBlockFrames];
+} MyOscillatorBank;
+
+#pragma mark - wavetables -
+
+// amplitude of harmonic h of the waveform, as a sum of sines
+static inline Float64 MyWaveformHarmonic(MyWaveform waveform, UInt32 h)
+{
+	switch (waveform) {
+		case kMyWaveformSine:
+			return h == 1 ? 1.0 : 0.0;
+		case kMyWaveformTriangle:
+			if (h % 2 == 0)
+				return 0.0;
+			return (8.0 / (M_PI * M_PI)) * ((h / 2) % 2 ? -1.0 : 1.0) / ((Float64)h * h);
+		case kMyWaveformSquare:
+			return h % 2 ? (4.0 / M_PI) / h : 0.0;
+		case kMyWaveformSawtooth:
+			return (2.0 / M_PI) * (h % 2 ? 1.0 : -1.0) / h;
+	}
+	return 0.0;
+}
+
+static inline void MyOscillatorBankBuildTables(MyOscillatorBank *bank, MyWaveform waveform)
+{
+	Float64 *table = (Float64 *)calloc(kMyWavetableSize, sizeof(Float64));
+	Float64 scale = 0.0;
+	int t;
+	for (t = 0; t < kMyWavetableCount; t++) {
+		UInt32 harmonics = kMyWavetableMaxHarmonic >> t;
+		memset(table, 0, kMyWavetableSize * sizeof(Float64));
+		UInt32 h, i;
+		for (h = 1; h <= harmonics; h++) {
+			Float64 amplitude = MyWaveformHarmonic(waveform, h);
+			if (amplitude == 0.0)
+				continue;
+			for (i = 0; i < kMyWavetableSize; i++)
+				table[i] += amplitude * sin(2 * M_PI * (Float64)((h * i) % kMyWavetableSize) / kMyWavetableSize);
+		}
+		// the fullest table overshoots the most. scale them all by its peak so
+		// every octave plays at the same level
+		if (t == 0) {
+			for (i = 0; i < kMyWavetableSize; i++)
+				if (fabs(table[i]) > scale)
+					scale = fabs(table[i]);
+		}
+		Float32 *out = bank->tables + t * (kMyWavetableSize + 1);
+		for (i = 0; i < kMyWavetableSize; i++)
+			out[i] = (Float32)(table[i] / scale);
+		out[kMyWavetableSize] = out[0]; // so interpolation never has to wrap
+	}
+	free(table);
+}
+
+// the fullest table whose top harmonic stays under Nyquist, or NULL if even
+// the fundamental doesn't
+static inline const Float32 *MyOscillatorBankTableForFrequency(const MyOscillatorBank *bank, Float32 frequency)
+{
+	Float64 harmonicsAllowed = bank->sampleRate * 0.5 / frequency;
+	int t = 0;
+	while (t < kMyWavetableCount && (kMyWavetableMaxHarmonic >> t) > harmonicsAllowed)
+		t++;
+	if (t == kMyWavetableCount)
+		return NULL;
+	return bank->tables + t * (kMyWavetableSize + 1);
+}
+
+#pragma mark - bank -
+
+// voices start silent. they start at different phases, so a bank of identical
+// voices doesn't add up to one huge spike
+static inline void MyOscillatorBankInit(MyOscillatorBank *bank, Float64 sampleRate, MyWaveform waveform, UInt32 voiceCount)
+{
+	bank->sampleRate = sampleRate;
+	bank->tables = (Float32 *)malloc(kMyWavetableCount * (kMyWavetableSize + 1) * sizeof(Float32));
+	MyOscillatorBankBuildTables(bank, waveform);
+	bank->voices = (MyOscillatorVoice *)calloc(voiceCount, sizeof(MyOscillatorVoice));
+	bank->voiceCount = voiceCount;
+	UInt32 i;
+	for (i = 0; i < voiceCount; i++)
+		bank->voices[i].phase = i * 2654435769u;
+}
+
+static inline void MyOscillatorBankDispose(MyOscillatorBank *bank)
+{
+	free(bank->tables);
+	free(bank->voices);
+	bank->tables = NULL;
+	bank->voices = NULL;
+	bank->voiceCount = 0;
+}
+
+// the voice glides to the new values. a voice that is silent right now starts
+// straight at the new frequency instead
+static inline void MyOscillatorBankSetVoice(MyOscillatorBank *bank, UInt32 voice, Float32 frequency, Float32 amplitude)
+{
+	bank->voices[voice].targetFrequency = frequency;
+	bank->voices[voice].targetAmplitude = amplitude;
+}
+
+// replace frames of out with the sum of every voice
+static inline void MyOscillatorBankRender(MyOscillatorBank *bank, Float32 *out, UInt32 frames)
+{
+	memset(out, 0, frames * sizeof(Float32));
+	const Float64 cyclesToPhase = 4294967296.0 / bank->sampleRate;
+	const UInt32 fractionBits = 32 - kMyWavetableBits;
+	const Float32 fractionScale = 1.0f / (1 << fractionBits);
+	while (frames > 0) {
+		UInt32 blockFrames = frames < kMyOscillatorBlockFrames ? frames : kMyOscillatorBlockFrames;
+		// how much of the distance to each target is left at the end of this block
+		Float32 remaining = (Float32)exp(-(Float64)blockFrames / (kMyOscillatorSmoothingTime * bank->sampleRate));
+		UInt32 v;
+		for (v = 0; v < bank->voiceCount; v++) {
+			MyOscillatorVoice *voice = &bank->voices[v];
+			Float32 targetFrequency = voice->targetFrequency;
+			Float32 targetAmplitude = voice->targetAmplitude;
+			if (voice->amplitude == 0.0f) {
+				if (targetAmplitude == 0.0f)
+					continue;
+				voice->frequency = targetFrequency;
+			}
+
+			Float32 amplitude = targetAmplitude + (voice->amplitude - targetAmplitude) * remaining;
+			if (fabsf(amplitude - targetAmplitude) < 1.0e-6f)
+				amplitude = targetAmplitude;
+			voice->frequency = targetFrequency + (voice->frequency - targetFrequency) * remaining;
+
+			// voices at or above Nyquist go quiet instead of aliasing
+			const Float32 *table = MyOscillatorBankTableForFrequency(bank, voice->frequency);
+			if (table) {
+				UInt32 increment = (UInt32)(voice->frequency * cyclesToPhase);
+				UInt32 phase = voice->phase;
+				UInt32 frame;
+				for (frame = 0; frame < blockFrames; frame++) {
+					UInt32 index = phase >> fractionBits;
+					Float32 fraction = (Float32)(phase & ((1 << fractionBits) - 1)) * fractionScale;
+					bank->scratch[frame] = table[index] + fraction * (table[index + 1] - table[index]);
+					phase += increment;
+				}
+				MyMixWithGainRamp(bank->scratch, out, blockFrames,
+								  voice->amplitude, (amplitude - voice->amplitude) / blockFrames);
+				voice->phase = phase;
+			}
+			voice->amplitude = amplitude;
+		}
+		out += blockFrames;
+		frames -= blockFrames;
+	}
+}
+
+#endif
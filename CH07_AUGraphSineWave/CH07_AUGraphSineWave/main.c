@@ -1,12 +1,34 @@
 #include <AudioToolbox/AudioToolbox.h>
+#include <mach/mach_time.h>
+#include "MyOscillatorBank.h"
+#include "../../Common/MyRenderGraph.h"
 
 #define sineFrequency 880.0
+#define voiceCount 1 // voices are spread voiceDetuneCents apart, centered on sineFrequency
+#define voiceDetuneCents 3.0
+#define voiceWaveform kMyWaveformSine
+#define renderBufferFrames 128 // frames we ask the device to pull per callback
+#define playSeconds 5
+#define offlineSampleRate 44100.0 // when rendering to a file
+#define offlineBranches 1 // independent oscillator banks, a semitone apart, mixed together
+#define offlineThreads 1 // threads the branches are spread across
+#define measureBranchSweep 0 // instead of playing, time the graph with 1...measureMaxBranches branches on 1...measureMaxThreads threads
+#define measureMaxBranches 16
+#define measureMaxThreads 8
+#define measureSeconds 10 // of audio, rendered for each branch and thread count
 
 
 typedef struct MySineWavePlayer
 {
 	AudioUnit outputUnit;
-	double startingFrameCount;
+	MyOscillatorBank oscillators;
+	
+	// render callback timing, host time
+	UInt64 renderTime;
+	UInt64 maxRenderTime;
+	UInt64 renderedFrames;
+	UInt32 renderCount;
+	UInt32 maxRenderFrames;
 } MySineWavePlayer;
 
 OSStatus SineWaveRenderProc(void *inRefCon,
@@ -15,7 +37,11 @@ OSStatus SineWaveRenderProc(void *inRefCon,
 							UInt32 inBusNumber,
 							UInt32 inNumberFrames,
 							AudioBufferList * ioData);
+void SetUpOscillators (MySineWavePlayer *player, Float64 sampleRate, Float64 transposeCents);
 void CreateAndConnectOutputUnit (MySineWavePlayer *player) ;
+void BuildBranchGraph (MyRenderGraph *graph, MySineWavePlayer *branches, int branchCount, int threadCount);
+void RenderToFile (const char *path);
+void MeasureBranchSweep (void);
 
 #pragma mark - callback function -
 OSStatus SineWaveRenderProc(void *inRefCon,
@@ -28,26 +54,26 @@ OSStatus SineWaveRenderProc(void *inRefCon,
 	//	printf ("SineWaveRenderProc needs %ld frames at %f\n", inNumberFrames, CFAbsoluteTimeGetCurrent());
 	
 	MySineWavePlayer *player = (MySineWavePlayer*)inRefCon;
+	UInt64 renderStart = mach_absolute_time();
+	
+	// the stream is non-interleaved, so the mono mix goes straight into the left buffer
+	Float32 *data = (Float32*)ioData->mBuffers[0].mData;
+	MyOscillatorBankRender(&player->oscillators, data, inNumberFrames);
+	
+	// copy to right channel too, all at once instead of calculating every sample twice
+	UInt32 buffer;
+	for (buffer = 1; buffer < ioData->mNumberBuffers; ++buffer)
+		memcpy(ioData->mBuffers[buffer].mData, data, inNumberFrames * sizeof(Float32));
 	
-	double j = player->startingFrameCount;
-	//	double cycleLength = 44100. / 2200./*frequency*/;
-	double cycleLength = 44100. / sineFrequency;
-	int frame = 0;
-	for (frame = 0; frame < inNumberFrames; ++frame) 
+	UInt64 elapsed = mach_absolute_time() - renderStart;
+	player->renderTime += elapsed;
+	player->renderedFrames += inNumberFrames;
+	player->renderCount++;
+	if (elapsed > player->maxRenderTime)
 	{
-		Float32 *data = (Float32*)ioData->mBuffers[0].mData;
-		(data)[frame] = (Float32)sin (2 * M_PI * (j / cycleLength));
-		
-		// copy to right channel too
-		data = (Float32*)ioData->mBuffers[1].mData;
-		(data)[frame] = (Float32)sin (2 * M_PI * (j / cycleLength));
-		
-		j += 1.0;
-		if (j > cycleLength)
-			j -= cycleLength;
+		player->maxRenderTime = elapsed;
+		player->maxRenderFrames = inNumberFrames;
 	}
-	
-	player->startingFrameCount = j;
 	return noErr;
 }	
 
@@ -74,6 +100,19 @@ static void CheckError(OSStatus error, const char *operation)
 }
 
 
+void SetUpOscillators (MySineWavePlayer *player, Float64 sampleRate, Float64 transposeCents) {
+	MyOscillatorBankInit(&player->oscillators, sampleRate, voiceWaveform, voiceCount);
+	UInt32 voice;
+	for (voice = 0; voice < voiceCount; voice++)
+	{
+		Float64 cents = transposeCents + (voice - (voiceCount - 1) / 2.0) * voiceDetuneCents;
+		MyOscillatorBankSetVoice(&player->oscillators,
+								 voice,
+								 sineFrequency * pow(2.0, cents / 1200.0),
+								 1.0 / voiceCount);
+	}
+}
+
 void CreateAndConnectOutputUnit (MySineWavePlayer *player) {
 	
 	//  10.6 and later: generate description that will match out output device (speakers)
@@ -101,19 +140,194 @@ void CreateAndConnectOutputUnit (MySineWavePlayer *player) {
 									&input, 
 									sizeof(input)),
 			   "AudioUnitSetProperty failed");
-		
+	
+	// ask for float, non-interleaved, at the device's own rate so nothing gets resampled
+	AudioStreamBasicDescription deviceFormat;
+	UInt32 propSize = sizeof(deviceFormat);
+	CheckError(AudioUnitGetProperty(player->outputUnit,
+									kAudioUnitProperty_StreamFormat,
+									kAudioUnitScope_Output,
+									0,
+									&deviceFormat,
+									&propSize),
+			   "Couldn't get output unit's device format");
+	AudioStreamBasicDescription streamFormat = {0};
+	streamFormat.mSampleRate = deviceFormat.mSampleRate;
+	streamFormat.mFormatID = kAudioFormatLinearPCM;
+	streamFormat.mFormatFlags = kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+	streamFormat.mChannelsPerFrame = deviceFormat.mChannelsPerFrame;
+	streamFormat.mFramesPerPacket = 1;
+	streamFormat.mBitsPerChannel = 32;
+	streamFormat.mBytesPerFrame = sizeof(Float32);
+	streamFormat.mBytesPerPacket = sizeof(Float32);
+	CheckError(AudioUnitSetProperty(player->outputUnit,
+									kAudioUnitProperty_StreamFormat,
+									kAudioUnitScope_Input,
+									0,
+									&streamFormat,
+									sizeof(streamFormat)),
+			   "Couldn't set output unit's stream format");
+	
+	// small buffers, like a synth would use. the render proc copes with any size
+	UInt32 bufferFrames = renderBufferFrames;
+	CheckError(AudioUnitSetProperty(player->outputUnit,
+									kAudioDevicePropertyBufferFrameSize,
+									kAudioUnitScope_Global,
+									0,
+									&bufferFrames,
+									sizeof(bufferFrames)),
+			   "Couldn't set output unit's buffer size");
+	
+	// the oscillators have to know the real rate before the first render
+	SetUpOscillators(player, streamFormat.mSampleRate, 0.0);
+	
 	// initialize unit
 	CheckError (AudioUnitInitialize(player->outputUnit),
 				"Couldn't initialize output unit");
 	
 }
 
+#pragma mark - offline rendering -
+
+// each branch is a player of its own, a semitone above the last, and the
+// branches are mixed. they render in parallel if threadCount > 1
+void BuildBranchGraph (MyRenderGraph *graph, MySineWavePlayer *branches, int branchCount, int threadCount) {
+	MyRenderGraphInit(graph, offlineSampleRate, 2, renderBufferFrames);
+	MyRenderNode mixerNode;
+	CheckError(MyRenderGraphAddMixerNode(graph, "mixer", &mixerNode),
+			   "MyRenderGraphAddMixerNode failed");
+	int branch;
+	for (branch = 0; branch < branchCount; branch++)
+	{
+		SetUpOscillators(&branches[branch], offlineSampleRate, branch * 100.0);
+		char name[kMyRenderGraphMaxNameLength];
+		snprintf(name, sizeof(name), "oscillators %d", branch);
+		MyRenderNode oscillatorNode;
+		CheckError(MyRenderGraphAddNode(graph, name, SineWaveRenderProc, &branches[branch], &oscillatorNode),
+				   "MyRenderGraphAddNode failed");
+		CheckError(MyRenderGraphConnectNodeInput(graph, oscillatorNode, mixerNode),
+				   "MyRenderGraphConnectNodeInput failed");
+		CheckError(MyRenderGraphSetMixerInputGain(graph, mixerNode, branch, 1.0 / branchCount),
+				   "MyRenderGraphSetMixerInputGain failed");
+	}
+	CheckError(MyRenderGraphSetOutputNode(graph, mixerNode),
+			   "MyRenderGraphSetOutputNode failed");
+	CheckError(MyRenderGraphSetThreadCount(graph, threadCount),
+			   "MyRenderGraphSetThreadCount failed");
+}
+
+// no output unit: pull the same render proc through a MyRenderGraph as fast as it
+// will go, and write playSeconds of it to a file
+void RenderToFile (const char *path) {
+	
+	MySineWavePlayer *branches = calloc(offlineBranches, sizeof(MySineWavePlayer));
+	
+	MyRenderGraph graph;
+	BuildBranchGraph(&graph, branches, offlineBranches, offlineThreads);
+	
+	// 16-bit stereo CAF
+	AudioStreamBasicDescription fileFormat = {0};
+	fileFormat.mSampleRate = offlineSampleRate;
+	fileFormat.mFormatID = kAudioFormatLinearPCM;
+	fileFormat.mFormatFlags = kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked;
+	fileFormat.mChannelsPerFrame = 2;
+	fileFormat.mFramesPerPacket = 1;
+	fileFormat.mBitsPerChannel = 16;
+	fileFormat.mBytesPerFrame = 4;
+	fileFormat.mBytesPerPacket = 4;
+	
+	CFURLRef fileURL = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault,
+															   (const UInt8*)path,
+															   strlen(path),
+															   false);
+	ExtAudioFileRef file;
+	CheckError(ExtAudioFileCreateWithURL(fileURL, kAudioFileCAFType, &fileFormat, NULL,
+										 kAudioFileFlags_EraseFile, &file),
+			   "Couldn't create output file");
+	CFRelease(fileURL);
+	
+	CheckError(MyRenderGraphRenderToFile(&graph, file, playSeconds * offlineSampleRate),
+			   "Couldn't render to file");
+	CheckError(ExtAudioFileDispose(file), "Couldn't close output file");
+	
+	printf ("rendered %d seconds of %d branches on %d threads to %s\n",
+			playSeconds, offlineBranches, offlineThreads, path);
+	MyRenderGraphPrintStats(&graph, stdout);
+	MyRenderGraphDispose(&graph);
+	
+	int branch;
+	for (branch = 0; branch < offlineBranches; branch++)
+		MyOscillatorBankDispose(&branches[branch].oscillators);
+	free (branches);
+}
+
+// render measureSeconds through every graph from 1 to measureMaxBranches branches,
+// on 1 to measureMaxThreads threads, and show the average cycle next to the serial
+// pull's. 1 thread is the serial pull: the output node renders its inputs itself
+void MeasureBranchSweep (void) {
+	MySineWavePlayer *branches = calloc(measureMaxBranches, sizeof(MySineWavePlayer));
+	UInt32 cycles = (UInt32)(measureSeconds * offlineSampleRate / renderBufferFrames);
+	
+	printf ("us per %d-frame cycle (speedup over 1 thread)\n", renderBufferFrames);
+	printf ("%8s", "branches");
+	int threads;
+	for (threads = 1; threads <= measureMaxThreads; threads++)
+		printf (" %11d thr%s", threads, threads == 1 ? " " : "s");
+	printf ("\n");
+	
+	int branchCount;
+	for (branchCount = 1; branchCount <= measureMaxBranches; branchCount++)
+	{
+		printf ("%8d", branchCount);
+		Float64 serialMicros = 0.0;
+		for (threads = 1; threads <= measureMaxThreads; threads++)
+		{
+			MyRenderGraph graph;
+			BuildBranchGraph(&graph, branches, branchCount, threads);
+			
+			// one untimed cycle, to work out the schedule and wake the workers
+			const AudioBufferList *output;
+			CheckError(MyRenderGraphRender(&graph, renderBufferFrames, &output),
+					   "MyRenderGraphRender failed");
+			UInt64 start = MyRenderGraphClock();
+			UInt32 cycle;
+			for (cycle = 0; cycle < cycles; cycle++)
+				CheckError(MyRenderGraphRender(&graph, renderBufferFrames, &output),
+						   "MyRenderGraphRender failed");
+			Float64 micros = MyRenderGraphClockSeconds(MyRenderGraphClock() - start) * 1000000.0 / cycles;
+			if (threads == 1)
+				serialMicros = micros;
+			printf (" %7.2f (%4.2fx)", micros, serialMicros / micros);
+			
+			MyRenderGraphDispose(&graph);
+			int branch;
+			for (branch = 0; branch < branchCount; branch++)
+				MyOscillatorBankDispose(&branches[branch].oscillators);
+		}
+		printf ("\n");
+		fflush (stdout);
+	}
+	free (branches);
+}
+
 #pragma mark main
 
+// with a file path argument, renders to that file instead of playing
 int	main(int argc, const char *argv[])
 {
  	MySineWavePlayer player = {0};
 	
+#if measureBranchSweep
+	MeasureBranchSweep();
+	return 0;
+#endif
+	
+	if (argc > 1)
+	{
+		RenderToFile(argv[1]);
+		return 0;
+	}
+	
 	// set up unit and callback
 	CreateAndConnectOutputUnit(&player);
 	
@@ -122,11 +336,30 @@ int	main(int argc, const char *argv[])
 	
 	printf ("playing\n");
 	// play for 5 seconds
-	sleep(5);
+	sleep(playSeconds);
 cleanup:
 	AudioOutputUnitStop(player.outputUnit);
 	AudioUnitUninitialize(player.outputUnit);
 	AudioComponentInstanceDispose(player.outputUnit);
 	
+	// how much of one core the voices took, and how many would fit in all of it
+	if (player.renderedFrames > 0)
+	{
+		mach_timebase_info_data_t timebase;
+		mach_timebase_info(&timebase);
+		Float64 nanosPerTick = (Float64)timebase.numer / timebase.denom;
+		Float64 sampleRate = player.oscillators.sampleRate;
+		Float64 nanosPerFrame = player.renderTime * nanosPerTick / player.renderedFrames;
+		Float64 load = nanosPerFrame * sampleRate / 1000000000.0;
+		printf ("%d voices at %.0f Hz: %.1f ns per frame, %.2f%% of one core\n",
+				voiceCount, sampleRate, nanosPerFrame, load * 100.0);
+		printf ("%u renders, longest %.1f us for %u frames. about %.0f voices would fill a core\n",
+				(unsigned int)player.renderCount,
+				player.maxRenderTime * nanosPerTick / 1000.0,
+				(unsigned int)player.maxRenderFrames,
+				voiceCount / load);
+	}
+	MyOscillatorBankDispose(&player.oscillators);
+	
 	return 0;
 }
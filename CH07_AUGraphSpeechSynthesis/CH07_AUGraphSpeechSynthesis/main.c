@@ -1,8 +1,18 @@
 #include <AudioToolbox/AudioToolbox.h>
 #include <ApplicationServices/ApplicationServices.h>
+#include "../../Common/MyRenderGraph.h"
+#include "../../Common/MyConvolutionReverb.h"
 
 #define PART_II
 
+#define useConvolutionReverb 1 // our own reverb, instead of MatrixReverb
+#define reverbSeconds 3.0 // how long the generated hall takes to die away
+#define reverbBlockFrames 256
+
+#define speakSeconds 10
+#define offlineSampleRate 44100.0 // when rendering to a file
+#define offlineSliceFrames 512
+
 typedef struct MyAUGraphPlayer
 {
 	//	AudioStreamBasicDescription streamFormat; // ASBD to use in the graph
@@ -10,10 +20,19 @@ typedef struct MyAUGraphPlayer
 	AUGraph graph;
 	AudioUnit speechAU;
 	
+	// rendering to a file uses our own graph instead
+	MyRenderGraph renderGraph;
+	AudioUnit reverbAU;
+	
+	MyConvolutionReverb convolutionReverb;
+	
 } MyAUGraphPlayer;
 
 void CreateMyAUGraph(MyAUGraphPlayer *player);
+void CreateMyRenderGraph(MyAUGraphPlayer *player);
 void PrepareSpeechAU(MyAUGraphPlayer *player);
+void PrepareConvolutionReverb(MyAUGraphPlayer *player, Float64 sampleRate);
+void RenderToFile(MyAUGraphPlayer *player, const char *path);
 
 #pragma mark - utility functions -
 
@@ -37,6 +56,27 @@ static void CheckError(OSStatus error, const char *operation)
 	exit(1);
 }
 
+#pragma mark - render proc -
+
+// the output unit's input when the convolution reverb is in use: pull the speech
+// AU, then add reverb in place
+static OSStatus ConvolutionReverbInputProc(void *inRefCon,
+										   AudioUnitRenderActionFlags *ioActionFlags,
+										   const AudioTimeStamp *inTimeStamp,
+										   UInt32 inBusNumber,
+										   UInt32 inNumberFrames,
+										   AudioBufferList *ioData)
+{
+	MyAUGraphPlayer *player = (MyAUGraphPlayer *)inRefCon;
+	OSStatus err = AudioUnitRender(player->speechAU, ioActionFlags, inTimeStamp, 0, inNumberFrames, ioData);
+	if (err != noErr)
+		return err;
+	return MyConvolutionReverbRenderProc(&player->convolutionReverb, ioActionFlags, inTimeStamp,
+										 inBusNumber, inNumberFrames, ioData);
+}
+
+#pragma mark - graph setup -
+
 void CreateMyAUGraph(MyAUGraphPlayer *player)
 {
 	// create a new AUGraph
@@ -84,6 +124,38 @@ void CreateMyAUGraph(MyAUGraphPlayer *player)
 	//			   "Couldn't get ASBD");	
 	
 #ifdef PART_II
+#if useConvolutionReverb
+	//
+	// the output node pulls our callback, which renders the speech AU and runs
+	// it through the convolution reverb
+	//
+	AudioUnit outputUnit;
+	CheckError(AUGraphNodeInfo(player->graph, outputNode, NULL, &outputUnit),
+			   "AUGraphNodeInfo failed");
+	
+	// nothing connects the speech AU for us, so give it the format the output unit takes
+	AudioStreamBasicDescription streamFormat;
+	UInt32 propSize = sizeof (AudioStreamBasicDescription);
+	CheckError(AudioUnitGetProperty(outputUnit, kAudioUnitProperty_StreamFormat,
+									kAudioUnitScope_Input, 0, &streamFormat, &propSize),
+			   "Couldn't get output unit's input ASBD");
+	CheckError(AudioUnitSetProperty(player->speechAU, kAudioUnitProperty_StreamFormat,
+									kAudioUnitScope_Output, 0, &streamFormat, propSize),
+			   "Couldn't set speech AU's output ASBD");
+	
+	AURenderCallbackStruct callback = {0};
+	callback.inputProc = ConvolutionReverbInputProc;
+	callback.inputProcRefCon = player;
+	CheckError(AUGraphSetNodeInputCallback(player->graph, outputNode, 0, &callback),
+			   "AUGraphSetNodeInputCallback failed");
+	
+	PrepareConvolutionReverb(player, streamFormat.mSampleRate);
+	
+	// now initialize the graph (causes resources to be allocated)
+	CheckError(AUGraphInitialize(player->graph),
+			   "AUGraphInitialize failed");
+	
+#else
 	//
 	// FUN! re-route the speech thru a reverb effect before sending to speakers
 	//
@@ -145,6 +217,7 @@ void CreateMyAUGraph(MyAUGraphPlayer *player)
 									kAudioUnitScope_Global, 0, &roomType, sizeof(UInt32)),
 			   "AudioUnitSetProperty[kAudioUnitProperty_ReverbRoomType] failed");
 	
+#endif
 	
 #else
 	
@@ -160,6 +233,72 @@ void CreateMyAUGraph(MyAUGraphPlayer *player)
 	CAShow(player->graph);
 }
 
+// open one of Apple's units ourselves, since there's no AUGraph to do it
+static AudioUnit OpenAppleUnit(OSType componentType, OSType componentSubType)
+{
+	AudioComponentDescription cd = {0};
+	cd.componentType = componentType;
+	cd.componentSubType = componentSubType;
+	cd.componentManufacturer = kAudioUnitManufacturer_Apple;
+	
+	AudioComponent comp = AudioComponentFindNext(NULL, &cd);
+	if (comp == NULL) {
+		printf ("can't find audio unit");
+		exit (-1);
+	}
+	AudioUnit unit;
+	CheckError(AudioComponentInstanceNew(comp, &unit),
+			   "AudioComponentInstanceNew failed");
+	return unit;
+}
+
+// the same speech->reverb chain as CreateMyAUGraph, but pulled by a MyRenderGraph
+// instead of an output device, so it can be rendered offline and timed
+void CreateMyRenderGraph(MyAUGraphPlayer *player)
+{
+	MyRenderGraph *graph = &player->renderGraph;
+	MyRenderGraphInit(graph, offlineSampleRate, 2, offlineSliceFrames);
+	
+	player->speechAU = OpenAppleUnit(kAudioUnitType_Generator, kAudioUnitSubType_SpeechSynthesis);
+	MyRenderNode speechNode;
+	CheckError(MyRenderGraphAddAudioUnitNode(graph, "speech", player->speechAU, &speechNode),
+			   "MyRenderGraphAddAudioUnitNode[speech] failed");
+	
+#ifdef PART_II
+	MyRenderNode reverbNode;
+#if useConvolutionReverb
+	PrepareConvolutionReverb(player, offlineSampleRate);
+	CheckError(MyRenderGraphAddNode(graph, "convolution reverb", MyConvolutionReverbRenderProc,
+									&player->convolutionReverb, &reverbNode),
+			   "MyRenderGraphAddNode[convolution reverb] failed");
+#else
+	player->reverbAU = OpenAppleUnit(kAudioUnitType_Effect, kAudioUnitSubType_MatrixReverb);
+	CheckError(MyRenderGraphAddAudioUnitNode(graph, "reverb", player->reverbAU, &reverbNode),
+			   "MyRenderGraphAddAudioUnitNode[reverb] failed");
+#endif
+	CheckError(MyRenderGraphConnectNodeInput(graph, speechNode, reverbNode),
+			   "MyRenderGraphConnectNodeInput failed");
+	CheckError(MyRenderGraphSetOutputNode(graph, reverbNode),
+			   "MyRenderGraphSetOutputNode failed");
+	
+	CheckError(MyRenderGraphInitialize(graph),
+			   "MyRenderGraphInitialize failed");
+	
+#if !useConvolutionReverb
+	UInt32 roomType = kReverbRoomType_LargeHall;
+	CheckError(AudioUnitSetProperty(player->reverbAU, kAudioUnitProperty_ReverbRoomType, 
+									kAudioUnitScope_Global, 0, &roomType, sizeof(UInt32)),
+			   "AudioUnitSetProperty[kAudioUnitProperty_ReverbRoomType] failed");
+#endif
+#else
+	CheckError(MyRenderGraphSetOutputNode(graph, speechNode),
+			   "MyRenderGraphSetOutputNode failed");
+	
+	CheckError(MyRenderGraphInitialize(graph),
+			   "MyRenderGraphInitialize failed");
+#endif
+}
+
 void PrepareSpeechAU(MyAUGraphPlayer *player)
 {
 	SpeechChannel chan;
@@ -172,11 +311,80 @@ void PrepareSpeechAU(MyAUGraphPlayer *player)
 	SpeakCFString(chan, CFSTR("hello world"), NULL);
 }
 
+#pragma mark - convolution reverb -
+
+// a made-up hall standing in for kReverbRoomType_LargeHall. to use a recorded
+// room instead, read its impulse response here and pass that to MyConvolutionReverbInit()
+void PrepareConvolutionReverb(MyAUGraphPlayer *player, Float64 sampleRate)
+{
+	UInt32 frames = (UInt32)(reverbSeconds * sampleRate);
+	Float32 *left = (Float32 *)malloc(frames * sizeof(Float32));
+	Float32 *right = (Float32 *)malloc(frames * sizeof(Float32));
+	MyConvolutionReverbMakeHall(left, right, frames, sampleRate, reverbSeconds);
+	CheckError(MyConvolutionReverbInit(&player->convolutionReverb, reverbBlockFrames, left, right, frames),
+			   "MyConvolutionReverbInit failed");
+	free(left);
+	free(right);
+}
+
+#pragma mark - offline rendering -
+
+// render speakSeconds of the graph into a 16-bit stereo CAF as fast as the units
+// can go, then show how long each one took
+void RenderToFile(MyAUGraphPlayer *player, const char *path)
+{
+	AudioStreamBasicDescription fileFormat = {0};
+	fileFormat.mSampleRate = offlineSampleRate;
+	fileFormat.mFormatID = kAudioFormatLinearPCM;
+	fileFormat.mFormatFlags = kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked;
+	fileFormat.mChannelsPerFrame = 2;
+	fileFormat.mFramesPerPacket = 1;
+	fileFormat.mBitsPerChannel = 16;
+	fileFormat.mBytesPerFrame = 4;
+	fileFormat.mBytesPerPacket = 4;
+	
+	CFURLRef fileURL = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault,
+															   (const UInt8*)path,
+															   strlen(path),
+															   false);
+	ExtAudioFileRef file;
+	CheckError(ExtAudioFileCreateWithURL(fileURL, kAudioFileCAFType, &fileFormat, NULL,
+										 kAudioFileFlags_EraseFile, &file),
+			   "Couldn't create output file");
+	CFRelease(fileURL);
+	
+	CheckError(MyRenderGraphRenderToFile(&player->renderGraph, file, speakSeconds * offlineSampleRate),
+			   "Couldn't render to file");
+	CheckError(ExtAudioFileDispose(file), "Couldn't close output file");
+	
+	printf ("rendered %d seconds to %s\n", speakSeconds, path);
+	MyRenderGraphPrintStats(&player->renderGraph, stdout);
+}
+
 #pragma mark main
 
+// with a file path argument, renders to that file instead of playing
 int	main(int argc, const char *argv[])
 {
  	MyAUGraphPlayer player = {0};
+	
+	if (argc > 1)
+	{
+		CreateMyRenderGraph(&player);
+		PrepareSpeechAU(&player);
+		RenderToFile(&player, argv[1]);
+		
+		MyRenderGraphDispose(&player.renderGraph);
+		MyConvolutionReverbDispose(&player.convolutionReverb);
+		AudioUnitUninitialize(player.speechAU);
+		AudioComponentInstanceDispose(player.speechAU);
+		if (player.reverbAU)
+		{
+			AudioUnitUninitialize(player.reverbAU);
+			AudioComponentInstanceDispose(player.reverbAU);
+		}
+		return 0;
+	}
 		
 	// build a basic speech->speakers graph
 	CreateMyAUGraph(&player);
@@ -188,12 +396,13 @@ int	main(int argc, const char *argv[])
 	CheckError(AUGraphStart(player.graph), "AUGraphStart failed");
 	
 	// sleep a while so the speech can play out
-	usleep ((int)(10 * 1000. * 1000.));
+	usleep ((int)(speakSeconds * 1000. * 1000.));
 	
 cleanup:
 	AUGraphStop (player.graph);
 	AUGraphUninitialize (player.graph);
 	AUGraphClose(player.graph);
+	MyConvolutionReverbDispose(&player.convolutionReverb);
 	
 	return 0;
 }
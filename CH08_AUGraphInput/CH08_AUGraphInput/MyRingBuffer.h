@@ -0,0 +1,271 @@
+//
+//  MyRingBuffer.h
+//  CH08_AUGraphInput
+//
+//  Copyright 2026 Subsequently and Furthermore, Inc. All rights reserved.
+//
+
+// A stand-in for CARingBuffer that lives in the project instead of an absolute
+// /Library/Developer path. Frames are stored and fetched by sample time, one
+// buffer per channel (non-interleaved), just like CARingBuffer. It supports
+// exactly one writer (the input callback) and one reader (the output callback),
+// and neither side ever takes a lock: the writer publishes the valid range of
+// sample times through a sequence counter, and the reader checks that range
+// again after copying to find out if the writer lapped it in the meantime.
+
+#ifndef CH08_AUGraphInput_MyRingBuffer_h
+#define CH08_AUGraphInput_MyRingBuffer_h
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <libkern/OSAtomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define kMyRingBufferCacheLineSize	64
+
+// error codes match CARingBuffer's
+enum {
+	kMyRingBufferError_OK = 0,
+	kMyRingBufferError_TooMuch = 3,		// fetch or store was larger than the buffer
+	kMyRingBufferError_CPUOverload = 4	// writer overwrote the frames while they were being fetched
+};
+typedef SInt32 MyRingBufferError;
+typedef SInt64 MyRingBufferTime;
+
+class MyRingBuffer {
+public:
+	MyRingBuffer() :
+		mBuffers(NULL), mNumberChannels(0), mBytesPerFrame(0), mCapacityFrames(0), mCapacityMask(0),
+		mBoundsSequence(0), mStartTime(0), mEndTime(0),
+		mUnderrunCount(0), mOverrunCount(0)
+	{ }
+	~MyRingBuffer() { Deallocate(); }
+
+	// capacityFrames is rounded up to a power of 2. not thread-safe: call before
+	// the writer and reader start
+	void Allocate(UInt32 nChannels, UInt32 bytesPerFrame, UInt32 capacityFrames)
+	{
+		Deallocate();
+
+		UInt32 capacity = 1;
+		while (capacity < capacityFrames)
+			capacity <<= 1;
+
+		mNumberChannels = nChannels;
+		mBytesPerFrame = bytesPerFrame;
+		mCapacityFrames = capacity;
+		mCapacityMask = capacity - 1;
+		mBuffers = (Byte **)malloc(nChannels * sizeof(Byte *));
+		for (UInt32 i = 0; i < nChannels; i++)
+			mBuffers[i] = (Byte *)calloc(capacity, bytesPerFrame);
+
+		mBoundsSequence = 0;
+		mStartTime = mEndTime = 0;
+		mUnderrunCount = mOverrunCount = 0;
+	}
+
+	void Deallocate()
+	{
+		if (mBuffers) {
+			for (UInt32 i = 0; i < mNumberChannels; i++)
+				free(mBuffers[i]);
+			free(mBuffers);
+			mBuffers = NULL;
+		}
+		mNumberChannels = 0;
+		mCapacityFrames = 0;
+	}
+
+#pragma mark writer
+
+	// copy nFrames from abl into the buffer, to be fetched later by sample time.
+	// if the reader has fallen more than a buffer behind, its oldest frames are lost
+	MyRingBufferError Store(const AudioBufferList *abl, UInt32 nFrames, MyRingBufferTime startWrite)
+	{
+		if (nFrames == 0)
+			return kMyRingBufferError_OK;
+		if (nFrames > mCapacityFrames)
+			return kMyRingBufferError_TooMuch;
+
+		// only the writer changes the time bounds, so it can read them directly
+		MyRingBufferTime endWrite = startWrite + nFrames;
+		if (startWrite < mEndTime) {
+			// going backwards, throw everything out
+			SetTimeBounds(startWrite, startWrite);
+		} else if (endWrite - mStartTime > mCapacityFrames) {
+			// move the start time past the region we are about to overwrite
+			// *before* writing, so that a concurrent fetch can tell
+			MyRingBufferTime newStart = endWrite - mCapacityFrames;
+			MyRingBufferTime newEnd = newStart > mEndTime ? newStart : mEndTime;
+			SetTimeBounds(newStart, newEnd);
+		}
+
+		// if we skipped some sample times, zero the range we skipped
+		MyRingBufferTime curEnd = mEndTime;
+		if (startWrite > curEnd)
+			ZeroRange(curEnd, (UInt32)(startWrite - curEnd));
+
+		// write the new frames, in two pieces if they wrap around the end
+		UInt32 offset = FrameOffset(startWrite);
+		UInt32 firstPart = mCapacityFrames - offset;
+		if (firstPart > nFrames)
+			firstPart = nFrames;
+		UInt32 channels = abl->mNumberBuffers < mNumberChannels ? abl->mNumberBuffers : mNumberChannels;
+		for (UInt32 i = 0; i < channels; i++) {
+			const Byte *src = (const Byte *)abl->mBuffers[i].mData;
+			memcpy(mBuffers[i] + offset * mBytesPerFrame, src, firstPart * mBytesPerFrame);
+			if (firstPart < nFrames)
+				memcpy(mBuffers[i], src + firstPart * mBytesPerFrame, (nFrames - firstPart) * mBytesPerFrame);
+		}
+
+		// publish the new frames
+		SetTimeBounds(mStartTime, endWrite);
+		return kMyRingBufferError_OK;
+	}
+
+#pragma mark reader
+
+	// copy nFrames starting at sample time startRead into abl. frames that are
+	// not in the buffer (not written yet, or already overwritten) come back as silence
+	MyRingBufferError Fetch(AudioBufferList *abl, UInt32 nFrames, MyRingBufferTime startRead)
+	{
+		if (nFrames == 0)
+			return kMyRingBufferError_OK;
+		if (nFrames > mCapacityFrames)
+			return kMyRingBufferError_TooMuch;
+
+		UInt32 channels = abl->mNumberBuffers < mNumberChannels ? abl->mNumberBuffers : mNumberChannels;
+		for (UInt32 i = 0; i < channels; i++)
+			abl->mBuffers[i].mDataByteSize = nFrames * mBytesPerFrame;
+
+		MyRingBufferTime endRead = startRead + nFrames;
+		MyRingBufferTime startTime, endTime;
+		GetTimeBounds(startTime, endTime);
+
+		MyRingBufferTime copyStart = startRead;
+		MyRingBufferTime copyEnd = endRead;
+		if (copyStart < startTime) {
+			mOverrunCount = mOverrunCount + 1;	// writer already overwrote what we wanted
+			copyStart = startTime;
+		}
+		if (copyEnd > endTime) {
+			mUnderrunCount = mUnderrunCount + 1;	// writer hasn't gotten here yet
+			copyEnd = endTime;
+		}
+		if (copyStart >= copyEnd) {
+			ZeroBufferList(abl, channels, 0, nFrames);
+			return kMyRingBufferError_OK;
+		}
+
+		// silence whatever falls outside the valid range, then copy the rest
+		UInt32 destOffset = (UInt32)(copyStart - startRead);
+		UInt32 copyFrames = (UInt32)(copyEnd - copyStart);
+		ZeroBufferList(abl, channels, 0, destOffset);
+		ZeroBufferList(abl, channels, destOffset + copyFrames, nFrames - (destOffset + copyFrames));
+
+		UInt32 offset = FrameOffset(copyStart);
+		UInt32 firstPart = mCapacityFrames - offset;
+		if (firstPart > copyFrames)
+			firstPart = copyFrames;
+		for (UInt32 i = 0; i < channels; i++) {
+			Byte *dest = (Byte *)abl->mBuffers[i].mData + destOffset * mBytesPerFrame;
+			memcpy(dest, mBuffers[i] + offset * mBytesPerFrame, firstPart * mBytesPerFrame);
+			if (firstPart < copyFrames)
+				memcpy(dest + firstPart * mBytesPerFrame, mBuffers[i], (copyFrames - firstPart) * mBytesPerFrame);
+		}
+
+		// if the writer moved the start time past what we copied, it was
+		// overwriting those frames while we read them
+		GetTimeBounds(startTime, endTime);
+		if (copyStart < startTime) {
+			mOverrunCount = mOverrunCount + 1;
+			ZeroBufferList(abl, channels, 0, nFrames);
+			return kMyRingBufferError_CPUOverload;
+		}
+		return kMyRingBufferError_OK;
+	}
+
+#pragma mark either thread
+
+	// range of sample times currently held in the buffer, [start, end)
+	void GetTimeBounds(MyRingBufferTime &start, MyRingBufferTime &end) const
+	{
+		UInt32 sequence;
+		do {
+			sequence = mBoundsSequence;
+			OSMemoryBarrier();
+			start = mStartTime;
+			end = mEndTime;
+			OSMemoryBarrier();
+		} while ((sequence & 1) || sequence != mBoundsSequence);
+	}
+
+	// fetches that wanted frames the writer had not stored yet
+	UInt32 GetUnderrunCount() const { return mUnderrunCount; }
+	// fetches that wanted frames the writer had already overwritten
+	UInt32 GetOverrunCount() const { return mOverrunCount; }
+	UInt32 GetCapacityFrames() const { return mCapacityFrames; }
+
+private:
+	UInt32 FrameOffset(MyRingBufferTime frameNumber) const { return (UInt32)(frameNumber & mCapacityMask); }
+
+	// writer only. an odd sequence number means an update is in progress
+	void SetTimeBounds(MyRingBufferTime start, MyRingBufferTime end)
+	{
+		mBoundsSequence = mBoundsSequence + 1;
+		OSMemoryBarrier();
+		mStartTime = start;
+		mEndTime = end;
+		OSMemoryBarrier();
+		mBoundsSequence = mBoundsSequence + 1;
+	}
+
+	void ZeroRange(MyRingBufferTime startTime, UInt32 nFrames)
+	{
+		if (nFrames > mCapacityFrames)
+			nFrames = mCapacityFrames;
+		UInt32 offset = FrameOffset(startTime);
+		UInt32 firstPart = mCapacityFrames - offset;
+		if (firstPart > nFrames)
+			firstPart = nFrames;
+		for (UInt32 i = 0; i < mNumberChannels; i++) {
+			memset(mBuffers[i] + offset * mBytesPerFrame, 0, firstPart * mBytesPerFrame);
+			if (firstPart < nFrames)
+				memset(mBuffers[i], 0, (nFrames - firstPart) * mBytesPerFrame);
+		}
+	}
+
+	void ZeroBufferList(AudioBufferList *abl, UInt32 channels, UInt32 frameOffset, UInt32 nFrames)
+	{
+		if (nFrames == 0)
+			return;
+		for (UInt32 i = 0; i < channels; i++)
+			memset((Byte *)abl->mBuffers[i].mData + frameOffset * mBytesPerFrame, 0, nFrames * mBytesPerFrame);
+	}
+
+	// set up by Allocate(), then only read
+	Byte				**mBuffers;
+	UInt32				mNumberChannels;
+	UInt32				mBytesPerFrame;
+	UInt32				mCapacityFrames;
+	UInt32				mCapacityMask;
+
+	// written only by the writer. the padding keeps these on a different
+	// cache line from the reader's counters, whatever the object's alignment
+	char				mWriterPad[kMyRingBufferCacheLineSize];
+	volatile UInt32		mBoundsSequence;
+	volatile MyRingBufferTime mStartTime;
+	volatile MyRingBufferTime mEndTime;
+
+	// written only by the reader
+	char				mReaderPad[kMyRingBufferCacheLineSize];
+	volatile UInt32		mUnderrunCount;
+	volatile UInt32		mOverrunCount;
+	char				mTailPad[kMyRingBufferCacheLineSize];
+
+	// not copyable
+	MyRingBuffer(const MyRingBuffer &);
+	MyRingBuffer &operator=(const MyRingBuffer &);
+};
+
+#endif
@@ -1,10 +1,28 @@
 #include <AudioToolbox/AudioToolbox.h>
 #include <ApplicationServices/ApplicationServices.h>
-#include "CARingBuffer.h"
+#include "MyRingBuffer.h"
 #include <pthread.h>
 
 //#define PART_II
 
+// drift compensation: how much input to keep buffered ahead of the output, in
+// multiples of the input device's buffer size. raise this if you hear dropouts
+#define kDriftTargetLatencyBuffers	2
+#define kDriftLatencySmoothing		0.01	// one-pole smoothing of the measured latency, per output callback
+#define kDriftCorrectionGain		0.002	// rate correction per unit of (normalized) latency error
+#define kDriftMaxCorrection			0.002	// largest correction applied on top of the timestamp rate ratio
+#define kDriftMaxRateDeviation		0.01	// input and output are the same nominal rate, so never stray further than this
+
+typedef struct MyDriftTracker
+{
+	Float64 targetLatency;		// frames of input to keep ahead of the read position
+	Float64 readSampleTime;		// input sample time of the next output frame
+	Float64 rateRatio;			// input frames consumed per output frame
+	Float64 smoothedLatency;
+	Boolean running;
+	UInt32 resyncCount;			// times we had to jump back to the target latency
+} MyDriftTracker;
+
 typedef struct MyAUGraphPlayer
 {
 	AudioStreamBasicDescription streamFormat; 
@@ -17,11 +35,12 @@ typedef struct MyAUGraphPlayer
 #endif
 	
 	AudioBufferList *inputBuffer;
-	CARingBuffer *ringBuffer;
+	MyRingBuffer *ringBuffer;
 	
-	Float64 firstInputSampleTime;
-	Float64 firstOutputSampleTime;
-	Float64 inToOutSampleTimeOffset;
+	volatile Float64 inputRateScalar;	// from the input's most recent AudioTimeStamp
+	MyDriftTracker drift;
+	AudioBufferList *resampleBuffer;	// frames fetched from the ring buffer, before resampling
+	UInt32 resampleBufferFrames;
 	
 } MyAUGraphPlayer;
 
@@ -40,6 +59,98 @@ OSStatus GraphRenderProc(void *inRefCon,
 void CreateInputUnit (MyAUGraphPlayer *player);
 void CreateMyAUGraph(MyAUGraphPlayer *player);
 
+#pragma mark - drift compensation -
+
+// The input and output devices run off different clocks, so a fixed offset between
+// their sample times slowly drifts into underruns or overruns. Instead, step through
+// the input's timeline at the ratio of the two devices' rate scalars, and nudge that
+// ratio up or down to hold the amount of buffered input near the target latency.
+// Returns false until there's enough input buffered to start playing.
+static Boolean MyDriftTrackerUpdate(MyDriftTracker *tracker,
+									MyRingBuffer *ringBuffer,
+									Float64 inputRateScalar,
+									const AudioTimeStamp *outputTimeStamp,
+									UInt32 inNumberFrames)
+{
+	MyRingBufferTime startTime, endTime;
+	ringBuffer->GetTimeBounds(startTime, endTime);
+	if (! tracker->running && (endTime - startTime) < tracker->targetLatency)
+		return false;
+	
+	Float64 latency = endTime - tracker->readSampleTime;
+	Float64 maxLatency = ringBuffer->GetCapacityFrames() - 2.0 * inNumberFrames;
+	if (! tracker->running || latency < inNumberFrames + 2 || latency > maxLatency) {
+		// first time through, or we fell out of the buffer: jump back to the target
+		if (tracker->running)
+			tracker->resyncCount++;
+		tracker->readSampleTime = endTime - tracker->targetLatency;
+		tracker->smoothedLatency = tracker->targetLatency;
+		tracker->running = true;
+		latency = tracker->targetLatency;
+	}
+	tracker->smoothedLatency += kDriftLatencySmoothing * (latency - tracker->smoothedLatency);
+	
+	// mRateScalar is actual host ticks per frame over nominal, so the ratio of the
+	// two devices' scalars is how many input frames arrive per output frame
+	Float64 ratio = 1.0;
+	if ((outputTimeStamp->mFlags & kAudioTimeStampRateScalarValid) && inputRateScalar > 0.0)
+		ratio = outputTimeStamp->mRateScalar / inputRateScalar;
+	
+	// then correct for whatever error has built up in the latency
+	Float64 correction = kDriftCorrectionGain *
+		(tracker->smoothedLatency - tracker->targetLatency) / tracker->targetLatency;
+	if (correction > kDriftMaxCorrection) correction = kDriftMaxCorrection;
+	if (correction < -kDriftMaxCorrection) correction = -kDriftMaxCorrection;
+	ratio *= 1.0 + correction;
+	
+	if (ratio > 1.0 + kDriftMaxRateDeviation) ratio = 1.0 + kDriftMaxRateDeviation;
+	if (ratio < 1.0 - kDriftMaxRateDeviation) ratio = 1.0 - kDriftMaxRateDeviation;
+	tracker->rateRatio = ratio;
+	return true;
+}
+
+// Fill ioData by reading the ring buffer from the tracker's read position, stepping
+// rateRatio input frames per output frame with linear interpolation.
+static OSStatus MyResampleFromRingBuffer(MyAUGraphPlayer *player,
+										 AudioBufferList *ioData,
+										 UInt32 inNumberFrames)
+{
+	MyDriftTracker *tracker = &player->drift;
+	Float64 ratio = tracker->rateRatio;
+	
+	// fetch every input frame the interpolation will touch, plus a little slop
+	MyRingBufferTime firstFrame = (MyRingBufferTime) floor(tracker->readSampleTime);
+	MyRingBufferTime lastFrame = (MyRingBufferTime) floor(tracker->readSampleTime + ratio * (inNumberFrames - 1));
+	UInt32 framesNeeded = (UInt32)(lastFrame - firstFrame) + 3;
+	if (framesNeeded > player->resampleBufferFrames)
+		return kMyRingBufferError_TooMuch;
+	
+	OSStatus err = player->ringBuffer->Fetch(player->resampleBuffer, framesNeeded, firstFrame);
+	if (err)
+		return err;
+	
+	Float64 startPosition = tracker->readSampleTime - firstFrame;
+	for (UInt32 b = 0; b < ioData->mNumberBuffers; b++) {
+		UInt32 channels = ioData->mBuffers[b].mNumberChannels;
+		const Float32 *src = (const Float32*) player->resampleBuffer->mBuffers[b].mData;
+		Float32 *dst = (Float32*) ioData->mBuffers[b].mData;
+		for (UInt32 ch = 0; ch < channels; ch++) {
+			for (UInt32 frame = 0; frame < inNumberFrames; frame++) {
+				Float64 position = startPosition + ratio * frame;
+				UInt32 index = (UInt32) position;
+				Float32 fraction = (Float32) (position - index);
+				Float32 s0 = src[index * channels + ch];
+				Float32 s1 = src[(index + 1) * channels + ch];
+				dst[frame * channels + ch] = s0 + (s1 - s0) * fraction;
+			}
+		}
+		ioData->mBuffers[b].mDataByteSize = inNumberFrames * channels * sizeof(Float32);
+	}
+	
+	tracker->readSampleTime += ratio * inNumberFrames;
+	return noErr;
+}
+
 #pragma mark - render proc - 
 OSStatus InputRenderProc(void *inRefCon,
 						 AudioUnitRenderActionFlags *ioActionFlags,
@@ -52,14 +163,9 @@ OSStatus InputRenderProc(void *inRefCon,
 	//	printf ("InputRenderProc!\n");
 	MyAUGraphPlayer *player = (MyAUGraphPlayer*) inRefCon;
 	
-	// have we ever logged input timing? (for offset calculation)
-	if (player->firstInputSampleTime < 0.0) {
-		player->firstInputSampleTime = inTimeStamp->mSampleTime;
-		if ((player->firstOutputSampleTime > 0.0) &&
-			(player->inToOutSampleTimeOffset < 0.0)) {
-			player->inToOutSampleTimeOffset = player->firstInputSampleTime - player->firstOutputSampleTime;
-		}
-	}
+	// keep track of the input device's clock rate, for drift compensation
+	if (inTimeStamp->mFlags & kAudioTimeStampRateScalarValid)
+		player->inputRateScalar = inTimeStamp->mRateScalar;
 	
 	// render into our buffer
 	OSStatus inputProcErr = noErr;
@@ -98,21 +204,22 @@ OSStatus GraphRenderProc(void *inRefCon,
 	
 	MyAUGraphPlayer *player = (MyAUGraphPlayer*) inRefCon;
 	
-	// have we ever logged output timing? (for offset calculation)
-	if (player->firstOutputSampleTime < 0.0) {
-		player->firstOutputSampleTime = inTimeStamp->mSampleTime;
-		if ((player->firstInputSampleTime > 0.0) &&
-			(player->inToOutSampleTimeOffset < 0.0)) {
-			player->inToOutSampleTimeOffset = player->firstInputSampleTime - player->firstOutputSampleTime;
-		}
+	// work out where and how fast to read from the input's timeline
+	if (! MyDriftTrackerUpdate(&player->drift,
+							   player->ringBuffer,
+							   player->inputRateScalar,
+							   inTimeStamp,
+							   inNumberFrames)) {
+		// not enough input yet: play silence
+		for (UInt32 b = 0; b < ioData->mNumberBuffers; b++)
+			memset(ioData->mBuffers[b].mData, 0, ioData->mBuffers[b].mDataByteSize);
+		*ioActionFlags |= kAudioUnitRenderAction_OutputIsSilence;
+		return noErr;
 	}
 	
-	// copy samples out of ring buffer
+	// copy samples out of ring buffer, resampling to follow the input's clock
 	OSStatus outputProcErr = noErr;
-	// new CARingBuffer doesn't take bool 4th arg
-	outputProcErr = player->ringBuffer->Fetch(ioData,
-											  inNumberFrames,
-											  inTimeStamp->mSampleTime + player->inToOutSampleTimeOffset);
+	outputProcErr = MyResampleFromRingBuffer(player, ioData, inNumberFrames);
 	
 	//	printf ("fetched %d frames at time %f\n", inNumberFrames, inTimeStamp->mSampleTime);
 	return outputProcErr;
@@ -296,10 +403,12 @@ void CreateInputUnit (MyAUGraphPlayer *player) {
 	}
 	
 	//Alloc ring buffer that will hold data between the two audio devices
-	player->ringBuffer = new CARingBuffer();	
+	// (the target latency, plus room for a few buffers of jitter either side)
+	player->drift.targetLatency = kDriftTargetLatencyBuffers * bufferSizeFrames;
+	player->ringBuffer = new MyRingBuffer();
 	player->ringBuffer->Allocate(player->streamFormat.mChannelsPerFrame,
 								 player->streamFormat.mBytesPerFrame,
-								 bufferSizeFrames * 3);
+								 bufferSizeFrames * (kDriftTargetLatencyBuffers + 3));
 	
 	// set render proc to supply samples from input unit
 	AURenderCallbackStruct callbackStruct;
@@ -317,9 +426,6 @@ void CreateInputUnit (MyAUGraphPlayer *player) {
 	CheckError(AudioUnitInitialize(player->inputUnit),
 			   "Couldn't initialize input unit");
 	
-	player->firstInputSampleTime = -1;
-	player->inToOutSampleTimeOffset = -1;
-	
 	printf ("Bottom of CreateInputUnit()\n");
 }
 
@@ -478,7 +584,37 @@ void CreateMyAUGraph(MyAUGraphPlayer *player)
 	CheckError(AUGraphInitialize(player->graph),
 			   "AUGraphInitialize failed");
 	
-	player->firstOutputSampleTime = -1;
+	// the resampler reads slightly more or fewer input frames than the output
+	// asks for, so give it room for the largest slice plus the maximum rate change
+	UInt32 maxFramesPerSlice = 0;
+	UInt32 propSize = sizeof(maxFramesPerSlice);
+	CheckError(AudioUnitGetProperty(player->outputUnit,
+									kAudioUnitProperty_MaximumFramesPerSlice,
+									kAudioUnitScope_Global,
+									0,
+									&maxFramesPerSlice,
+									&propSize),
+			   "Couldn't get maximum frames per slice from output unit");
+	player->resampleBufferFrames = (UInt32)(maxFramesPerSlice * (1.0 + kDriftMaxRateDeviation)) + 4;
+	
+	UInt32 resampleBufferCount = player->inputBuffer->mNumberBuffers;
+	player->resampleBuffer = (AudioBufferList *)malloc(offsetof(AudioBufferList, mBuffers[0]) +
+													   (sizeof(AudioBuffer) * resampleBufferCount));
+	player->resampleBuffer->mNumberBuffers = resampleBufferCount;
+	for (UInt32 i = 0; i < resampleBufferCount; i++) {
+		UInt32 channels = player->inputBuffer->mBuffers[i].mNumberChannels;
+		player->resampleBuffer->mBuffers[i].mNumberChannels = channels;
+		player->resampleBuffer->mBuffers[i].mDataByteSize = player->resampleBufferFrames * channels * sizeof(Float32);
+		player->resampleBuffer->mBuffers[i].mData = malloc(player->resampleBuffer->mBuffers[i].mDataByteSize);
+	}
+	
+	// the ring was sized before we knew the slice size. it has to hold the target
+	// latency and still have room for two fetches of the resampler's largest span
+	UInt32 ringFrames = (UInt32)player->drift.targetLatency + 2 * player->resampleBufferFrames;
+	if (player->ringBuffer->GetCapacityFrames() < ringFrames)
+		player->ringBuffer->Allocate(player->streamFormat.mChannelsPerFrame,
+									 player->streamFormat.mBytesPerFrame,
+									 ringFrames);
 	
 	printf ("Bottom of CreateSimpleAUGraph()\n");
 }
@@ -526,8 +662,22 @@ int main (int argc, const char * argv[]) {
 	
 cleanup:
 	AUGraphStop (player.graph);
+	AudioOutputUnitStop(player.inputUnit);
 	AUGraphUninitialize (player.graph);
 	AUGraphClose(player.graph);
 	
+	printf ("ring buffer: %u underruns, %u overruns\n",
+			(unsigned int)player.ringBuffer->GetUnderrunCount(),
+			(unsigned int)player.ringBuffer->GetOverrunCount());
+	printf ("drift: rate ratio %f, latency %.1f frames (target %.0f), %u resyncs\n",
+			player.drift.rateRatio,
+			player.drift.smoothedLatency,
+			player.drift.targetLatency,
+			(unsigned int)player.drift.resyncCount);
+	delete player.ringBuffer;
+	for (UInt32 i = 0; i < player.resampleBuffer->mNumberBuffers; i++)
+		free(player.resampleBuffer->mBuffers[i].mData);
+	free(player.resampleBuffer);
+	
 	
 }
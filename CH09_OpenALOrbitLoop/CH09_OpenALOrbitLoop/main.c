@@ -1,23 +1,71 @@
 #import <AudioToolbox/AudioToolbox.h>
 #import <OpenAL/al.h>
 #import <OpenAL/alc.h>
+#import <sys/stat.h>
+#import <sys/mman.h>
+#import <fcntl.h>
+#import <unistd.h>
+#import "../../Common/MyOrbitEngine.h"
+#import "../../Common/MySpatialMixer.h"
 
 // #define LOOP_PATH CFSTR("/Library/Audio/Apple Loops/Apple/iLife Sound Effects/Stingers/Cartoon Boing Boing.caf")
 #define LOOP_PATH CFSTR ("/Library/Audio/Apple Loops/Apple/iLife Sound Effects/Transportation/Bicycle Coasting.caf")
 
 #define ORBIT_SPEED 1
 #define RUN_TIME 20.0
+#define CONTROL_RATE 10.0 // source position updates per second
+#define SOURCE_COUNT 1 // sources orbiting the listener, all playing the same loop
+#define MAX_CACHED_LOOPS 8
+#define USE_DISK_CACHE 1 // save decoded loops in LOOP_CACHE_DIRECTORY and map them from there next time
+#define LOOP_CACHE_DIRECTORY "/tmp/CH09_OpenALOrbitLoop"
+#define LOOP_CACHE_MAGIC 'Loop'
+#define LOOP_CACHE_VERSION 1
 
 #pragma mark user-data struct
+// one decoded loop, shared by every source that plays it
+typedef struct MyLoopCacheEntry {
+	UInt64						key; // hash of the file's path, modification time, size and the client format
+	ALuint						alBuffer;
+	UInt32						bufferSizeBytes;
+	UInt32						useCount;
+} MyLoopCacheEntry;
+
+typedef struct MyLoopCache {
+	MyLoopCacheEntry			entries[MAX_CACHED_LOOPS];
+	UInt32						entryCount;
+	UInt32						decodeCount; // loops decoded with ExtAudioFile
+	UInt32						diskHitCount; // loops mapped from LOOP_CACHE_DIRECTORY
+	UInt32						memoryHitCount; // loops that were already in an AL buffer
+} MyLoopCache;
+
+// start of each file in LOOP_CACHE_DIRECTORY. the samples follow it
+typedef struct MyLoopCacheFileHeader {
+	UInt32						magic;
+	UInt32						version;
+	UInt64						key;
+	AudioStreamBasicDescription	format;
+	UInt32						dataByteSize;
+} MyLoopCacheFileHeader;
+
 typedef struct MyLoopPlayer {
 	AudioStreamBasicDescription	dataFormat;
-	UInt16						*sampleBuffer;
 	UInt32						bufferSizeBytes;
-	ALuint						sources[1];
+	ALuint						sources[SOURCE_COUNT];
+	ALuint						loopBuffer;
+	MyLoopCache					loopCache;
+	
+	// source positions
+	MyOrbitEngine				orbits;
+	UInt32						updateCount;
+	Float64						totalUpdateTime; // seconds
+	Float64						maxUpdateTime;
 } MyLoopPlayer;
 
-void updateSourceLocation (MyLoopPlayer player);
+void setUpOrbits (MyLoopPlayer* player);
+void updateSourceLocation (MyLoopPlayer* player, Float32 deltaSeconds);
 OSStatus loadLoopIntoBuffer(MyLoopPlayer* player);
+ALuint acquireLoopBuffer (MyLoopCache* cache, CFStringRef path, const AudioStreamBasicDescription* format, UInt32* outBufferSizeBytes);
+void releaseLoopCache (MyLoopCache* cache);
 
 #pragma mark - utility functions -
 // generic error handler - if err is nonzero, prints error message and exits program.
@@ -56,33 +104,120 @@ static void CheckALError (const char *operation) {
 	
 }
 
-void updateSourceLocation (MyLoopPlayer player) {
-	double theta = fmod (CFAbsoluteTimeGetCurrent() * ORBIT_SPEED, M_PI * 2);
-	// printf ("%f\n", theta);
-	ALfloat x = 3 * cos (theta);
-	ALfloat y = 0.5 * sin (theta);
-	ALfloat z = 1.0 * sin (theta);
-	printf ("x=%f, y=%f, z=%f\n", x, y, z);
-	alSource3f(player.sources[0], AL_POSITION, x, y, z);
+// one orbit per source, spread evenly around the listener
+void setUpOrbits (MyLoopPlayer* player) {
+	MyOrbitEngineInit(&player->orbits, SOURCE_COUNT);
+	for (int i=0; i<SOURCE_COUNT; i++) {
+		MyOrbitEngineAddSource(&player->orbits, M_PI * 2 * i / SOURCE_COUNT, ORBIT_SPEED, 3.0, 0.5, 1.0);
+	}
 }
 
-OSStatus loadLoopIntoBuffer(MyLoopPlayer* player) {
-	CFURLRef loopFileURL = CFURLCreateWithFileSystemPath(kCFAllocatorDefault, 
-														 LOOP_PATH,
-														 kCFURLPOSIXPathStyle,
-														 false);
+// move every source along its orbit, then hand all the new positions to AL in one pass
+void updateSourceLocation (MyLoopPlayer* player, Float32 deltaSeconds) {
+	CFAbsoluteTime updateStart = CFAbsoluteTimeGetCurrent();
+	MyOrbitEngineTick(&player->orbits, deltaSeconds);
+	for (UInt32 i=0; i<player->orbits.sourceCount; i++) {
+		alSource3f(player->sources[i], AL_POSITION, player->orbits.x[i], player->orbits.y[i], player->orbits.z[i]);
+	}
+	Float64 updateTime = CFAbsoluteTimeGetCurrent() - updateStart;
+	player->totalUpdateTime += updateTime;
+	if (updateTime > player->maxUpdateTime)
+		player->maxUpdateTime = updateTime;
+	player->updateCount++;
+}
+
+#pragma mark - decoded loop cache -
+
+// FNV-1a
+static UInt64 hashBytes (UInt64 hash, const void* bytes, size_t length) {
+	const UInt8* p = (const UInt8*) bytes;
+	for (size_t i=0; i<length; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+// the key changes whenever the file is edited or replaced, or we ask for a different format
+static UInt64 loopCacheKey (const char* path, const struct stat* fileInfo, const AudioStreamBasicDescription* format) {
+	UInt64 hash = 0xcbf29ce484222325ULL;
+	hash = hashBytes(hash, path, strlen(path));
+	SInt64 modTime = fileInfo->st_mtime;
+	SInt64 size = fileInfo->st_size;
+	hash = hashBytes(hash, &modTime, sizeof(modTime));
+	hash = hashBytes(hash, &size, sizeof(size));
+	hash = hashBytes(hash, format, sizeof(*format));
+	return hash;
+}
+
+static void loopCacheFilePath (UInt64 key, char* outPath, size_t outPathSize) {
+	snprintf (outPath, outPathSize, "%s/%016llx.pcm", LOOP_CACHE_DIRECTORY, (unsigned long long) key);
+}
+
+// map a previously decoded loop straight into alBuffer. returns false if it isn't
+// on disk, or the file there doesn't match
+static Boolean loadLoopFromDiskCache (UInt64 key, const AudioStreamBasicDescription* format, ALuint alBuffer, UInt32* outBufferSizeBytes) {
+	if (!USE_DISK_CACHE) return false;
+	char cachePath[PATH_MAX];
+	loopCacheFilePath(key, cachePath, sizeof(cachePath));
+	int fd = open (cachePath, O_RDONLY);
+	if (fd < 0) return false;
+	
+	struct stat cacheInfo;
+	Boolean loaded = false;
+	if (fstat (fd, &cacheInfo) == 0 && cacheInfo.st_size >= (off_t) sizeof(MyLoopCacheFileHeader)) {
+		void* mapped = mmap (NULL, cacheInfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped != MAP_FAILED) {
+			const MyLoopCacheFileHeader* header = (const MyLoopCacheFileHeader*) mapped;
+			if (header->magic == LOOP_CACHE_MAGIC &&
+				header->version == LOOP_CACHE_VERSION &&
+				header->key == key &&
+				memcmp (&header->format, format, sizeof(*format)) == 0 &&
+				(off_t) (sizeof(MyLoopCacheFileHeader) + header->dataByteSize) == cacheInfo.st_size) {
+				alBufferData(alBuffer,
+							 AL_FORMAT_MONO16,
+							 header + 1,
+							 header->dataByteSize,
+							 format->mSampleRate);
+				*outBufferSizeBytes = header->dataByteSize;
+				loaded = true;
+			}
+			munmap (mapped, cacheInfo.st_size);
+		}
+	}
+	close (fd);
+	return loaded;
+}
+
+// write to a temporary file and rename it into place, so a reader never sees half a file
+static void saveLoopToDiskCache (UInt64 key, const AudioStreamBasicDescription* format, const void* samples, UInt32 bufferSizeBytes) {
+	if (!USE_DISK_CACHE) return;
+	mkdir (LOOP_CACHE_DIRECTORY, 0755);
+	char cachePath[PATH_MAX];
+	char tempPath[PATH_MAX];
+	loopCacheFilePath(key, cachePath, sizeof(cachePath));
+	snprintf (tempPath, sizeof(tempPath), "%s.%d", cachePath, (int) getpid());
 	
-	// describe the client format - AL needs mono
-	memset(&player->dataFormat, 0, sizeof(player->dataFormat));
-	player->dataFormat.mFormatID = kAudioFormatLinearPCM;
-	player->dataFormat.mFormatFlags = kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked;
-	player->dataFormat.mSampleRate = 44100.0;
-	player->dataFormat.mChannelsPerFrame = 1;
-	player->dataFormat.mFramesPerPacket = 1;
-	player->dataFormat.mBitsPerChannel = 16;
-	player->dataFormat.mBytesPerFrame = 2;
-	player->dataFormat.mBytesPerPacket = 2;
+	MyLoopCacheFileHeader header;
+	memset (&header, 0, sizeof(header));
+	header.magic = LOOP_CACHE_MAGIC;
+	header.version = LOOP_CACHE_VERSION;
+	header.key = key;
+	header.format = *format;
+	header.dataByteSize = bufferSizeBytes;
 	
+	FILE* cacheFile = fopen (tempPath, "wb");
+	if (cacheFile == NULL) return;
+	Boolean written = fwrite (&header, sizeof(header), 1, cacheFile) == 1 &&
+		fwrite (samples, 1, bufferSizeBytes, cacheFile) == bufferSizeBytes;
+	if (fclose (cacheFile) == 0 && written)
+		rename (tempPath, cachePath);
+	else
+		unlink (tempPath);
+}
+
+// decode the whole file into memory in the given format. the caller frees the samples
+static UInt16* decodeLoop (CFURLRef loopFileURL, const AudioStreamBasicDescription* format, UInt32* outBufferSizeBytes) {
 	ExtAudioFileRef extAudioFile;
 	CheckError (ExtAudioFileOpenURL(loopFileURL, &extAudioFile),
 				"Couldn't open ExtAudioFile for reading");
@@ -91,7 +226,7 @@ OSStatus loadLoopIntoBuffer(MyLoopPlayer* player) {
 	CheckError(ExtAudioFileSetProperty(extAudioFile,
 									   kExtAudioFileProperty_ClientDataFormat,
 									   sizeof (AudioStreamBasicDescription),
-									   &player->dataFormat),
+									   format),
 			   "Couldn't set client format on ExtAudioFile");
 	
 	// figure out how big a buffer we need
@@ -103,82 +238,279 @@ OSStatus loadLoopIntoBuffer(MyLoopPlayer* player) {
 							&fileLengthFrames);
 	
 	printf ("plan on reading %lld frames\n", fileLengthFrames);
-	player->bufferSizeBytes = fileLengthFrames * player->dataFormat.mBytesPerFrame;
+	UInt32 bufferSizeBytes = fileLengthFrames * format->mBytesPerFrame;
 	
 	AudioBufferList *buffers;
 	UInt32 ablSize = offsetof(AudioBufferList, mBuffers[0]) + (sizeof(AudioBuffer) * 1); // 1 channel
 	buffers = malloc (ablSize);
 	
 	// allocate sample buffer
-	player->sampleBuffer =  malloc(sizeof(UInt16) * player->bufferSizeBytes); // 4/18/11 - fix 1
+	UInt16* sampleBuffer = malloc(bufferSizeBytes);
 	
 	buffers->mNumberBuffers = 1;
 	buffers->mBuffers[0].mNumberChannels = 1;
-	buffers->mBuffers[0].mDataByteSize = player->bufferSizeBytes;
-	buffers->mBuffers[0].mData = player->sampleBuffer;
-	
-	printf ("created AudioBufferList\n");
 	
 	// loop reading into the ABL until buffer is full
 	UInt32 totalFramesRead = 0;
 	do {
 		UInt32 framesRead = fileLengthFrames - totalFramesRead;
-		buffers->mBuffers[0].mData = player->sampleBuffer + (totalFramesRead * (sizeof(UInt16)));
+		buffers->mBuffers[0].mData = sampleBuffer + totalFramesRead;
+		buffers->mBuffers[0].mDataByteSize = framesRead * format->mBytesPerFrame;
 		CheckError(ExtAudioFileRead(extAudioFile, 
 									&framesRead,
 									buffers),
 				   "ExtAudioFileRead failed");
+		if (framesRead == 0)
+			break; // file was shorter than it said
 		totalFramesRead += framesRead;
-		printf ("read %d frames\n", framesRead);
 	} while (totalFramesRead < fileLengthFrames);
+	printf ("read %d frames\n", totalFramesRead);
 	
 	// can free the ABL; still have samples in sampleBuffer
 	free(buffers);
+	ExtAudioFileDispose(extAudioFile);
+	*outBufferSizeBytes = totalFramesRead * format->mBytesPerFrame;
+	return sampleBuffer;
+}
+
+// get an AL buffer holding the loop at path in the given format. the first request decodes
+// the file (or maps an earlier decode from disk); later ones share the same AL buffer
+ALuint acquireLoopBuffer (MyLoopCache* cache, CFStringRef path, const AudioStreamBasicDescription* format, UInt32* outBufferSizeBytes) {
+	char filePath[PATH_MAX];
+	if (!CFStringGetFileSystemRepresentation(path, filePath, sizeof(filePath))) {
+		fprintf (stderr, "Error: loop path too long\n");
+		exit(1);
+	}
+	struct stat fileInfo;
+	if (stat (filePath, &fileInfo) != 0) {
+		fprintf (stderr, "Error: couldn't find loop file %s\n", filePath);
+		exit(1);
+	}
+	UInt64 key = loopCacheKey(filePath, &fileInfo, format);
+	
+	for (UInt32 i=0; i<cache->entryCount; i++) {
+		if (cache->entries[i].key == key) {
+			cache->entries[i].useCount++;
+			cache->memoryHitCount++;
+			*outBufferSizeBytes = cache->entries[i].bufferSizeBytes;
+			return cache->entries[i].alBuffer;
+		}
+	}
+	if (cache->entryCount == MAX_CACHED_LOOPS) {
+		fprintf (stderr, "Error: more than %d different loops\n", MAX_CACHED_LOOPS);
+		exit(1);
+	}
+	
+	MyLoopCacheEntry* entry = &cache->entries[cache->entryCount];
+	entry->key = key;
+	entry->useCount = 1;
+	alGenBuffers(1, &entry->alBuffer);
+	CheckALError ("Couldn't generate buffers");
+	
+	if (loadLoopFromDiskCache(key, format, entry->alBuffer, &entry->bufferSizeBytes)) {
+		cache->diskHitCount++;
+	} else {
+		CFURLRef loopFileURL = CFURLCreateWithFileSystemPath(kCFAllocatorDefault, 
+															 path,
+															 kCFURLPOSIXPathStyle,
+															 false);
+		UInt16* sampleBuffer = decodeLoop(loopFileURL, format, &entry->bufferSizeBytes);
+		CFRelease(loopFileURL);
+		alBufferData(entry->alBuffer,
+					 AL_FORMAT_MONO16,
+					 sampleBuffer,
+					 entry->bufferSizeBytes,
+					 format->mSampleRate);
+		saveLoopToDiskCache(key, format, sampleBuffer, entry->bufferSizeBytes);
+		
+		// AL copies the samples, so we can free them now
+		free (sampleBuffer);
+		cache->decodeCount++;
+	}
+	CheckALError ("Couldn't fill loop buffer");
+	cache->entryCount++;
+	*outBufferSizeBytes = entry->bufferSizeBytes;
+	return entry->alBuffer;
+}
+
+// call after the sources using the buffers have been deleted
+void releaseLoopCache (MyLoopCache* cache) {
+	printf ("loop cache: %d decoded, %d from disk, %d shared\n",
+			cache->decodeCount, cache->diskHitCount, cache->memoryHitCount);
+	for (UInt32 i=0; i<cache->entryCount; i++) {
+		alDeleteBuffers(1, &cache->entries[i].alBuffer);
+	}
+	cache->entryCount = 0;
+}
+
+#pragma mark - loop player -
+
+// describe the client format - AL needs mono
+static void describeClientFormat (AudioStreamBasicDescription* format) {
+	memset(format, 0, sizeof(*format));
+	format->mFormatID = kAudioFormatLinearPCM;
+	format->mFormatFlags = kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked;
+	format->mSampleRate = 44100.0;
+	format->mChannelsPerFrame = 1;
+	format->mFramesPerPacket = 1;
+	format->mBitsPerChannel = 16;
+	format->mBytesPerFrame = 2;
+	format->mBytesPerPacket = 2;
+}
+
+// get an AL buffer for the loop from the cache. needs a current AL context
+OSStatus loadLoopIntoBuffer(MyLoopPlayer* player) {
+	describeClientFormat(&player->dataFormat);
+	
+	CFAbsoluteTime loadStart = CFAbsoluteTimeGetCurrent();
+	player->loopBuffer = acquireLoopBuffer(&player->loopCache, LOOP_PATH, &player->dataFormat, &player->bufferSizeBytes);
+	printf ("loaded %d byte loop in %.2f ms\n",
+			player->bufferSizeBytes, (CFAbsoluteTimeGetCurrent() - loadStart) * 1000.0);
 	return noErr;
 }
 
+#pragma mark - offline render -
+
+// play the same scene through MySpatialMixer instead of OpenAL, and write RUN_TIME
+// seconds of it to a stereo file as fast as the mixer can go
+static void renderLoopToFile (const char* outputPath) {
+	MyLoopPlayer player = {0};
+	describeClientFormat(&player.dataFormat);
+	CFURLRef loopFileURL = CFURLCreateWithFileSystemPath(kCFAllocatorDefault, 
+														 LOOP_PATH,
+														 kCFURLPOSIXPathStyle,
+														 false);
+	UInt16* sampleBuffer = decodeLoop(loopFileURL, &player.dataFormat, &player.bufferSizeBytes);
+	CFRelease(loopFileURL);
+	
+	// same sources as the AL version: looping, full gain, sharing one buffer
+	setUpOrbits(&player);
+	MySpatialMixer mixer;
+	MySpatialMixerInit(&mixer, SOURCE_COUNT);
+	for (int i=0; i<SOURCE_COUNT; i++) {
+		mixer.sources[i].samples = (const SInt16*) sampleBuffer;
+		mixer.sources[i].frameCount = player.bufferSizeBytes / player.dataFormat.mBytesPerFrame;
+		mixer.sources[i].looping = true;
+		mixer.sources[i].playing = true;
+		mixer.sources[i].gain = AL_MAX_GAIN;
+	}
+	
+	// mix in interleaved stereo float, and let ExtAudioFile convert to 16-bit for the file
+	AudioStreamBasicDescription mixFormat;
+	memset(&mixFormat, 0, sizeof(mixFormat));
+	mixFormat.mFormatID = kAudioFormatLinearPCM;
+	mixFormat.mFormatFlags = kAudioFormatFlagIsFloat | kAudioFormatFlagIsPacked;
+	mixFormat.mSampleRate = player.dataFormat.mSampleRate;
+	mixFormat.mChannelsPerFrame = 2;
+	mixFormat.mFramesPerPacket = 1;
+	mixFormat.mBitsPerChannel = 32;
+	mixFormat.mBytesPerFrame = 8;
+	mixFormat.mBytesPerPacket = 8;
+	AudioStreamBasicDescription fileFormat = mixFormat;
+	fileFormat.mFormatFlags = kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked;
+	fileFormat.mBitsPerChannel = 16;
+	fileFormat.mBytesPerFrame = 4;
+	fileFormat.mBytesPerPacket = 4;
+	
+	CFURLRef outputURL = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault,
+																 (const UInt8*) outputPath,
+																 strlen(outputPath),
+																 false);
+	ExtAudioFileRef outputFile;
+	CheckError(ExtAudioFileCreateWithURL(outputURL, kAudioFileCAFType, &fileFormat, NULL,
+										 kAudioFileFlags_EraseFile, &outputFile),
+			   "Couldn't create output file");
+	CFRelease(outputURL);
+	CheckError(ExtAudioFileSetProperty(outputFile,
+									   kExtAudioFileProperty_ClientDataFormat,
+									   sizeof (AudioStreamBasicDescription),
+									   &mixFormat),
+			   "Couldn't set client format on output file");
+	
+	// one mix per position update, just like the AL run loop
+	UInt32 framesPerUpdate = mixFormat.mSampleRate / CONTROL_RATE;
+	Float32* mixBuffer = malloc (framesPerUpdate * mixFormat.mBytesPerFrame);
+	AudioBufferList outputBufferList;
+	outputBufferList.mNumberBuffers = 1;
+	outputBufferList.mBuffers[0].mNumberChannels = 2;
+	outputBufferList.mBuffers[0].mData = mixBuffer;
+	
+	UInt32 updateCount = RUN_TIME * CONTROL_RATE;
+	Float64 mixTime = 0;
+	CFAbsoluteTime renderStart = CFAbsoluteTimeGetCurrent();
+	for (UInt32 update=0; update<updateCount; update++) {
+		MyOrbitEngineTick(&player.orbits, update == 0 ? 0 : 1.0 / CONTROL_RATE);
+		for (int i=0; i<SOURCE_COUNT; i++) {
+			mixer.sources[i].x = player.orbits.x[i];
+			mixer.sources[i].y = player.orbits.y[i];
+			mixer.sources[i].z = player.orbits.z[i];
+		}
+		
+		CFAbsoluteTime mixStart = CFAbsoluteTimeGetCurrent();
+		MySpatialMixerRender(&mixer, mixBuffer, framesPerUpdate);
+		mixTime += CFAbsoluteTimeGetCurrent() - mixStart;
+		
+		outputBufferList.mBuffers[0].mDataByteSize = framesPerUpdate * mixFormat.mBytesPerFrame;
+		CheckError(ExtAudioFileWrite(outputFile, framesPerUpdate, &outputBufferList),
+				   "Couldn't write to output file");
+	}
+	CheckError(ExtAudioFileDispose(outputFile), "Couldn't close output file");
+	Float64 renderTime = CFAbsoluteTimeGetCurrent() - renderStart;
+	
+	Float64 renderedSeconds = (Float64) updateCount * framesPerUpdate / mixFormat.mSampleRate;
+	printf ("rendered %.1f seconds of %d sources to %s in %.3f seconds (%.0fx realtime)\n",
+			renderedSeconds, SOURCE_COUNT, outputPath, renderTime, renderedSeconds / renderTime);
+	printf ("mixing took %.3f ms per source per second of audio\n",
+			mixTime * 1000.0 / SOURCE_COUNT / renderedSeconds);
+	
+	free (mixBuffer);
+	MySpatialMixerDispose(&mixer);
+	MyOrbitEngineDispose(&player.orbits);
+	free (sampleBuffer);
+}
+
 #pragma mark main
 
+// with an output file argument, renders the scene to that file instead of playing it
 int main (int argc, const char * argv[]) {
-	MyLoopPlayer player;
+	if (argc > 1) {
+		renderLoopToFile(argv[1]);
+		return 0;
+	}
 	
-	// convert to an OpenAL-friendly format and read into memory
-	CheckError(loadLoopIntoBuffer(&player),
-			   "Couldn't load loop into buffer") ;
+	MyLoopPlayer player = {0};
 	
-	// set up OpenAL buffer
+	// set up OpenAL
 	ALCdevice* alDevice = alcOpenDevice(NULL);
 	CheckALError ("Couldn't open AL device"); // default device
 	ALCcontext* alContext = alcCreateContext(alDevice, 0);
 	CheckALError ("Couldn't open AL context");
 	alcMakeContextCurrent (alContext);
 	CheckALError ("Couldn't make AL context current");
-	ALuint buffers[1];
-	alGenBuffers(1, buffers);
-	CheckALError ("Couldn't generate buffers");
-	alBufferData(*buffers,
-				 AL_FORMAT_MONO16,
-				 player.sampleBuffer,
-				 player.bufferSizeBytes,
-				 player.dataFormat.mSampleRate);
 	
-	// AL copies the samples, so we can free them now
-	free(player.sampleBuffer);
+	// convert to an OpenAL-friendly format and load into an AL buffer
+	CheckError(loadLoopIntoBuffer(&player),
+			   "Couldn't load loop into buffer") ;
 	
-	// set up OpenAL source
-	alGenSources(1, player.sources);
+	// set up OpenAL sources
+	alGenSources(SOURCE_COUNT, player.sources);
 	CheckALError ("Couldn't generate sources");
-	alSourcei(player.sources[0], AL_LOOPING, AL_TRUE);
-	CheckALError ("Couldn't set source looping property");
-	alSourcef(player.sources[0], AL_GAIN, AL_MAX_GAIN);
-	CheckALError("Couldn't set source gain");
-	updateSourceLocation(player);
+	for (int i=0; i<SOURCE_COUNT; i++) {
+		alSourcei(player.sources[i], AL_LOOPING, AL_TRUE);
+		CheckALError ("Couldn't set source looping property");
+		alSourcef(player.sources[i], AL_GAIN, AL_MAX_GAIN);
+		CheckALError("Couldn't set source gain");
+		
+		// connect buffer to source. every source after the first shares the first one's buffer
+		UInt32 bufferSizeBytes;
+		ALuint loopBuffer = i == 0 ? player.loopBuffer : acquireLoopBuffer(&player.loopCache, LOOP_PATH, &player.dataFormat, &bufferSizeBytes);
+		alSourcei(player.sources[i], AL_BUFFER, loopBuffer);
+		CheckALError ("Couldn't connect buffer to source");
+	}
+	setUpOrbits(&player);
+	updateSourceLocation(&player, 0);
 	CheckALError ("Couldn't set initial source position");
 	
-	// connect buffer to source
-	alSourcei(player.sources[0], AL_BUFFER, buffers[0]);
-	CheckALError ("Couldn't connect buffer to source");
-	
 	// set up listener
 	alListener3f (AL_POSITION, 0.0, 0.0, 0.0);
 	CheckALError("Couldn't set listner position");
@@ -190,25 +522,32 @@ int main (int argc, const char * argv[]) {
 	//	alListenerfv (AL_ORIENTATION, listenerOrientation);
 	
 	// start playing
-	// alSourcePlayv (1, player.sources);
-	alSourcePlay(player.sources[0]);
+	alSourcePlayv (SOURCE_COUNT, player.sources);
 	CheckALError ("Couldn't play");
 	
 	// and wait
 	printf("Playing...\n");
 	time_t startTime = time(NULL);
+	CFAbsoluteTime lastUpdateTime = CFAbsoluteTimeGetCurrent();
 	do
 	{
-		// get next theta
-		updateSourceLocation(player);
+		// move sources by however long it's been since the last update
+		CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+		updateSourceLocation(&player, now - lastUpdateTime);
+		lastUpdateTime = now;
 		CheckALError ("Couldn't set looping source position");
-		CFRunLoopRunInMode(kCFRunLoopDefaultMode, 0.1, false);
+		CFRunLoopRunInMode(kCFRunLoopDefaultMode, 1.0 / CONTROL_RATE, false);
 	} while (difftime(time(NULL), startTime) < RUN_TIME);
 	
 	// cleanup:
-	alSourceStop(player.sources[0]);
-	alDeleteSources(1, player.sources);
-	alDeleteBuffers(1, buffers);
+	alSourceStopv(SOURCE_COUNT, player.sources);
+	alDeleteSources(SOURCE_COUNT, player.sources);
+	releaseLoopCache(&player.loopCache);
+	printf ("%d position updates of %d sources, average %.3f ms, longest %.3f ms\n",
+			player.updateCount, player.orbits.sourceCount,
+			player.updateCount ? player.totalUpdateTime * 1000.0 / player.updateCount : 0.0,
+			player.maxUpdateTime * 1000.0);
+	MyOrbitEngineDispose(&player.orbits);
 	alcDestroyContext(alContext);
 	alcCloseDevice(alDevice);
 	printf ("Bottom of main\n");
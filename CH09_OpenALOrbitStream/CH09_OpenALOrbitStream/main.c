@@ -1,6 +1,8 @@
 #import <AudioToolbox/AudioToolbox.h>
 #import <OpenAL/al.h>
 #import <OpenAL/alc.h>
+#import <pthread.h>
+#import "../../Common/MyOrbitEngine.h"
 
 #define STREAM_PATH CFSTR ("/Library/Audio/Apple Loops/Apple/iLife Sound Effects/Jingles/Kickflip Long.caf")
 //#define STREAM_PATH CFSTR ("/Volumes/Sephiroth/Tunes/Yes/Highlights - The Very Best Of Yes/Long Distance Runaround.m4a")
@@ -9,6 +11,13 @@
 #define BUFFER_DURATION_SECONDS	1.0
 #define BUFFER_COUNT 3
 #define RUN_TIME 20.0
+#define CONTROL_RATE 10.0 // source position updates per second
+#define DECODE_BLOCK_COUNT BUFFER_COUNT // decoded blocks kept ready ahead of the AL queue
+
+// one AL buffer's worth of decoded samples
+typedef struct MyDecodeBlock {
+	UInt16						*samples;
+} MyDecodeBlock;
 
 typedef struct MyStreamPlayer {
 	AudioStreamBasicDescription	dataFormat;
@@ -18,10 +27,37 @@ typedef struct MyStreamPlayer {
 	ALuint						sources[1];
 	// ALuint						buffers[BUFFER_COUNT]; // might need this back for static buffers in ch12/13?
 	ExtAudioFileRef				extAudioFile;
+	
+	// the decode thread fills blocks from the file ahead of time; the main loop
+	// hands them to AL buffers as they're played. the block ring is guarded by
+	// decodeMutex, except that a ready block's samples belong to the main loop
+	// and a free block's to the decode thread
+	MyDecodeBlock				blocks[DECODE_BLOCK_COUNT];
+	UInt32						firstReadyBlock;
+	UInt32						readyBlockCount;
+	AudioBufferList				*decodeBufferList; // decode thread only
+	Boolean						decodeShouldExit;
+	pthread_mutex_t				decodeMutex;
+	pthread_cond_t				decodeCond; // signalled when a block is filled or freed
+	pthread_t					decodeThread;
+	
+	// statistics (main loop only)
+	UInt32						refillCount; // AL buffers refilled from a ready block
+	UInt32						refillMisses; // times a played buffer had to wait for the decode thread
+	Float64						maxRefillTime; // seconds
+	
+	// source positions
+	MyOrbitEngine				orbits;
+	UInt32						updateCount;
+	Float64						totalUpdateTime; // seconds
+	Float64						maxUpdateTime;
 } MyStreamPlayer;
 
-void updateSourceLocation (MyStreamPlayer player);
+void setUpOrbits (MyStreamPlayer* player);
+void updateSourceLocation (MyStreamPlayer* player, Float32 deltaSeconds);
 OSStatus setUpExtAudioFile (MyStreamPlayer* player);
+void startDecodeThread (MyStreamPlayer* player);
+void stopDecodeThread (MyStreamPlayer* player);
 void refillALBuffers (MyStreamPlayer* player);
 void fillALBuffer (MyStreamPlayer* player, ALuint alBuffer);
 
@@ -63,14 +99,24 @@ static void CheckALError (const char *operation) {
 	
 }
 
-void updateSourceLocation (MyStreamPlayer player) {
-	double theta = fmod (CFAbsoluteTimeGetCurrent() * ORBIT_SPEED, M_PI * 2);
-	// printf ("%f\n", theta);
-	ALfloat x = 3 * cos (theta);
-	ALfloat y = 0.5 * sin (theta);
-	ALfloat z = 1.0 * sin (theta);
-	printf ("x=%f, y=%f, z=%f\n", x, y, z);
-	alSource3f(player.sources[0], AL_POSITION, x, y, z);
+// the streaming source's orbit around the listener
+void setUpOrbits (MyStreamPlayer* player) {
+	MyOrbitEngineInit(&player->orbits, 1);
+	MyOrbitEngineAddSource(&player->orbits, 0, ORBIT_SPEED, 3.0, 0.5, 1.0);
+}
+
+// move every source along its orbit, then hand all the new positions to AL in one pass
+void updateSourceLocation (MyStreamPlayer* player, Float32 deltaSeconds) {
+	CFAbsoluteTime updateStart = CFAbsoluteTimeGetCurrent();
+	MyOrbitEngineTick(&player->orbits, deltaSeconds);
+	for (UInt32 i=0; i<player->orbits.sourceCount; i++) {
+		alSource3f(player->sources[i], AL_POSITION, player->orbits.x[i], player->orbits.y[i], player->orbits.z[i]);
+	}
+	Float64 updateTime = CFAbsoluteTimeGetCurrent() - updateStart;
+	player->totalUpdateTime += updateTime;
+	if (updateTime > player->maxUpdateTime)
+		player->maxUpdateTime = updateTime;
+	player->updateCount++;
 }
 
 
@@ -120,45 +166,129 @@ OSStatus setUpExtAudioFile (MyStreamPlayer* player) {
 	return noErr;
 }
 
-void fillALBuffer (MyStreamPlayer* player, ALuint alBuffer) {
-	AudioBufferList *bufferList;
-	UInt32 ablSize = offsetof(AudioBufferList, mBuffers[0]) + (sizeof(AudioBuffer) * 1); // 1 channel
-	bufferList = malloc (ablSize);
-	
-	// allocate sample buffer
-	UInt16 *sampleBuffer = malloc(sizeof(UInt16) * player->bufferSizeBytes); // 4/18/11 - fix 2
-	
-	bufferList->mNumberBuffers = 1;
-	bufferList->mBuffers[0].mNumberChannels = 1;
-	bufferList->mBuffers[0].mDataByteSize = player->bufferSizeBytes;
-	bufferList->mBuffers[0].mData = sampleBuffer;
-	printf ("allocated %d byte buffer for ABL\n", 
-			player->bufferSizeBytes);
-	
-	// read from ExtAudioFile into sampleBuffer
-	// TODO: handle end-of-file wraparound
+#pragma mark - decode thread -
+
+// read one block's worth of frames from the file, starting over at the beginning
+// of the file when we reach the end
+static void decodeBlock (MyStreamPlayer* player, MyDecodeBlock* block) {
+	UInt32 blockFrames = player->bufferSizeBytes / player->dataFormat.mBytesPerFrame;
 	UInt32 framesReadIntoBuffer = 0;
-	do {
-		UInt32 framesRead = player->fileLengthFrames - framesReadIntoBuffer;
-		bufferList->mBuffers[0].mData = sampleBuffer + (framesReadIntoBuffer * (sizeof(UInt16))); // 4/18/11 - fix 3
+	Boolean rewound = false;
+	while (framesReadIntoBuffer < blockFrames) {
+		UInt32 framesRead = blockFrames - framesReadIntoBuffer;
+		player->decodeBufferList->mBuffers[0].mData = block->samples + framesReadIntoBuffer;
+		player->decodeBufferList->mBuffers[0].mDataByteSize = framesRead * player->dataFormat.mBytesPerFrame;
 		CheckError(ExtAudioFileRead(player->extAudioFile, 
 									&framesRead,
-									bufferList),
+									player->decodeBufferList),
 				   "ExtAudioFileRead failed");
+		if (framesRead == 0) {
+			if (rewound) {
+				// nothing to read even from the start of the file; play silence
+				memset (block->samples + framesReadIntoBuffer, 0,
+						(blockFrames - framesReadIntoBuffer) * player->dataFormat.mBytesPerFrame);
+				break;
+			}
+			CheckError(ExtAudioFileSeek(player->extAudioFile, 0),
+					   "Couldn't seek to start of file");
+			rewound = true;
+			continue;
+		}
+		rewound = false;
 		framesReadIntoBuffer += framesRead;
 		player->totalFramesRead += framesRead;
-		printf ("read %d frames\n", framesRead);
-	} while (framesReadIntoBuffer < (player->bufferSizeBytes / sizeof(UInt16))); // 4/18/11 - fix 4
+	}
+}
+
+static void *decodeThreadProc (void *userData) {
+	MyStreamPlayer* player = (MyStreamPlayer*) userData;
+	pthread_mutex_lock(&player->decodeMutex);
+	while (!player->decodeShouldExit) {
+		if (player->readyBlockCount == DECODE_BLOCK_COUNT) {
+			// all caught up; wait for the main loop to use a block
+			pthread_cond_wait(&player->decodeCond, &player->decodeMutex);
+			continue;
+		}
+		UInt32 blockIndex = (player->firstReadyBlock + player->readyBlockCount) % DECODE_BLOCK_COUNT;
+		
+		// decode without holding the lock, so the main loop is never kept waiting on the file
+		pthread_mutex_unlock(&player->decodeMutex);
+		decodeBlock(player, &player->blocks[blockIndex]);
+		pthread_mutex_lock(&player->decodeMutex);
+		
+		player->readyBlockCount++;
+		pthread_cond_broadcast(&player->decodeCond);
+	}
+	pthread_mutex_unlock(&player->decodeMutex);
+	return NULL;
+}
+
+// allocate all the decode memory up front, then start decoding. returns when
+// the first BUFFER_COUNT blocks are ready
+void startDecodeThread (MyStreamPlayer* player) {
+	for (int i=0; i<DECODE_BLOCK_COUNT; i++) {
+		player->blocks[i].samples = malloc (player->bufferSizeBytes);
+	}
+	UInt32 ablSize = offsetof(AudioBufferList, mBuffers[0]) + (sizeof(AudioBuffer) * 1); // 1 channel
+	player->decodeBufferList = malloc (ablSize);
+	player->decodeBufferList->mNumberBuffers = 1;
+	player->decodeBufferList->mBuffers[0].mNumberChannels = 1;
+	player->firstReadyBlock = 0;
+	player->readyBlockCount = 0;
+	player->decodeShouldExit = false;
+	
+	pthread_mutex_init(&player->decodeMutex, NULL);
+	pthread_cond_init(&player->decodeCond, NULL);
+	if (pthread_create(&player->decodeThread, NULL, decodeThreadProc, player) != 0) {
+		fprintf (stderr, "Error: couldn't create decode thread\n");
+		exit(1);
+	}
+	
+	pthread_mutex_lock(&player->decodeMutex);
+	while (player->readyBlockCount < BUFFER_COUNT)
+		pthread_cond_wait(&player->decodeCond, &player->decodeMutex);
+	pthread_mutex_unlock(&player->decodeMutex);
+}
+
+void stopDecodeThread (MyStreamPlayer* player) {
+	pthread_mutex_lock(&player->decodeMutex);
+	player->decodeShouldExit = true;
+	pthread_cond_broadcast(&player->decodeCond);
+	pthread_mutex_unlock(&player->decodeMutex);
+	pthread_join(player->decodeThread, NULL);
+	pthread_cond_destroy(&player->decodeCond);
+	pthread_mutex_destroy(&player->decodeMutex);
 	
-	// copy from sampleBuffer to AL buffer
+	for (int i=0; i<DECODE_BLOCK_COUNT; i++) {
+		free (player->blocks[i].samples);
+	}
+	free (player->decodeBufferList);
+	
+	printf ("refilled %d buffers, %d waited for the decoder, longest refill %.3f ms\n",
+			player->refillCount, player->refillMisses, player->maxRefillTime * 1000.0);
+}
+
+#pragma mark - AL buffers -
+
+// copy the oldest ready block into alBuffer. the caller must make sure there is one
+void fillALBuffer (MyStreamPlayer* player, ALuint alBuffer) {
+	pthread_mutex_lock(&player->decodeMutex);
+	MyDecodeBlock *block = &player->blocks[player->firstReadyBlock];
+	pthread_mutex_unlock(&player->decodeMutex);
+	
+	// copy from the block to AL buffer. the decode thread won't touch a ready block
 	alBufferData(alBuffer,
 				 AL_FORMAT_MONO16,
-				 sampleBuffer,
+				 block->samples,
 				 player->bufferSizeBytes,
 				 player->dataFormat.mSampleRate);
 	
-	free (bufferList);
-	free (sampleBuffer);
+	// hand the block back to the decode thread
+	pthread_mutex_lock(&player->decodeMutex);
+	player->firstReadyBlock = (player->firstReadyBlock + 1) % DECODE_BLOCK_COUNT;
+	player->readyBlockCount--;
+	pthread_cond_broadcast(&player->decodeCond);
+	pthread_mutex_unlock(&player->decodeMutex);
 }
 
 void refillALBuffers (MyStreamPlayer* player) {
@@ -167,14 +297,27 @@ void refillALBuffers (MyStreamPlayer* player) {
 	CheckALError ("couldn't get al_buffers_processed");
 	
 	while (processed > 0) {
+		// only take a played buffer off the queue if there's a block ready for it;
+		// otherwise leave it until next time around the loop
+		pthread_mutex_lock(&player->decodeMutex);
+		UInt32 readyBlockCount = player->readyBlockCount;
+		pthread_mutex_unlock(&player->decodeMutex);
+		if (readyBlockCount == 0) {
+			player->refillMisses++;
+			break;
+		}
+		
+		CFAbsoluteTime refillStart = CFAbsoluteTimeGetCurrent();
 		ALuint freeBuffer;
 		alSourceUnqueueBuffers(player->sources[0], 1, &freeBuffer);
 		CheckALError("couldn't unqueue buffer");
-		printf ("refilling buffer %d\n", freeBuffer);
 		fillALBuffer(player, freeBuffer);
 		alSourceQueueBuffers(player->sources[0], 1, &freeBuffer);
 		CheckALError ("couldn't queue refilled buffer");
-		printf ("re-queued buffer %d\n", freeBuffer);
+		Float64 refillTime = CFAbsoluteTimeGetCurrent() - refillStart;
+		if (refillTime > player->maxRefillTime)
+			player->maxRefillTime = refillTime;
+		player->refillCount++;
 		processed--;
 	}
 	
@@ -183,12 +326,15 @@ void refillALBuffers (MyStreamPlayer* player) {
 #pragma mark main
 
 int main (int argc, const char * argv[]) {
-	MyStreamPlayer player;
+	MyStreamPlayer player = {0};
 	
 	// prepare the ExtAudioFile for reading
 	CheckError(setUpExtAudioFile(&player),
 			   "Couldn't open ExtAudioFile") ;
 	
+	// start decoding ahead
+	startDecodeThread(&player);
+	
 	// set up OpenAL buffers
 	ALCdevice* alDevice = alcOpenDevice(NULL);
 	CheckALError ("Couldn't open AL device"); // default device
@@ -209,7 +355,8 @@ int main (int argc, const char * argv[]) {
 	CheckALError ("Couldn't generate sources");
 	alSourcef(player.sources[0], AL_GAIN, AL_MAX_GAIN);
 	CheckALError("Couldn't set source gain");
-	updateSourceLocation(player);
+	setUpOrbits(&player);
+	updateSourceLocation(&player, 0);
 	CheckALError ("Couldn't set initial source position");
 	
 	// queue up the buffers on the source
@@ -229,16 +376,19 @@ int main (int argc, const char * argv[]) {
 	// and wait
 	printf("Playing...\n");
 	time_t startTime = time(NULL);
+	CFAbsoluteTime lastUpdateTime = CFAbsoluteTimeGetCurrent();
 	do
 	{
-		// get next theta
-		updateSourceLocation(player);
+		// move the source by however long it's been since the last update
+		CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+		updateSourceLocation(&player, now - lastUpdateTime);
+		lastUpdateTime = now;
 		CheckALError ("Couldn't set source position");
 		
 		// refill buffers if needed
 		refillALBuffers (&player);
 		
-		CFRunLoopRunInMode(kCFRunLoopDefaultMode, 0.1, false);
+		CFRunLoopRunInMode(kCFRunLoopDefaultMode, 1.0 / CONTROL_RATE, false);
 	} while (difftime(time(NULL), startTime) < RUN_TIME);
 	
 	// cleanup:
@@ -247,6 +397,13 @@ int main (int argc, const char * argv[]) {
 	alDeleteBuffers(BUFFER_COUNT, buffers);
 	alcDestroyContext(alContext);
 	alcCloseDevice(alDevice);
+	stopDecodeThread(&player);
+	ExtAudioFileDispose(player.extAudioFile);
+	printf ("%d position updates of %d sources, average %.3f ms, longest %.3f ms\n",
+			player.updateCount, player.orbits.sourceCount,
+			player.updateCount ? player.totalUpdateTime * 1000.0 / player.updateCount : 0.0,
+			player.maxUpdateTime * 1000.0);
+	MyOrbitEngineDispose(&player.orbits);
 	printf ("Bottom of main\n");
 }
 
@@ -8,12 +8,13 @@
 
 #import <UIKit/UIKit.h>
 #import <AudioToolbox/AudioToolbox.h>
+#import "MyRingModulator.h"
 
 typedef struct {
 	AudioUnit rioUnit;
 	AudioStreamBasicDescription asbd;
 	float sineFrequency;
-	float sinePhase;
+	MyRingModulator modulator;
 } EffectState;
 
 
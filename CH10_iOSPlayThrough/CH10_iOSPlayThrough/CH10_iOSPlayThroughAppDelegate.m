@@ -78,36 +78,14 @@ static OSStatus InputModulatingRenderCallback (
 								ioData),
 			   "Couldn't render from RemoteIO unit");
 	
-	// walk the samples
-	AudioSampleType sample = 0;
-	UInt32 bytesPerChannel = effectState->asbd.mBytesPerFrame/effectState->asbd.mChannelsPerFrame;
+	// modulate the samples. the modulator advances once per frame, and every
+	// channel in the frame gets the same value
 	for (int bufCount=0; bufCount<ioData->mNumberBuffers; bufCount++) {
 		AudioBuffer buf = ioData->mBuffers[bufCount];
-		int currentFrame = 0;
-		while ( currentFrame < inNumberFrames ) {
-			// copy sample to buffer, across all channels
-			for (int currentChannel=0; currentChannel<buf.mNumberChannels; currentChannel++) {
-				memcpy(&sample,
-					   buf.mData + (currentFrame * effectState->asbd.mBytesPerFrame) +
-							(currentChannel * bytesPerChannel),
-					   sizeof(AudioSampleType));
-				
-				float theta = effectState->sinePhase * M_PI * 2;
-				
-				sample = (sin(theta) * sample);
-
-				memcpy(buf.mData + (currentFrame * effectState->asbd.mBytesPerFrame) +
-							(currentChannel * bytesPerChannel),
-					   &sample,
-					   sizeof(AudioSampleType));
-				
-				effectState->sinePhase += 1.0 / (effectState->asbd.mSampleRate / effectState->sineFrequency);
-				if (effectState->sinePhase > 1.0) {
-					effectState->sinePhase -= 1.0;
-				}
-			}	
-			currentFrame++;
-		}
+		MyRingModulatorProcessInt16(&effectState->modulator,
+									(AudioSampleType*) buf.mData,
+									buf.mNumberChannels,
+									inNumberFrames);
 	}
 	return noErr;
 }
@@ -237,7 +215,7 @@ static OSStatus InputModulatingRenderCallback (
 	// http://homepage.powerup.com.au/~spratleo/Tech/Dalek_Voice_Primer.html
 	_effectState.asbd = myASBD;
 	_effectState.sineFrequency = 30;
-	_effectState.sinePhase = 0;
+	MyRingModulatorInit(&_effectState.modulator, myASBD.mSampleRate, _effectState.sineFrequency, 0);
 	
 	// set callback method
 	AURenderCallbackStruct callbackStruct;
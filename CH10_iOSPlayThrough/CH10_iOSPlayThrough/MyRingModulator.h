@@ -0,0 +1,96 @@
+//
+//  MyRingModulator.h
+//  CH10_iOSPlayThrough
+//
+//  Copyright 2026 Subsequently and Furthermore, Inc. All rights reserved.
+//
+
+// The play-through ring modulation effect, processed a buffer at a time. The
+// modulating sine wave comes from a recursive oscillator: a unit vector rotated
+// by a fixed angle every frame, which costs a few multiplies per frame instead
+// of a sin(). It's computed once per frame, and every channel of that frame is
+// multiplied by the same value.
+
+#ifndef CH10_iOSPlayThrough_MyRingModulator_h
+#define CH10_iOSPlayThrough_MyRingModulator_h
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <math.h>
+#include "../../Common/MyAudioKernels.h"
+
+// frames the modulator is generated for at a time. also how often the
+// oscillator's vector is pulled back to unit length
+#define kMyRingModulatorBlockFrames	256
+
+typedef struct MyRingModulator {
+	Float64			sampleRate;
+	Float64			frequency;
+	Float64			sinValue; // the oscillator's vector: (cos, sin) of the current phase
+	Float64			cosValue;
+	Float64			rotationSin; // the angle it moves each frame
+	Float64			rotationCos;
+} MyRingModulator;
+
+// phase is in cycles, 0.0 <= phase < 1.0
+static inline void MyRingModulatorInit(MyRingModulator *modulator, Float64 sampleRate, Float64 frequency, Float64 phase)
+{
+	modulator->sampleRate = sampleRate;
+	modulator->frequency = frequency;
+	modulator->sinValue = sin(2 * M_PI * phase);
+	modulator->cosValue = cos(2 * M_PI * phase);
+	modulator->rotationSin = sin(2 * M_PI * frequency / sampleRate);
+	modulator->rotationCos = cos(2 * M_PI * frequency / sampleRate);
+}
+
+// fill modulation with the next frames values of the sine wave
+static inline void MyRingModulatorGenerate(MyRingModulator *modulator, Float32 *modulation, UInt32 frames)
+{
+	Float64 s = modulator->sinValue;
+	Float64 c = modulator->cosValue;
+	const Float64 rs = modulator->rotationSin;
+	const Float64 rc = modulator->rotationCos;
+	UInt32 frame;
+	for (frame = 0; frame < frames; frame++) {
+		modulation[frame] = (Float32)s;
+		Float64 nextS = s * rc + c * rs;
+		c = c * rc - s * rs;
+		s = nextS;
+	}
+	// rounding slowly changes the vector's length; one Newton step back toward 1.0
+	// per block is plenty
+	Float64 scale = 1.5 - 0.5 * (s * s + c * c);
+	modulator->sinValue = s * scale;
+	modulator->cosValue = c * scale;
+}
+
+// interleaved float samples, in place
+static inline void MyRingModulatorProcessFloat(MyRingModulator *modulator, Float32 *samples, UInt32 channels, UInt32 frames)
+{
+	Float32 modulation[kMyRingModulatorBlockFrames];
+	while (frames > 0) {
+		UInt32 blockFrames = frames < kMyRingModulatorBlockFrames ? frames : kMyRingModulatorBlockFrames;
+		MyRingModulatorGenerate(modulator, modulation, blockFrames);
+		MyApplyFrameGains(samples, channels, modulation, blockFrames);
+		samples += blockFrames * channels;
+		frames -= blockFrames;
+	}
+}
+
+// interleaved 16-bit samples, in place. converted to float a block at a time
+static inline void MyRingModulatorProcessInt16(MyRingModulator *modulator, SInt16 *samples, UInt32 channels, UInt32 frames)
+{
+	Float32 block[kMyRingModulatorBlockFrames * 2];
+	UInt32 framesPerBlock = (kMyRingModulatorBlockFrames * 2) / channels;
+	if (framesPerBlock == 0)
+		return;
+	while (frames > 0) {
+		UInt32 blockFrames = frames < framesPerBlock ? frames : framesPerBlock;
+		MyInt16ToFloat(samples, block, blockFrames * channels);
+		MyRingModulatorProcessFloat(modulator, block, channels, blockFrames);
+		MyFloatToInt16(block, samples, blockFrames * channels);
+		samples += blockFrames * channels;
+		frames -= blockFrames;
+	}
+}
+
+#endif
@@ -9,18 +9,76 @@
 #include <CoreFoundation/CoreFoundation.h>
 #import <CoreMIDI/CoreMIDI.h>
 #import <AudioToolbox/AudioToolbox.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../../Common/MyMIDIEventQueue.h"
+#include "../../Common/MyMIDIParser.h"
+#include "../../Common/MyMIDISender.h"
+
+#define kMIDIEventLatency	0.02 // seconds added to every event, so it reaches a slice that hasn't rendered yet
+
+// measuring the event queue, with an events-per-second argument
+#define kMeasureSeconds		10
+#define kMeasureSampleRate	44100.0
+#define kMeasureSliceFrames	512
+
+// measuring the parser, with a "parse" argument
+#define kMeasureParseBytes	(8 * 1024 * 1024) // of each stream
+#define kMeasurePacketBytes	256 // most a MIDIPacket carries
+#define kMeasureParsePasses	4
+
+// measuring the batched sender, with a "send" argument
+#define kMeasureSendSeconds	4 // at each rate
+#define kMeasureSendMaxBytes	512 // of a packet list
+#define kMeasureSendMaxEvents	(20000 * kMeasureSendSeconds) // at the highest rate
 
 #pragma mark - state struct
 typedef struct MyMIDIPlayer {
 	AUGraph		graph;
 	AudioUnit	instrumentUnit;
+	MyMIDIEventQueue eventQueue; // from MyMIDIReadProc to the instrument's render
+	MyMIDIParser *parsers; // one for each source
 } MyMIDIPlayer;
 
+// a fake MIDI source and render thread, for timing the event queue
+typedef struct MyQueueMeasurement {
+	MyMIDIEventQueue *queue;
+	UInt32		eventsPerSecond;
+	UInt64		start; // host time of the first slice
+	UInt64		end; // when the source stops
+	UInt32		pushed;
+	UInt32		slice; // being rendered
+	Float64		totalError; // frames between where events were delivered and where they were due
+	Float64		maxError;
+	UInt32		measured;
+	UInt64		pushTicks; // time spent in MyMIDIEventQueuePush()
+	UInt64		drainTicks;
+} MyQueueMeasurement;
+
+// a MIDI network session stand-in: packet lists go over UDP on the loopback
+// interface, and a thread on the other end times each event's trip
+typedef struct MySendMeasurement {
+	int			sendSocket;
+	int			receiveSocket;
+	UInt16		sequence; // of the RTP header
+	UInt64		datagrams;
+	UInt64		datagramBytes;
+	UInt32		received; // events
+	Float64		*latencies; // milliseconds from each event's time stamp to its arrival
+} MySendMeasurement;
+
 #pragma mark - forward declarations
 void setupMIDI(MyMIDIPlayer *player);
 void setupAUGraph(MyMIDIPlayer *player);
 static void	MyMIDIReadProc(const MIDIPacketList *pktlist, void *refCon, void *connRefCon);
+static void MyMIDIMessageProc(void *refCon, const MyMIDIMessage *message);
 void MyMIDINotifyProc (const MIDINotification  *message, void *refCon);
+void measureEventQueue(UInt32 eventsPerSecond);
+void measureParser(const char *recordedPath);
+void measureSender(void);
 
 #pragma mark utility functions
 static void CheckError(OSStatus error, const char *operation)
@@ -44,29 +102,30 @@ static void CheckError(OSStatus error, const char *operation)
 
 #pragma mark - callbacks
 static void	MyMIDIReadProc(const MIDIPacketList *pktlist, void *refCon, void *connRefCon) {
-	MyMIDIPlayer *player = (MyMIDIPlayer*) refCon;
+	// each source has a parser of its own, so a message split across packets, or
+	// one source's running status, can't get mixed up with another source's
+	MyMIDIParser *parser = (MyMIDIParser*) connRefCon;
+	MyMIDIParserParsePacketList(parser, pktlist);
+}
 
-	MIDIPacket *packet = (MIDIPacket *)pktlist->packet;	
-	for (int i=0; i < pktlist->numPackets; i++) {
-		Byte midiStatus = packet->data[0];
-		Byte midiCommand = midiStatus >> 4;
-		// is it a note-on or note-off
-		if ((midiCommand == 0x09) ||
-			(midiCommand == 0x08)) {
-			Byte note = packet->data[1] & 0x7F;
-			Byte velocity = packet->data[2] & 0x7F;
-			printf("midiCommand=%d. Note=%d, Velocity=%d\n", midiCommand, note, velocity);
-			
-			// send to augraph
-			CheckError(MusicDeviceMIDIEvent (player->instrumentUnit,
-											 midiStatus,
-											 note,
-											 velocity,
-											 0), 
-					   "Couldn't send MIDI event");
-			
-		}
-		packet = MIDIPacketNext(packet);
+static void MyMIDIMessageProc(void *refCon, const MyMIDIMessage *message) {
+	MyMIDIPlayer *player = (MyMIDIPlayer*) refCon;
+	
+	if (message->command < 0xF0) {
+		// every channel message, not just notes, is queued for the instrument's next
+		// render, which plays it at the packet's time stamp. no printing here: the
+		// stats are shown from main()
+		MyMIDIEventQueuePush(&player->eventQueue,
+							 message->timeStamp,
+							 message->status,
+							 message->data1,
+							 message->data2);
+	} else if (message->command == 0xF0 &&
+			   message->sysExFlags == (kMyMIDISysExFirst | kMyMIDISysExLast) &&
+			   message->sysEx[message->sysExLength - 1] == 0xF7) {
+		// whole SysEx messages go straight to the instrument. real time and system
+		// common messages mean nothing to it
+		MusicDeviceSysEx(player->instrumentUnit, message->sysEx, message->sysExLength);
 	}
 }
 
@@ -120,6 +179,16 @@ void setupAUGraph(MyMIDIPlayer *player) {
 	CheckError(AUGraphInitialize(player->graph),
 			   "AUGraphInitialize failed");
 
+	// the instrument takes the events due in each slice just before rendering it
+	AudioStreamBasicDescription instrumentFormat;
+	UInt32 propSize = sizeof(instrumentFormat);
+	CheckError(AudioUnitGetProperty(player->instrumentUnit, kAudioUnitProperty_StreamFormat,
+									kAudioUnitScope_Output, 0, &instrumentFormat, &propSize),
+			   "Couldn't get instrument's stream format");
+	MyMIDIEventQueueInit(&player->eventQueue, instrumentFormat.mSampleRate, kMIDIEventLatency);
+	player->eventQueue.instrumentUnit = player->instrumentUnit;
+	CheckError(AudioUnitAddRenderNotify(player->instrumentUnit, MyMIDIEventQueueRenderNotify, &player->eventQueue),
+			   "AudioUnitAddRenderNotify failed");
 	
 }
 
@@ -136,6 +205,7 @@ void setupMIDI(MyMIDIPlayer *player) {
 	
 	unsigned long sourceCount = MIDIGetNumberOfSources();
 	printf ("%ld sources\n", sourceCount);
+	player->parsers = (MyMIDIParser*) calloc(sourceCount, sizeof(MyMIDIParser));
 	for (int i = 0; i < sourceCount; ++i) {
 		MIDIEndpointRef src = MIDIGetSource(i);
 		CFStringRef endpointName = NULL;
@@ -144,16 +214,316 @@ void setupMIDI(MyMIDIPlayer *player) {
 		char endpointNameC[255];
 		CFStringGetCString(endpointName, endpointNameC, 255, kCFStringEncodingUTF8);
 		printf("  source %d: %s\n", i, endpointNameC);
-		CheckError (MIDIPortConnectSource(inPort, src, NULL),
+		MyMIDIParserInit(&player->parsers[i], MyMIDIMessageProc, player);
+		CheckError (MIDIPortConnectSource(inPort, src, &player->parsers[i]),
 					"Couldn't connect MIDI port");
 	}
 	
 
 }
 
+#pragma mark - measuring
+static void *measureSourceThread(void *refCon) {
+	MyQueueMeasurement *measurement = (MyQueueMeasurement*) refCon;
+	Float64 ticksPerEvent = measurement->queue->ticksPerSecond / measurement->eventsPerSecond;
+	
+	// like a MIDI driver: wake every millisecond or so, and push what came in since,
+	// each event stamped with when it arrived
+	UInt64 now;
+	while ((now = MyMIDIEventQueueClock()) < measurement->end) {
+		UInt64 pushStart = now;
+		UInt32 due = (UInt32)((now - measurement->start) / ticksPerEvent);
+		for (; measurement->pushed < due; measurement->pushed++) {
+			UInt64 timeStamp = measurement->start + (UInt64)(measurement->pushed * ticksPerEvent);
+			MyMIDIEventQueuePush(measurement->queue, timeStamp, 0x90, 60, (measurement->pushed & 0x7F) | 1);
+		}
+		measurement->pushTicks += MyMIDIEventQueueClock() - pushStart;
+		usleep(1000);
+	}
+	return NULL;
+}
+
+static void measureDeliver(void *refCon, const MyMIDIEvent *event, UInt32 offsetSampleFrame) {
+	MyQueueMeasurement *measurement = (MyQueueMeasurement*) refCon;
+	Float64 framesPerTick = kMeasureSampleRate / measurement->queue->ticksPerSecond;
+	Float64 due = (event->timeStamp + measurement->queue->latency - measurement->start) * framesPerTick;
+	Float64 error = fabs((Float64)measurement->slice * kMeasureSliceFrames + offsetSampleFrame - due);
+	measurement->totalError += error;
+	if (error > measurement->maxError)
+		measurement->maxError = error;
+	measurement->measured++;
+}
+
+// no MIDI or audio hardware: a thread pushes eventsPerSecond note-ons for
+// kMeasureSeconds while this one pretends to render, and each event's delivered
+// frame is compared with the one its time stamp asked for
+void measureEventQueue(UInt32 eventsPerSecond) {
+	MyMIDIEventQueue *queue = (MyMIDIEventQueue*) calloc(1, sizeof(MyMIDIEventQueue));
+	MyMIDIEventQueueInit(queue, kMeasureSampleRate, kMIDIEventLatency);
+	
+	MyQueueMeasurement measurement = {0};
+	measurement.queue = queue;
+	measurement.eventsPerSecond = eventsPerSecond;
+	measurement.start = MyMIDIEventQueueClock();
+	measurement.end = measurement.start + (UInt64)(kMeasureSeconds * queue->ticksPerSecond);
+	
+	pthread_t sourceThread;
+	CheckError(pthread_create(&sourceThread, NULL, measureSourceThread, &measurement),
+			   "Couldn't start source thread");
+	
+	// render each slice at its own host time, as an output unit with no latency would
+	Float64 ticksPerSlice = kMeasureSliceFrames * queue->ticksPerSecond / kMeasureSampleRate;
+	UInt64 last = measurement.end + queue->latency + (UInt64)ticksPerSlice;
+	for (measurement.slice = 0; ; measurement.slice++) {
+		UInt64 sliceHostTime = measurement.start + (UInt64)(measurement.slice * ticksPerSlice);
+		if (sliceHostTime > last)
+			break;
+		UInt64 now = MyMIDIEventQueueClock();
+		if (now < sliceHostTime)
+			usleep((useconds_t)((sliceHostTime - now) * 1000000.0 / queue->ticksPerSecond));
+		UInt64 drainStart = MyMIDIEventQueueClock();
+		MyMIDIEventQueueDrain(queue, sliceHostTime, kMeasureSliceFrames, measureDeliver, &measurement);
+		measurement.drainTicks += MyMIDIEventQueueClock() - drainStart;
+	}
+	pthread_join(sourceThread, NULL);
+	
+	printf("%u events/second for %d seconds, %d frame slices\n", (unsigned)eventsPerSecond, kMeasureSeconds, kMeasureSliceFrames);
+	MyMIDIEventQueuePrintStats(queue, stdout);
+	if (measurement.measured > 0)
+		printf("timing error: %.3f frames average, %.3f frames at most\n",
+			   measurement.totalError / measurement.measured, measurement.maxError);
+	if (measurement.pushed > 0 && measurement.measured > 0)
+		printf("%.1f ns per push, %.1f ns per delivery\n",
+			   measurement.pushTicks * 1000000000.0 / queue->ticksPerSecond / measurement.pushed,
+			   measurement.drainTicks * 1000000000.0 / queue->ticksPerSecond / measurement.measured);
+	free(queue);
+}
+
+static void measureParseMessage(void *refCon, const MyMIDIMessage *message) {
+	// something that depends on every message, so none of them can be skipped
+	UInt32 *checksum = (UInt32*) refCon;
+	*checksum += message->status + message->data1 + message->data2 + message->sysExLength;
+}
+
+// parse bytes in packet-sized pieces kMeasureParsePasses times, and show how fast
+static void measureParseStream(const char *name, const Byte *bytes, UInt32 length) {
+	MyMIDIParser *parser = (MyMIDIParser*) malloc(sizeof(MyMIDIParser));
+	UInt32 checksum = 0;
+	MyMIDIParserInit(parser, measureParseMessage, &checksum);
+	UInt64 start = MyMIDIEventQueueClock();
+	for (int pass = 0; pass < kMeasureParsePasses; pass++) {
+		for (UInt32 offset = 0; offset < length; offset += kMeasurePacketBytes) {
+			UInt32 packetBytes = length - offset < kMeasurePacketBytes ? length - offset : kMeasurePacketBytes;
+			MyMIDIParserParse(parser, offset, bytes + offset, packetBytes);
+		}
+	}
+	Float64 seconds = (MyMIDIEventQueueClock() - start) / MyMIDIEventQueueTicksPerSecond();
+	printf("%-36s %7.2f M messages/s, %7.1f MB/s (%u stray bytes, checksum %08x)\n", name,
+		   parser->messages / seconds / 1000000.0,
+		   (Float64)length * kMeasureParsePasses / seconds / (1024.0 * 1024.0),
+		   (unsigned)parser->strayBytes, (unsigned)checksum);
+	free(parser);
+}
+
+// no MIDI hardware: parse made-up streams, each one hard in its own way, and
+// recordedPath, if given, which holds MIDI bytes as they came off the wire
+void measureParser(const char *recordedPath) {
+	Byte *bytes = (Byte*) malloc(kMeasureParseBytes);
+	UInt32 i;
+	
+	// one controller status, then nothing but data bytes
+	bytes[0] = 0xB0;
+	for (i = 1; i < kMeasureParseBytes; i++)
+		bytes[i] = (i & 1) ? 7 : (i >> 1) & 0x7F;
+	measureParseStream("controllers, running status", bytes, kMeasureParseBytes);
+	
+	// a status byte on every message, each note on another channel
+	for (i = 0; i + 3 <= kMeasureParseBytes; i += 3) {
+		bytes[i] = ((i / 3) & 1 ? 0x80 : 0x90) | ((i / 6) & 0x0F);
+		bytes[i + 1] = (i >> 4) & 0x7F;
+		bytes[i + 2] = (i / 3) & 1 ? 0 : 100;
+	}
+	for (; i < kMeasureParseBytes; i++)
+		bytes[i] = 0xF8;
+	measureParseStream("notes, status on every message", bytes, kMeasureParseBytes);
+	
+	// running status, with a clock tick after every data byte, so no message is
+	// ever in one piece, and a new status every 64 messages
+	for (i = 0; i < kMeasureParseBytes; i++) {
+		UInt32 position = i % 257;
+		if (position == 0)
+			bytes[i] = 0xE0 | ((i / 257) & 0x0F);
+		else
+			bytes[i] = (position & 1) ? (i >> 3) & 0x7F : 0xF8;
+	}
+	measureParseStream("running status, clock between bytes", bytes, kMeasureParseBytes);
+	
+	// SysEx bigger than the parser holds
+	for (i = 0; i < kMeasureParseBytes; i++) {
+		UInt32 position = i % 3000;
+		bytes[i] = position == 0 ? 0xF0 : position == 2999 ? 0xF7 : i & 0x7F;
+	}
+	measureParseStream("SysEx, 3000 bytes each", bytes, kMeasureParseBytes);
+	
+	if (recordedPath) {
+		FILE *recorded = fopen(recordedPath, "rb");
+		if (!recorded) {
+			fprintf(stderr, "Couldn't open %s\n", recordedPath);
+		} else {
+			UInt32 length = (UInt32)fread(bytes, 1, kMeasureParseBytes, recorded);
+			fclose(recorded);
+			measureParseStream(recordedPath, bytes, length);
+		}
+	}
+	free(bytes);
+}
+
+static int compareLatencies(const void *a, const void *b) {
+	Float64 x = *(const Float64*) a;
+	Float64 y = *(const Float64*) b;
+	return x < y ? -1 : x > y;
+}
+
+// each packet list as one datagram: an RTP header, then each packet's time stamp,
+// length and bytes. RTP-MIDI packs things tighter, but sends as many datagrams
+static OSStatus measureSendDatagram(void *refCon, const MIDIPacketList *packetList) {
+	MySendMeasurement *measurement = (MySendMeasurement*) refCon;
+	Byte datagram[12 + kMeasureSendMaxBytes];
+	const MIDIPacket *packet = packetList->packet;
+	UInt32 rtpTime = (UInt32)(packet->timeStamp / 100000); // the receiver doesn't use it
+	datagram[0] = 0x80; // version 2
+	datagram[1] = 0x61; // payload type 97
+	datagram[2] = measurement->sequence >> 8;
+	datagram[3] = (Byte) measurement->sequence++;
+	for (int i = 0; i < 4; i++) {
+		datagram[4 + i] = (Byte)(rtpTime >> (24 - 8 * i));
+		datagram[8 + i] = 0; // SSRC
+	}
+	UInt32 length = 12;
+	for (UInt32 i = 0; i < packetList->numPackets; i++) {
+		memcpy(datagram + length, &packet->timeStamp, sizeof(MIDITimeStamp));
+		datagram[length + 8] = (Byte) packet->length;
+		memcpy(datagram + length + 9, packet->data, packet->length);
+		length += 9 + packet->length;
+		packet = MIDIPacketNext(packet);
+	}
+	if (send(measurement->sendSocket, datagram, length, 0) != (ssize_t) length)
+		return -1;
+	measurement->datagrams++;
+	measurement->datagramBytes += length;
+	return noErr;
+}
+
+// the other end: a datagram of just an RTP header means stop
+static void *measureReceiveThread(void *refCon) {
+	MySendMeasurement *measurement = (MySendMeasurement*) refCon;
+	Float64 ticksPerSecond = MyMIDISenderTicksPerSecond();
+	Byte datagram[12 + kMeasureSendMaxBytes];
+	ssize_t length;
+	while ((length = recv(measurement->receiveSocket, datagram, sizeof(datagram), 0)) > 12) {
+		UInt64 now = MyMIDISenderClock();
+		for (ssize_t offset = 12; offset + 9 <= length; offset += 9 + datagram[offset + 8]) {
+			MIDITimeStamp timeStamp;
+			memcpy(&timeStamp, datagram + offset, sizeof(timeStamp));
+			for (int event = 0; event < datagram[offset + 8] / 3 && measurement->received < kMeasureSendMaxEvents; event++)
+				measurement->latencies[measurement->received++] = (now - timeStamp) * 1000.0 / ticksPerSecond;
+		}
+	}
+	return NULL;
+}
+
+// eventsPerSecond notes, each added when it's due, through a sender with budgetSeconds
+static void measureSendRate(UInt32 eventsPerSecond, Float64 budgetSeconds) {
+	MySendMeasurement measurement = {0};
+	measurement.latencies = (Float64*) calloc(kMeasureSendMaxEvents, sizeof(Float64));
+	measurement.receiveSocket = socket(AF_INET, SOCK_DGRAM, 0);
+	measurement.sendSocket = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in address = {0};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addressLength = sizeof(address);
+	CheckError(bind(measurement.receiveSocket, (struct sockaddr*) &address, addressLength) ||
+			   getsockname(measurement.receiveSocket, (struct sockaddr*) &address, &addressLength) ||
+			   connect(measurement.sendSocket, (struct sockaddr*) &address, addressLength),
+			   "Couldn't set up loopback sockets");
+	pthread_t receiveThread;
+	CheckError(pthread_create(&receiveThread, NULL, measureReceiveThread, &measurement),
+			   "Couldn't start receive thread");
+	
+	MyMIDISender sender;
+	CheckError(MyMIDISenderInit(&sender, measureSendDatagram, &measurement, kMeasureSendMaxBytes, budgetSeconds),
+			   "Couldn't start sender");
+	Float64 ticksPerEvent = sender.ticksPerSecond / eventsPerSecond;
+	UInt32 events = eventsPerSecond * kMeasureSendSeconds;
+	UInt64 start = MyMIDISenderClock();
+	for (UInt32 event = 0; event < events; event++) {
+		UInt64 due = start + (UInt64)(event * ticksPerEvent);
+		UInt64 now = MyMIDISenderClock();
+		if (due > now + sender.ticksPerSecond / 10000) // sleeping any less oversleeps
+			usleep((useconds_t)((due - now) * 1000000.0 / sender.ticksPerSecond));
+		MyMIDISenderAddEvent(&sender, 0, event & 1 ? 0x80 : 0x90, 36 + (event >> 1) % 48, 100);
+	}
+	MyMIDISenderDispose(&sender);
+	
+	// an empty datagram once everything's had time to arrive
+	usleep(100000);
+	Byte stop[12] = { 0x80, 0x61 };
+	send(measurement.sendSocket, stop, sizeof(stop), 0);
+	pthread_join(receiveThread, NULL);
+	close(measurement.sendSocket);
+	close(measurement.receiveSocket);
+	
+	if (measurement.received == 0) {
+		printf("%6u events/s, %s: nothing received\n",
+			   (unsigned)eventsPerSecond, budgetSeconds > 0.0 ? "batched" : "one each");
+		free(measurement.latencies);
+		return;
+	}
+	Float64 total = 0.0;
+	for (UInt32 i = 0; i < measurement.received; i++)
+		total += measurement.latencies[i];
+	qsort(measurement.latencies, measurement.received, sizeof(Float64), compareLatencies);
+	printf("%6u events/s, %s: %6.1f events a datagram, %5.1f bytes an event on the wire, "
+		   "%.3f ms average latency, %.3f ms 99th percentile, %.3f ms at most%s\n",
+		   (unsigned)eventsPerSecond, budgetSeconds > 0.0 ? "batched" : "one each",
+		   (Float64) measurement.received / measurement.datagrams,
+		   (Float64) measurement.datagramBytes / measurement.received,
+		   total / measurement.received, measurement.latencies[measurement.received * 99 / 100],
+		   measurement.latencies[measurement.received - 1],
+		   measurement.received == events ? "" : " (events lost)");
+	free(measurement.latencies);
+}
+
+// no network: send notes through a loopback stand-in for a network session, at
+// rates from a player's to a sequencer's, one event per packet list and batched
+void measureSender(void) {
+	UInt32 rates[] = { 100, 1000, 5000, 20000 };
+	printf("%d seconds at each rate, %.1f ms budget for batches of at most %d bytes\n",
+		   kMeasureSendSeconds, kMyMIDISenderDefaultBudget * 1000.0, kMeasureSendMaxBytes);
+	for (int rate = 0; rate < 4; rate++) {
+		measureSendRate(rates[rate], 0.0);
+		measureSendRate(rates[rate], kMyMIDISenderDefaultBudget);
+	}
+}
+
 #pragma mark - main
+// with an events-per-second argument, measures the event queue instead of playing.
+// with "parse", and optionally a file of recorded MIDI bytes, measures the parser.
+// with "send", measures the batched sender over loopback
 int main (int argc, const char * argv[])
 {
+	if (argc > 1 && strcmp(argv[1], "parse") == 0) {
+		measureParser(argc > 2 ? argv[2] : NULL);
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "send") == 0) {
+		measureSender();
+		return 0;
+	}
+	if (argc > 1) {
+		measureEventQueue((UInt32)atoi(argv[1]));
+		return 0;
+	}
 	
 	MyMIDIPlayer player;
 	
@@ -163,8 +533,15 @@ int main (int argc, const char * argv[])
 	CheckError (AUGraphStart(player.graph),
 				"couldn't start graph");
 	
-	CFRunLoopRun();
-	// run until aborted with control-C
+	// run until aborted with control-C, showing how the events are doing
+	UInt32 shownDelivered = 0;
+	while (1) {
+		CFRunLoopRunInMode(kCFRunLoopDefaultMode, 1.0, false);
+		if (player.eventQueue.delivered != shownDelivered) {
+			shownDelivered = player.eventQueue.delivered;
+			MyMIDIEventQueuePrintStats(&player.eventQueue, stdout);
+		}
+	}
 	
 	return 0;
 }
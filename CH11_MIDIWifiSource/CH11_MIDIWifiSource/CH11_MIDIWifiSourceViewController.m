@@ -8,8 +8,11 @@
 
 #import "CH11_MIDIWifiSourceViewController.h"
 #import <CoreMIDI/CoreMIDI.h>
+#include "../../Common/MyMIDISender.h"
 
 #define DESTINATION_ADDRESS @"192.168.2.108"
+#define MIDI_SEND_BUDGET kMyMIDISenderDefaultBudget // seconds an event can wait for others to share its packet list
+#define MIDI_SEND_MAX_BYTES 256 // of a packet list
 
 @interface CH11_MIDIWifiSourceViewController()
 - (void) connectToHost;
@@ -19,6 +22,7 @@
 @property (assign) MIDINetworkSession *midiSession;
 @property (assign) MIDIEndpointRef destinationEndpoint;
 @property (assign) MIDIPortRef outputPort;
+@property (assign) MyMIDISender *midiSender;
 @end
 
 @implementation CH11_MIDIWifiSourceViewController
@@ -26,6 +30,7 @@
 @synthesize midiSession;
 @synthesize destinationEndpoint;
 @synthesize outputPort;
+@synthesize midiSender;
 
 
 #pragma mark utility functions
@@ -92,21 +97,22 @@ static void CheckError(OSStatus error, const char *operation)
 					"Couldn't create output port");
 		self.outputPort = outport;
 		NSLog (@"Got output port");
+		
+		self.midiSender = (MyMIDISender*) calloc(1, sizeof(MyMIDISender));
+		CheckError (MyMIDISenderInitForDestination(self.midiSender, self.outputPort, self.destinationEndpoint,
+												   MIDI_SEND_MAX_BYTES, MIDI_SEND_BUDGET),
+					"Couldn't start MIDI sender");
 	}
 }
 
+// the event goes out with any others played in the next MIDI_SEND_BUDGET,
+// time stamped with when it was played
 -(void) sendStatus:(Byte)status data1:(Byte)data1 data2:(Byte)data2 {
-	MIDIPacketList packetList;
-	
-	packetList.numPackets = 1;
-	packetList.packet[0].length = 3;
-	packetList.packet[0].data[0] = status;
-	packetList.packet[0].data[1] = data1;
-	packetList.packet[0].data[2] = data2;
-	packetList.packet[0].timeStamp = 0;
-	
-	CheckError (MIDISend(self.outputPort, self.destinationEndpoint, &packetList),
-				"Couldn't send MIDI packet list");
+	if (!self.midiSender)
+		return;
+	CheckError (MyMIDISenderAddEvent(self.midiSender, 0, status, data1, data2),
+				"Couldn't send MIDI event");
+	CheckError (MyMIDISenderGetLastError(self.midiSender), "Couldn't send MIDI packet list");
 }
 
 -(void) sendNoteOnEvent:(Byte)key velocity:(Byte)velocity {
@@ -119,6 +125,15 @@ static void CheckError(OSStatus error, const char *operation)
 }
 
 
+- (void)dealloc
+{
+	if (self.midiSender) {
+		MyMIDISenderDispose(self.midiSender);
+		free(self.midiSender);
+	}
+	[super dealloc];
+}
+
 #pragma mark event handlers
 -(IBAction) handleKeyDown:(id)sender {
 	NSInteger note = [sender tag];
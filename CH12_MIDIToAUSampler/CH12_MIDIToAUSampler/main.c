@@ -9,18 +9,60 @@
 #include <CoreFoundation/CoreFoundation.h>
 #import <CoreMIDI/CoreMIDI.h>
 #import <AudioToolbox/AudioToolbox.h>
+#include "../../Common/MyMIDIEventQueue.h"
+#include "../../Common/MyMIDIParser.h"
+#include "../../Common/MySampler.h"
+#include <sys/resource.h>
+
+#define useMySampler		0 // play the preset with MySampler instead of AUSampler
+#define kPresetPath			"/Users/cadamson/Library/Audio/Presets/Apple/AUSampler/ch12-aupreset.aupreset"
+#define kMIDIEventLatency	0.02 // seconds added to every event, so it reaches a slice that hasn't rendered yet
+
+// measureSampler() renders kMeasureSeconds of audio for each voice count it tries.
+// a voice count keeps up if 99% of its renders take no more than kMeasureLoad of
+// the time their slice lasts
+#define kMeasureSampleRate	44100.0
+#define kMeasureSeconds		2.0
+#define kMeasureLoad		0.7
+#define kMeasureMaxVoices	4096
+#define kMeasureNotesPerSecond	50 // played on top of the held notes, so voices get stolen
+
+// measureStreaming() writes kStreamGigabytes of samples, in kStreamFiles files,
+// then plays notes from them for kStreamSeconds in real time, in slices of
+// kStreamSliceFrames, with only the first kStreamHeadFrames of each in memory
+#define kStreamGigabytes	2.0
+#define kStreamFiles		64 // one for each key, up from kStreamLowKey
+#define kStreamLowKey		24
+#define kStreamHeadFrames	16384
+#define kStreamPreloadLimit	(64 * 1048576)
+#define kStreamVoices		256
+#define kStreamSeconds		20.0
+#define kStreamSliceFrames	256
+#define kStreamNotesPerSecond	300
+#define kStreamNoteSeconds	1.5 // from note on to note off
 
 #pragma mark - state struct
 typedef struct MyMIDIPlayer {
 	AUGraph		graph;
 	AudioUnit	instrumentUnit;
+	MyMIDIEventQueue eventQueue; // from MyMIDIReadProc to the instrument's render
+	MyMIDIParser *parsers; // one for each source
+	MySampler	sampler; // if useMySampler
 } MyMIDIPlayer;
 
 #pragma mark - forward declarations
 void setupMIDI(MyMIDIPlayer *player);
 void setupAUGraph(MyMIDIPlayer *player);
 static void	MyMIDIReadProc(const MIDIPacketList *pktlist, void *refCon, void *connRefCon);
+static void MyMIDIMessageProc(void *refCon, const MyMIDIMessage *message);
 void MyMIDINotifyProc (const MIDINotification  *message, void *refCon);
+void setupMySampler(MyMIDIPlayer *player, AUNode outputNode);
+static OSStatus MySamplerRenderProc(void *inRefCon, AudioUnitRenderActionFlags *ioActionFlags,
+									const AudioTimeStamp *inTimeStamp, UInt32 inBusNumber,
+									UInt32 inNumberFrames, AudioBufferList *ioData);
+static void MySamplerDeliverProc(void *refCon, const MyMIDIEvent *event, UInt32 offsetSampleFrame);
+void measureSampler(const char *presetPath);
+void measureStreaming(const char *directory);
 
 #pragma mark utility functions
 static void CheckError(OSStatus error, const char *operation)
@@ -44,29 +86,30 @@ static void CheckError(OSStatus error, const char *operation)
 
 #pragma mark - callbacks
 static void	MyMIDIReadProc(const MIDIPacketList *pktlist, void *refCon, void *connRefCon) {
+	// each source has a parser of its own, so a message split across packets, or
+	// one source's running status, can't get mixed up with another source's
+	MyMIDIParser *parser = (MyMIDIParser*) connRefCon;
+	MyMIDIParserParsePacketList(parser, pktlist);
+}
+
+static void MyMIDIMessageProc(void *refCon, const MyMIDIMessage *message) {
 	MyMIDIPlayer *player = (MyMIDIPlayer*) refCon;
 	
-	MIDIPacket *packet = (MIDIPacket *)pktlist->packet;	
-	for (int i=0; i < pktlist->numPackets; i++) {
-		Byte midiStatus = packet->data[0];
-		Byte midiCommand = midiStatus >> 4;
-		// is it a note-on or note-off
-		if ((midiCommand == 0x09) ||
-			(midiCommand == 0x08)) {
-			Byte note = packet->data[1] & 0x7F;
-			Byte velocity = packet->data[2] & 0x7F;
-			printf("midiCommand=%d. Note=%d, Velocity=%d\n", midiCommand, note, velocity);
-			
-			// send to augraph
-			CheckError(MusicDeviceMIDIEvent (player->instrumentUnit,
-											 midiStatus,
-											 note,
-											 velocity,
-											 0), 
-					   "Couldn't send MIDI event");
-			
-		}
-		packet = MIDIPacketNext(packet);
+	if (message->command < 0xF0) {
+		// every channel message, not just notes, is queued for the instrument's next
+		// render, which plays it at the packet's time stamp. no printing here: the
+		// stats are shown from main()
+		MyMIDIEventQueuePush(&player->eventQueue,
+							 message->timeStamp,
+							 message->status,
+							 message->data1,
+							 message->data2);
+	} else if (message->command == 0xF0 && player->instrumentUnit &&
+			   message->sysExFlags == (kMyMIDISysExFirst | kMyMIDISysExLast) &&
+			   message->sysEx[message->sysExLength - 1] == 0xF7) {
+		// whole SysEx messages go straight to the instrument. real time and system
+		// common messages mean nothing to it
+		MusicDeviceSysEx(player->instrumentUnit, message->sysEx, message->sysExLength);
 	}
 }
 
@@ -75,6 +118,24 @@ void MyMIDINotifyProc (const MIDINotification  *message, void *refCon) {
 	printf("MIDI Notify, messageId=%d,", message->messageID);
 }
 
+static OSStatus MySamplerRenderProc(void *inRefCon, AudioUnitRenderActionFlags *ioActionFlags,
+									const AudioTimeStamp *inTimeStamp, UInt32 inBusNumber,
+									UInt32 inNumberFrames, AudioBufferList *ioData) {
+	MyMIDIPlayer *player = (MyMIDIPlayer*) inRefCon;
+	UInt64 sliceHostTime = (inTimeStamp->mFlags & kAudioTimeStampHostTimeValid) ?
+		inTimeStamp->mHostTime : MyMIDIEventQueueClock();
+	MyMIDIEventQueueDrain(&player->eventQueue, sliceHostTime, inNumberFrames, MySamplerDeliverProc, &player->sampler);
+	MySamplerRender(&player->sampler,
+					(Float32*) ioData->mBuffers[0].mData,
+					(Float32*) ioData->mBuffers[1].mData,
+					inNumberFrames);
+	return noErr;
+}
+
+static void MySamplerDeliverProc(void *refCon, const MyMIDIEvent *event, UInt32 offsetSampleFrame) {
+	MySamplerScheduleMIDIEvent((MySampler*) refCon, event->status, event->data1, event->data2, offsetSampleFrame);
+}
+
 
 
 #pragma mark - augraph
@@ -94,6 +155,9 @@ void setupAUGraph(MyMIDIPlayer *player) {
 	CheckError(AUGraphAddNode(player->graph, &outputcd, &outputNode),
 			   "AUGraphAddNode[kAudioUnitSubType_DefaultOutput] failed");
 	
+#if useMySampler
+	setupMySampler(player, outputNode);
+#else
 	
 	AudioComponentDescription instrumentcd = {0};
 	instrumentcd.componentManufacturer = kAudioUnitManufacturer_Apple;
@@ -120,13 +184,24 @@ void setupAUGraph(MyMIDIPlayer *player) {
 	CheckError(AUGraphInitialize(player->graph),
 			   "AUGraphInitialize failed");
 	
+	// the sampler takes the events due in each slice just before rendering it.
+	// set this up first, so the queue is ready even if the preset doesn't load
+	AudioStreamBasicDescription instrumentFormat;
+	UInt32 propSize = sizeof(instrumentFormat);
+	CheckError(AudioUnitGetProperty(player->instrumentUnit, kAudioUnitProperty_StreamFormat,
+									kAudioUnitScope_Output, 0, &instrumentFormat, &propSize),
+			   "Couldn't get instrument's stream format");
+	MyMIDIEventQueueInit(&player->eventQueue, instrumentFormat.mSampleRate, kMIDIEventLatency);
+	player->eventQueue.instrumentUnit = player->instrumentUnit;
+	CheckError(AudioUnitAddRenderNotify(player->instrumentUnit, MyMIDIEventQueueRenderNotify, &player->eventQueue),
+			   "AudioUnitAddRenderNotify failed");
 	
 	// configure the AUSampler
 	// 2nd parameter obviously needs to be a full path on your system, and 3rd param is its length in characters
 	CFURLRef presetURL = CFURLCreateFromFileSystemRepresentation(
 						    kCFAllocatorDefault,
-							"/Users/cadamson/Library/Audio/Presets/Apple/AUSampler/ch12-aupreset.aupreset",
-							77,
+							(const UInt8*) kPresetPath,
+							strlen(kPresetPath),
 							false);
 	
 	// load preset file into a CFDataRef
@@ -165,9 +240,59 @@ void setupAUGraph(MyMIDIPlayer *player) {
 										sizeof(presetPlist)),
 				   "Couldn't set aupreset plist as sampler's class info");
 	}
+#endif
+}
 
+// MySampler in place of AUSampler: it renders straight into the output unit,
+// taking the events due in each slice from the queue first
+void setupMySampler(MyMIDIPlayer *player, AUNode outputNode) {
+	
+	CheckError(AUGraphOpen(player->graph),
+			   "AUGraphOpen failed");
+	
+	AudioUnit outputUnit;
+	CheckError(AUGraphNodeInfo(player->graph, outputNode, NULL, &outputUnit),
+			   "AUGraphNodeInfo failed");
+	
+	// render at the device's sample rate, as non-interleaved stereo floats
+	AudioStreamBasicDescription deviceFormat;
+	UInt32 propSize = sizeof(deviceFormat);
+	CheckError(AudioUnitGetProperty(outputUnit, kAudioUnitProperty_StreamFormat,
+									kAudioUnitScope_Output, 0, &deviceFormat, &propSize),
+			   "Couldn't get output's stream format");
+	AudioStreamBasicDescription samplerFormat = {0};
+	samplerFormat.mSampleRate = deviceFormat.mSampleRate;
+	samplerFormat.mFormatID = kAudioFormatLinearPCM;
+	samplerFormat.mFormatFlags = kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+	samplerFormat.mBytesPerPacket = sizeof(Float32);
+	samplerFormat.mFramesPerPacket = 1;
+	samplerFormat.mBytesPerFrame = sizeof(Float32);
+	samplerFormat.mChannelsPerFrame = 2;
+	samplerFormat.mBitsPerChannel = 32;
+	CheckError(AudioUnitSetProperty(outputUnit, kAudioUnitProperty_StreamFormat,
+									kAudioUnitScope_Input, 0, &samplerFormat, sizeof(samplerFormat)),
+			   "Couldn't set output's stream format");
+	
+	CheckError(MySamplerInit(&player->sampler, samplerFormat.mSampleRate),
+			   "MySamplerInit failed");
+	CheckError(MySamplerLoadPreset(&player->sampler, kPresetPath),
+			   "Couldn't load .aupreset into MySampler");
+	printf("MySampler: %u zones, %.1f MB of samples, %u voices\n",
+		   (unsigned)player->sampler.zoneCount, player->sampler.sampleBytes / 1048576.0,
+		   (unsigned)player->sampler.voiceCount);
+	
+	AURenderCallbackStruct callback = {0};
+	callback.inputProc = MySamplerRenderProc;
+	callback.inputProcRefCon = player;
+	CheckError(AUGraphSetNodeInputCallback(player->graph, outputNode, 0, &callback),
+			   "AUGraphSetNodeInputCallback failed");
 	
+	CheckError(AUGraphInitialize(player->graph),
+			   "AUGraphInitialize failed");
 	
+	// no instrument unit: SysEx has nowhere to go
+	player->instrumentUnit = NULL;
+	MyMIDIEventQueueInit(&player->eventQueue, samplerFormat.mSampleRate, kMIDIEventLatency);
 }
 
 #pragma mark - midi
@@ -183,6 +308,7 @@ void setupMIDI(MyMIDIPlayer *player) {
 	
 	unsigned long sourceCount = MIDIGetNumberOfSources();
 	printf ("%ld sources\n", sourceCount);
+	player->parsers = (MyMIDIParser*) calloc(sourceCount, sizeof(MyMIDIParser));
 	for (int i = 0; i < sourceCount; ++i) {
 		MIDIEndpointRef src = MIDIGetSource(i);
 		CFStringRef endpointName = NULL;
@@ -191,18 +317,271 @@ void setupMIDI(MyMIDIPlayer *player) {
 		char endpointNameC[255];
 		CFStringGetCString(endpointName, endpointNameC, 255, kCFStringEncodingUTF8);
 		printf("  source %d: %s\n", i, endpointNameC);
-		CheckError (MIDIPortConnectSource(inPort, src, NULL),
+		MyMIDIParserInit(&player->parsers[i], MyMIDIMessageProc, player);
+		CheckError (MIDIPortConnectSource(inPort, src, &player->parsers[i]),
 					"Couldn't connect MIDI port");
 	}
 	
 	
 }
 
+#pragma mark - measuring
+// an instrument for when no preset is given: one looping two-second sample,
+// some decaying harmonics of A2, across the whole keyboard
+static void makeMeasureInstrument(MySampler *sampler) {
+	UInt32 frames = (UInt32)(2.0 * kMeasureSampleRate);
+	MySamplerSample *sample = MySamplerAddSample(sampler, 1, frames, kMeasureSampleRate);
+	CheckError(sample == NULL, "Couldn't allocate sample");
+	for (UInt32 frame = 0; frame < frames; frame++) {
+		Float64 t = frame / kMeasureSampleRate;
+		Float64 value = 0.0;
+		for (int harmonic = 1; harmonic <= 8; harmonic++)
+			value += sin(2.0 * M_PI * 110.0 * harmonic * t) * exp(-t * harmonic) / harmonic;
+		sample->data[0][frame] = (Float32)(0.3 * value);
+	}
+	MySamplerZone zone = {0};
+	zone.minKey = 0;
+	zone.maxKey = 127;
+	zone.maxVelocity = 127;
+	zone.rootKey = 45;
+	zone.gain = 1.0f;
+	zone.sampleIndex = 0;
+	zone.envelope.attackSeconds = 0.005;
+	zone.envelope.sustainLevel = 1.0f;
+	zone.envelope.releaseSeconds = 0.2;
+	CheckError(MySamplerAddZone(sampler, &zone), "Couldn't add zone");
+}
+
+static int compareSeconds(const void *a, const void *b) {
+	Float64 x = *(const Float64*) a;
+	Float64 y = *(const Float64*) b;
+	return x < y ? -1 : x > y;
+}
+
+// render kMeasureSeconds of voiceCount held notes, plus kMeasureNotesPerSecond
+// more, in slices of sliceFrames. returns the 99th percentile render time as a
+// fraction of a slice's duration
+static Float64 measureSamplerLoad(MySampler *sampler, UInt32 voiceCount, UInt32 sliceFrames, UInt32 *outSteals) {
+	CheckError(MySamplerSetVoiceCount(sampler, voiceCount), "Couldn't set voice count");
+	for (UInt32 i = 0; i < voiceCount; i++)
+		MySamplerMIDIEvent(sampler, 0x90 | (i % 16), 36 + (i * 7) % 48, 64 + i % 64);
+	
+	UInt32 slices = (UInt32)(kMeasureSeconds * kMeasureSampleRate / sliceFrames);
+	Float32 *left = (Float32*) calloc(sliceFrames, sizeof(Float32));
+	Float32 *right = (Float32*) calloc(sliceFrames, sizeof(Float32));
+	Float64 *seconds = (Float64*) calloc(slices, sizeof(Float64));
+	Float64 ticksPerSecond = MyMIDIEventQueueTicksPerSecond();
+	Float64 notesDue = 0.0;
+	UInt32 extraNote = 0;
+	for (UInt32 slice = 0; slice < slices; slice++) {
+		notesDue += kMeasureNotesPerSecond * sliceFrames / kMeasureSampleRate;
+		for (; notesDue >= 1.0; notesDue -= 1.0, extraNote++)
+			MySamplerScheduleMIDIEvent(sampler, 0x90, 60 + extraNote % 24, 100, (extraNote * 37) % sliceFrames);
+		UInt64 start = MyMIDIEventQueueClock();
+		MySamplerRender(sampler, left, right, sliceFrames);
+		seconds[slice] = (MyMIDIEventQueueClock() - start) / ticksPerSecond;
+	}
+	qsort(seconds, slices, sizeof(Float64), compareSeconds);
+	Float64 load = seconds[slices * 99 / 100] / (sliceFrames / kMeasureSampleRate);
+	*outSteals = sampler->steals;
+	free(left);
+	free(right);
+	free(seconds);
+	return load;
+}
+
+// the most voices MySampler can render on this thread, with 64- and 256-frame
+// slices. every zone loops, so the held notes last for the whole measurement
+void measureSampler(const char *presetPath) {
+	MySampler sampler;
+	CheckError(MySamplerInit(&sampler, kMeasureSampleRate), "MySamplerInit failed");
+	if (presetPath)
+		CheckError(MySamplerLoadPreset(&sampler, presetPath), "Couldn't load .aupreset into MySampler");
+	else
+		makeMeasureInstrument(&sampler);
+	for (UInt32 i = 0; i < sampler.zoneCount; i++) {
+		MySamplerZone *zone = &sampler.zones[i];
+		if (!zone->loop) {
+			zone->loop = true;
+			zone->loopStart = 0;
+			zone->loopEnd = sampler.samples[zone->sampleIndex].frames;
+		}
+		if (zone->envelope.sustainLevel <= 0.0f)
+			zone->envelope.sustainLevel = 1.0f;
+	}
+	printf("%s: %u zones, %.1f MB of samples\n", presetPath ? presetPath : "made-up instrument",
+		   (unsigned)sampler.zoneCount, sampler.sampleBytes / 1048576.0);
+	
+	UInt32 sliceSizes[] = { 64, 256 };
+	for (int size = 0; size < 2; size++) {
+		UInt32 sliceFrames = sliceSizes[size];
+		// the load grows with the voice count, so search for the last count that keeps up
+		UInt32 good = 0;
+		UInt32 bad = kMeasureMaxVoices + 1;
+		Float64 goodLoad = 0.0;
+		UInt32 goodSteals = 0;
+		while (bad - good > 1) {
+			UInt32 voiceCount = good + (bad - good) / 2;
+			UInt32 steals;
+			Float64 load = measureSamplerLoad(&sampler, voiceCount, sliceFrames, &steals);
+			if (load > kMeasureLoad) // once more, in case something else had the CPU
+				load = measureSamplerLoad(&sampler, voiceCount, sliceFrames, &steals);
+			if (load <= kMeasureLoad) {
+				good = voiceCount;
+				goodLoad = load;
+				goodSteals = steals;
+			} else {
+				bad = voiceCount;
+			}
+		}
+		printf("%u-frame slices (%.2f ms): %u voices at most%s, %.0f%% of the slice at the 99th percentile, %u stolen\n",
+			   (unsigned)sliceFrames, sliceFrames * 1000.0 / kMeasureSampleRate, (unsigned)good,
+			   good == kMeasureMaxVoices ? " (the most tried)" : "", goodLoad * 100.0, (unsigned)goodSteals);
+	}
+	MySamplerDispose(&sampler);
+}
+
+// a stereo 16-bit WAV file of noise, unless there's already one of the right size
+static void writeStreamFile(const char *path, UInt32 frames) {
+	struct stat info;
+	UInt32 dataBytes = frames * 4;
+	if (stat(path, &info) == 0 && info.st_size == 44 + (off_t)dataBytes)
+		return;
+	FILE *file = fopen(path, "wb");
+	CheckError(file == NULL, "Couldn't create sample file");
+	Byte header[44] = { 'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ',
+		16, 0, 0, 0, 1, 0, 2, 0, 0x44, 0xAC, 0, 0, 0x10, 0xB1, 0x02, 0, 4, 0, 16, 0,
+		'd', 'a', 't', 'a', 0, 0, 0, 0 };
+	UInt32 riffBytes = 36 + dataBytes;
+	for (int i = 0; i < 4; i++) {
+		header[4 + i] = (Byte)(riffBytes >> (8 * i));
+		header[40 + i] = (Byte)(dataBytes >> (8 * i));
+	}
+	fwrite(header, 1, sizeof(header), file);
+	static SInt16 noise[65536];
+	UInt32 seed = frames;
+	for (UInt32 written = 0; written < frames; ) {
+		UInt32 count = frames - written < 32768 ? frames - written : 32768;
+		for (UInt32 i = 0; i < count * 2; i++) {
+			seed = seed * 1664525 + 1013904223;
+			noise[i] = (SInt16)(seed >> 18); // quiet: hundreds of them play at once
+		}
+		if (fwrite(noise, 4, count, file) != count)
+			CheckError(-1, "Couldn't write sample file");
+		written += count;
+	}
+	fclose(file);
+}
+
+// tell the system the file needn't stay cached, so streaming has to read it from disk
+static void uncacheStreamFile(const char *path) {
+#ifdef POSIX_FADV_DONTNEED
+	int fd = open(path, O_RDONLY);
+	if (fd >= 0) {
+		fdatasync(fd);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+#endif
+}
+
+// play kStreamNotesPerSecond notes a second, for kStreamSeconds, from samples far
+// bigger than the memory MySampler is allowed to keep them in, rendering each
+// slice when its time comes as an output unit would
+void measureStreaming(const char *directory) {
+	UInt32 frames = (UInt32)(kStreamGigabytes * 1073741824.0 / kStreamFiles / 4);
+	char path[kMySamplerMaxPath];
+	printf("%d files of %.0f MB in %s\n", kStreamFiles, frames * 4 / 1048576.0, directory);
+	for (int i = 0; i < kStreamFiles; i++) {
+		snprintf(path, sizeof(path), "%s/stream-%02d.wav", directory, i);
+		writeStreamFile(path, frames);
+		uncacheStreamFile(path);
+	}
+	
+	MySampler sampler;
+	CheckError(MySamplerInit(&sampler, kMeasureSampleRate), "MySamplerInit failed");
+	CheckError(MySamplerSetStreaming(&sampler, kStreamHeadFrames, kStreamPreloadLimit), "Couldn't start streaming");
+	CheckError(MySamplerSetVoiceCount(&sampler, kStreamVoices), "Couldn't set voice count");
+	for (int i = 0; i < kStreamFiles; i++) {
+		snprintf(path, sizeof(path), "%s/stream-%02d.wav", directory, i);
+		MySamplerZone zone = {0};
+		CheckError(MySamplerOpenSample(&sampler, path, &zone.sampleIndex), "Couldn't open sample file");
+		zone.minKey = zone.maxKey = zone.rootKey = kStreamLowKey + i;
+		zone.maxVelocity = 127;
+		zone.gain = 1.0f;
+		zone.envelope.attackSeconds = 0.005;
+		zone.envelope.sustainLevel = 1.0f;
+		zone.envelope.releaseSeconds = 0.1;
+		CheckError(MySamplerAddZone(&sampler, &zone), "Couldn't add zone");
+	}
+	
+	// note offs, in the order they're due
+	UInt32 slices = (UInt32)(kStreamSeconds * kMeasureSampleRate / kStreamSliceFrames);
+	UInt32 noteSlices = (UInt32)(kStreamNoteSeconds * kMeasureSampleRate / kStreamSliceFrames);
+	UInt32 offCapacity = (UInt32)(kStreamNotesPerSecond * (kStreamNoteSeconds + 1.0));
+	UInt32 *offSlices = (UInt32*) calloc(offCapacity, sizeof(UInt32));
+	Byte *offKeys = (Byte*) calloc(offCapacity, 1);
+	UInt32 offsWritten = 0, offsRead = 0;
+	
+	Float32 left[kStreamSliceFrames], right[kStreamSliceFrames];
+	Float64 ticksPerSecond = MyMIDIEventQueueTicksPerSecond();
+	UInt64 ticksPerSlice = (UInt64)(kStreamSliceFrames / kMeasureSampleRate * ticksPerSecond);
+	UInt64 start = MyMIDIEventQueueClock();
+	UInt32 lateSlices = 0;
+	Float64 notesDue = 0.0;
+	UInt32 notes = 0;
+	for (UInt32 slice = 0; slice < slices; slice++) {
+		notesDue += kStreamNotesPerSecond * kStreamSliceFrames / kMeasureSampleRate;
+		for (; notesDue >= 1.0 && offsWritten - offsRead < offCapacity; notesDue -= 1.0, notes++) {
+			Byte key = kStreamLowKey + (notes * 37) % kStreamFiles;
+			MySamplerScheduleMIDIEvent(&sampler, 0x90, key, 100, (notes * 53) % kStreamSliceFrames);
+			offSlices[offsWritten % offCapacity] = slice + noteSlices;
+			offKeys[offsWritten++ % offCapacity] = key;
+		}
+		while (offsRead != offsWritten && offSlices[offsRead % offCapacity] <= slice)
+			MySamplerScheduleMIDIEvent(&sampler, 0x80, offKeys[offsRead++ % offCapacity], 0, 0);
+		
+		// wait for the slice's time, as the output unit would
+		UInt64 due = start + slice * ticksPerSlice;
+		UInt64 now = MyMIDIEventQueueClock();
+		if (now < due)
+			usleep((useconds_t)((due - now) * 1000000.0 / ticksPerSecond));
+		MySamplerRender(&sampler, left, right, kStreamSliceFrames);
+		if (MyMIDIEventQueueClock() > due + ticksPerSlice)
+			lateSlices++;
+	}
+	
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+	Float64 residentMB = usage.ru_maxrss / 1048576.0; // bytes
+#else
+	Float64 residentMB = usage.ru_maxrss / 1024.0; // kilobytes
+#endif
+	printf("%u notes in %.0f seconds, %.0f MB of samples in %d files\n", (unsigned)notes, kStreamSeconds,
+		   kStreamFiles * frames * 4 / 1048576.0, kStreamFiles);
+	printf("memory: %.1f MB resident at most, %.1f MB of sample heads, %.1f MB of stream blocks\n",
+		   residentMB, sampler.sampleBytes / 1048576.0, sampler.streamBytes / 1048576.0);
+	printf("%u of %u slices rendered after they were due\n", (unsigned)lateSlices, (unsigned)slices);
+	MySamplerPrintStats(&sampler, stdout);
+	free(offSlices);
+	free(offKeys);
+	MySamplerDispose(&sampler);
+}
+
 #pragma mark - main
 int main (int argc, const char * argv[])
 {
+	if (argc > 1 && strcmp(argv[1], "measure") == 0) {
+		measureSampler(argc > 2 ? argv[2] : NULL);
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "stream") == 0) {
+		measureStreaming(argc > 2 ? argv[2] : "/tmp");
+		return 0;
+	}
 	
-	MyMIDIPlayer player;
+	MyMIDIPlayer player = {0};
 	
 	setupAUGraph(&player);
 	setupMIDI(&player);
@@ -210,8 +589,18 @@ int main (int argc, const char * argv[])
 	CheckError (AUGraphStart(player.graph),
 				"couldn't start graph");
 	
-	CFRunLoopRun();
-	// run until aborted with control-C
+	// run until aborted with control-C, showing how the events are doing
+	UInt32 shownDelivered = 0;
+	while (1) {
+		CFRunLoopRunInMode(kCFRunLoopDefaultMode, 1.0, false);
+		if (player.eventQueue.delivered != shownDelivered) {
+			shownDelivered = player.eventQueue.delivered;
+			MyMIDIEventQueuePrintStats(&player.eventQueue, stdout);
+#if useMySampler
+			MySamplerPrintStats(&player.sampler, stdout);
+#endif
+		}
+	}
 	
 	return 0;
 }
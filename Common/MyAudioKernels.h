@@ -0,0 +1,564 @@
+//
+//  MyAudioKernels.h
+//  Common
+//
+//  Copyright 2026 Subsequently and Furthermore, Inc. All rights reserved.
+//
+
+// Block sample-format kernels that several of the samples share: 16- and 24-bit
+// integer <-> float conversion, endian swapping, interleaving and de-interleaving
+// AudioBufferList-shaped data, gain, mixing and resampling. Each kernel works on
+// a whole buffer per call, so render callbacks don't have to touch one sample at
+// a time.
+//
+// The vector paths are picked when the file is compiled: SSE2 on Intel (every
+// Intel Mac has it) and NEON on ARM (every armv7 iOS device has it). Anything
+// else, or defining MY_AUDIO_KERNELS_NO_SIMD, gets the plain C loops, which are
+// also what the vector paths use for their leftover samples. Pointers don't need
+// any particular alignment.
+
+#ifndef Common_MyAudioKernels_h
+#define Common_MyAudioKernels_h
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <math.h>
+
+#if !defined(MY_AUDIO_KERNELS_NO_SIMD) && defined(__SSE2__)
+#define MY_AUDIO_KERNELS_SSE2 1
+#include <emmintrin.h>
+#elif !defined(MY_AUDIO_KERNELS_NO_SIMD) && (defined(__ARM_NEON__) || defined(__ARM_NEON))
+#define MY_AUDIO_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+// full scale for 16- and 24-bit samples. floats outside -1.0 ... 1.0 are clipped
+#define kMyInt16Scale	32768.0f
+#define kMyInt24Scale	8388608.0f
+
+#pragma mark - integer <-> float -
+
+static inline void MyInt16ToFloat(const SInt16 *src, Float32 *dst, UInt32 count)
+{
+	UInt32 i = 0;
+#if MY_AUDIO_KERNELS_SSE2
+	const __m128 scale = _mm_set1_ps(1.0f / kMyInt16Scale);
+	for (; i + 8 <= count; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+		// sign-extend each half to 32 bits
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+#elif MY_AUDIO_KERNELS_NEON
+	for (; i + 8 <= count; i += 8) {
+		int16x8_t x = vld1q_s16(src + i);
+		vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), 1.0f / kMyInt16Scale));
+		vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), 1.0f / kMyInt16Scale));
+	}
+#endif
+	for (; i < count; i++)
+		dst[i] = src[i] * (1.0f / kMyInt16Scale);
+}
+
+// rounds to the nearest integer and clips to the 16-bit range
+static inline void MyFloatToInt16(const Float32 *src, SInt16 *dst, UInt32 count)
+{
+	UInt32 i = 0;
+#if MY_AUDIO_KERNELS_SSE2
+	const __m128 scale = _mm_set1_ps(kMyInt16Scale);
+	const __m128 minValue = _mm_set1_ps(-32768.0f);
+	const __m128 maxValue = _mm_set1_ps(32767.0f);
+	for (; i + 8 <= count; i += 8) {
+		__m128 a = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+		__m128 b = _mm_mul_ps(_mm_loadu_ps(src + i + 4), scale);
+		a = _mm_min_ps(_mm_max_ps(a, minValue), maxValue);
+		b = _mm_min_ps(_mm_max_ps(b, minValue), maxValue);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+	}
+#elif MY_AUDIO_KERNELS_NEON
+	const float32x4_t minValue = vdupq_n_f32(-32768.0f);
+	const float32x4_t maxValue = vdupq_n_f32(32767.0f);
+#if !defined(__aarch64__) && (!defined(__ARM_ARCH) || __ARM_ARCH < 8)
+	// armv7 has no rounding conversion. adding and taking away 1.5 * 2^23 rounds
+	// to the nearest integer, ties to even, and then vcvtq's truncation is exact
+	const float32x4_t roundingBias = vdupq_n_f32(12582912.0f);
+#endif
+	for (; i + 8 <= count; i += 8) {
+		float32x4_t a = vmulq_n_f32(vld1q_f32(src + i), kMyInt16Scale);
+		float32x4_t b = vmulq_n_f32(vld1q_f32(src + i + 4), kMyInt16Scale);
+		a = vminq_f32(vmaxq_f32(a, minValue), maxValue);
+		b = vminq_f32(vmaxq_f32(b, minValue), maxValue);
+		// round to nearest, ties to even, the same as _mm_cvtps_epi32 and lrintf
+#if defined(__aarch64__) || (defined(__ARM_ARCH) && __ARM_ARCH >= 8)
+		int32x4_t ia = vcvtnq_s32_f32(a);
+		int32x4_t ib = vcvtnq_s32_f32(b);
+#else
+		int32x4_t ia = vcvtq_s32_f32(vsubq_f32(vaddq_f32(a, roundingBias), roundingBias));
+		int32x4_t ib = vcvtq_s32_f32(vsubq_f32(vaddq_f32(b, roundingBias), roundingBias));
+#endif
+		vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(ia), vqmovn_s32(ib)));
+	}
+#endif
+	for (; i < count; i++) {
+		Float32 x = src[i] * kMyInt16Scale;
+		if (x < -32768.0f)
+			x = -32768.0f;
+		else if (x > 32767.0f)
+			x = 32767.0f;
+		dst[i] = (SInt16)lrintf(x);
+	}
+}
+
+// packed 3-byte samples. there's no cheap way to gather 3-byte lanes without
+// SSSE3 shuffles, so these stay scalar on every architecture
+static inline void MyInt24ToFloat(const Byte *src, Float32 *dst, UInt32 count, Boolean isBigEndian)
+{
+	UInt32 i;
+	for (i = 0; i < count; i++, src += 3) {
+		SInt32 value;
+		if (isBigEndian)
+			value = ((SInt32)src[0] << 24) | ((SInt32)src[1] << 16) | ((SInt32)src[2] << 8);
+		else
+			value = ((SInt32)src[2] << 24) | ((SInt32)src[1] << 16) | ((SInt32)src[0] << 8);
+		// the value is in the top 24 bits, so the shift sign-extends it
+		dst[i] = (value >> 8) * (1.0f / kMyInt24Scale);
+	}
+}
+
+static inline void MyFloatToInt24(const Float32 *src, Byte *dst, UInt32 count, Boolean isBigEndian)
+{
+	UInt32 i;
+	for (i = 0; i < count; i++, dst += 3) {
+		Float32 x = src[i] * kMyInt24Scale;
+		if (x < -8388608.0f)
+			x = -8388608.0f;
+		else if (x > 8388607.0f)
+			x = 8388607.0f;
+		UInt32 value = (UInt32)(SInt32)lrintf(x);
+		if (isBigEndian) {
+			dst[0] = (Byte)(value >> 16);
+			dst[1] = (Byte)(value >> 8);
+			dst[2] = (Byte)value;
+		} else {
+			dst[0] = (Byte)value;
+			dst[1] = (Byte)(value >> 8);
+			dst[2] = (Byte)(value >> 16);
+		}
+	}
+}
+
+#pragma mark - endian swap -
+
+// in place. use for 16-bit samples
+static inline void MySwapInt16(UInt16 *samples, UInt32 count)
+{
+	UInt32 i = 0;
+#if MY_AUDIO_KERNELS_SSE2
+	for (; i + 8 <= count; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(samples + i));
+		_mm_storeu_si128((__m128i *)(samples + i), _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8)));
+	}
+#elif MY_AUDIO_KERNELS_NEON
+	for (; i + 8 <= count; i += 8)
+		vst1q_u16(samples + i, vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(vld1q_u16(samples + i)))));
+#endif
+	for (; i < count; i++)
+		samples[i] = (UInt16)((samples[i] << 8) | (samples[i] >> 8));
+}
+
+// in place. use for 32-bit integer and float samples
+static inline void MySwapInt32(UInt32 *samples, UInt32 count)
+{
+	UInt32 i = 0;
+#if MY_AUDIO_KERNELS_SSE2
+	for (; i + 4 <= count; i += 4) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(samples + i));
+		// swap the 16-bit halves, then the bytes within each half
+		x = _mm_or_si128(_mm_slli_epi32(x, 16), _mm_srli_epi32(x, 16));
+		_mm_storeu_si128((__m128i *)(samples + i), _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8)));
+	}
+#elif MY_AUDIO_KERNELS_NEON
+	for (; i + 4 <= count; i += 4)
+		vst1q_u32(samples + i, vreinterpretq_u32_u8(vrev32q_u8(vreinterpretq_u8_u32(vld1q_u32(samples + i)))));
+#endif
+	for (; i < count; i++) {
+		UInt32 x = samples[i];
+		samples[i] = (x << 24) | ((x & 0xff00) << 8) | ((x >> 8) & 0xff00) | (x >> 24);
+	}
+}
+
+#pragma mark - interleave / de-interleave -
+
+// src has one buffer per channel; dst gets mNumberBuffers channels per frame
+static inline void MyInterleaveFloat(const AudioBufferList *src, Float32 *dst, UInt32 frames)
+{
+	UInt32 channels = src->mNumberBuffers;
+	UInt32 frame = 0;
+	if (channels == 2) {
+		const Float32 *left = (const Float32 *)src->mBuffers[0].mData;
+		const Float32 *right = (const Float32 *)src->mBuffers[1].mData;
+#if MY_AUDIO_KERNELS_SSE2
+		for (; frame + 4 <= frames; frame += 4) {
+			__m128 l = _mm_loadu_ps(left + frame);
+			__m128 r = _mm_loadu_ps(right + frame);
+			_mm_storeu_ps(dst + frame * 2, _mm_unpacklo_ps(l, r));
+			_mm_storeu_ps(dst + frame * 2 + 4, _mm_unpackhi_ps(l, r));
+		}
+#elif MY_AUDIO_KERNELS_NEON
+		for (; frame + 4 <= frames; frame += 4) {
+			float32x4x2_t lr;
+			lr.val[0] = vld1q_f32(left + frame);
+			lr.val[1] = vld1q_f32(right + frame);
+			vst2q_f32(dst + frame * 2, lr);
+		}
+#endif
+		for (; frame < frames; frame++) {
+			dst[frame * 2] = left[frame];
+			dst[frame * 2 + 1] = right[frame];
+		}
+		return;
+	}
+	UInt32 channel;
+	for (channel = 0; channel < channels; channel++) {
+		const Float32 *in = (const Float32 *)src->mBuffers[channel].mData;
+		for (frame = 0; frame < frames; frame++)
+			dst[frame * channels + channel] = in[frame];
+	}
+}
+
+// src has mNumberBuffers channels per frame; each of dst's buffers gets one channel
+static inline void MyDeinterleaveFloat(const Float32 *src, AudioBufferList *dst, UInt32 frames)
+{
+	UInt32 channels = dst->mNumberBuffers;
+	UInt32 frame = 0;
+	UInt32 channel;
+	for (channel = 0; channel < channels; channel++)
+		dst->mBuffers[channel].mDataByteSize = frames * sizeof(Float32);
+	if (channels == 2) {
+		Float32 *left = (Float32 *)dst->mBuffers[0].mData;
+		Float32 *right = (Float32 *)dst->mBuffers[1].mData;
+#if MY_AUDIO_KERNELS_SSE2
+		for (; frame + 4 <= frames; frame += 4) {
+			__m128 a = _mm_loadu_ps(src + frame * 2);
+			__m128 b = _mm_loadu_ps(src + frame * 2 + 4);
+			_mm_storeu_ps(left + frame, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+			_mm_storeu_ps(right + frame, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+		}
+#elif MY_AUDIO_KERNELS_NEON
+		for (; frame + 4 <= frames; frame += 4) {
+			float32x4x2_t lr = vld2q_f32(src + frame * 2);
+			vst1q_f32(left + frame, lr.val[0]);
+			vst1q_f32(right + frame, lr.val[1]);
+		}
+#endif
+		for (; frame < frames; frame++) {
+			left[frame] = src[frame * 2];
+			right[frame] = src[frame * 2 + 1];
+		}
+		return;
+	}
+	for (channel = 0; channel < channels; channel++) {
+		Float32 *out = (Float32 *)dst->mBuffers[channel].mData;
+		for (frame = 0; frame < frames; frame++)
+			out[frame] = src[frame * channels + channel];
+	}
+}
+
+static inline void MyInterleaveInt16(const AudioBufferList *src, SInt16 *dst, UInt32 frames)
+{
+	UInt32 channels = src->mNumberBuffers;
+	UInt32 frame = 0;
+	if (channels == 2) {
+		const SInt16 *left = (const SInt16 *)src->mBuffers[0].mData;
+		const SInt16 *right = (const SInt16 *)src->mBuffers[1].mData;
+#if MY_AUDIO_KERNELS_SSE2
+		for (; frame + 8 <= frames; frame += 8) {
+			__m128i l = _mm_loadu_si128((const __m128i *)(left + frame));
+			__m128i r = _mm_loadu_si128((const __m128i *)(right + frame));
+			_mm_storeu_si128((__m128i *)(dst + frame * 2), _mm_unpacklo_epi16(l, r));
+			_mm_storeu_si128((__m128i *)(dst + frame * 2 + 8), _mm_unpackhi_epi16(l, r));
+		}
+#elif MY_AUDIO_KERNELS_NEON
+		for (; frame + 8 <= frames; frame += 8) {
+			int16x8x2_t lr;
+			lr.val[0] = vld1q_s16(left + frame);
+			lr.val[1] = vld1q_s16(right + frame);
+			vst2q_s16(dst + frame * 2, lr);
+		}
+#endif
+		for (; frame < frames; frame++) {
+			dst[frame * 2] = left[frame];
+			dst[frame * 2 + 1] = right[frame];
+		}
+		return;
+	}
+	UInt32 channel;
+	for (channel = 0; channel < channels; channel++) {
+		const SInt16 *in = (const SInt16 *)src->mBuffers[channel].mData;
+		for (frame = 0; frame < frames; frame++)
+			dst[frame * channels + channel] = in[frame];
+	}
+}
+
+static inline void MyDeinterleaveInt16(const SInt16 *src, AudioBufferList *dst, UInt32 frames)
+{
+	UInt32 channels = dst->mNumberBuffers;
+	UInt32 frame = 0;
+	UInt32 channel;
+	for (channel = 0; channel < channels; channel++)
+		dst->mBuffers[channel].mDataByteSize = frames * sizeof(SInt16);
+	if (channels == 2) {
+		SInt16 *left = (SInt16 *)dst->mBuffers[0].mData;
+		SInt16 *right = (SInt16 *)dst->mBuffers[1].mData;
+#if MY_AUDIO_KERNELS_SSE2
+		for (; frame + 8 <= frames; frame += 8) {
+			__m128i a = _mm_loadu_si128((const __m128i *)(src + frame * 2));
+			__m128i b = _mm_loadu_si128((const __m128i *)(src + frame * 2 + 8));
+			// left samples are the low half of each 32-bit frame, right the high half.
+			// sign-extend each to 32 bits, then pack the two registers back down
+			__m128i la = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+			__m128i lb = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+			_mm_storeu_si128((__m128i *)(left + frame), _mm_packs_epi32(la, lb));
+			_mm_storeu_si128((__m128i *)(right + frame), _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16)));
+		}
+#elif MY_AUDIO_KERNELS_NEON
+		for (; frame + 8 <= frames; frame += 8) {
+			int16x8x2_t lr = vld2q_s16(src + frame * 2);
+			vst1q_s16(left + frame, lr.val[0]);
+			vst1q_s16(right + frame, lr.val[1]);
+		}
+#endif
+		for (; frame < frames; frame++) {
+			left[frame] = src[frame * 2];
+			right[frame] = src[frame * 2 + 1];
+		}
+		return;
+	}
+	for (channel = 0; channel < channels; channel++) {
+		SInt16 *out = (SInt16 *)dst->mBuffers[channel].mData;
+		for (frame = 0; frame < frames; frame++)
+			out[frame] = src[frame * channels + channel];
+	}
+}
+
+#pragma mark - gain -
+
+// in place
+static inline void MyApplyGain(Float32 *samples, UInt32 count, Float32 gain)
+{
+	UInt32 i = 0;
+#if MY_AUDIO_KERNELS_SSE2
+	const __m128 g = _mm_set1_ps(gain);
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), g));
+#elif MY_AUDIO_KERNELS_NEON
+	for (; i + 4 <= count; i += 4)
+		vst1q_f32(samples + i, vmulq_n_f32(vld1q_f32(samples + i), gain));
+#endif
+	for (; i < count; i++)
+		samples[i] *= gain;
+}
+
+// in place. multiplies every channel of each interleaved frame by that frame's gain
+static inline void MyApplyFrameGains(Float32 *samples, UInt32 channels, const Float32 *gains, UInt32 frames)
+{
+	UInt32 frame = 0;
+	if (channels == 1) {
+#if MY_AUDIO_KERNELS_SSE2
+		for (; frame + 4 <= frames; frame += 4)
+			_mm_storeu_ps(samples + frame, _mm_mul_ps(_mm_loadu_ps(samples + frame), _mm_loadu_ps(gains + frame)));
+#elif MY_AUDIO_KERNELS_NEON
+		for (; frame + 4 <= frames; frame += 4)
+			vst1q_f32(samples + frame, vmulq_f32(vld1q_f32(samples + frame), vld1q_f32(gains + frame)));
+#endif
+	} else if (channels == 2) {
+#if MY_AUDIO_KERNELS_SSE2
+		for (; frame + 4 <= frames; frame += 4) {
+			__m128 g = _mm_loadu_ps(gains + frame);
+			Float32 *s = samples + frame * 2;
+			// (g0, g0, g1, g1) and (g2, g2, g3, g3) line up with the interleaved frames
+			_mm_storeu_ps(s, _mm_mul_ps(_mm_loadu_ps(s), _mm_unpacklo_ps(g, g)));
+			_mm_storeu_ps(s + 4, _mm_mul_ps(_mm_loadu_ps(s + 4), _mm_unpackhi_ps(g, g)));
+		}
+#elif MY_AUDIO_KERNELS_NEON
+		for (; frame + 4 <= frames; frame += 4) {
+			float32x4x2_t lr = vld2q_f32(samples + frame * 2);
+			float32x4_t g = vld1q_f32(gains + frame);
+			lr.val[0] = vmulq_f32(lr.val[0], g);
+			lr.val[1] = vmulq_f32(lr.val[1], g);
+			vst2q_f32(samples + frame * 2, lr);
+		}
+#endif
+	}
+	for (; frame < frames; frame++) {
+		UInt32 channel;
+		for (channel = 0; channel < channels; channel++)
+			samples[frame * channels + channel] *= gains[frame];
+	}
+}
+
+#pragma mark - mixing -
+
+// add a mono signal into an interleaved stereo mix, with each side's gain ramping
+// linearly from gainLeft/gainRight by the given step every frame
+static inline void MyMixMonoIntoStereo(const Float32 *src, Float32 *dst, UInt32 frames,
+									   Float32 gainLeft, Float32 stepLeft,
+									   Float32 gainRight, Float32 stepRight)
+{
+	UInt32 frame = 0;
+#if MY_AUDIO_KERNELS_SSE2
+	const __m128 ramp = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+	const __m128 stepL = _mm_set1_ps(stepLeft);
+	const __m128 stepR = _mm_set1_ps(stepRight);
+	for (; frame + 4 <= frames; frame += 4) {
+		__m128 position = _mm_add_ps(_mm_set1_ps((Float32)frame), ramp);
+		__m128 gl = _mm_add_ps(_mm_set1_ps(gainLeft), _mm_mul_ps(position, stepL));
+		__m128 gr = _mm_add_ps(_mm_set1_ps(gainRight), _mm_mul_ps(position, stepR));
+		__m128 s = _mm_loadu_ps(src + frame);
+		__m128 l = _mm_mul_ps(s, gl);
+		__m128 r = _mm_mul_ps(s, gr);
+		Float32 *d = dst + frame * 2;
+		_mm_storeu_ps(d, _mm_add_ps(_mm_loadu_ps(d), _mm_unpacklo_ps(l, r)));
+		_mm_storeu_ps(d + 4, _mm_add_ps(_mm_loadu_ps(d + 4), _mm_unpackhi_ps(l, r)));
+	}
+#elif MY_AUDIO_KERNELS_NEON
+	const Float32 rampValues[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+	const float32x4_t ramp = vld1q_f32(rampValues);
+	for (; frame + 4 <= frames; frame += 4) {
+		float32x4_t position = vaddq_f32(vdupq_n_f32((Float32)frame), ramp);
+		float32x4_t gl = vmlaq_n_f32(vdupq_n_f32(gainLeft), position, stepLeft);
+		float32x4_t gr = vmlaq_n_f32(vdupq_n_f32(gainRight), position, stepRight);
+		float32x4_t s = vld1q_f32(src + frame);
+		float32x4x2_t lr = vld2q_f32(dst + frame * 2);
+		lr.val[0] = vmlaq_f32(lr.val[0], s, gl);
+		lr.val[1] = vmlaq_f32(lr.val[1], s, gr);
+		vst2q_f32(dst + frame * 2, lr);
+	}
+#endif
+	for (; frame < frames; frame++) {
+		dst[frame * 2] += src[frame] * (gainLeft + frame * stepLeft);
+		dst[frame * 2 + 1] += src[frame] * (gainRight + frame * stepRight);
+	}
+}
+
+// add src into dst, with the gain ramping linearly from gain by step every sample
+static inline void MyMixWithGainRamp(const Float32 *src, Float32 *dst, UInt32 count, Float32 gain, Float32 step)
+{
+	UInt32 i = 0;
+#if MY_AUDIO_KERNELS_SSE2
+	const __m128 ramp = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+	const __m128 g0 = _mm_set1_ps(gain);
+	const __m128 s = _mm_set1_ps(step);
+	for (; i + 4 <= count; i += 4) {
+		__m128 g = _mm_add_ps(g0, _mm_mul_ps(_mm_add_ps(_mm_set1_ps((Float32)i), ramp), s));
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), g)));
+	}
+#elif MY_AUDIO_KERNELS_NEON
+	const Float32 rampValues[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+	const float32x4_t ramp = vld1q_f32(rampValues);
+	for (; i + 4 <= count; i += 4) {
+		float32x4_t g = vmlaq_n_f32(vdupq_n_f32(gain), vaddq_f32(vdupq_n_f32((Float32)i), ramp), step);
+		vst1q_f32(dst + i, vmlaq_f32(vld1q_f32(dst + i), vld1q_f32(src + i), g));
+	}
+#endif
+	for (; i < count; i++)
+		dst[i] += src[i] * (gain + i * step);
+}
+
+#pragma mark - resampling -
+
+// read src at a position that starts at position and moves on by increment for
+// every sample written, interpolating linearly between neighbouring samples.
+// position and increment are 32.32 fixed point frames, so a long sample played
+// back at any speed doesn't drift. src[(position >> 32) + 1] has to be readable
+// for every sample written. fractions are kept to 24 bits, which a float holds
+// exactly
+static inline void MyInterpolateLinear(const Float32 *src, UInt64 position, UInt64 increment,
+									   Float32 *dst, UInt32 count)
+{
+	UInt32 i = 0;
+#if MY_AUDIO_KERNELS_SSE2
+	const __m128 fractionScale = _mm_set1_ps(1.0f / 16777216.0f);
+	for (; i + 4 <= count; i += 4) {
+		// each lane reads from a place of its own, so the loads are scalar
+		UInt64 p0 = position;
+		UInt64 p1 = p0 + increment;
+		UInt64 p2 = p1 + increment;
+		UInt64 p3 = p2 + increment;
+		position = p3 + increment;
+		const Float32 *s0 = src + (p0 >> 32);
+		const Float32 *s1 = src + (p1 >> 32);
+		const Float32 *s2 = src + (p2 >> 32);
+		const Float32 *s3 = src + (p3 >> 32);
+		__m128 a = _mm_set_ps(s3[0], s2[0], s1[0], s0[0]);
+		__m128 b = _mm_set_ps(s3[1], s2[1], s1[1], s0[1]);
+		__m128i fractions = _mm_set_epi32((int)((UInt32)p3 >> 8), (int)((UInt32)p2 >> 8),
+										  (int)((UInt32)p1 >> 8), (int)((UInt32)p0 >> 8));
+		__m128 f = _mm_mul_ps(_mm_cvtepi32_ps(fractions), fractionScale);
+		_mm_storeu_ps(dst + i, _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), f)));
+	}
+#elif MY_AUDIO_KERNELS_NEON
+	for (; i + 4 <= count; i += 4) {
+		Float32 a[4], b[4];
+		uint32_t fractions[4];
+		int lane;
+		for (lane = 0; lane < 4; lane++) {
+			const Float32 *s = src + (position >> 32);
+			a[lane] = s[0];
+			b[lane] = s[1];
+			fractions[lane] = (UInt32)position >> 8;
+			position += increment;
+		}
+		float32x4_t va = vld1q_f32(a);
+		float32x4_t f = vmulq_n_f32(vcvtq_f32_u32(vld1q_u32(fractions)), 1.0f / 16777216.0f);
+		vst1q_f32(dst + i, vmlaq_f32(va, vsubq_f32(vld1q_f32(b), va), f));
+	}
+#endif
+	for (; i < count; i++) {
+		const Float32 *s = src + (position >> 32);
+		Float32 fraction = (Float32)((UInt32)position >> 8) * (1.0f / 16777216.0f);
+		dst[i] = s[0] + (s[1] - s[0]) * fraction;
+		position += increment;
+	}
+}
+
+#pragma mark - complex -
+
+// (outRe + i outIm) += (aRe + i aIm) * (bRe + i bIm), element by element, on
+// split complex arrays (real and imaginary parts in separate arrays)
+static inline void MyComplexMultiplyAdd(const Float32 *aRe, const Float32 *aIm,
+										const Float32 *bRe, const Float32 *bIm,
+										Float32 *outRe, Float32 *outIm, UInt32 count)
+{
+	UInt32 i = 0;
+#if MY_AUDIO_KERNELS_SSE2
+	for (; i + 4 <= count; i += 4) {
+		__m128 ar = _mm_loadu_ps(aRe + i);
+		__m128 ai = _mm_loadu_ps(aIm + i);
+		__m128 br = _mm_loadu_ps(bRe + i);
+		__m128 bi = _mm_loadu_ps(bIm + i);
+		__m128 re = _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi));
+		__m128 im = _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br));
+		_mm_storeu_ps(outRe + i, _mm_add_ps(_mm_loadu_ps(outRe + i), re));
+		_mm_storeu_ps(outIm + i, _mm_add_ps(_mm_loadu_ps(outIm + i), im));
+	}
+#elif MY_AUDIO_KERNELS_NEON
+	for (; i + 4 <= count; i += 4) {
+		float32x4_t ar = vld1q_f32(aRe + i);
+		float32x4_t ai = vld1q_f32(aIm + i);
+		float32x4_t br = vld1q_f32(bRe + i);
+		float32x4_t bi = vld1q_f32(bIm + i);
+		float32x4_t re = vmlsq_f32(vmlaq_f32(vld1q_f32(outRe + i), ar, br), ai, bi);
+		float32x4_t im = vmlaq_f32(vmlaq_f32(vld1q_f32(outIm + i), ar, bi), ai, br);
+		vst1q_f32(outRe + i, re);
+		vst1q_f32(outIm + i, im);
+	}
+#endif
+	for (; i < count; i++) {
+		outRe[i] += aRe[i] * bRe[i] - aIm[i] * bIm[i];
+		outIm[i] += aRe[i] * bIm[i] + aIm[i] * bRe[i];
+	}
+}
+
+#endif
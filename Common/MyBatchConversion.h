@@ -0,0 +1,185 @@
+//
+//  MyBatchConversion.h
+//  Common
+//
+//  Copyright 2026 Subsequently and Furthermore, Inc. All rights reserved.
+//
+
+// The batch part of the CH06 converters: which files to convert, what to call
+// what they're converted to, and how the batch went. Each file is a
+// MyConversionJob, and converting it is up to the converter. A converter
+// reports a failed step with MyBatchCheckResult() and gives up on that job
+// alone, so one bad file doesn't stop the rest of the batch.
+
+#ifndef Common_MyBatchConversion_h
+#define Common_MyBatchConversion_h
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "MyPacketIndex.h"
+
+// one file in a batch conversion. each job gets its own files and converter,
+// so jobs can run on separate threads
+typedef struct MyConversionJob
+{
+	char						inputPath[PATH_MAX];
+	char						outputPath[PATH_MAX];
+	Boolean						succeeded;
+	UInt64						inputFileBytes; // size of the input file, for MB/s
+	Float64						audioSeconds; // duration of the input audio
+	Float64						elapsedSeconds; // wall clock time the conversion took
+} MyConversionJob;
+
+#pragma mark - jobs -
+
+// add a job for inputPath to the jobs array, growing it as needed
+static inline void MyBatchAddJob(MyConversionJob **jobs, UInt32 *jobCount, UInt32 *jobCapacity, const char *inputPath)
+{
+	if (*jobCount == *jobCapacity)
+	{
+		*jobCapacity = *jobCapacity ? *jobCapacity * 2 : 64;
+		*jobs = (MyConversionJob *)realloc(*jobs, *jobCapacity * sizeof(MyConversionJob));
+	}
+	MyConversionJob *job = &(*jobs)[*jobCount];
+	memset(job, 0, sizeof(MyConversionJob));
+	strlcpy(job->inputPath, inputPath, sizeof(job->inputPath));
+	(*jobCount)++;
+}
+
+// whether a file found in a directory is one of the packet indexes MyPacketIndexOpen()
+// saves next to the audio files it indexes, rather than audio
+static inline Boolean MyBatchIsPacketIndex(const char *name)
+{
+	size_t nameLength = strlen(name);
+	size_t extensionLength = strlen(kMyPacketIndexExtension);
+	return nameLength > extensionLength &&
+		strcmp(name + nameLength - extensionLength, kMyPacketIndexExtension) == 0;
+}
+
+// every argument is either an audio file, or a directory whose (non-hidden) audio files are all converted
+static inline void MyBatchCollectJobs(int argc, const char *argv[], MyConversionJob **jobs, UInt32 *jobCount)
+{
+	UInt32 jobCapacity = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		struct stat pathStat;
+		if (stat(argv[i], &pathStat) != 0)
+		{
+			fprintf(stderr, "Skipping %s: no such file or directory\n", argv[i]);
+			continue;
+		}
+		if (! S_ISDIR(pathStat.st_mode))
+		{
+			MyBatchAddJob(jobs, jobCount, &jobCapacity, argv[i]);
+			continue;
+		}
+
+		DIR *dir = opendir(argv[i]);
+		if (dir == NULL)
+			continue;
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL)
+		{
+			if (entry->d_name[0] == '.' || MyBatchIsPacketIndex(entry->d_name))
+				continue;
+			char path[PATH_MAX];
+			snprintf(path, sizeof(path), "%s/%s", argv[i], entry->d_name);
+			if (stat(path, &pathStat) == 0 && S_ISREG(pathStat.st_mode))
+				MyBatchAddJob(jobs, jobCount, &jobCapacity, path);
+		}
+		closedir(dir);
+	}
+}
+
+// name each output after its input ("song.m4a" -> "song.aif") in the current directory,
+// adding "-2", "-3"... if an earlier job or an existing file already has that name.
+// this runs before any conversion starts, so the threads never race for a name
+static inline void MyBatchChooseOutputPaths(MyConversionJob *jobs, UInt32 jobCount)
+{
+	for (UInt32 i = 0; i < jobCount; i++)
+	{
+		char baseName[PATH_MAX];
+		const char *fileName = strrchr(jobs[i].inputPath, '/');
+		strlcpy(baseName, fileName ? fileName + 1 : jobs[i].inputPath, sizeof(baseName));
+		char *extension = strrchr(baseName, '.');
+		if (extension && extension != baseName)
+			*extension = '\0';
+
+		for (int suffix = 1; ; suffix++)
+		{
+			if (suffix == 1)
+				snprintf(jobs[i].outputPath, sizeof(jobs[i].outputPath), "%s.aif", baseName);
+			else
+				snprintf(jobs[i].outputPath, sizeof(jobs[i].outputPath), "%s-%d.aif", baseName, suffix);
+
+			Boolean taken = (access(jobs[i].outputPath, F_OK) == 0);
+			for (UInt32 j = 0; j < i && ! taken; j++)
+				taken = (strcmp(jobs[i].outputPath, jobs[j].outputPath) == 0);
+			if (! taken)
+				break;
+		}
+	}
+}
+
+#pragma mark - errors -
+
+// like CheckResult(), but for one job of a batch: prints the error and returns
+// TRUE if result isn't noErr, rather than exiting
+static inline Boolean MyBatchCheckResult(const MyConversionJob *job, OSStatus result, const char *operation)
+{
+	if (result == noErr) return FALSE;
+
+	char errorString[20];
+	// see if it appears to be a 4-char-code
+	*(UInt32 *)(errorString + 1) = CFSwapInt32HostToBig(result);
+	if (isprint(errorString[1]) && isprint(errorString[2]) && isprint(errorString[3]) && isprint(errorString[4])) {
+		errorString[0] = errorString[5] = '\'';
+		errorString[6] = '\0';
+	} else
+		// no, format it as an integer
+		sprintf(errorString, "%d", (int)result);
+
+	fprintf(stderr, "Skipping %s: %s (%s)\n", job->inputPath, operation, errorString);
+	return TRUE;
+}
+
+#pragma mark - statistics -
+
+static inline void MyBatchPrintJob(const MyConversionJob *job)
+{
+	printf("%s -> %s: %.1f sec of audio in %.2f sec (%.1fx realtime, %.1f MB/s)\n",
+		   job->inputPath, job->outputPath,
+		   job->audioSeconds, job->elapsedSeconds,
+		   job->elapsedSeconds > 0 ? job->audioSeconds / job->elapsedSeconds : 0.0,
+		   job->elapsedSeconds > 0 ? job->inputFileBytes / (1024.0 * 1024.0) / job->elapsedSeconds : 0.0);
+}
+
+// the whole batch, which took batchSeconds of wall clock time
+static inline void MyBatchPrintSummary(const MyConversionJob *jobs, UInt32 jobCount, Float64 batchSeconds)
+{
+	UInt32 succeeded = 0;
+	Float64 totalAudioSeconds = 0;
+	UInt64 totalInputBytes = 0;
+	for (UInt32 i = 0; i < jobCount; i++)
+	{
+		if (! jobs[i].succeeded)
+			continue;
+		succeeded++;
+		totalAudioSeconds += jobs[i].audioSeconds;
+		totalInputBytes += jobs[i].inputFileBytes;
+	}
+	printf("Converted %u of %u file(s), %u failed: %.1f sec of audio in %.2f sec (%.1fx realtime, %.1f MB/s)\n",
+		   (unsigned int)succeeded, (unsigned int)jobCount, (unsigned int)(jobCount - succeeded),
+		   totalAudioSeconds, batchSeconds,
+		   batchSeconds > 0 ? totalAudioSeconds / batchSeconds : 0.0,
+		   batchSeconds > 0 ? totalInputBytes / (1024.0 * 1024.0) / batchSeconds : 0.0);
+}
+
+#endif
@@ -0,0 +1,101 @@
+//
+//  MyBufferPolicy.h
+//  Common
+//
+//  Copyright 2026 Subsequently and Furthermore, Inc. All rights reserved.
+//
+
+// How many audio queue buffers to use, and how big to make them, for a
+// recorder or a player that does its file I/O on another thread. Each buffer
+// has to last a good while longer than one read or write takes (the I/O
+// service time), or the disk can't keep up with the queue. Past that, the
+// target latency is split over kMyBufferPolicyPreferredBuffers buffers.
+//
+// Start with a guess at the service time, and once some real I/O has been
+// timed, compute the policy again with the longest time seen.
+//
+// The buffer count comes from how long each buffer plays. A format with no fixed
+// packet duration needs packetDuration, the average, to know that. Without it,
+// a default-sized buffer is assumed to play for the seconds asked of it.
+
+#ifndef Common_MyBufferPolicy_h
+#define Common_MyBufferPolicy_h
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <math.h>
+
+#define kMyBufferPolicyPreferredBuffers	3
+#define kMyBufferPolicyMinBuffers		2
+#define kMyBufferPolicyMaxBuffers		8
+#define kMyBufferPolicyDefaultBytes		0x10000 // for formats whose packets have no fixed duration
+
+typedef struct MyBufferPolicy {
+	Float64						targetLatency; // seconds of audio across all the queue's buffers
+	Float64						ioServiceTime; // seconds a file read or write takes (guessed or measured)
+	Float64						packetDuration; // average seconds a packet plays, for formats with no fixed packet duration. 0 if not known
+	UInt32						bufferCount;
+	UInt32						bufferByteSize;
+	UInt32						packetsPerBuffer; // most packets one buffer can hold
+	Float64						bufferDuration; // seconds of audio in each buffer
+} MyBufferPolicy;
+
+// fill in the buffer count and size from policy's targetLatency and ioServiceTime.
+// maxPacketSize is the largest packet format can have: mBytesPerPacket for CBR,
+// or the file's or the queue's maximum packet size for VBR
+static inline void MyComputeBufferPolicy(MyBufferPolicy *policy, const AudioStreamBasicDescription *format, UInt32 maxPacketSize)
+{
+	Float64 seconds = policy->targetLatency / kMyBufferPolicyPreferredBuffers;
+	if (seconds < 4 * policy->ioServiceTime)
+		seconds = 4 * policy->ioServiceTime;
+
+	UInt32 packets, bytes;
+	if (format->mBytesPerFrame > 0 && format->mSampleRate > 0)
+	{
+		// linear PCM: size to the frame
+		UInt32 frames = (UInt32)ceil(seconds * format->mSampleRate);
+		bytes = frames * format->mBytesPerFrame;
+		packets = format->mBytesPerPacket > 0 ? bytes / format->mBytesPerPacket : frames;
+		seconds = frames / format->mSampleRate;
+	}
+	else if (format->mFramesPerPacket > 0 && format->mSampleRate > 0)
+	{
+		// whole packets, each a known number of frames
+		packets = (UInt32)ceil(seconds * format->mSampleRate / format->mFramesPerPacket);
+		if (packets == 0)
+			packets = 1;
+		bytes = packets * maxPacketSize;
+		seconds = packets * format->mFramesPerPacket / format->mSampleRate;
+	}
+	else if (policy->packetDuration > 0)
+	{
+		// packets vary in length, but we know how long they are on average
+		packets = (UInt32)ceil(seconds / policy->packetDuration);
+		if (packets == 0)
+			packets = 1;
+		bytes = packets * maxPacketSize;
+		seconds = packets * policy->packetDuration;
+	}
+	else
+	{
+		// if frames per packet is zero, then the codec has no predictable packet == time
+		// so we can't tailor this (we don't know how many Packets represent a time period
+		// we'll just use a default 64K buffer, and count buffers as if it lasts seconds
+		packets = maxPacketSize > 0 ? kMyBufferPolicyDefaultBytes / maxPacketSize : 1;
+		if (packets == 0)
+			packets = 1;
+		bytes = packets * maxPacketSize;
+	}
+
+	policy->packetsPerBuffer = packets;
+	policy->bufferByteSize = bytes;
+	policy->bufferDuration = seconds;
+
+	UInt32 count = (UInt32)ceil(policy->targetLatency / seconds);
+	if (count < kMyBufferPolicyMinBuffers)
+		count = kMyBufferPolicyMinBuffers;
+	if (count > kMyBufferPolicyMaxBuffers)
+		count = kMyBufferPolicyMaxBuffers;
+	policy->bufferCount = count;
+}
+
+#endif
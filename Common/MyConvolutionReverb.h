@@ -0,0 +1,344 @@
+//
+//  MyConvolutionReverb.h
+//  Common
+//
+//  Copyright 2026 Subsequently and Furthermore, Inc. All rights reserved.
+//
+
+// A convolution reverb that can stand in for MatrixReverb: the input is
+// convolved with a recorded (or generated) impulse response of a room, so the
+// sound is whatever the impulse response sounds like. It only needs CoreAudio's
+// types, so it runs wherever MyRenderGraph does.
+//
+// Convolving with a response several seconds long, one sample at a time, would
+// be far too slow. Instead the response is cut into partitions of blockSize
+// frames, and each partition is kept as a spectrum. Every blockSize frames the
+// newest input block (with the block before it) goes through one FFT. The
+// output spectrum is the sum of each of the last partitionCount input spectra
+// times its partition's spectrum, and one inverse FFT of that sum gives the
+// next blockSize frames of reverb (overlap-save). All the partitions are the
+// same size, so the cost per block grows with the response's length, but the
+// FFTs stay small.
+//
+// The reverb is mono in, stereo out: the left and right responses are packed
+// into one complex signal (left + i right). Since the input is real, the inverse
+// FFT comes back as (left wet + i right wet), so both sides cost one FFT pair.
+//
+// The wet signal is late by blockSize frames, like a short pre-delay. The dry
+// signal passes straight through. Processing never allocates or locks, so it
+// is safe on the render thread.
+
+#ifndef Common_MyConvolutionReverb_h
+#define Common_MyConvolutionReverb_h
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "MyAudioKernels.h"
+
+typedef enum MyConvolutionReverbError {
+	kMyConvolutionReverbError_BadBlockSize = 1, // not a power of two from 16 to 16384
+	kMyConvolutionReverbError_NoImpulseResponse = 2,
+	kMyConvolutionReverbError_OutOfMemory = 3
+} MyConvolutionReverbError;
+
+// a radix-2 FFT on split complex data
+typedef struct MyFFT {
+	UInt32				size;
+	UInt32				*bitReverse;
+	Float32				*twiddleRe; // size - 1 twiddles, the ones for each pass stored together
+	Float32				*twiddleIm;
+} MyFFT;
+
+typedef struct MyConvolutionReverb {
+	UInt32				blockSize;
+	UInt32				fftSize; // 2 * blockSize
+	UInt32				partitionCount;
+	MyFFT				fft;
+	Float32				*responseRe; // partitionCount spectra of fftSize bins
+	Float32				*responseIm;
+	Float32				*inputRe; // the last partitionCount input spectra, a ring
+	Float32				*inputIm;
+	UInt32				newestInput; // ring slot of the newest input spectrum
+	Float32				*sumRe; // fftSize
+	Float32				*sumIm;
+	Float32				*inputHistory; // fftSize: the previous input block, then the one being filled
+	UInt32				inputFill; // frames of the current block so far
+	Float32				*wetLeft; // blockSize frames of wet output, played while the next block fills
+	Float32				*wetRight;
+	Float32				dryGain;
+	Float32				wetGain;
+} MyConvolutionReverb;
+
+#pragma mark - fft -
+
+static inline OSStatus MyFFTInit(MyFFT *fft, UInt32 size)
+{
+	memset(fft, 0, sizeof(MyFFT));
+	UInt32 bits = 0;
+	while ((1u << bits) < size)
+		bits++;
+	fft->size = size;
+	fft->bitReverse = (UInt32 *)malloc(size * sizeof(UInt32));
+	fft->twiddleRe = (Float32 *)malloc(size * sizeof(Float32));
+	fft->twiddleIm = (Float32 *)malloc(size * sizeof(Float32));
+	if (!fft->bitReverse || !fft->twiddleRe || !fft->twiddleIm)
+		return kMyConvolutionReverbError_OutOfMemory;
+
+	UInt32 i, b;
+	for (i = 0; i < size; i++) {
+		UInt32 reversed = 0;
+		for (b = 0; b < bits; b++)
+			if (i & (1u << b))
+				reversed |= 1u << (bits - 1 - b);
+		fft->bitReverse[i] = reversed;
+	}
+	// the pass that joins halves of length half uses twiddles half - 1 ... 2 * half - 2
+	UInt32 half;
+	for (half = 1; half < size; half <<= 1)
+		for (i = 0; i < half; i++) {
+			Float64 angle = -M_PI * i / half;
+			fft->twiddleRe[half - 1 + i] = (Float32)cos(angle);
+			fft->twiddleIm[half - 1 + i] = (Float32)sin(angle);
+		}
+	return noErr;
+}
+
+static inline void MyFFTDispose(MyFFT *fft)
+{
+	free(fft->bitReverse);
+	free(fft->twiddleRe);
+	free(fft->twiddleIm);
+	memset(fft, 0, sizeof(MyFFT));
+}
+
+// forward transform, in place. the inverse is the same call with re and im
+// swapped, then dividing by size
+static inline void MyFFTForward(const MyFFT *fft, Float32 *re, Float32 *im)
+{
+	const UInt32 size = fft->size;
+	UInt32 i;
+	for (i = 0; i < size; i++) {
+		UInt32 j = fft->bitReverse[i];
+		if (i < j) {
+			Float32 t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+	UInt32 half;
+	for (half = 1; half < size; half <<= 1) {
+		const Float32 *wRe = fft->twiddleRe + half - 1;
+		const Float32 *wIm = fft->twiddleIm + half - 1;
+		UInt32 start, k;
+		for (start = 0; start < size; start += 2 * half) {
+			Float32 *aRe = re + start, *aIm = im + start;
+			Float32 *bRe = aRe + half, *bIm = aIm + half;
+			for (k = 0; k < half; k++) {
+				Float32 tRe = wRe[k] * bRe[k] - wIm[k] * bIm[k];
+				Float32 tIm = wRe[k] * bIm[k] + wIm[k] * bRe[k];
+				bRe[k] = aRe[k] - tRe;
+				bIm[k] = aIm[k] - tIm;
+				aRe[k] += tRe;
+				aIm[k] += tIm;
+			}
+		}
+	}
+}
+
+#pragma mark - impulse responses -
+
+// fill left and right with a made-up hall: noise that decays by 60dB in decaySeconds,
+// different on each side so the tail is wide. each side has unit energy
+static inline void MyConvolutionReverbMakeHall(Float32 *left, Float32 *right, UInt32 frames,
+											   Float64 sampleRate, Float64 decaySeconds)
+{
+	UInt32 seed = 22222;
+	const Float64 decayPerFrame = pow(0.001, 1.0 / (decaySeconds * sampleRate));
+	const Float64 onsetFrames = 0.005 * sampleRate; // fade in, so the reverb doesn't click
+	Float64 energyLeft = 0.0, energyRight = 0.0;
+	Float64 envelope = 1.0;
+	UInt32 frame;
+	for (frame = 0; frame < frames; frame++) {
+		Float64 gain = envelope;
+		if (frame < onsetFrames)
+			gain *= frame / onsetFrames;
+		seed = seed * 1664525 + 1013904223;
+		left[frame] = (Float32)(gain * ((Float64)seed / 2147483648.0 - 1.0));
+		seed = seed * 1664525 + 1013904223;
+		right[frame] = (Float32)(gain * ((Float64)seed / 2147483648.0 - 1.0));
+		energyLeft += left[frame] * left[frame];
+		energyRight += right[frame] * right[frame];
+		envelope *= decayPerFrame;
+	}
+	if (energyLeft > 0.0)
+		MyApplyGain(left, frames, (Float32)(1.0 / sqrt(energyLeft)));
+	if (energyRight > 0.0)
+		MyApplyGain(right, frames, (Float32)(1.0 / sqrt(energyRight)));
+}
+
+#pragma mark - reverb -
+
+static inline void MyConvolutionReverbDispose(MyConvolutionReverb *reverb)
+{
+	MyFFTDispose(&reverb->fft);
+	free(reverb->responseRe);
+	free(reverb->responseIm);
+	free(reverb->inputRe);
+	free(reverb->inputIm);
+	free(reverb->sumRe); // sumIm, inputHistory, wetLeft and wetRight share this block
+	memset(reverb, 0, sizeof(MyConvolutionReverb));
+}
+
+// blockSize must be a power of two. smaller blocks mean less pre-delay but more
+// work per frame. right may be NULL for the same response on both sides. the
+// response is copied, so the caller can free it
+static inline OSStatus MyConvolutionReverbInit(MyConvolutionReverb *reverb, UInt32 blockSize,
+											   const Float32 *left, const Float32 *right, UInt32 frames)
+{
+	memset(reverb, 0, sizeof(MyConvolutionReverb));
+	if (blockSize < 16 || blockSize > 16384 || (blockSize & (blockSize - 1)))
+		return kMyConvolutionReverbError_BadBlockSize;
+	if (!left || frames == 0)
+		return kMyConvolutionReverbError_NoImpulseResponse;
+	if (!right)
+		right = left;
+
+	const UInt32 fftSize = 2 * blockSize;
+	const UInt32 partitionCount = (frames + blockSize - 1) / blockSize;
+	reverb->blockSize = blockSize;
+	reverb->fftSize = fftSize;
+	reverb->partitionCount = partitionCount;
+	reverb->dryGain = 1.0f;
+	reverb->wetGain = 0.5f;
+
+	const size_t spectraBytes = (size_t)partitionCount * fftSize * sizeof(Float32);
+	reverb->responseRe = (Float32 *)malloc(spectraBytes);
+	reverb->responseIm = (Float32 *)malloc(spectraBytes);
+	reverb->inputRe = (Float32 *)calloc(1, spectraBytes);
+	reverb->inputIm = (Float32 *)calloc(1, spectraBytes);
+	reverb->sumRe = (Float32 *)calloc(4 * fftSize, sizeof(Float32));
+	if (MyFFTInit(&reverb->fft, fftSize) != noErr ||
+		!reverb->responseRe || !reverb->responseIm || !reverb->inputRe || !reverb->inputIm || !reverb->sumRe) {
+		MyConvolutionReverbDispose(reverb);
+		return kMyConvolutionReverbError_OutOfMemory;
+	}
+	reverb->sumIm = reverb->sumRe + fftSize;
+	reverb->inputHistory = reverb->sumIm + fftSize;
+	reverb->wetLeft = reverb->inputHistory + fftSize;
+	reverb->wetRight = reverb->wetLeft + blockSize;
+
+	// each partition, zero padded to fftSize, as left + i right. the 1 / fftSize
+	// the inverse FFT needs is folded in here
+	const Float32 scale = 1.0f / fftSize;
+	UInt32 p;
+	for (p = 0; p < partitionCount; p++) {
+		Float32 *re = reverb->responseRe + (size_t)p * fftSize;
+		Float32 *im = reverb->responseIm + (size_t)p * fftSize;
+		UInt32 start = p * blockSize;
+		UInt32 count = frames - start < blockSize ? frames - start : blockSize;
+		memset(re, 0, fftSize * sizeof(Float32));
+		memset(im, 0, fftSize * sizeof(Float32));
+		memcpy(re, left + start, count * sizeof(Float32));
+		memcpy(im, right + start, count * sizeof(Float32));
+		MyFFTForward(&reverb->fft, re, im);
+		MyApplyGain(re, fftSize, scale);
+		MyApplyGain(im, fftSize, scale);
+	}
+	return noErr;
+}
+
+// inputHistory holds a full block: turn it into the next blockSize frames of wet output
+static inline void MyConvolutionReverbProcessBlock(MyConvolutionReverb *reverb)
+{
+	const UInt32 blockSize = reverb->blockSize;
+	const UInt32 fftSize = reverb->fftSize;
+	const UInt32 partitionCount = reverb->partitionCount;
+
+	// the newest spectrum goes in the slot of the oldest, so the ring runs
+	// newest to oldest going forward from newestInput
+	reverb->newestInput = (reverb->newestInput + partitionCount - 1) % partitionCount;
+	Float32 *newRe = reverb->inputRe + (size_t)reverb->newestInput * fftSize;
+	Float32 *newIm = reverb->inputIm + (size_t)reverb->newestInput * fftSize;
+	memcpy(newRe, reverb->inputHistory, fftSize * sizeof(Float32));
+	memset(newIm, 0, fftSize * sizeof(Float32));
+	MyFFTForward(&reverb->fft, newRe, newIm);
+
+	// input from p blocks ago meets partition p. the two loops walk the ring
+	// without a modulo per partition
+	memset(reverb->sumRe, 0, fftSize * sizeof(Float32));
+	memset(reverb->sumIm, 0, fftSize * sizeof(Float32));
+	UInt32 p = 0, slot;
+	for (slot = reverb->newestInput; slot < partitionCount; slot++, p++)
+		MyComplexMultiplyAdd(reverb->inputRe + (size_t)slot * fftSize, reverb->inputIm + (size_t)slot * fftSize,
+							 reverb->responseRe + (size_t)p * fftSize, reverb->responseIm + (size_t)p * fftSize,
+							 reverb->sumRe, reverb->sumIm, fftSize);
+	for (slot = 0; slot < reverb->newestInput; slot++, p++)
+		MyComplexMultiplyAdd(reverb->inputRe + (size_t)slot * fftSize, reverb->inputIm + (size_t)slot * fftSize,
+							 reverb->responseRe + (size_t)p * fftSize, reverb->responseIm + (size_t)p * fftSize,
+							 reverb->sumRe, reverb->sumIm, fftSize);
+
+	// inverse FFT. the second half is the part of the circular convolution that
+	// didn't wrap around
+	MyFFTForward(&reverb->fft, reverb->sumIm, reverb->sumRe);
+	memcpy(reverb->wetLeft, reverb->sumRe + blockSize, blockSize * sizeof(Float32));
+	memcpy(reverb->wetRight, reverb->sumIm + blockSize, blockSize * sizeof(Float32));
+
+	// this block is the previous one next time
+	memcpy(reverb->inputHistory, reverb->inputHistory + blockSize, blockSize * sizeof(Float32));
+}
+
+// in place, any number of frames. the input is the average of left and right.
+// right may be NULL for mono, which gets the left wet signal only
+static inline void MyConvolutionReverbProcess(MyConvolutionReverb *reverb, Float32 *left, Float32 *right, UInt32 frames)
+{
+	const Float32 dry = reverb->dryGain;
+	const Float32 wet = reverb->wetGain;
+	while (frames > 0) {
+		UInt32 count = reverb->blockSize - reverb->inputFill;
+		if (count > frames)
+			count = frames;
+		Float32 *input = reverb->inputHistory + reverb->blockSize + reverb->inputFill;
+		const Float32 *wetLeft = reverb->wetLeft + reverb->inputFill;
+		const Float32 *wetRight = reverb->wetRight + reverb->inputFill;
+		UInt32 i;
+		if (right) {
+			for (i = 0; i < count; i++) {
+				input[i] = 0.5f * (left[i] + right[i]);
+				left[i] = dry * left[i] + wet * wetLeft[i];
+				right[i] = dry * right[i] + wet * wetRight[i];
+			}
+			right += count;
+		} else {
+			for (i = 0; i < count; i++) {
+				input[i] = left[i];
+				left[i] = dry * left[i] + wet * wetLeft[i];
+			}
+		}
+		left += count;
+		frames -= count;
+		reverb->inputFill += count;
+		if (reverb->inputFill == reverb->blockSize) {
+			MyConvolutionReverbProcessBlock(reverb);
+			reverb->inputFill = 0;
+		}
+	}
+}
+
+// an AURenderCallback with the reverb as inRefCon, for a MyRenderGraph node with
+// one input, or anywhere else ioData already holds the signal to process
+static OSStatus MyConvolutionReverbRenderProc(void *inRefCon,
+											  AudioUnitRenderActionFlags *ioActionFlags,
+											  const AudioTimeStamp *inTimeStamp,
+											  UInt32 inBusNumber,
+											  UInt32 inNumberFrames,
+											  AudioBufferList *ioData)
+{
+	MyConvolutionReverb *reverb = (MyConvolutionReverb *)inRefCon;
+	Float32 *left = (Float32 *)ioData->mBuffers[0].mData;
+	Float32 *right = ioData->mNumberBuffers > 1 ? (Float32 *)ioData->mBuffers[1].mData : NULL;
+	MyConvolutionReverbProcess(reverb, left, right, inNumberFrames);
+	return noErr;
+}
+
+#endif
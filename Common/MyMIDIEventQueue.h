@@ -0,0 +1,201 @@
+//
+//  MyMIDIEventQueue.h
+//  Common
+//
+//  Copyright 2026 Subsequently and Furthermore, Inc. All rights reserved.
+//
+
+// Hands MIDI events from the MIDI thread to the render thread, each one landing
+// on the sample its time stamp says it should. Sending events straight from a
+// MIDIReadProc with MusicDeviceMIDIEvent() and an offset of 0 makes every event
+// wait for the next render, so notes are only as accurate as the buffer size.
+//
+// The read proc pushes events with their MIDIPacket time stamps, which are host
+// times. Before the instrument renders a slice, the render thread takes every
+// event due before the slice ends. Each one goes to the instrument at the
+// offset in frames between the slice's host time and the event's. Every event
+// is delayed by the queue's latency. That has to be at least as long as it takes
+// an event to reach a slice that hasn't rendered yet. Events that miss their
+// slice anyway are played at the start of the next one and counted as late.
+//
+// The queue is a ring with one writer and one reader, and no locks. Pushing
+// never blocks: if the ring is full the event is dropped and counted. Events
+// come out in the order they went in, so one stamped earlier than the event
+// before it waits for that event.
+//
+// Define MY_MIDI_EVENT_QUEUE_PORTABLE to leave out the audio unit part. Then
+// host times are CLOCK_MONOTONIC nanoseconds.
+
+#ifndef Common_MyMIDIEventQueue_h
+#define Common_MyMIDIEventQueue_h
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__APPLE__)
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+
+#define kMyMIDIEventQueueCapacity	4096 // a power of two
+
+typedef struct MyMIDIEvent {
+	UInt64				timeStamp; // host time, before the queue's latency is added
+	Byte				status;
+	Byte				data1;
+	Byte				data2;
+} MyMIDIEvent;
+
+// called from the render thread for each event due in the slice
+typedef void (*MyMIDIEventDeliverProc)(void *refCon, const MyMIDIEvent *event, UInt32 offsetSampleFrame);
+
+typedef struct MyMIDIEventQueue {
+	MyMIDIEvent			events[kMyMIDIEventQueueCapacity];
+	volatile UInt32		written; // positions count events and wrap at 2^32
+	volatile UInt32		read;
+
+	Float64				sampleRate;
+	Float64				ticksPerSecond; // of the host clock
+	UInt64				latency; // host ticks added to every event's time stamp
+#ifndef MY_MIDI_EVENT_QUEUE_PORTABLE
+	AudioUnit			instrumentUnit; // where MyMIDIEventQueueRenderNotify() sends events
+#endif
+
+	// stats
+	volatile UInt32		dropped; // pushed while the queue was full
+	UInt32				delivered;
+	UInt32				late; // due before the slice they were delivered in
+	UInt64				maxLateness; // host ticks
+} MyMIDIEventQueue;
+
+#pragma mark - clock -
+
+static inline UInt64 MyMIDIEventQueueClock(void)
+{
+#if defined(__APPLE__)
+	return mach_absolute_time();
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (UInt64)now.tv_sec * 1000000000ull + now.tv_nsec;
+#endif
+}
+
+static inline Float64 MyMIDIEventQueueTicksPerSecond(void)
+{
+#if defined(__APPLE__)
+	mach_timebase_info_data_t timebase;
+	mach_timebase_info(&timebase);
+	return 1000000000.0 * timebase.denom / timebase.numer;
+#else
+	return 1000000000.0;
+#endif
+}
+
+#pragma mark - queue -
+
+static inline void MyMIDIEventQueueInit(MyMIDIEventQueue *queue, Float64 sampleRate, Float64 latencySeconds)
+{
+	memset(queue, 0, sizeof(MyMIDIEventQueue));
+	queue->sampleRate = sampleRate;
+	queue->ticksPerSecond = MyMIDIEventQueueTicksPerSecond();
+	queue->latency = (UInt64)(latencySeconds * queue->ticksPerSecond);
+}
+
+// from the MIDI thread. a time stamp of 0 means now. false if the queue was full
+static inline Boolean MyMIDIEventQueuePush(MyMIDIEventQueue *queue, UInt64 timeStamp,
+										   Byte status, Byte data1, Byte data2)
+{
+	UInt32 written = queue->written;
+	if (written - queue->read >= kMyMIDIEventQueueCapacity) {
+		queue->dropped++;
+		return false;
+	}
+	MyMIDIEvent *event = &queue->events[written & (kMyMIDIEventQueueCapacity - 1)];
+	event->timeStamp = timeStamp ? timeStamp : MyMIDIEventQueueClock();
+	event->status = status;
+	event->data1 = data1;
+	event->data2 = data2;
+	// the event has to be there before the reader can see it
+	__sync_synchronize();
+	queue->written = written + 1;
+	return true;
+}
+
+// from the render thread: deliver every event due before the end of a slice of
+// frames whose first frame is at sliceHostTime. returns how many were delivered
+static inline UInt32 MyMIDIEventQueueDrain(MyMIDIEventQueue *queue, UInt64 sliceHostTime, UInt32 frames,
+										   MyMIDIEventDeliverProc deliver, void *refCon)
+{
+	Float64 framesPerTick = queue->sampleRate / queue->ticksPerSecond;
+	UInt64 sliceEnd = sliceHostTime + (UInt64)(frames / framesPerTick);
+	UInt32 read = queue->read;
+	UInt32 written = queue->written;
+	__sync_synchronize();
+	UInt32 count = 0;
+	while (read != written) {
+		const MyMIDIEvent *event = &queue->events[read & (kMyMIDIEventQueueCapacity - 1)];
+		UInt64 due = event->timeStamp + queue->latency;
+		if (due >= sliceEnd)
+			break;
+		UInt32 offset = 0;
+		if (due >= sliceHostTime) {
+			offset = (UInt32)((due - sliceHostTime) * framesPerTick + 0.5);
+			if (offset >= frames)
+				offset = frames - 1;
+		} else {
+			queue->late++;
+			if (sliceHostTime - due > queue->maxLateness)
+				queue->maxLateness = sliceHostTime - due;
+		}
+		deliver(refCon, event, offset);
+		read++;
+		count++;
+	}
+	// done with the events before the writer can reuse their slots
+	__sync_synchronize();
+	queue->read = read;
+	queue->delivered += count;
+	return count;
+}
+
+static inline void MyMIDIEventQueuePrintStats(const MyMIDIEventQueue *queue, FILE *out)
+{
+	fprintf(out, "MIDI events: %u delivered, %u late (%.2f ms at most), %u dropped\n",
+			(unsigned)queue->delivered, (unsigned)queue->late,
+			queue->maxLateness * 1000.0 / queue->ticksPerSecond, (unsigned)queue->dropped);
+}
+
+#ifndef MY_MIDI_EVENT_QUEUE_PORTABLE
+
+#pragma mark - instrument unit -
+
+static void MyMIDIEventQueueSendToInstrument(void *refCon, const MyMIDIEvent *event, UInt32 offsetSampleFrame)
+{
+	MyMIDIEventQueue *queue = (MyMIDIEventQueue *)refCon;
+	MusicDeviceMIDIEvent(queue->instrumentUnit, event->status, event->data1, event->data2, offsetSampleFrame);
+}
+
+// add with AudioUnitAddRenderNotify() on queue->instrumentUnit. before each
+// slice, sends the unit the events due in it
+static OSStatus MyMIDIEventQueueRenderNotify(void *inRefCon,
+											 AudioUnitRenderActionFlags *ioActionFlags,
+											 const AudioTimeStamp *inTimeStamp,
+											 UInt32 inBusNumber,
+											 UInt32 inNumberFrames,
+											 AudioBufferList *ioData)
+{
+	if (!(*ioActionFlags & kAudioUnitRenderAction_PreRender) || inBusNumber != 0)
+		return noErr;
+	MyMIDIEventQueue *queue = (MyMIDIEventQueue *)inRefCon;
+	UInt64 sliceHostTime = (inTimeStamp->mFlags & kAudioTimeStampHostTimeValid) ?
+		inTimeStamp->mHostTime : MyMIDIEventQueueClock();
+	MyMIDIEventQueueDrain(queue, sliceHostTime, inNumberFrames, MyMIDIEventQueueSendToInstrument, queue);
+	return noErr;
+}
+
+#endif
+
+#endif
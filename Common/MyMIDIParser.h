@@ -0,0 +1,242 @@
+//
+//  MyMIDIParser.h
+//  Common
+//
+//  Copyright 2026 Subsequently and Furthermore, Inc. All rights reserved.
+//
+
+// Turns a MIDI 1.0 byte stream into messages. A MIDIPacket can hold several
+// messages, or part of one. Channel messages can leave out their status byte
+// when it's the same as the one before (running status). Real-time bytes, like
+// clock ticks, can turn up anywhere, even in the middle of another message. The
+// parser keeps its place between packets, so all of that comes out right as long
+// as each source has a parser of its own.
+//
+// How many data bytes follow each status byte comes from a table. A run of data
+// bytes under running status, which is what a stream of controller or pressure
+// changes looks like, is taken a message at a time, without going through the
+// byte-at-a-time state machine.
+//
+// SysEx is collected in the parser, F0 and F7 included. A message that doesn't
+// fit comes out in pieces, each with sysExFlags saying whether it's the first
+// and/or last. SysEx cut short by a status byte other than F7 comes out with
+// kMyMIDISysExLast set but no F7, and is counted. Data bytes with no status to
+// go with them are dropped and counted. Nothing is allocated.
+//
+// Define MY_MIDI_PARSER_PORTABLE to leave out the MIDIPacketList part.
+
+#ifndef Common_MyMIDIParser_h
+#define Common_MyMIDIParser_h
+
+#include <AudioToolbox/AudioToolbox.h>
+#ifndef MY_MIDI_PARSER_PORTABLE
+#include <CoreMIDI/CoreMIDI.h>
+#endif
+#include <stddef.h>
+#include <string.h>
+
+#define kMyMIDIParserSysExBytes		1024 // of a SysEx message, before it's passed on in pieces
+
+// sysExFlags
+enum {
+	kMyMIDISysExFirst = 1,
+	kMyMIDISysExLast = 2
+};
+
+typedef struct MyMIDIMessage {
+	UInt64				timeStamp; // of the packet the message ended in
+	Byte				status; // as sent, or as running status supplied it
+	Byte				command; // status without the channel for channel messages, status for system ones
+	Byte				channel; // 0-15, for channel messages
+	Byte				length; // data bytes: 0, 1 or 2
+	Byte				data1;
+	Byte				data2;
+	Byte				sysExFlags;
+	UInt32				sysExLength;
+	const Byte			*sysEx; // only good until the callback returns
+} MyMIDIMessage;
+
+typedef void (*MyMIDIParserMessageProc)(void *refCon, const MyMIDIMessage *message);
+
+typedef struct MyMIDIParser {
+	MyMIDIParserMessageProc	proc;
+	void				*refCon;
+
+	Byte				status; // of the message being parsed, or the running status. 0 if none
+	Byte				expected; // data bytes status takes
+	Byte				dataCount; // data bytes so far
+	Byte				data[2];
+	Boolean				inSysEx;
+	Byte				sysExFlags; // for the next piece
+	UInt32				sysExLength;
+
+	// stats
+	UInt64				messages;
+	UInt32				strayBytes; // data bytes with no status, and F7 outside SysEx
+	UInt32				unterminatedSysEx;
+
+	Byte				sysEx[kMyMIDIParserSysExBytes]; // last, so MyMIDIParserInit() needn't clear it
+} MyMIDIParser;
+
+// data bytes after each status byte, 0x80 to 0xFF. F0 (SysEx) is handled on its own
+static const Byte kMyMIDIDataBytes[128] = {
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, // 8x note off
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, // 9x note on
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, // Ax polyphonic key pressure
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, // Bx control change
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // Cx program change
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // Dx channel pressure
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, // Ex pitch bend
+	0, 1, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0  // F0 SysEx, F1 time code, F2 song position, F3 song select,
+													// F6 tune request, F7 end of SysEx, F8-FF real time
+};
+
+static inline void MyMIDIParserInit(MyMIDIParser *parser, MyMIDIParserMessageProc proc, void *refCon)
+{
+	memset(parser, 0, offsetof(MyMIDIParser, sysEx));
+	parser->proc = proc;
+	parser->refCon = refCon;
+}
+
+// the pitch bend of a pitch bend message, -8192 to 8191
+static inline SInt32 MyMIDIMessagePitchBend(const MyMIDIMessage *message)
+{
+	return ((SInt32)message->data2 << 7 | message->data1) - 8192;
+}
+
+#pragma mark - parsing -
+
+static inline void MyMIDIParserSend(MyMIDIParser *parser, UInt64 timeStamp, Byte status, Byte length,
+									Byte data1, Byte data2)
+{
+	MyMIDIMessage message;
+	message.timeStamp = timeStamp;
+	message.status = status;
+	message.command = status < 0xF0 ? status & 0xF0 : status;
+	message.channel = status < 0xF0 ? status & 0x0F : 0;
+	message.length = length;
+	message.data1 = data1;
+	message.data2 = data2;
+	message.sysExFlags = 0;
+	message.sysExLength = 0;
+	message.sysEx = NULL;
+	parser->messages++;
+	parser->proc(parser->refCon, &message);
+}
+
+static inline void MyMIDIParserSendSysEx(MyMIDIParser *parser, UInt64 timeStamp, Boolean last)
+{
+	MyMIDIMessage message;
+	memset(&message, 0, sizeof(message));
+	message.timeStamp = timeStamp;
+	message.status = message.command = 0xF0;
+	message.sysExFlags = parser->sysExFlags | (last ? kMyMIDISysExLast : 0);
+	message.sysExLength = parser->sysExLength;
+	message.sysEx = parser->sysEx;
+	if (last)
+		parser->messages++;
+	parser->proc(parser->refCon, &message);
+	parser->sysExFlags = 0;
+	parser->sysExLength = 0;
+	parser->inSysEx = !last;
+}
+
+// parse length bytes, carrying on from the end of the last call. returns how many
+// messages were passed on. pieces of SysEx count only when they're the last piece
+static inline UInt32 MyMIDIParserParse(MyMIDIParser *parser, UInt64 timeStamp, const Byte *bytes, UInt32 length)
+{
+	UInt64 messagesBefore = parser->messages;
+	UInt32 i = 0;
+	while (i < length) {
+		// running status: whole messages at a time, for as long as the data bytes last
+		if (parser->dataCount == 0 && parser->status && parser->status < 0xF0) {
+			Byte status = parser->status;
+			if (parser->expected == 2) {
+				while (i + 1 < length && bytes[i] < 0x80 && bytes[i + 1] < 0x80) {
+					MyMIDIParserSend(parser, timeStamp, status, 2, bytes[i], bytes[i + 1]);
+					i += 2;
+				}
+			} else {
+				while (i < length && bytes[i] < 0x80) {
+					MyMIDIParserSend(parser, timeStamp, status, 1, bytes[i], 0);
+					i++;
+				}
+			}
+			if (i == length)
+				break;
+		}
+
+		Byte byte = bytes[i++];
+		if (byte >= 0xF8) {
+			// real time: on its own, whatever it interrupted carries on after it
+			MyMIDIParserSend(parser, timeStamp, byte, 0, 0, 0);
+		} else if (byte < 0x80) {
+			if (parser->inSysEx) {
+				if (parser->sysExLength == kMyMIDIParserSysExBytes)
+					MyMIDIParserSendSysEx(parser, timeStamp, false);
+				parser->sysEx[parser->sysExLength++] = byte;
+			} else if (parser->status) {
+				parser->data[parser->dataCount++] = byte;
+				if (parser->dataCount == parser->expected) {
+					MyMIDIParserSend(parser, timeStamp, parser->status, parser->expected,
+									 parser->data[0], parser->expected == 2 ? parser->data[1] : 0);
+					parser->dataCount = 0;
+					// only channel messages leave a running status
+					if (parser->status >= 0xF0)
+						parser->status = 0;
+				}
+			} else {
+				parser->strayBytes++;
+			}
+		} else if (byte == 0xF7) {
+			if (parser->inSysEx) {
+				if (parser->sysExLength == kMyMIDIParserSysExBytes)
+					MyMIDIParserSendSysEx(parser, timeStamp, false);
+				parser->sysEx[parser->sysExLength++] = byte;
+				MyMIDIParserSendSysEx(parser, timeStamp, true);
+			} else {
+				parser->strayBytes++;
+			}
+		} else {
+			// any other status byte ends SysEx, and starts something new
+			if (parser->inSysEx) {
+				parser->unterminatedSysEx++;
+				MyMIDIParserSendSysEx(parser, timeStamp, true);
+			}
+			parser->status = 0;
+			parser->dataCount = 0;
+			if (byte == 0xF0) {
+				parser->inSysEx = true;
+				parser->sysExFlags = kMyMIDISysExFirst;
+				parser->sysEx[0] = byte;
+				parser->sysExLength = 1;
+			} else {
+				parser->expected = kMyMIDIDataBytes[byte - 0x80];
+				if (parser->expected == 0)
+					MyMIDIParserSend(parser, timeStamp, byte, 0, 0, 0); // tune request, or undefined
+				else
+					parser->status = byte;
+			}
+		}
+	}
+	return (UInt32)(parser->messages - messagesBefore);
+}
+
+#ifndef MY_MIDI_PARSER_PORTABLE
+
+// every message in every packet, each with its packet's time stamp
+static inline UInt32 MyMIDIParserParsePacketList(MyMIDIParser *parser, const MIDIPacketList *packetList)
+{
+	UInt32 count = 0;
+	const MIDIPacket *packet = packetList->packet;
+	UInt32 i;
+	for (i = 0; i < packetList->numPackets; i++) {
+		count += MyMIDIParserParse(parser, packet->timeStamp, packet->data, packet->length);
+		packet = MIDIPacketNext(packet);
+	}
+	return count;
+}
+
+#endif
+
+#endif
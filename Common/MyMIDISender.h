@@ -0,0 +1,298 @@
+//
+//  MyMIDISender.h
+//  Common
+//
+//  Copyright 2026 Subsequently and Furthermore, Inc. All rights reserved.
+//
+
+// Sends MIDI events in batches. Calling MIDISend() with a one-event packet list
+// for every event costs a trip through the MIDI server for each, and over a
+// network session a packet on the wire for each too. When events come thick and
+// fast, most of those packets could have carried several events.
+//
+// Events are added to a MIDIPacketList, each with the time stamp it was played
+// at, so the receiver can still space them out as they were played. The list
+// is sent when the first event in it has waited the sender's budget, or when
+// the next event doesn't fit in maxBytes. A thread of the sender's sends the
+// lists whose time is up; full ones are sent by whoever added the event that
+// didn't fit. With a budget of 0, every event is sent as soon as it's added.
+//
+// Adding and sending take a mutex, so don't add events from a render thread.
+// Lists go to a send proc, which is MIDISend() to a destination unless the
+// sender was made with MyMIDISenderInit().
+
+#ifndef Common_MyMIDISender_h
+#define Common_MyMIDISender_h
+
+#include <CoreMIDI/CoreMIDI.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__APPLE__)
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+
+#define kMyMIDISenderListBytes		1024 // most a packet list can take, for the maxBytes of any sender
+#define kMyMIDISenderDefaultBudget	0.001 // seconds
+
+enum {
+	kMyMIDISenderError_Thread = 1,		// couldn't start the send thread
+	kMyMIDISenderError_TooBig = 2		// the event doesn't fit in maxBytes on its own
+};
+
+typedef OSStatus (*MyMIDISenderSendProc)(void *refCon, const MIDIPacketList *packetList);
+
+typedef struct MyMIDISender {
+	MyMIDISenderSendProc send;
+	void				*refCon;
+	MIDIPortRef			port; // for MyMIDISenderInitForDestination()
+	MIDIEndpointRef		destination;
+	UInt32				maxBytes; // of a packet list
+	UInt64				budget; // host ticks an event can wait to be sent
+	Float64				ticksPerSecond; // of the host clock
+
+	pthread_mutex_t		mutex;
+	pthread_cond_t		cond; // signalled when the list gets its first event, and to stop
+	pthread_t			thread;
+	Boolean				stop;
+	MIDIPacket			*current; // the list's last packet. NULL while the list's empty
+	UInt32				listEvents;
+	UInt64				firstAdded; // host time the list's first event was added
+	UInt64				addedSum; // of the host times all its events were added
+
+	// stats
+	UInt64				events;
+	UInt64				lists; // sent
+	UInt64				packets;
+	UInt64				bytes; // of packet lists
+	UInt32				fullLists; // sent because the next event didn't fit
+	UInt64				waitTicks; // from adding each event to sending it, all of them together
+	UInt64				maxWaitTicks; // of a list's first event
+	UInt32				errors; // from the send proc
+	OSStatus			lastError;
+
+	union {
+		MIDIPacketList	packetList;
+		Byte			bytes[kMyMIDISenderListBytes];
+	} list;
+} MyMIDISender;
+
+#pragma mark - clock -
+
+// the host time MIDI time stamps use
+static inline UInt64 MyMIDISenderClock(void)
+{
+#if defined(__APPLE__)
+	return mach_absolute_time();
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (UInt64)now.tv_sec * 1000000000ull + now.tv_nsec;
+#endif
+}
+
+static inline Float64 MyMIDISenderTicksPerSecond(void)
+{
+#if defined(__APPLE__)
+	mach_timebase_info_data_t timebase;
+	mach_timebase_info(&timebase);
+	return 1000000000.0 * timebase.denom / timebase.numer;
+#else
+	return 1000000000.0;
+#endif
+}
+
+#pragma mark - sending -
+
+// with the mutex held
+static inline void MyMIDISenderSendList(MyMIDISender *sender)
+{
+	if (sender->listEvents == 0)
+		return;
+	UInt64 now = MyMIDISenderClock();
+	OSStatus err = sender->send(sender->refCon, &sender->list.packetList);
+	if (err != noErr) {
+		sender->errors++;
+		sender->lastError = err;
+	}
+	sender->lists++;
+	sender->packets += sender->list.packetList.numPackets;
+	sender->bytes += (Byte *)MIDIPacketNext(sender->current) - sender->list.bytes;
+	sender->waitTicks += sender->listEvents * now - sender->addedSum;
+	if (now - sender->firstAdded > sender->maxWaitTicks)
+		sender->maxWaitTicks = now - sender->firstAdded;
+	sender->current = NULL;
+	sender->listEvents = 0;
+	sender->addedSum = 0;
+}
+
+// wait for the cond, but no longer than ticks
+static inline void MyMIDISenderWait(MyMIDISender *sender, UInt64 ticks)
+{
+	UInt64 nanoseconds = (UInt64)(ticks * 1000000000.0 / sender->ticksPerSecond);
+#if defined(__APPLE__)
+	struct timespec timeout = { (time_t)(nanoseconds / 1000000000), (long)(nanoseconds % 1000000000) };
+	pthread_cond_timedwait_relative_np(&sender->cond, &sender->mutex, &timeout);
+#else
+	struct timespec until;
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += nanoseconds / 1000000000;
+	until.tv_nsec += nanoseconds % 1000000000;
+	if (until.tv_nsec >= 1000000000) {
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000;
+	}
+	pthread_cond_timedwait(&sender->cond, &sender->mutex, &until);
+#endif
+}
+
+// sends each list once its first event has waited the budget
+static void *MyMIDISenderProc(void *refCon)
+{
+	MyMIDISender *sender = (MyMIDISender *)refCon;
+	pthread_mutex_lock(&sender->mutex);
+	while (!sender->stop) {
+		if (sender->listEvents == 0) {
+			pthread_cond_wait(&sender->cond, &sender->mutex);
+			continue;
+		}
+		UInt64 due = sender->firstAdded + sender->budget;
+		UInt64 now = MyMIDISenderClock();
+		if (now >= due)
+			MyMIDISenderSendList(sender);
+		else
+			MyMIDISenderWait(sender, due - now);
+	}
+	MyMIDISenderSendList(sender);
+	pthread_mutex_unlock(&sender->mutex);
+	return NULL;
+}
+
+static OSStatus MyMIDISenderSendToDestination(void *refCon, const MIDIPacketList *packetList)
+{
+	MyMIDISender *sender = (MyMIDISender *)refCon;
+	return MIDISend(sender->port, sender->destination, packetList);
+}
+
+#pragma mark - sender -
+
+// lists go to send. maxBytes is at most kMyMIDISenderListBytes
+static inline OSStatus MyMIDISenderInit(MyMIDISender *sender, MyMIDISenderSendProc send, void *refCon,
+										UInt32 maxBytes, Float64 budgetSeconds)
+{
+	memset(sender, 0, offsetof(MyMIDISender, list));
+	sender->send = send;
+	sender->refCon = refCon;
+	sender->maxBytes = maxBytes < kMyMIDISenderListBytes ? maxBytes : kMyMIDISenderListBytes;
+	sender->ticksPerSecond = MyMIDISenderTicksPerSecond();
+	sender->budget = (UInt64)(budgetSeconds * sender->ticksPerSecond);
+	pthread_mutex_init(&sender->mutex, NULL);
+	pthread_cond_init(&sender->cond, NULL);
+	if (pthread_create(&sender->thread, NULL, MyMIDISenderProc, sender) != 0) {
+		pthread_cond_destroy(&sender->cond);
+		pthread_mutex_destroy(&sender->mutex);
+		return kMyMIDISenderError_Thread;
+	}
+	return noErr;
+}
+
+// lists go to destination through port
+static inline OSStatus MyMIDISenderInitForDestination(MyMIDISender *sender, MIDIPortRef port,
+													  MIDIEndpointRef destination, UInt32 maxBytes,
+													  Float64 budgetSeconds)
+{
+	OSStatus err = MyMIDISenderInit(sender, MyMIDISenderSendToDestination, sender, maxBytes, budgetSeconds);
+	sender->port = port;
+	sender->destination = destination;
+	return err;
+}
+
+// sends what's waiting, and stops the thread
+static inline void MyMIDISenderDispose(MyMIDISender *sender)
+{
+	pthread_mutex_lock(&sender->mutex);
+	sender->stop = true;
+	pthread_cond_signal(&sender->cond);
+	pthread_mutex_unlock(&sender->mutex);
+	pthread_join(sender->thread, NULL);
+	pthread_cond_destroy(&sender->cond);
+	pthread_mutex_destroy(&sender->mutex);
+}
+
+// a message, played at timeStamp, or now if it's 0. time stamps should only go up
+static inline OSStatus MyMIDISenderAdd(MyMIDISender *sender, MIDITimeStamp timeStamp, const Byte *data, UInt16 length)
+{
+	UInt64 now = MyMIDISenderClock();
+	if (timeStamp == 0)
+		timeStamp = now;
+	pthread_mutex_lock(&sender->mutex);
+	MIDIPacket *packet = NULL;
+	if (sender->current)
+		packet = MIDIPacketListAdd(&sender->list.packetList, sender->maxBytes, sender->current,
+								   timeStamp, length, data);
+	if (!packet) {
+		if (sender->current) {
+			sender->fullLists++;
+			MyMIDISenderSendList(sender);
+		}
+		packet = MIDIPacketListAdd(&sender->list.packetList, sender->maxBytes,
+								   MIDIPacketListInit(&sender->list.packetList), timeStamp, length, data);
+		if (!packet) {
+			pthread_mutex_unlock(&sender->mutex);
+			return kMyMIDISenderError_TooBig;
+		}
+		sender->firstAdded = now;
+		pthread_cond_signal(&sender->cond);
+	}
+	sender->current = packet;
+	sender->listEvents++;
+	sender->addedSum += now;
+	sender->events++;
+	if (sender->budget == 0)
+		MyMIDISenderSendList(sender);
+	pthread_mutex_unlock(&sender->mutex);
+	return noErr;
+}
+
+static inline OSStatus MyMIDISenderAddEvent(MyMIDISender *sender, MIDITimeStamp timeStamp,
+											Byte status, Byte data1, Byte data2)
+{
+	Byte data[3] = { status, data1, data2 };
+	return MyMIDISenderAdd(sender, timeStamp, data, 3);
+}
+
+// the send proc's last error, or noErr if it has never failed
+static inline OSStatus MyMIDISenderGetLastError(MyMIDISender *sender)
+{
+	pthread_mutex_lock(&sender->mutex);
+	OSStatus err = sender->errors ? sender->lastError : noErr;
+	pthread_mutex_unlock(&sender->mutex);
+	return err;
+}
+
+// send what's waiting now, without waiting for the budget
+static inline void MyMIDISenderFlush(MyMIDISender *sender)
+{
+	pthread_mutex_lock(&sender->mutex);
+	MyMIDISenderSendList(sender);
+	pthread_mutex_unlock(&sender->mutex);
+}
+
+static inline void MyMIDISenderPrintStats(MyMIDISender *sender, FILE *out)
+{
+	pthread_mutex_lock(&sender->mutex);
+	UInt64 sent = sender->events - sender->listEvents;
+	fprintf(out, "MIDI sender: %llu events in %llu packet lists (%llu packets, %u full), "
+			"%.3f ms wait on average (%.3f ms at most), %u send errors\n",
+			(unsigned long long)sender->events, (unsigned long long)sender->lists,
+			(unsigned long long)sender->packets, (unsigned)sender->fullLists,
+			sent ? sender->waitTicks * 1000.0 / sender->ticksPerSecond / sent : 0.0,
+			sender->maxWaitTicks * 1000.0 / sender->ticksPerSecond, (unsigned)sender->errors);
+	pthread_mutex_unlock(&sender->mutex);
+}
+
+#endif
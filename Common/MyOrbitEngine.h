@@ -0,0 +1,224 @@
+//
+//  MyOrbitEngine.h
+//  Common
+//
+//  Copyright 2026 Subsequently and Furthermore, Inc. All rights reserved.
+//
+
+// Moves any number of sources around elliptical orbits, all at once. Each
+// source's orbit is stored as a column in a set of arrays (structure of arrays),
+// so one tick runs down every array in order, four sources per step on SSE2 or
+// NEON. Positions come out in the x, y and z arrays, ready to hand to OpenAL.
+//
+// A source at phase theta is at
+//		x = centerX + radiusX * cos(theta)
+//		y = centerY + radiusY * sin(theta)
+//		z = centerZ + radiusZ * sin(theta)
+// and theta advances by speed radians per second. sin and cos come from a short
+// polynomial that's good to a few millionths, which is plenty for positions.
+
+#ifndef Common_MyOrbitEngine_h
+#define Common_MyOrbitEngine_h
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <stdlib.h>
+#include <math.h>
+
+#if !defined(MY_AUDIO_KERNELS_NO_SIMD) && defined(__SSE2__)
+#define MY_ORBIT_ENGINE_SSE2 1
+#include <emmintrin.h>
+#elif !defined(MY_AUDIO_KERNELS_NO_SIMD) && (defined(__ARM_NEON__) || defined(__ARM_NEON))
+#define MY_ORBIT_ENGINE_NEON 1
+#include <arm_neon.h>
+#endif
+
+typedef struct MyOrbitEngine {
+	UInt32			sourceCount;
+	UInt32			capacity;
+
+	// orbits, one entry per source
+	Float32			*phase; // radians, kept in -pi ... pi
+	Float32			*speed; // radians per second
+	Float32			*radiusX;
+	Float32			*radiusY;
+	Float32			*radiusZ;
+	Float32			*centerX;
+	Float32			*centerY;
+	Float32			*centerZ;
+
+	// positions as of the last tick
+	Float32			*x;
+	Float32			*y;
+	Float32			*z;
+} MyOrbitEngine;
+
+#define kMyOrbitEngineArrayCount	11
+
+// capacity is rounded up to a multiple of 4, so the vector loops never need a scalar tail
+static inline void MyOrbitEngineInit(MyOrbitEngine *engine, UInt32 capacity)
+{
+	capacity = (capacity + 3) & ~3;
+	engine->sourceCount = 0;
+	engine->capacity = capacity;
+	Float32 *arrays = (Float32 *)calloc((size_t)capacity * kMyOrbitEngineArrayCount, sizeof(Float32));
+	engine->phase = arrays;
+	engine->speed = arrays + capacity;
+	engine->radiusX = arrays + capacity * 2;
+	engine->radiusY = arrays + capacity * 3;
+	engine->radiusZ = arrays + capacity * 4;
+	engine->centerX = arrays + capacity * 5;
+	engine->centerY = arrays + capacity * 6;
+	engine->centerZ = arrays + capacity * 7;
+	engine->x = arrays + capacity * 8;
+	engine->y = arrays + capacity * 9;
+	engine->z = arrays + capacity * 10;
+}
+
+static inline void MyOrbitEngineDispose(MyOrbitEngine *engine)
+{
+	free(engine->phase);
+	engine->phase = NULL;
+	engine->sourceCount = engine->capacity = 0;
+}
+
+// returns the new source's index, or -1 if the engine is full
+static inline SInt32 MyOrbitEngineAddSource(MyOrbitEngine *engine, Float32 phase, Float32 speed,
+											Float32 radiusX, Float32 radiusY, Float32 radiusZ)
+{
+	if (engine->sourceCount == engine->capacity)
+		return -1;
+	UInt32 i = engine->sourceCount++;
+	engine->phase[i] = (Float32)remainder(phase, 2 * M_PI);
+	engine->speed[i] = speed;
+	engine->radiusX[i] = radiusX;
+	engine->radiusY[i] = radiusY;
+	engine->radiusZ[i] = radiusZ;
+	engine->centerX[i] = engine->centerY[i] = engine->centerZ[i] = 0.0f;
+	return (SInt32)i;
+}
+
+#pragma mark - sin/cos -
+
+// sin(x) for -pi/2 <= x <= pi/2, Taylor series to x^9
+#define kMyOrbitSin3	(-1.0f / 6.0f)
+#define kMyOrbitSin5	(1.0f / 120.0f)
+#define kMyOrbitSin7	(-1.0f / 5040.0f)
+#define kMyOrbitSin9	(1.0f / 362880.0f)
+
+static inline Float32 MyOrbitSinHalfPi(Float32 x)
+{
+	Float32 x2 = x * x;
+	return x * (1.0f + x2 * (kMyOrbitSin3 + x2 * (kMyOrbitSin5 + x2 * (kMyOrbitSin7 + x2 * kMyOrbitSin9))));
+}
+
+// sin and cos of -pi <= theta <= pi
+static inline void MyOrbitSinCos(Float32 theta, Float32 *outSin, Float32 *outCos)
+{
+	// sin(theta) = sin(pi - theta) folds theta into -pi/2 ... pi/2
+	Float32 s = theta;
+	if (s > (Float32)M_PI_2)
+		s = (Float32)M_PI - s;
+	else if (s < (Float32)-M_PI_2)
+		s = (Float32)-M_PI - s;
+	// cos(theta) = sin(pi/2 - |theta|), which is already in range
+	Float32 c = (Float32)M_PI_2 - fabsf(theta);
+	*outSin = MyOrbitSinHalfPi(s);
+	*outCos = MyOrbitSinHalfPi(c);
+}
+
+#if MY_ORBIT_ENGINE_SSE2
+static inline __m128 MyOrbitSinHalfPiSSE(__m128 x)
+{
+	__m128 x2 = _mm_mul_ps(x, x);
+	__m128 p = _mm_add_ps(_mm_set1_ps(kMyOrbitSin7), _mm_mul_ps(x2, _mm_set1_ps(kMyOrbitSin9)));
+	p = _mm_add_ps(_mm_set1_ps(kMyOrbitSin5), _mm_mul_ps(x2, p));
+	p = _mm_add_ps(_mm_set1_ps(kMyOrbitSin3), _mm_mul_ps(x2, p));
+	p = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(x2, p));
+	return _mm_mul_ps(x, p);
+}
+#elif MY_ORBIT_ENGINE_NEON
+static inline float32x4_t MyOrbitSinHalfPiNEON(float32x4_t x)
+{
+	float32x4_t x2 = vmulq_f32(x, x);
+	float32x4_t p = vmlaq_n_f32(vdupq_n_f32(kMyOrbitSin7), x2, kMyOrbitSin9);
+	p = vmlaq_f32(vdupq_n_f32(kMyOrbitSin5), x2, p);
+	p = vmlaq_f32(vdupq_n_f32(kMyOrbitSin3), x2, p);
+	p = vmlaq_f32(vdupq_n_f32(1.0f), x2, p);
+	return vmulq_f32(x, p);
+}
+#endif
+
+#pragma mark - tick -
+
+// advance every orbit by deltaSeconds and recompute the positions
+static inline void MyOrbitEngineTick(MyOrbitEngine *engine, Float32 deltaSeconds)
+{
+	UInt32 count = engine->sourceCount;
+	UInt32 i = 0;
+#if MY_ORBIT_ENGINE_SSE2
+	const __m128 dt = _mm_set1_ps(deltaSeconds);
+	const __m128 twoPi = _mm_set1_ps((Float32)(2 * M_PI));
+	const __m128 inverseTwoPi = _mm_set1_ps((Float32)(1.0 / (2 * M_PI)));
+	const __m128 pi = _mm_set1_ps((Float32)M_PI);
+	const __m128 halfPi = _mm_set1_ps((Float32)M_PI_2);
+	const __m128 signBit = _mm_set1_ps(-0.0f);
+	for (; i < count; i += 4) {
+		// advance and wrap back into -pi ... pi
+		__m128 theta = _mm_add_ps(_mm_loadu_ps(engine->phase + i), _mm_mul_ps(_mm_loadu_ps(engine->speed + i), dt));
+		__m128 turns = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(theta, inverseTwoPi)));
+		theta = _mm_sub_ps(theta, _mm_mul_ps(turns, twoPi));
+		_mm_storeu_ps(engine->phase + i, theta);
+
+		// fold into -pi/2 ... pi/2 for sin: pi - theta above, -pi - theta below
+		__m128 thetaSign = _mm_and_ps(theta, signBit);
+		__m128 absTheta = _mm_andnot_ps(signBit, theta);
+		__m128 folded = _mm_sub_ps(_mm_or_ps(pi, thetaSign), theta);
+		__m128 needsFold = _mm_cmpgt_ps(absTheta, halfPi);
+		__m128 s = _mm_or_ps(_mm_and_ps(needsFold, folded), _mm_andnot_ps(needsFold, theta));
+		__m128 sinTheta = MyOrbitSinHalfPiSSE(s);
+		__m128 cosTheta = MyOrbitSinHalfPiSSE(_mm_sub_ps(halfPi, absTheta));
+
+		_mm_storeu_ps(engine->x + i, _mm_add_ps(_mm_loadu_ps(engine->centerX + i), _mm_mul_ps(_mm_loadu_ps(engine->radiusX + i), cosTheta)));
+		_mm_storeu_ps(engine->y + i, _mm_add_ps(_mm_loadu_ps(engine->centerY + i), _mm_mul_ps(_mm_loadu_ps(engine->radiusY + i), sinTheta)));
+		_mm_storeu_ps(engine->z + i, _mm_add_ps(_mm_loadu_ps(engine->centerZ + i), _mm_mul_ps(_mm_loadu_ps(engine->radiusZ + i), sinTheta)));
+	}
+#elif MY_ORBIT_ENGINE_NEON
+	const float32x4_t pi = vdupq_n_f32((Float32)M_PI);
+	const float32x4_t halfPi = vdupq_n_f32((Float32)M_PI_2);
+	const float32x4_t zero = vdupq_n_f32(0.0f);
+	for (; i < count; i += 4) {
+		// advance and wrap back into -pi ... pi. vcvtq truncates, so round by hand
+		float32x4_t theta = vmlaq_n_f32(vld1q_f32(engine->phase + i), vld1q_f32(engine->speed + i), deltaSeconds);
+		float32x4_t scaled = vmulq_n_f32(theta, (Float32)(1.0 / (2 * M_PI)));
+		scaled = vaddq_f32(scaled, vbslq_f32(vcltq_f32(scaled, zero), vdupq_n_f32(-0.5f), vdupq_n_f32(0.5f)));
+		float32x4_t turns = vcvtq_f32_s32(vcvtq_s32_f32(scaled));
+		theta = vmlsq_n_f32(theta, turns, (Float32)(2 * M_PI));
+		vst1q_f32(engine->phase + i, theta);
+
+		// fold into -pi/2 ... pi/2 for sin: pi - theta above, -pi - theta below
+		float32x4_t absTheta = vabsq_f32(theta);
+		float32x4_t folded = vsubq_f32(vbslq_f32(vcltq_f32(theta, zero), vnegq_f32(pi), pi), theta);
+		float32x4_t s = vbslq_f32(vcgtq_f32(absTheta, halfPi), folded, theta);
+		float32x4_t sinTheta = MyOrbitSinHalfPiNEON(s);
+		float32x4_t cosTheta = MyOrbitSinHalfPiNEON(vsubq_f32(halfPi, absTheta));
+
+		vst1q_f32(engine->x + i, vmlaq_f32(vld1q_f32(engine->centerX + i), vld1q_f32(engine->radiusX + i), cosTheta));
+		vst1q_f32(engine->y + i, vmlaq_f32(vld1q_f32(engine->centerY + i), vld1q_f32(engine->radiusY + i), sinTheta));
+		vst1q_f32(engine->z + i, vmlaq_f32(vld1q_f32(engine->centerZ + i), vld1q_f32(engine->radiusZ + i), sinTheta));
+	}
+#else
+	for (; i < count; i++) {
+		Float32 theta = engine->phase[i] + engine->speed[i] * deltaSeconds;
+		theta -= (Float32)(2 * M_PI) * rintf(theta * (Float32)(1.0 / (2 * M_PI)));
+		engine->phase[i] = theta;
+
+		Float32 sinTheta, cosTheta;
+		MyOrbitSinCos(theta, &sinTheta, &cosTheta);
+		engine->x[i] = engine->centerX[i] + engine->radiusX[i] * cosTheta;
+		engine->y[i] = engine->centerY[i] + engine->radiusY[i] * sinTheta;
+		engine->z[i] = engine->centerZ[i] + engine->radiusZ[i] * sinTheta;
+	}
+#endif
+}
+
+#endif
@@ -0,0 +1,565 @@
+//
+//  MyPacketIndex.h
+//  Common
+//
+//  Copyright 2026 Subsequently and Furthermore, Inc. All rights reserved.
+//
+
+// Where each packet of a VBR file starts, so any packet (or any point in time)
+// can be read straight away. Without this, the only way to find packet n of
+// some VBR files (MP3 without a seek table, ADTS AAC) is to walk the packets
+// before it. AudioFileReadPacketData() does that walk for us, every time we jump.
+//
+// The index is built once, by reading the file's packet descriptions from start
+// to end, and saved next to the file as "<file>.pktidx". Later opens map the
+// saved index into memory instead of rebuilding it. If the file's size or
+// modification time has changed since, the index is rebuilt.
+//
+// The first packet of each group of kMyPacketIndexGroupPackets is checked
+// against kAudioFilePropertyPacketToByte (checking every packet would cost a
+// property call per packet), and the packets' sizes against the file's audio
+// data byte count. Some files have bytes between their packets that AudioFile
+// leaves out of the packets (the header of each ADTS AAC frame, say). Those get
+// an index with no byte offsets, and reads go to AudioFileReadPacketData().
+// Frame lookups still work.
+//
+// The index only makes reads faster. If it can't be built,
+// MyPacketIndexOpenUnindexed() gives an index with no arrays at all: reads go
+// to AudioFileReadPacketData(), the packet count comes from the file, and a
+// file whose packets vary in frames gets estimated times.
+//
+// Byte offsets are stored in groups of kMyPacketIndexGroupPackets packets: a
+// 64-bit offset for each group, then a 32-bit offset into the group for each
+// packet, so a lookup is two array reads. Formats whose packets don't all hold
+// the same number of frames also store where each packet starts in frames, the
+// same way, and a time is found by a binary search. CBR formats need no index:
+// every lookup is arithmetic, and nothing is saved.
+//
+// MyPacketIndexReadPackets() is a stand-in for AudioFileReadPacketData() that
+// reads the packets' bytes in one AudioFileReadBytes() call and fills in their
+// descriptions from the index.
+
+#ifndef Common_MyPacketIndex_h
+#define Common_MyPacketIndex_h
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define kMyPacketIndexMagic			0x70696478 // 'pidx'
+#define kMyPacketIndexVersion		2
+#define kMyPacketIndexGroupPackets	1024
+#define kMyPacketIndexBuildPackets	4096 // packets read at a time while building
+#define kMyPacketIndexExtension		".pktidx"
+
+enum {
+	kMyPacketIndexError_OutOfMemory = 1,
+	kMyPacketIndexError_BadPacket = 2 // past the end of the file
+};
+
+enum {
+	kMyPacketIndexFlag_NoByteOffsets = 1 // the packets aren't laid end to end in the audio data
+};
+
+// the start of a saved index. the arrays follow it
+typedef struct MyPacketIndexHeader {
+	UInt32				magic;
+	UInt32				version;
+	SInt64				sourceSize; // of the audio file, when the index was built
+	SInt64				sourceModTime;
+	SInt64				packetCount;
+	SInt64				frameCount;
+	UInt32				framesPerPacket; // 0 if it varies
+	UInt32				primingFrames; // decoder delay at the start of the file
+	UInt32				remainderFrames; // padding at the end of the last packet
+	UInt32				flags;
+} MyPacketIndexHeader;
+
+typedef struct MyPacketIndex {
+	MyPacketIndexHeader	header;
+	UInt32				bytesPerPacket; // CBR formats, which have no arrays
+	const SInt64		*groupBytes; // groupCount + 1 entries. all 0 with kMyPacketIndexFlag_NoByteOffsets
+	const UInt32		*packetBytes; // packetCount + 1 entries, from their group's start
+	const SInt64		*groupFrames; // only if framesPerPacket is 0
+	const UInt32		*packetFrames;
+	void				*memory; // the mapped file, or the arrays if the index couldn't be saved
+	size_t				memorySize;
+	Boolean				isMapped;
+	Boolean				wasBuilt; // false if an existing index was mapped
+	Float64				openSeconds; // building or mapping
+} MyPacketIndex;
+
+#pragma mark - layout -
+
+static inline SInt64 MyPacketIndexGroupCount(SInt64 packetCount)
+{
+	return packetCount / kMyPacketIndexGroupPackets + 1; // the end of the last packet needs a group too
+}
+
+// bytes after the header, and where each array starts
+static inline size_t MyPacketIndexLayout(const MyPacketIndexHeader *header,
+										 size_t *outGroupBytes, size_t *outPacketBytes,
+										 size_t *outGroupFrames, size_t *outPacketFrames)
+{
+	SInt64 groups = MyPacketIndexGroupCount(header->packetCount);
+	size_t offset = sizeof(MyPacketIndexHeader);
+	*outGroupBytes = offset;
+	offset += (groups + 1) * sizeof(SInt64);
+	*outPacketBytes = offset;
+	offset += (header->packetCount + 1) * sizeof(UInt32);
+	offset = (offset + 7) & ~(size_t)7;
+	*outGroupFrames = *outPacketFrames = 0;
+	if (header->framesPerPacket == 0) {
+		*outGroupFrames = offset;
+		offset += (groups + 1) * sizeof(SInt64);
+		*outPacketFrames = offset;
+		offset += (header->packetCount + 1) * sizeof(UInt32);
+	}
+	return offset;
+}
+
+static inline void MyPacketIndexSetArrays(MyPacketIndex *index)
+{
+	size_t groupBytes, packetBytes, groupFrames, packetFrames;
+	MyPacketIndexLayout(&index->header, &groupBytes, &packetBytes, &groupFrames, &packetFrames);
+	const char *base = (const char *)index->memory;
+	index->groupBytes = (const SInt64 *)(base + groupBytes);
+	index->packetBytes = (const UInt32 *)(base + packetBytes);
+	index->groupFrames = groupFrames ? (const SInt64 *)(base + groupFrames) : NULL;
+	index->packetFrames = packetFrames ? (const UInt32 *)(base + packetFrames) : NULL;
+}
+
+#pragma mark - lookups -
+
+// where packet starts, from the start of the audio data. packet may be
+// packetCount, for the end of the last packet
+static inline SInt64 MyPacketIndexPacketToByte(const MyPacketIndex *index, SInt64 packet)
+{
+	if (index->bytesPerPacket)
+		return packet * index->bytesPerPacket;
+	return index->groupBytes[packet / kMyPacketIndexGroupPackets] + index->packetBytes[packet];
+}
+
+static inline UInt32 MyPacketIndexPacketSize(const MyPacketIndex *index, SInt64 packet)
+{
+	return (UInt32)(MyPacketIndexPacketToByte(index, packet + 1) - MyPacketIndexPacketToByte(index, packet));
+}
+
+// the first frame of packet, counting the decoder's priming frames
+static inline SInt64 MyPacketIndexPacketToFrame(const MyPacketIndex *index, SInt64 packet)
+{
+	if (index->header.framesPerPacket)
+		return packet * index->header.framesPerPacket;
+	if (!index->packetFrames) {
+		// unindexed: spread the frames evenly over the packets
+		SInt64 frames = index->header.frameCount + index->header.primingFrames + index->header.remainderFrames;
+		return index->header.packetCount > 0 ? packet * frames / index->header.packetCount : 0;
+	}
+	return index->groupFrames[packet / kMyPacketIndexGroupPackets] + index->packetFrames[packet];
+}
+
+// the packet holding frame (0 being the first frame after priming), and how
+// far into it the frame is
+static inline SInt64 MyPacketIndexFrameToPacket(const MyPacketIndex *index, SInt64 frame, UInt32 *outFrameInPacket)
+{
+	frame += index->header.primingFrames;
+	SInt64 packet;
+	if (index->header.framesPerPacket) {
+		packet = frame / index->header.framesPerPacket;
+	} else {
+		// the last packet starting at or before frame
+		SInt64 low = 0, high = index->header.packetCount;
+		while (high - low > 1) {
+			SInt64 middle = (low + high) / 2;
+			if (MyPacketIndexPacketToFrame(index, middle) <= frame)
+				low = middle;
+			else
+				high = middle;
+		}
+		packet = low;
+	}
+	if (packet >= index->header.packetCount)
+		packet = index->header.packetCount > 0 ? index->header.packetCount - 1 : 0;
+	if (outFrameInPacket)
+		*outFrameInPacket = (UInt32)(frame - MyPacketIndexPacketToFrame(index, packet));
+	return packet;
+}
+
+static inline SInt64 MyPacketIndexTimeToPacket(const MyPacketIndex *index, Float64 sampleRate, Float64 seconds,
+											   UInt32 *outFrameInPacket)
+{
+	return MyPacketIndexFrameToPacket(index, (SInt64)(seconds * sampleRate), outFrameInPacket);
+}
+
+#pragma mark - reading -
+
+// like AudioFileReadPacketData(): read up to *ioNumPackets packets from startPacket
+// into outBuffer, which holds *ioNumBytes bytes, setting *ioNumPackets and
+// *ioNumBytes to what was read. reading past the end isn't an error; it reads
+// no packets. outDescriptions may be NULL for CBR formats
+static inline OSStatus MyPacketIndexReadPackets(const MyPacketIndex *index, AudioFileID file, Boolean useCache,
+												UInt32 *ioNumBytes, AudioStreamPacketDescription *outDescriptions,
+												SInt64 startPacket, UInt32 *ioNumPackets, void *outBuffer)
+{
+	UInt32 bufferSize = *ioNumBytes;
+	*ioNumBytes = 0;
+	if (startPacket >= index->header.packetCount) {
+		*ioNumPackets = 0;
+		return noErr;
+	}
+	if (startPacket + *ioNumPackets > index->header.packetCount)
+		*ioNumPackets = (UInt32)(index->header.packetCount - startPacket);
+
+	if (index->header.flags & kMyPacketIndexFlag_NoByteOffsets) {
+		*ioNumBytes = bufferSize;
+		OSStatus err = AudioFileReadPacketData(file, useCache, ioNumBytes, outDescriptions,
+											   startPacket, ioNumPackets, outBuffer);
+		return err == kAudioFileEndOfFileError ? noErr : err;
+	}
+
+	// no more packets than fit in outBuffer
+	SInt64 startByte = MyPacketIndexPacketToByte(index, startPacket);
+	while (*ioNumPackets > 0 &&
+		   MyPacketIndexPacketToByte(index, startPacket + *ioNumPackets) - startByte > bufferSize)
+		(*ioNumPackets)--;
+	UInt32 numBytes = (UInt32)(MyPacketIndexPacketToByte(index, startPacket + *ioNumPackets) - startByte);
+	OSStatus err = AudioFileReadBytes(file, useCache, startByte, &numBytes, outBuffer);
+	if (err && numBytes == 0)
+		return err;
+
+	// a short read (the end of a truncated file) keeps only the packets it covered
+	UInt32 packet;
+	for (packet = 0; packet < *ioNumPackets; packet++) {
+		SInt64 packetStart = MyPacketIndexPacketToByte(index, startPacket + packet) - startByte;
+		UInt32 packetSize = MyPacketIndexPacketSize(index, startPacket + packet);
+		if (packetStart + packetSize > numBytes)
+			break;
+		if (outDescriptions) {
+			outDescriptions[packet].mStartOffset = packetStart;
+			outDescriptions[packet].mDataByteSize = packetSize;
+			outDescriptions[packet].mVariableFramesInPacket = index->header.framesPerPacket ? 0 :
+				(UInt32)(MyPacketIndexPacketToFrame(index, startPacket + packet + 1) -
+						 MyPacketIndexPacketToFrame(index, startPacket + packet));
+		}
+	}
+	*ioNumPackets = packet;
+	*ioNumBytes = packet > 0 ? (UInt32)(MyPacketIndexPacketToByte(index, startPacket + packet) - startByte) : 0;
+	return noErr;
+}
+
+#pragma mark - building and saving -
+
+static inline Float64 MyPacketIndexSecondsSince(CFAbsoluteTime start)
+{
+	return CFAbsoluteTimeGetCurrent() - start;
+}
+
+// whether packet starts at byte in the audio data, by the file's own reckoning.
+// only asked of each group's first packet
+static inline Boolean MyPacketIndexPacketStartsAt(AudioFileID file, SInt64 packet, SInt64 byte)
+{
+	AudioBytePacketTranslation translation = {0};
+	translation.mPacket = packet;
+	UInt32 propSize = sizeof(translation);
+	if (AudioFileGetProperty(file, kAudioFilePropertyPacketToByte, &propSize, &translation))
+		return false;
+	return !(translation.mFlags & kBytePacketTranslationFlag_IsEstimate) && translation.mByte == byte;
+}
+
+// read every packet description in the file into memory laid out as a saved index
+static inline OSStatus MyPacketIndexBuild(MyPacketIndex *index, AudioFileID file)
+{
+	UInt32 maxPacketSize;
+	UInt32 propSize = sizeof(maxPacketSize);
+	OSStatus err = AudioFileGetProperty(file, kAudioFilePropertyPacketSizeUpperBound, &propSize, &maxPacketSize);
+	if (err)
+		return err;
+	UInt64 dataByteCount;
+	propSize = sizeof(dataByteCount);
+	Boolean byteOffsets = AudioFileGetProperty(file, kAudioFilePropertyAudioDataByteCount, &propSize, &dataByteCount) == noErr;
+
+	// packets are read until there are no more, rather than trusting a packet
+	// count that the file might have to scan for itself
+	SInt64 capacity = 0, packetCount = 0;
+	SInt64 *starts = NULL; // byte and frame of each packet, and of the end of the last one
+	SInt64 *frames = NULL;
+	Boolean variableFrames = index->header.framesPerPacket == 0;
+	void *buffer = malloc((size_t)maxPacketSize * kMyPacketIndexBuildPackets);
+	AudioStreamPacketDescription *descriptions =
+		(AudioStreamPacketDescription *)malloc(sizeof(AudioStreamPacketDescription) * kMyPacketIndexBuildPackets);
+	if (!buffer || !descriptions) {
+		err = kMyPacketIndexError_OutOfMemory;
+		goto done;
+	}
+	SInt64 byte = 0, frame = 0;
+	for (;;) {
+		if (packetCount + kMyPacketIndexBuildPackets + 1 > capacity) {
+			capacity = capacity ? capacity * 2 : 65536;
+			SInt64 *newStarts = (SInt64 *)realloc(starts, capacity * sizeof(SInt64));
+			SInt64 *newFrames = variableFrames ? (SInt64 *)realloc(frames, capacity * sizeof(SInt64)) : NULL;
+			if (newStarts)
+				starts = newStarts;
+			if (newFrames)
+				frames = newFrames;
+			if (!newStarts || (variableFrames && !newFrames)) {
+				err = kMyPacketIndexError_OutOfMemory;
+				goto done;
+			}
+		}
+		UInt32 numBytes = maxPacketSize * kMyPacketIndexBuildPackets;
+		UInt32 numPackets = kMyPacketIndexBuildPackets;
+		err = AudioFileReadPacketData(file, false, &numBytes, descriptions, packetCount, &numPackets, buffer);
+		if (err && err != kAudioFileEndOfFileError)
+			goto done;
+		// each packet should start where the one before it ends. if one doesn't,
+		// there's something between them, and its size would be wrong. the group
+		// anchors catch that, and a gap anywhere else shows in the total
+		UInt32 i;
+		for (i = 0; i < numPackets; i++) {
+			if (byteOffsets && packetCount % kMyPacketIndexGroupPackets == 0)
+				byteOffsets = MyPacketIndexPacketStartsAt(file, packetCount, byte);
+			starts[packetCount] = byte;
+			byte += descriptions[i].mDataByteSize;
+			if (variableFrames) {
+				frames[packetCount] = frame;
+				frame += descriptions[i].mVariableFramesInPacket;
+			}
+			packetCount++;
+		}
+		if (err || numPackets == 0)
+			break;
+	}
+	err = noErr;
+	starts[packetCount] = byte;
+	if (variableFrames)
+		frames[packetCount] = frame;
+	if (byteOffsets && (UInt64)byte != dataByteCount)
+		byteOffsets = false;
+	if (!byteOffsets)
+		index->header.flags |= kMyPacketIndexFlag_NoByteOffsets;
+
+	// now the same thing, grouped
+	index->header.packetCount = packetCount;
+	if (!variableFrames)
+		frame = packetCount * index->header.framesPerPacket;
+	index->header.frameCount = frame - index->header.primingFrames - index->header.remainderFrames;
+	size_t groupBytesOffset, packetBytesOffset, groupFramesOffset, packetFramesOffset;
+	index->memorySize = MyPacketIndexLayout(&index->header, &groupBytesOffset, &packetBytesOffset,
+											&groupFramesOffset, &packetFramesOffset);
+	index->memory = calloc(1, index->memorySize);
+	if (!index->memory) {
+		err = kMyPacketIndexError_OutOfMemory;
+		goto done;
+	}
+	memcpy(index->memory, &index->header, sizeof(MyPacketIndexHeader));
+	MyPacketIndexSetArrays(index);
+	SInt64 *groupBytes = (SInt64 *)index->groupBytes;
+	UInt32 *packetBytes = (UInt32 *)index->packetBytes;
+	SInt64 *groupFrames = (SInt64 *)index->groupFrames;
+	UInt32 *packetFrames = (UInt32 *)index->packetFrames;
+	SInt64 packet;
+	for (packet = 0; packet <= packetCount; packet++) {
+		SInt64 group = packet / kMyPacketIndexGroupPackets;
+		if (packet % kMyPacketIndexGroupPackets == 0) {
+			if (byteOffsets)
+				groupBytes[group] = starts[packet];
+			if (variableFrames)
+				groupFrames[group] = frames[packet];
+		}
+		if (byteOffsets)
+			packetBytes[packet] = (UInt32)(starts[packet] - groupBytes[group]);
+		if (variableFrames)
+			packetFrames[packet] = (UInt32)(frames[packet] - groupFrames[group]);
+	}
+
+done:
+	free(starts);
+	free(frames);
+	free(buffer);
+	free(descriptions);
+	return err;
+}
+
+// map a saved index, if there is one and it still matches the audio file
+static inline Boolean MyPacketIndexMap(MyPacketIndex *index, const char *indexPath)
+{
+	int fd = open(indexPath, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat indexStat;
+	Boolean mapped = false;
+	if (fstat(fd, &indexStat) == 0 && indexStat.st_size >= (off_t)sizeof(MyPacketIndexHeader)) {
+		void *memory = mmap(NULL, indexStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (memory != MAP_FAILED) {
+			const MyPacketIndexHeader *saved = (const MyPacketIndexHeader *)memory;
+			size_t a, b, c, d;
+			if (saved->magic == kMyPacketIndexMagic &&
+				saved->version == kMyPacketIndexVersion &&
+				saved->sourceSize == index->header.sourceSize &&
+				saved->sourceModTime == index->header.sourceModTime &&
+				saved->framesPerPacket == index->header.framesPerPacket &&
+				saved->packetCount >= 0 &&
+				MyPacketIndexLayout(saved, &a, &b, &c, &d) == (size_t)indexStat.st_size) {
+				index->header = *saved;
+				index->memory = memory;
+				index->memorySize = indexStat.st_size;
+				index->isMapped = true;
+				MyPacketIndexSetArrays(index);
+				mapped = true;
+			} else {
+				munmap(memory, indexStat.st_size);
+			}
+		}
+	}
+	close(fd);
+	return mapped;
+}
+
+static inline void MyPacketIndexClose(MyPacketIndex *index)
+{
+	if (index->isMapped)
+		munmap(index->memory, index->memorySize);
+	else
+		free(index->memory);
+	memset(index, 0, sizeof(MyPacketIndex));
+}
+
+// start an index for file: the header fields that come straight from the file's
+// properties. *outValidFrames is the packet table's frame count, or -1 if it has none
+static inline OSStatus MyPacketIndexStart(MyPacketIndex *index, AudioFileID file,
+										  AudioStreamBasicDescription *outDataFormat, SInt64 *outValidFrames)
+{
+	memset(index, 0, sizeof(MyPacketIndex));
+	index->header.magic = kMyPacketIndexMagic;
+	index->header.version = kMyPacketIndexVersion;
+
+	UInt32 propSize = sizeof(*outDataFormat);
+	OSStatus err = AudioFileGetProperty(file, kAudioFilePropertyDataFormat, &propSize, outDataFormat);
+	if (err)
+		return err;
+	index->header.framesPerPacket = outDataFormat->mFramesPerPacket;
+
+	*outValidFrames = -1;
+	AudioFilePacketTableInfo packetTable;
+	propSize = sizeof(packetTable);
+	if (AudioFileGetProperty(file, kAudioFilePropertyPacketTableInfo, &propSize, &packetTable) == noErr) {
+		index->header.primingFrames = packetTable.mPrimingFrames;
+		index->header.remainderFrames = packetTable.mRemainderFrames;
+		*outValidFrames = packetTable.mNumberValidFrames;
+	}
+	return noErr;
+}
+
+// an index with no arrays, for a file whose packets can't be (or weren't) indexed:
+// the packet count comes from kAudioFilePropertyAudioDataPacketCount, reads go to
+// AudioFileReadPacketData() (or arithmetic, for CBR), and nothing is saved
+static inline OSStatus MyPacketIndexOpenUnindexed(MyPacketIndex *index, AudioFileID file)
+{
+	CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+	AudioStreamBasicDescription dataFormat;
+	SInt64 validFrames;
+	OSStatus err = MyPacketIndexStart(index, file, &dataFormat, &validFrames);
+	if (err)
+		return err;
+
+	SInt64 packetCount;
+	UInt32 propSize = sizeof(packetCount);
+	err = AudioFileGetProperty(file, kAudioFilePropertyAudioDataPacketCount, &propSize, &packetCount);
+	if (err)
+		return err;
+	index->header.packetCount = packetCount;
+	if (dataFormat.mFramesPerPacket)
+		index->header.frameCount = packetCount * dataFormat.mFramesPerPacket -
+			index->header.primingFrames - index->header.remainderFrames;
+	else if (validFrames > 0)
+		index->header.frameCount = validFrames;
+	else if (dataFormat.mSampleRate > 0) {
+		Float64 duration;
+		propSize = sizeof(duration);
+		if (AudioFileGetProperty(file, kAudioFilePropertyEstimatedDuration, &propSize, &duration) == noErr)
+			index->header.frameCount = (SInt64)(duration * dataFormat.mSampleRate);
+	}
+	if (dataFormat.mBytesPerPacket && dataFormat.mFramesPerPacket)
+		index->bytesPerPacket = dataFormat.mBytesPerPacket;
+	else
+		index->header.flags |= kMyPacketIndexFlag_NoByteOffsets;
+	index->openSeconds = MyPacketIndexSecondsSince(start);
+	return noErr;
+}
+
+// open the index for file, whose path is audioPath: map the saved one, or build
+// it and try to save it for next time. CBR files get an index with no arrays
+static inline OSStatus MyPacketIndexOpen(MyPacketIndex *index, AudioFileID file, const char *audioPath)
+{
+	CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+	AudioStreamBasicDescription dataFormat;
+	SInt64 validFrames;
+	OSStatus err = MyPacketIndexStart(index, file, &dataFormat, &validFrames);
+	if (err)
+		return err;
+
+	if (dataFormat.mBytesPerPacket && dataFormat.mFramesPerPacket) {
+		err = MyPacketIndexOpenUnindexed(index, file);
+		index->openSeconds = MyPacketIndexSecondsSince(start);
+		return err;
+	}
+
+	struct stat audioStat;
+	if (stat(audioPath, &audioStat) == 0) {
+		index->header.sourceSize = audioStat.st_size;
+		index->header.sourceModTime = audioStat.st_mtime;
+	}
+	char indexPath[PATH_MAX];
+	snprintf(indexPath, sizeof(indexPath), "%s%s", audioPath, kMyPacketIndexExtension);
+	if (MyPacketIndexMap(index, indexPath)) {
+		index->openSeconds = MyPacketIndexSecondsSince(start);
+		return noErr;
+	}
+
+	err = MyPacketIndexBuild(index, file);
+	if (err) {
+		MyPacketIndexClose(index);
+		return err;
+	}
+
+	// save it, then use the saved copy. if it can't be saved (a read-only volume,
+	// say) keep using the one in memory. other openers may have the old index
+	// mapped, so it's written to a temporary file and renamed into place rather
+	// than truncated under them. mkstemp() keeps concurrent builds in this process
+	// (CH06's jobs, CH07's players) out of each other's way too
+	char tempPath[PATH_MAX];
+	snprintf(tempPath, sizeof(tempPath), "%s.%d.XXXXXX", indexPath, (int)getpid());
+	int tempFD = mkstemp(tempPath);
+	if (tempFD >= 0)
+		fchmod(tempFD, 0644); // mkstemp() makes it private
+	FILE *out = tempFD >= 0 ? fdopen(tempFD, "wb") : NULL;
+	if (tempFD >= 0 && !out) {
+		close(tempFD);
+		unlink(tempPath);
+	}
+	if (out) {
+		Boolean saved = fwrite(index->memory, index->memorySize, 1, out) == 1;
+		saved = fclose(out) == 0 && saved;
+		saved = saved && rename(tempPath, indexPath) == 0;
+		if (saved) {
+			MyPacketIndex built = *index;
+			if (MyPacketIndexMap(index, indexPath))
+				free(built.memory);
+			else
+				*index = built;
+		} else {
+			unlink(tempPath);
+		}
+	}
+	index->wasBuilt = true;
+	index->openSeconds = MyPacketIndexSecondsSince(start);
+	return noErr;
+}
+
+#endif
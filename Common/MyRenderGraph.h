@@ -0,0 +1,812 @@
+//
+//  MyRenderGraph.h
+//  Common
+//
+//  Copyright 2026 Subsequently and Furthermore, Inc. All rights reserved.
+//
+
+// A small pull-model render graph, for running a chain of render callbacks and
+// audio units without an output device. Nothing waits on the hardware: the graph
+// has its own sample-time clock, which advances by the slice size every cycle,
+// so a render goes as fast as the nodes allow and the same graph renders the same
+// way every time.
+//
+// Pulling the output node renders everything upstream of it first. A node is
+// rendered once per cycle, even if it feeds several others, and only its own
+// work is timed, so the stats show where the time goes. There are three kinds of
+// node:
+//	- callback nodes, using the same AURenderCallback an AUGraph node input does.
+//	  With no input, the callback fills ioData. With one input, ioData already
+//	  holds a copy of that input, to be processed in place
+//	- mixer nodes, which sum any number of inputs, each with its own gain
+//	- AudioUnit nodes, which call AudioUnitRender(). The unit's input, if it
+//	  has one, is fed from the node connected to it
+//
+// Every buffer is non-interleaved Float32, with the channel count and largest
+// slice the graph was created with.
+//
+// MyRenderGraphSetThreadCount() lets independent branches render at the same
+// time. Each node keeps a count of inputs still to finish. Whichever thread
+// finishes a node's last input puts that node in a ready queue, so a mixer
+// starts as soon as its last branch is done. The queue needs no locks. A thread
+// claims the next slot with an atomic add, then waits for that slot to be
+// filled. The thread that calls MyRenderGraphRender() takes part too. Only as
+// many workers are woken as the graph has branches to give them.
+//
+// Define MY_RENDER_GRAPH_PORTABLE to leave out the AudioUnit and file parts.
+// What's left only needs CoreAudio's types and a clock, so graphs of callbacks
+// can be built and timed on machines without Core Audio.
+
+#ifndef Common_MyRenderGraph_h
+#define Common_MyRenderGraph_h
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MyAudioKernels.h"
+
+#include <pthread.h>
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/thread_policy.h>
+#else
+#include <time.h>
+#include <semaphore.h>
+#endif
+#include <sched.h>
+
+#define kMyRenderGraphMaxInputs		16
+#define kMyRenderGraphMaxNameLength	32
+#define kMyRenderGraphMaxThreads	32
+
+enum {
+	kMyRenderGraphError_InvalidNode = 1,	// no such node
+	kMyRenderGraphError_TooManyInputs = 2,	// only mixers take more than one input
+	kMyRenderGraphError_Cycle = 3,			// a node ended up upstream of itself
+	kMyRenderGraphError_TooManyFrames = 4,	// more frames than the graph's largest slice
+	kMyRenderGraphError_NoOutputNode = 5,
+	kMyRenderGraphError_ThreadCount = 6		// 1 ... kMyRenderGraphMaxThreads
+};
+
+typedef SInt32 MyRenderNode;
+
+typedef enum MyRenderNodeType {
+	kMyRenderNodeType_Callback,
+	kMyRenderNodeType_Mixer,
+	kMyRenderNodeType_AudioUnit
+} MyRenderNodeType;
+
+struct MyRenderGraph;
+
+// refCon for an AudioUnit node's input callback
+typedef struct MyRenderGraphUnitInput {
+	struct MyRenderGraph	*graph;
+	MyRenderNode			node;
+} MyRenderGraphUnitInput;
+
+typedef struct MyRenderGraphNode {
+	char					name[kMyRenderGraphMaxNameLength];
+	MyRenderNodeType		type;
+	AURenderCallback		render; // callback nodes
+	void					*renderRefCon;
+#ifndef MY_RENDER_GRAPH_PORTABLE
+	AudioUnit				unit; // AudioUnit nodes
+	MyRenderGraphUnitInput	*unitInput;
+#endif
+	MyRenderNode			inputs[kMyRenderGraphMaxInputs];
+	Float32					inputGains[kMyRenderGraphMaxInputs]; // mixer nodes
+	UInt32					inputCount;
+	AudioBufferList			*buffers; // this node's output
+	Float32					*bufferMemory;
+	UInt64					renderedCycle;
+	Boolean					rendering; // set while its inputs render, to catch loops
+
+	// threaded rendering
+	UInt32					consumerStart; // where this node's consumers are in the graph's consumers
+	UInt32					consumerCount;
+	volatile SInt32			pendingInputs; // inputs that haven't finished this cycle
+
+	// this node's own work, in MyRenderGraphClock() ticks
+	UInt64					renderTime;
+	UInt64					maxRenderTime;
+	UInt32					renderCount;
+} MyRenderGraphNode;
+
+typedef struct MyRenderGraph {
+	Float64					sampleRate;
+	UInt32					channelCount;
+	UInt32					maxFramesPerSlice;
+	MyRenderGraphNode		*nodes;
+	UInt32					nodeCount;
+	UInt32					nodeCapacity;
+	MyRenderNode			outputNode;
+	AudioTimeStamp			timeStamp; // of the cycle being rendered
+	UInt64					cycle;
+
+	// whole cycles, in MyRenderGraphClock() ticks
+	UInt64					renderedFrames;
+	UInt64					cycleTime;
+	UInt64					maxCycleTime;
+
+	// threaded rendering. the schedule is worked out again after any change to the graph
+	UInt32					threadCount;
+	pthread_t				workers[kMyRenderGraphMaxThreads];
+#if defined(__APPLE__)
+	semaphore_t				wakeSemaphore;
+#else
+	sem_t					wakeSemaphore;
+#endif
+	volatile Boolean		stopWorkers;
+	Boolean					scheduleIsValid;
+	MyRenderNode			*scheduleNodes; // every node upstream of the output node
+	UInt32					scheduleCount;
+	UInt32					scheduleWidth; // roughly how many nodes can ever render at once
+	MyRenderNode			*consumers;
+	volatile MyRenderNode	*readyQueue;
+	volatile SInt32			readyHead; // next slot to claim
+	volatile SInt32			readyTail; // next slot to fill
+	volatile SInt32			finishedWorkers;
+	volatile OSStatus		cycleError;
+	UInt32					cycleFrames;
+} MyRenderGraph;
+
+#pragma mark - clock -
+
+static inline UInt64 MyRenderGraphClock(void)
+{
+#if defined(__APPLE__)
+	return mach_absolute_time();
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (UInt64)now.tv_sec * 1000000000ull + now.tv_nsec;
+#endif
+}
+
+static inline Float64 MyRenderGraphClockSeconds(UInt64 ticks)
+{
+#if defined(__APPLE__)
+	mach_timebase_info_data_t timebase;
+	mach_timebase_info(&timebase);
+	return ticks * ((Float64)timebase.numer / timebase.denom) / 1000000000.0;
+#else
+	return ticks / 1000000000.0;
+#endif
+}
+
+#pragma mark - worker threads -
+
+static inline void MyRenderGraphSemaphoreSignal(MyRenderGraph *graph)
+{
+#if defined(__APPLE__)
+	semaphore_signal(graph->wakeSemaphore);
+#else
+	sem_post(&graph->wakeSemaphore);
+#endif
+}
+
+static inline void MyRenderGraphSemaphoreWait(MyRenderGraph *graph)
+{
+#if defined(__APPLE__)
+	semaphore_wait(graph->wakeSemaphore);
+#else
+	while (sem_wait(&graph->wakeSemaphore) != 0)
+		;
+#endif
+}
+
+// called while spinning on another thread's progress. after a while, give the
+// core away, in case that thread is waiting for it
+static inline void MyRenderGraphSpin(UInt32 *spins)
+{
+	if (++*spins >= 256) {
+		*spins = 0;
+		sched_yield();
+	}
+}
+
+// back to rendering everything on the calling thread
+static inline void MyRenderGraphStopWorkers(MyRenderGraph *graph)
+{
+	if (graph->threadCount <= 1)
+		return;
+	graph->stopWorkers = true;
+	__sync_synchronize();
+	UInt32 i;
+	for (i = 0; i < graph->threadCount - 1; i++)
+		MyRenderGraphSemaphoreSignal(graph);
+	for (i = 0; i < graph->threadCount - 1; i++)
+		pthread_join(graph->workers[i], NULL);
+#if defined(__APPLE__)
+	semaphore_destroy(mach_task_self(), graph->wakeSemaphore);
+#else
+	sem_destroy(&graph->wakeSemaphore);
+#endif
+	graph->stopWorkers = false;
+	graph->threadCount = 1;
+}
+
+#pragma mark - building -
+
+static inline void MyRenderGraphInit(MyRenderGraph *graph, Float64 sampleRate, UInt32 channelCount, UInt32 maxFramesPerSlice)
+{
+	memset(graph, 0, sizeof(*graph));
+	graph->sampleRate = sampleRate;
+	graph->channelCount = channelCount;
+	graph->maxFramesPerSlice = maxFramesPerSlice;
+	graph->outputNode = -1;
+	graph->timeStamp.mFlags = kAudioTimeStampSampleTimeValid;
+	graph->threadCount = 1;
+}
+
+// doesn't touch the nodes' audio units, which still belong to the caller
+static inline void MyRenderGraphDispose(MyRenderGraph *graph)
+{
+	MyRenderGraphStopWorkers(graph);
+	UInt32 i;
+	for (i = 0; i < graph->nodeCount; i++) {
+		free(graph->nodes[i].buffers);
+		free(graph->nodes[i].bufferMemory);
+#ifndef MY_RENDER_GRAPH_PORTABLE
+		free(graph->nodes[i].unitInput);
+#endif
+	}
+	free(graph->nodes);
+	free(graph->scheduleNodes);
+	free(graph->consumers);
+	free((void *)graph->readyQueue);
+	graph->nodes = NULL;
+	graph->scheduleNodes = graph->consumers = NULL;
+	graph->readyQueue = NULL;
+	graph->nodeCount = graph->nodeCapacity = 0;
+}
+
+// the format of every node's buffers
+static inline void MyRenderGraphGetStreamFormat(const MyRenderGraph *graph, AudioStreamBasicDescription *format)
+{
+	memset(format, 0, sizeof(*format));
+	format->mSampleRate = graph->sampleRate;
+	format->mFormatID = kAudioFormatLinearPCM;
+	format->mFormatFlags = kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+	format->mChannelsPerFrame = graph->channelCount;
+	format->mFramesPerPacket = 1;
+	format->mBitsPerChannel = 32;
+	format->mBytesPerFrame = sizeof(Float32);
+	format->mBytesPerPacket = sizeof(Float32);
+}
+
+static inline MyRenderGraphNode *MyRenderGraphNewNode(MyRenderGraph *graph, const char *name,
+													  MyRenderNodeType type, MyRenderNode *outNode)
+{
+	if (graph->nodeCount == graph->nodeCapacity) {
+		graph->nodeCapacity = graph->nodeCapacity ? graph->nodeCapacity * 2 : 8;
+		graph->nodes = (MyRenderGraphNode *)realloc(graph->nodes, graph->nodeCapacity * sizeof(MyRenderGraphNode));
+	}
+	graph->scheduleIsValid = false;
+	*outNode = graph->nodeCount;
+	MyRenderGraphNode *node = &graph->nodes[graph->nodeCount++];
+	memset(node, 0, sizeof(*node));
+	strncpy(node->name, name, kMyRenderGraphMaxNameLength - 1);
+	node->type = type;
+
+	UInt32 channel;
+	node->buffers = (AudioBufferList *)malloc(offsetof(AudioBufferList, mBuffers) +
+											  graph->channelCount * sizeof(AudioBuffer));
+	node->bufferMemory = (Float32 *)calloc(graph->channelCount * graph->maxFramesPerSlice, sizeof(Float32));
+	node->buffers->mNumberBuffers = graph->channelCount;
+	for (channel = 0; channel < graph->channelCount; channel++) {
+		node->buffers->mBuffers[channel].mNumberChannels = 1;
+		node->buffers->mBuffers[channel].mDataByteSize = graph->maxFramesPerSlice * sizeof(Float32);
+		node->buffers->mBuffers[channel].mData = node->bufferMemory + channel * graph->maxFramesPerSlice;
+	}
+	return node;
+}
+
+static inline OSStatus MyRenderGraphAddNode(MyRenderGraph *graph, const char *name,
+											AURenderCallback render, void *refCon, MyRenderNode *outNode)
+{
+	MyRenderGraphNode *node = MyRenderGraphNewNode(graph, name, kMyRenderNodeType_Callback, outNode);
+	node->render = render;
+	node->renderRefCon = refCon;
+	return noErr;
+}
+
+static inline OSStatus MyRenderGraphAddMixerNode(MyRenderGraph *graph, const char *name, MyRenderNode *outNode)
+{
+	MyRenderGraphNewNode(graph, name, kMyRenderNodeType_Mixer, outNode);
+	return noErr;
+}
+
+static inline OSStatus MyRenderGraphSetMixerInputGain(MyRenderGraph *graph, MyRenderNode mixer, UInt32 input, Float32 gain)
+{
+	if (mixer < 0 || mixer >= (MyRenderNode)graph->nodeCount || input >= graph->nodes[mixer].inputCount)
+		return kMyRenderGraphError_InvalidNode;
+	graph->nodes[mixer].inputGains[input] = gain;
+	return noErr;
+}
+
+static inline OSStatus MyRenderGraphSetOutputNode(MyRenderGraph *graph, MyRenderNode node)
+{
+	if (node < 0 || node >= (MyRenderNode)graph->nodeCount)
+		return kMyRenderGraphError_InvalidNode;
+	graph->outputNode = node;
+	graph->scheduleIsValid = false;
+	return noErr;
+}
+
+#ifndef MY_RENDER_GRAPH_PORTABLE
+
+#pragma mark - audio units -
+
+// an AudioUnit node's unit pulls its input through here, and gets a copy of
+// what the connected node rendered earlier in the cycle
+static OSStatus MyRenderGraphUnitInputProc(void *inRefCon,
+										   AudioUnitRenderActionFlags *ioActionFlags,
+										   const AudioTimeStamp *inTimeStamp,
+										   UInt32 inBusNumber,
+										   UInt32 inNumberFrames,
+										   AudioBufferList *ioData)
+{
+	MyRenderGraphUnitInput *unitInput = (MyRenderGraphUnitInput *)inRefCon;
+	MyRenderGraph *graph = unitInput->graph;
+	const AudioBufferList *source = graph->nodes[graph->nodes[unitInput->node].inputs[0]].buffers;
+	UInt32 buffer;
+	for (buffer = 0; buffer < ioData->mNumberBuffers; buffer++) {
+		if (buffer < source->mNumberBuffers)
+			memcpy(ioData->mBuffers[buffer].mData, source->mBuffers[buffer].mData, inNumberFrames * sizeof(Float32));
+		else
+			memset(ioData->mBuffers[buffer].mData, 0, inNumberFrames * sizeof(Float32));
+	}
+	return noErr;
+}
+
+// unit must not be initialized yet; MyRenderGraphInitialize() does that once
+// everything is connected. its output is set to the graph's stream format
+static inline OSStatus MyRenderGraphAddAudioUnitNode(MyRenderGraph *graph, const char *name,
+													 AudioUnit unit, MyRenderNode *outNode)
+{
+	AudioStreamBasicDescription format;
+	MyRenderGraphGetStreamFormat(graph, &format);
+	OSStatus err = AudioUnitSetProperty(unit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Output, 0,
+										&format, sizeof(format));
+	if (err)
+		return err;
+	UInt32 maxFrames = graph->maxFramesPerSlice;
+	err = AudioUnitSetProperty(unit, kAudioUnitProperty_MaximumFramesPerSlice, kAudioUnitScope_Global, 0,
+							   &maxFrames, sizeof(maxFrames));
+	if (err)
+		return err;
+
+	MyRenderGraphNode *node = MyRenderGraphNewNode(graph, name, kMyRenderNodeType_AudioUnit, outNode);
+	node->unit = unit;
+	return noErr;
+}
+
+// initializes every AudioUnit node's unit
+static inline OSStatus MyRenderGraphInitialize(MyRenderGraph *graph)
+{
+	UInt32 i;
+	for (i = 0; i < graph->nodeCount; i++) {
+		if (graph->nodes[i].type != kMyRenderNodeType_AudioUnit)
+			continue;
+		OSStatus err = AudioUnitInitialize(graph->nodes[i].unit);
+		if (err)
+			return err;
+	}
+	return noErr;
+}
+
+#endif
+
+// source's output becomes the next input of dest. mixer inputs start at gain 1
+static inline OSStatus MyRenderGraphConnectNodeInput(MyRenderGraph *graph, MyRenderNode source, MyRenderNode dest)
+{
+	if (source < 0 || source >= (MyRenderNode)graph->nodeCount || dest < 0 || dest >= (MyRenderNode)graph->nodeCount)
+		return kMyRenderGraphError_InvalidNode;
+	MyRenderGraphNode *node = &graph->nodes[dest];
+	UInt32 maxInputs = node->type == kMyRenderNodeType_Mixer ? kMyRenderGraphMaxInputs : 1;
+	if (node->inputCount == maxInputs)
+		return kMyRenderGraphError_TooManyInputs;
+
+#ifndef MY_RENDER_GRAPH_PORTABLE
+	// feed the unit's input bus from the graph, in the graph's format
+	if (node->type == kMyRenderNodeType_AudioUnit) {
+		AudioStreamBasicDescription format;
+		MyRenderGraphGetStreamFormat(graph, &format);
+		OSStatus err = AudioUnitSetProperty(node->unit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input, 0,
+											&format, sizeof(format));
+		if (err)
+			return err;
+		node->unitInput = (MyRenderGraphUnitInput *)malloc(sizeof(MyRenderGraphUnitInput));
+		node->unitInput->graph = graph;
+		node->unitInput->node = dest;
+		AURenderCallbackStruct input;
+		input.inputProc = MyRenderGraphUnitInputProc;
+		input.inputProcRefCon = node->unitInput;
+		err = AudioUnitSetProperty(node->unit, kAudioUnitProperty_SetRenderCallback, kAudioUnitScope_Input, 0,
+								   &input, sizeof(input));
+		if (err)
+			return err;
+	}
+#endif
+
+	node->inputs[node->inputCount] = source;
+	node->inputGains[node->inputCount] = 1.0f;
+	node->inputCount++;
+	graph->scheduleIsValid = false;
+	return noErr;
+}
+
+#pragma mark - rendering -
+
+// render node itself. its inputs have to be done already
+static inline OSStatus MyRenderGraphProcessNode(MyRenderGraph *graph, MyRenderNode n, UInt32 frames)
+{
+	MyRenderGraphNode *node = &graph->nodes[n];
+	OSStatus err = noErr;
+	UInt32 input, channel;
+	AudioBufferList *buffers = node->buffers;
+	for (channel = 0; channel < buffers->mNumberBuffers; channel++)
+		buffers->mBuffers[channel].mDataByteSize = frames * sizeof(Float32);
+
+	UInt64 start = MyRenderGraphClock();
+	AudioUnitRenderActionFlags flags = 0;
+	switch (node->type) {
+		case kMyRenderNodeType_Mixer:
+			for (channel = 0; channel < buffers->mNumberBuffers; channel++) {
+				Float32 *out = (Float32 *)buffers->mBuffers[channel].mData;
+				memset(out, 0, frames * sizeof(Float32));
+				for (input = 0; input < node->inputCount; input++)
+					MyMixWithGainRamp((const Float32 *)graph->nodes[node->inputs[input]].buffers->mBuffers[channel].mData,
+									  out, frames, node->inputGains[input], 0.0f);
+			}
+			break;
+		case kMyRenderNodeType_Callback:
+			if (node->inputCount == 1) {
+				const AudioBufferList *source = graph->nodes[node->inputs[0]].buffers;
+				for (channel = 0; channel < buffers->mNumberBuffers; channel++)
+					memcpy(buffers->mBuffers[channel].mData, source->mBuffers[channel].mData, frames * sizeof(Float32));
+			}
+			err = node->render(node->renderRefCon, &flags, &graph->timeStamp, 0, frames, buffers);
+			break;
+		case kMyRenderNodeType_AudioUnit:
+#ifndef MY_RENDER_GRAPH_PORTABLE
+			err = AudioUnitRender(node->unit, &flags, &graph->timeStamp, 0, frames, buffers);
+#endif
+			break;
+	}
+	UInt64 elapsed = MyRenderGraphClock() - start;
+	node->renderTime += elapsed;
+	node->renderCount++;
+	if (elapsed > node->maxRenderTime)
+		node->maxRenderTime = elapsed;
+
+	node->renderedCycle = graph->cycle;
+	return err;
+}
+
+// render node's inputs, then node itself, unless it's already been done this cycle
+static inline OSStatus MyRenderGraphRenderNode(MyRenderGraph *graph, MyRenderNode n, UInt32 frames)
+{
+	MyRenderGraphNode *node = &graph->nodes[n];
+	if (node->renderedCycle == graph->cycle)
+		return noErr;
+	if (node->rendering)
+		return kMyRenderGraphError_Cycle;
+
+	node->rendering = true;
+	OSStatus err = noErr;
+	UInt32 input;
+	for (input = 0; input < node->inputCount && !err; input++)
+		err = MyRenderGraphRenderNode(graph, node->inputs[input], frames);
+	node->rendering = false;
+	if (err)
+		return err;
+	return MyRenderGraphProcessNode(graph, n, frames);
+}
+
+#pragma mark - threaded rendering -
+
+// depth-first from the output node. puts every upstream node in the schedule
+// once, and turns up loops
+static inline OSStatus MyRenderGraphScheduleNode(MyRenderGraph *graph, MyRenderNode n, Boolean *visited)
+{
+	MyRenderGraphNode *node = &graph->nodes[n];
+	if (visited[n])
+		return noErr;
+	if (node->rendering)
+		return kMyRenderGraphError_Cycle;
+	node->rendering = true;
+	UInt32 input;
+	for (input = 0; input < node->inputCount; input++) {
+		OSStatus err = MyRenderGraphScheduleNode(graph, node->inputs[input], visited);
+		if (err) {
+			node->rendering = false;
+			return err;
+		}
+	}
+	node->rendering = false;
+	visited[n] = true;
+	graph->scheduleNodes[graph->scheduleCount++] = n;
+	return noErr;
+}
+
+// work out which nodes take part, and who consumes each one's output
+static inline OSStatus MyRenderGraphPrepareSchedule(MyRenderGraph *graph)
+{
+	UInt32 count = graph->nodeCount;
+	free(graph->scheduleNodes);
+	free(graph->consumers);
+	free((void *)graph->readyQueue);
+	graph->scheduleNodes = (MyRenderNode *)malloc(count * sizeof(MyRenderNode));
+	graph->consumers = (MyRenderNode *)malloc(count * kMyRenderGraphMaxInputs * sizeof(MyRenderNode));
+	graph->readyQueue = (MyRenderNode *)malloc(count * sizeof(MyRenderNode));
+	graph->scheduleCount = 0;
+
+	Boolean *visited = (Boolean *)calloc(count, sizeof(Boolean));
+	OSStatus err = MyRenderGraphScheduleNode(graph, graph->outputNode, visited);
+	if (err) {
+		free(visited);
+		return err;
+	}
+
+	// consumers are listed once per connection, so a node that feeds the same
+	// mixer twice counts down that mixer's pendingInputs twice
+	UInt32 i, j, input;
+	for (i = 0; i < count; i++)
+		graph->nodes[i].consumerCount = 0;
+	for (i = 0; i < graph->scheduleCount; i++) {
+		MyRenderGraphNode *node = &graph->nodes[graph->scheduleNodes[i]];
+		for (input = 0; input < node->inputCount; input++)
+			graph->nodes[node->inputs[input]].consumerCount++;
+	}
+	UInt32 start = 0;
+	UInt32 width = 0;
+	for (i = 0; i < graph->scheduleCount; i++) {
+		MyRenderGraphNode *node = &graph->nodes[graph->scheduleNodes[i]];
+		node->consumerStart = start;
+		start += node->consumerCount;
+		// every source starts a branch, and so does every extra consumer of a node
+		if (node->inputCount == 0)
+			width++;
+		if (node->consumerCount > 1)
+			width += node->consumerCount - 1;
+		node->consumerCount = 0;
+	}
+	for (i = 0; i < graph->scheduleCount; i++) {
+		MyRenderNode n = graph->scheduleNodes[i];
+		MyRenderGraphNode *node = &graph->nodes[n];
+		for (j = 0; j < node->inputCount; j++) {
+			MyRenderGraphNode *source = &graph->nodes[node->inputs[j]];
+			graph->consumers[source->consumerStart + source->consumerCount++] = n;
+		}
+	}
+	graph->scheduleWidth = width < graph->scheduleCount ? width : graph->scheduleCount;
+	free(visited);
+	graph->scheduleIsValid = true;
+	return noErr;
+}
+
+// claim ready nodes and render them until every node in the cycle is claimed
+static inline void MyRenderGraphWorkOnCycle(MyRenderGraph *graph)
+{
+	for (;;) {
+		SInt32 slot = __sync_fetch_and_add(&graph->readyHead, 1);
+		if (slot >= (SInt32)graph->scheduleCount)
+			return;
+		// whoever finishes the next node's last input will fill this slot
+		MyRenderNode n;
+		UInt32 spins = 0;
+		while ((n = graph->readyQueue[slot]) < 0)
+			MyRenderGraphSpin(&spins);
+		__sync_synchronize();
+
+		OSStatus err = MyRenderGraphProcessNode(graph, n, graph->cycleFrames);
+		if (err)
+			__sync_bool_compare_and_swap(&graph->cycleError, noErr, err);
+
+		// hand on every consumer that was only waiting for this node
+		MyRenderGraphNode *node = &graph->nodes[n];
+		UInt32 i;
+		for (i = 0; i < node->consumerCount; i++) {
+			MyRenderNode consumer = graph->consumers[node->consumerStart + i];
+			if (__sync_sub_and_fetch(&graph->nodes[consumer].pendingInputs, 1) == 0)
+				graph->readyQueue[__sync_fetch_and_add(&graph->readyTail, 1)] = consumer;
+		}
+	}
+}
+
+// workers ask for time-constraint (real-time) scheduling, like an audio I/O thread
+static inline void MyRenderGraphMakeThreadRealTime(MyRenderGraph *graph)
+{
+#if defined(__APPLE__)
+	mach_timebase_info_data_t timebase;
+	mach_timebase_info(&timebase);
+	Float64 ticksPerSecond = 1000000000.0 * timebase.denom / timebase.numer;
+	UInt32 period = (UInt32)(ticksPerSecond * graph->maxFramesPerSlice / graph->sampleRate);
+	thread_time_constraint_policy_data_t policy;
+	policy.period = period;
+	policy.computation = period / 2;
+	policy.constraint = period;
+	policy.preemptible = true;
+	thread_policy_set(pthread_mach_thread_np(pthread_self()), THREAD_TIME_CONSTRAINT_POLICY,
+					  (thread_policy_t)&policy, THREAD_TIME_CONSTRAINT_POLICY_COUNT);
+#else
+	// needs privileges. without them the worker just stays at normal priority
+	struct sched_param param;
+	param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 1;
+	pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+#endif
+}
+
+static void *MyRenderGraphWorkerProc(void *refCon)
+{
+	MyRenderGraph *graph = (MyRenderGraph *)refCon;
+	MyRenderGraphMakeThreadRealTime(graph);
+	for (;;) {
+		MyRenderGraphSemaphoreWait(graph);
+		if (graph->stopWorkers)
+			break;
+		MyRenderGraphWorkOnCycle(graph);
+		__sync_fetch_and_add(&graph->finishedWorkers, 1);
+	}
+	return NULL;
+}
+
+// render with threadCount threads: the one calling MyRenderGraphRender() plus
+// threadCount - 1 workers. 1 renders everything on the calling thread
+static inline OSStatus MyRenderGraphSetThreadCount(MyRenderGraph *graph, UInt32 threadCount)
+{
+	if (threadCount < 1 || threadCount > kMyRenderGraphMaxThreads)
+		return kMyRenderGraphError_ThreadCount;
+	MyRenderGraphStopWorkers(graph);
+	if (threadCount == 1)
+		return noErr;
+
+#if defined(__APPLE__)
+	kern_return_t err = semaphore_create(mach_task_self(), &graph->wakeSemaphore, SYNC_POLICY_FIFO, 0);
+	if (err)
+		return err;
+#else
+	if (sem_init(&graph->wakeSemaphore, 0, 0) != 0)
+		return kMyRenderGraphError_ThreadCount;
+#endif
+	UInt32 i;
+	for (i = 0; i < threadCount - 1; i++) {
+		if (pthread_create(&graph->workers[i], NULL, MyRenderGraphWorkerProc, graph) != 0) {
+			graph->threadCount = i + 1;
+			MyRenderGraphStopWorkers(graph);
+			return kMyRenderGraphError_ThreadCount;
+		}
+	}
+	graph->threadCount = threadCount;
+	return noErr;
+}
+
+// one cycle, spread across the workers
+static inline OSStatus MyRenderGraphRenderThreaded(MyRenderGraph *graph, UInt32 frames)
+{
+	if (!graph->scheduleIsValid) {
+		OSStatus err = MyRenderGraphPrepareSchedule(graph);
+		if (err)
+			return err;
+	}
+
+	// reset the counts and queue the sources, then let the workers at it
+	graph->cycleFrames = frames;
+	graph->cycleError = noErr;
+	graph->readyHead = 0;
+	graph->readyTail = 0;
+	graph->finishedWorkers = 0;
+	UInt32 i;
+	for (i = 0; i < graph->scheduleCount; i++) {
+		MyRenderGraphNode *node = &graph->nodes[graph->scheduleNodes[i]];
+		node->pendingInputs = node->inputCount;
+		graph->readyQueue[i] = -1;
+	}
+	for (i = 0; i < graph->scheduleCount; i++) {
+		if (graph->nodes[graph->scheduleNodes[i]].inputCount == 0)
+			graph->readyQueue[graph->readyTail++] = graph->scheduleNodes[i];
+	}
+	__sync_synchronize();
+
+	SInt32 wake = graph->threadCount - 1;
+	if (wake > (SInt32)graph->scheduleWidth - 1)
+		wake = graph->scheduleWidth - 1;
+	for (i = 0; i < (UInt32)wake; i++)
+		MyRenderGraphSemaphoreSignal(graph);
+	MyRenderGraphWorkOnCycle(graph);
+
+	// every slot is claimed. wait for the workers to finish what they claimed,
+	// so none of them is still in this cycle when the next one is set up
+	UInt32 spins = 0;
+	while (graph->finishedWorkers < wake)
+		MyRenderGraphSpin(&spins);
+	__sync_synchronize();
+	return graph->cycleError;
+}
+
+// run one cycle of frames through the graph and advance its clock. *outData
+// points at the output node's buffers until the next cycle
+static inline OSStatus MyRenderGraphRender(MyRenderGraph *graph, UInt32 frames, const AudioBufferList **outData)
+{
+	if (graph->outputNode < 0)
+		return kMyRenderGraphError_NoOutputNode;
+	if (frames > graph->maxFramesPerSlice)
+		return kMyRenderGraphError_TooManyFrames;
+
+	graph->cycle++;
+	UInt64 start = MyRenderGraphClock();
+	OSStatus err;
+	if (graph->threadCount > 1)
+		err = MyRenderGraphRenderThreaded(graph, frames);
+	else
+		err = MyRenderGraphRenderNode(graph, graph->outputNode, frames);
+	UInt64 elapsed = MyRenderGraphClock() - start;
+	graph->cycleTime += elapsed;
+	if (elapsed > graph->maxCycleTime)
+		graph->maxCycleTime = elapsed;
+	graph->renderedFrames += frames;
+
+	graph->timeStamp.mSampleTime += frames;
+	*outData = graph->nodes[graph->outputNode].buffers;
+	return err;
+}
+
+// each node's share of the time, and how much faster than real time the whole graph ran
+static inline void MyRenderGraphPrintStats(const MyRenderGraph *graph, FILE *stream)
+{
+	if (graph->cycle == 0)
+		return;
+	Float64 audioSeconds = graph->renderedFrames / graph->sampleRate;
+	Float64 cycleSeconds = MyRenderGraphClockSeconds(graph->cycleTime);
+	fprintf(stream, "%-20s %12s %12s %15s\n", "node", "avg us", "max us", "% of real time");
+	UInt32 i;
+	for (i = 0; i < graph->nodeCount; i++) {
+		const MyRenderGraphNode *node = &graph->nodes[i];
+		Float64 nodeSeconds = MyRenderGraphClockSeconds(node->renderTime);
+		fprintf(stream, "%-20s %12.2f %12.2f %15.3f\n",
+				node->name,
+				node->renderCount ? nodeSeconds * 1000000.0 / node->renderCount : 0.0,
+				MyRenderGraphClockSeconds(node->maxRenderTime) * 1000000.0,
+				nodeSeconds * 100.0 / audioSeconds);
+	}
+	fprintf(stream, "%-20s %12.2f %12.2f %15.3f\n",
+			"(whole graph)",
+			cycleSeconds * 1000000.0 / graph->cycle,
+			MyRenderGraphClockSeconds(graph->maxCycleTime) * 1000000.0,
+			cycleSeconds * 100.0 / audioSeconds);
+	fprintf(stream, "%llu cycles, %.2f seconds of audio in %.3f seconds (%.0fx real time)\n",
+			(unsigned long long)graph->cycle, audioSeconds, cycleSeconds,
+			cycleSeconds > 0.0 ? audioSeconds / cycleSeconds : 0.0);
+}
+
+#ifndef MY_RENDER_GRAPH_PORTABLE
+
+#pragma mark - files -
+
+// render frameCount frames, a full slice at a time, and write them to file. the
+// file's client format is set to the graph's stream format
+static inline OSStatus MyRenderGraphRenderToFile(MyRenderGraph *graph, ExtAudioFileRef file, UInt64 frameCount)
+{
+	AudioStreamBasicDescription format;
+	MyRenderGraphGetStreamFormat(graph, &format);
+	OSStatus err = ExtAudioFileSetProperty(file, kExtAudioFileProperty_ClientDataFormat, sizeof(format), &format);
+	while (!err && frameCount > 0) {
+		UInt32 frames = frameCount < graph->maxFramesPerSlice ? (UInt32)frameCount : graph->maxFramesPerSlice;
+		const AudioBufferList *output;
+		err = MyRenderGraphRender(graph, frames, &output);
+		if (!err)
+			err = ExtAudioFileWrite(file, frames, output);
+		frameCount -= frames;
+	}
+	return err;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,1772 @@
+//
+//  MySampler.h
+//  Common
+//
+//  Copyright 2026 Subsequently and Furthermore, Inc. All rights reserved.
+//
+
+// A sample-playback instrument that reads the same .aupreset files as AUSampler,
+// for when AUSampler isn't there or can't be looked inside. It only needs
+// CoreAudio's types, and reads the preset and its samples itself, so it runs
+// anywhere the rest of Common does.
+//
+// From the preset it takes each layer's zones (key and velocity ranges, root
+// key, tuning, gain, looping), the layer's first envelope, the preset's voice
+// count, gain and tuning, and the file-references that say which sample file
+// each zone's waveform is. A sample file that isn't where the preset says is
+// looked for next to the preset, then in a Sounds folder next to it. Only XML
+// presets are read: a binary one can be converted with "plutil -convert xml1".
+// Modulation connections, filters and LFOs are left out.
+//
+// Samples are loaded into memory as floats, each channel separately. CAF and
+// WAV files holding 16-, 24- or 32-bit integer or 32-bit float PCM are mapped
+// into memory and converted; anything else is read with ExtAudioFile, unless
+// MY_SAMPLER_PORTABLE is defined.
+//
+// Each voice reads its sample with MyInterpolateLinear() and mixes it in with
+// MyMixWithGainRamp(). Envelopes are linear, so each stage of a voice is one
+// gain ramp. When a note needs a voice and they're all playing, the quietest
+// released voice is stolen, or the oldest if none are released. A stolen voice
+// fades out over kMySamplerStealSeconds in one of kMySamplerFadeVoices spare
+// voices, so it doesn't click.
+//
+// Samples too big to keep in memory can be streamed. After MySamplerSetStreaming()
+// only the head of each long sample is loaded, and the heads together have to
+// fit in a preload limit. The rest is read from disk as it's played, into
+// kMySamplerStreamBlocks blocks that each voice has. A note-on asks for reads of
+// the stretch after the head straight away, and each block that's been played is
+// asked for again with the stretch after the others. The reads are done by an
+// I/O thread, soonest needed first. A voice whose next block hasn't been read
+// yet goes silent and waits for it; that's counted as a dropout. Only CAF and
+// WAV samples are streamed.
+//
+// MIDI events can be sent straight away with MySamplerMIDIEvent(), or scheduled
+// for a frame of the next render with MySamplerScheduleMIDIEvent(), which is
+// what MyMIDIEventQueueDrain() wants. Both, and MySamplerRender(), are for the
+// render thread: they never allocate or lock. Loading a preset and setting the
+// voice count allocate, so they're done before rendering starts.
+
+#ifndef Common_MySampler_h
+#define Common_MySampler_h
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include "MyAudioKernels.h"
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#include <errno.h>
+#include <semaphore.h>
+#endif
+
+#define kMySamplerDefaultVoices		64 // until a preset says otherwise
+#define kMySamplerFadeVoices		16 // spare voices for stolen ones to fade out in
+#define kMySamplerMaxEvents			256 // scheduled for one render
+#define kMySamplerChunkFrames		256 // a voice is rendered this many frames at a time
+#define kMySamplerConvertSamples	4096 // converted from a sample file at a time
+#define kMySamplerStealSeconds		0.005 // fade of a stolen voice
+#define kMySamplerMinRampSeconds	0.001 // shortest attack and release, so notes don't click
+#define kMySamplerPitchBendRange	2.0 // semitones
+#define kMySamplerMaxPath			1024
+#define kMySamplerStreamBlockFrames	4096 // read from disk at a time, for one voice
+#define kMySamplerStreamBlocks		3 // for each voice: how far ahead of it the reads can get
+#define kMySamplerRequestCapacity	4096 // reads waiting for the I/O thread. a power of two
+#define kMySamplerHeaderBytes		65536 // read from a streamed file to find its format
+
+typedef enum MySamplerError {
+	kMySamplerError_CantReadPreset = 1,
+	kMySamplerError_BadPreset = 2, // not an XML plist, or no zones with samples
+	kMySamplerError_CantReadSample = 3,
+	kMySamplerError_UnsupportedSampleFormat = 4,
+	kMySamplerError_OutOfMemory = 5,
+	kMySamplerError_PreloadLimit = 6, // the resident heads would take more than the limit
+	kMySamplerError_Thread = 7
+} MySamplerError;
+
+// envelope stages, in order
+enum {
+	kMySamplerStage_Delay = 0,
+	kMySamplerStage_Attack = 1,
+	kMySamplerStage_Hold = 2,
+	kMySamplerStage_Decay = 3,
+	kMySamplerStage_Sustain = 4,
+	kMySamplerStage_Release = 5,
+	kMySamplerStage_Done = 6
+};
+
+typedef struct MySamplerEnvelope {
+	Float64				delaySeconds;
+	Float64				attackSeconds;
+	Float64				holdSeconds;
+	Float64				decaySeconds;
+	Float32				sustainLevel; // 0 to 1
+	Float64				releaseSeconds;
+} MySamplerEnvelope;
+
+typedef struct MySamplerFileFormat {
+	Float64				sampleRate;
+	UInt32				channelCount;
+	UInt32				bitsPerChannel; // 16, 24 or 32
+	Boolean				isFloat;
+	Boolean				isBigEndian;
+	UInt32				bytesPerFrame;
+	SInt64				dataOffset; // of the first frame
+	SInt64				frames;
+} MySamplerFileFormat;
+
+typedef struct MySamplerSample {
+	SInt32				waveform; // the preset's number for it, -1 if it isn't from a preset
+	UInt32				channelCount; // 1 or 2
+	UInt32				frames;
+	Float64				sampleRate;
+	Float32				*data[2]; // residentFrames + 1, so interpolation can read one past the end
+	UInt32				residentFrames; // frames, unless the rest is streamed
+	int					fd; // of a streamed sample's file, or -1
+	MySamplerFileFormat	format; // of a streamed sample's file
+} MySamplerSample;
+
+typedef struct MySamplerZone {
+	Byte				minKey;
+	Byte				maxKey;
+	Byte				minVelocity;
+	Byte				maxVelocity;
+	Byte				rootKey;
+	Float64				tuneCents; // coarse and fine tuning, the preset's and the zone's
+	Float32				gain; // linear, the preset's and the zone's
+	UInt32				sampleIndex;
+	Boolean				loop;
+	UInt32				loopStart; // frames
+	UInt32				loopEnd;
+	MySamplerEnvelope	envelope;
+} MySamplerZone;
+
+// a stream block's ticket is its generation << 2 | its state. each request
+// is for one generation, so a read for a block that has since been reused is
+// thrown away
+enum {
+	kMySamplerBlock_Empty = 0,
+	kMySamplerBlock_Requested = 1,
+	kMySamplerBlock_Ready = 2
+};
+
+typedef struct MySamplerStreamBlock {
+	volatile UInt32		ticket;
+	UInt32				start; // frame of the sample
+	UInt32				frames; // and one more after them, to interpolate into
+	Float32				*data[2];
+} MySamplerStreamBlock;
+
+// the blocks of a voice's sample past its resident head, played in turn
+typedef struct MySamplerStream {
+	MySamplerStreamBlock blocks[kMySamplerStreamBlocks];
+	UInt32				playBlock; // being played, or next to be
+	UInt32				nextStart; // of the next block to request
+	Boolean				underran; // this note has been counted as a dropout
+} MySamplerStream;
+
+typedef struct MySamplerStreamRequest {
+	MySamplerStreamBlock *block;
+	UInt32				ticket; // the block's, when it was requested
+	const MySamplerSample *sample;
+	UInt32				start;
+	UInt32				frames;
+	UInt64				deadline; // in output frames: when the voice will need it
+	UInt64				requestTime; // MySamplerClock()
+} MySamplerStreamRequest;
+
+typedef struct MySamplerVoice {
+	const MySamplerZone	*zone; // NULL if the voice is free
+	const MySamplerSample *sample;
+	Byte				channel;
+	Byte				note;
+	Boolean				released; // its note is off, or it was stolen
+	Boolean				sustained; // its note is off, but the sustain pedal is down
+	Boolean				stolen;
+	UInt32				age; // when it started, in notes: the lowest is the oldest
+	UInt64				position; // 32.32 fixed point frames into the sample
+	Float64				increment; // frames of sample for each frame of output, before pitch bend
+	Float32				gain; // velocity and zone
+	UInt32				stage;
+	UInt32				stageFrames; // left in the stage
+	Float32				level; // of the envelope
+	Float32				step; // change in level each frame
+} MySamplerVoice;
+
+typedef struct MySamplerEvent {
+	UInt32				offset; // frames into the next render
+	Byte				status;
+	Byte				data1;
+	Byte				data2;
+} MySamplerEvent;
+
+typedef struct MySampler {
+	Float64				sampleRate; // of the output
+	MySamplerSample		*samples;
+	UInt32				sampleCount;
+	MySamplerZone		*zones;
+	UInt32				zoneCount;
+	UInt32				presetVoiceCount; // what the preset asked for
+	size_t				sampleBytes; // of sample data in memory
+
+	MySamplerVoice		*voices; // voiceCount + kMySamplerFadeVoices
+	UInt32				voiceCount; // notes that can play at once
+	UInt32				noteCount; // ages voices
+
+	Boolean				sustainPedal[16];
+	Float64				pitchBend[16]; // as a ratio of frequencies
+	Float32				volume[16];
+
+	MySamplerEvent		events[kMySamplerMaxEvents]; // in offset order
+	UInt32				eventCount;
+	Float32				scratch[kMySamplerChunkFrames];
+	volatile UInt64		renderedFrames;
+
+	// streaming, if streamHeadFrames isn't 0
+	UInt32				streamHeadFrames; // of each sample kept in memory
+	size_t				preloadLimit; // for all the heads together
+	MySamplerStream		*streams; // one for each voice
+	Float32				*streamMemory;
+	size_t				streamBytes;
+	MySamplerStreamRequest requests[kMySamplerRequestCapacity]; // from the render thread to the I/O thread
+	volatile UInt32		requestsWritten;
+	volatile UInt32		requestsRead;
+	Boolean				requestsToWake;
+	pthread_t			ioThread;
+#if defined(__APPLE__)
+	semaphore_t			wakeSemaphore;
+#else
+	sem_t				wakeSemaphore;
+#endif
+	volatile Boolean	stopStreaming;
+	MySamplerStreamRequest *pending; // the I/O thread's, kMySamplerRequestCapacity of them
+	UInt32				pendingCount;
+	Byte				*readBuffer;
+	UInt32				readBufferBytesPerFrame;
+
+	// stats
+	UInt32				playingVoices; // after the last render
+	UInt32				maxPlayingVoices;
+	UInt32				steals;
+	UInt32				droppedEvents; // scheduled while events was full
+	UInt32				unmappedNotes; // notes no zone covers
+	UInt32				dropouts; // notes whose stream ran dry
+	UInt64				underrunFrames;
+	UInt32				droppedRequests; // made while requests was full
+	volatile UInt32		streamReads;
+	volatile UInt32		lateReads; // finished after their deadline
+	volatile UInt64		readTicks; // from request to data, all reads together
+	volatile UInt64		maxReadTicks;
+} MySampler;
+
+#pragma mark - clock -
+
+static inline UInt64 MySamplerClock(void)
+{
+#if defined(__APPLE__)
+	return mach_absolute_time();
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (UInt64)now.tv_sec * 1000000000ull + now.tv_nsec;
+#endif
+}
+
+static inline Float64 MySamplerClockSeconds(UInt64 ticks)
+{
+#if defined(__APPLE__)
+	mach_timebase_info_data_t timebase;
+	mach_timebase_info(&timebase);
+	return ticks * ((Float64)timebase.numer / timebase.denom) / 1000000000.0;
+#else
+	return ticks / 1000000000.0;
+#endif
+}
+
+#pragma mark - property lists -
+
+// just enough of an XML property list reader for .aupreset files. integers,
+// reals and booleans are all numbers; strings, data and dates are all strings
+
+enum {
+	kMyPlistDict = 0,
+	kMyPlistArray = 1,
+	kMyPlistString = 2,
+	kMyPlistNumber = 3
+};
+
+typedef struct MyPlistNode {
+	UInt32				type;
+	char				*key; // if it's in a dict
+	char				*string;
+	Float64				number;
+	struct MyPlistNode	*child; // the first, of a dict or array
+	struct MyPlistNode	*next;
+} MyPlistNode;
+
+typedef struct MyPlistReader {
+	const char			*at;
+	const char			*end;
+} MyPlistReader;
+
+static inline void MyPlistFree(MyPlistNode *node)
+{
+	while (node) {
+		MyPlistNode *next = node->next;
+		MyPlistFree(node->child);
+		free(node->key);
+		free(node->string);
+		free(node);
+		node = next;
+	}
+}
+
+// the name of the next tag, skipping text, comments, <?xml?> and <!DOCTYPE>.
+// false at the end of the text
+static inline Boolean MyPlistNextTag(MyPlistReader *reader, char *name, size_t nameSize,
+									 Boolean *isClose, Boolean *isEmpty)
+{
+	while (reader->at < reader->end) {
+		const char *open = memchr(reader->at, '<', reader->end - reader->at);
+		if (!open || open + 1 >= reader->end)
+			break;
+		if (reader->end - open >= 4 && !memcmp(open, "<!--", 4)) {
+			const char *comment = open + 4;
+			while (comment + 3 <= reader->end && memcmp(comment, "-->", 3))
+				comment++;
+			reader->at = comment + 3;
+			continue;
+		}
+		const char *close = memchr(open, '>', reader->end - open);
+		if (!close)
+			break;
+		reader->at = close + 1;
+		if (open[1] == '?' || open[1] == '!')
+			continue;
+		const char *tag = open + 1;
+		*isClose = *tag == '/';
+		if (*isClose)
+			tag++;
+		*isEmpty = close[-1] == '/';
+		size_t length = 0;
+		while (tag + length < close && isalnum((unsigned char)tag[length]) && length + 1 < nameSize) {
+			name[length] = tag[length];
+			length++;
+		}
+		name[length] = '\0';
+		return true;
+	}
+	reader->at = reader->end;
+	return false;
+}
+
+// the text up to the next tag, with entities decoded
+static inline char *MyPlistCopyText(MyPlistReader *reader)
+{
+	const char *start = reader->at;
+	const char *stop = memchr(start, '<', reader->end - start);
+	if (!stop)
+		stop = reader->end;
+	reader->at = stop;
+	char *text = (char *)malloc(stop - start + 1);
+	if (!text)
+		return NULL;
+	static const char *const entities[5][2] = {
+		{ "&lt;", "<" }, { "&gt;", ">" }, { "&amp;", "&" }, { "&quot;", "\"" }, { "&apos;", "'" }
+	};
+	char *out = text;
+	while (start < stop) {
+		int i;
+		for (i = 0; i < 5; i++) {
+			size_t length = strlen(entities[i][0]);
+			if ((size_t)(stop - start) >= length && !memcmp(start, entities[i][0], length)) {
+				*out++ = entities[i][1][0];
+				start += length;
+				break;
+			}
+		}
+		if (i == 5)
+			*out++ = *start++;
+	}
+	*out = '\0';
+	return text;
+}
+
+// the value whose opening tag was just read
+static inline MyPlistNode *MyPlistParseValue(MyPlistReader *reader, const char *tag, Boolean isEmpty)
+{
+	MyPlistNode *node = (MyPlistNode *)calloc(1, sizeof(MyPlistNode));
+	if (!node)
+		return NULL;
+	char name[16];
+	Boolean isClose, childIsEmpty;
+	if (!strcmp(tag, "dict") || !strcmp(tag, "array")) {
+		Boolean isDict = tag[0] == 'd';
+		node->type = isDict ? kMyPlistDict : kMyPlistArray;
+		MyPlistNode **last = &node->child;
+		char *key = NULL;
+		while (!isEmpty && MyPlistNextTag(reader, name, sizeof(name), &isClose, &childIsEmpty) && !isClose) {
+			if (isDict && !strcmp(name, "key")) {
+				free(key);
+				key = childIsEmpty ? NULL : MyPlistCopyText(reader);
+				if (!childIsEmpty)
+					MyPlistNextTag(reader, name, sizeof(name), &isClose, &childIsEmpty);
+				continue;
+			}
+			MyPlistNode *child = MyPlistParseValue(reader, name, childIsEmpty);
+			if (!child) {
+				free(key);
+				MyPlistFree(node);
+				return NULL;
+			}
+			child->key = key;
+			key = NULL;
+			*last = child;
+			last = &child->next;
+		}
+		free(key);
+	} else if (!strcmp(tag, "true") || !strcmp(tag, "false")) {
+		node->type = kMyPlistNumber;
+		node->number = tag[0] == 't';
+		if (!isEmpty)
+			MyPlistNextTag(reader, name, sizeof(name), &isClose, &childIsEmpty);
+	} else {
+		if (!isEmpty) {
+			node->string = MyPlistCopyText(reader);
+			MyPlistNextTag(reader, name, sizeof(name), &isClose, &childIsEmpty);
+		}
+		if (!strcmp(tag, "integer") || !strcmp(tag, "real")) {
+			node->type = kMyPlistNumber;
+			node->number = node->string ? strtod(node->string, NULL) : 0.0;
+		} else {
+			node->type = kMyPlistString;
+		}
+	}
+	return node;
+}
+
+// the root value of a property list, or NULL
+static inline MyPlistNode *MyPlistParse(const char *text, size_t length)
+{
+	MyPlistReader reader = { text, text + length };
+	char name[16];
+	Boolean isClose, isEmpty;
+	while (MyPlistNextTag(&reader, name, sizeof(name), &isClose, &isEmpty)) {
+		if (strcmp(name, "plist"))
+			continue;
+		if (!MyPlistNextTag(&reader, name, sizeof(name), &isClose, &isEmpty) || isClose)
+			return NULL;
+		return MyPlistParseValue(&reader, name, isEmpty);
+	}
+	return NULL;
+}
+
+static inline const MyPlistNode *MyPlistGet(const MyPlistNode *dict, const char *key)
+{
+	if (!dict || dict->type != kMyPlistDict)
+		return NULL;
+	const MyPlistNode *child;
+	for (child = dict->child; child; child = child->next)
+		if (child->key && !strcmp(child->key, key))
+			return child;
+	return NULL;
+}
+
+static inline Float64 MyPlistGetNumber(const MyPlistNode *dict, const char *key, Float64 defaultValue)
+{
+	const MyPlistNode *node = MyPlistGet(dict, key);
+	return node && node->type == kMyPlistNumber ? node->number : defaultValue;
+}
+
+#pragma mark - sample files -
+
+static inline UInt32 MySamplerBig32(const Byte *bytes)
+{
+	return (UInt32)bytes[0] << 24 | (UInt32)bytes[1] << 16 | (UInt32)bytes[2] << 8 | bytes[3];
+}
+
+static inline UInt64 MySamplerBig64(const Byte *bytes)
+{
+	return (UInt64)MySamplerBig32(bytes) << 32 | MySamplerBig32(bytes + 4);
+}
+
+static inline UInt32 MySamplerLittle16(const Byte *bytes)
+{
+	return (UInt32)bytes[1] << 8 | bytes[0];
+}
+
+static inline UInt32 MySamplerLittle32(const Byte *bytes)
+{
+	return (UInt32)bytes[3] << 24 | (UInt32)bytes[2] << 16 | (UInt32)bytes[1] << 8 | bytes[0];
+}
+
+static inline OSStatus MySamplerCheckFileFormat(MySamplerFileFormat *format)
+{
+	if (format->channelCount == 0 || format->sampleRate <= 0.0)
+		return kMySamplerError_UnsupportedSampleFormat;
+	if (format->isFloat ? format->bitsPerChannel != 32 :
+		format->bitsPerChannel != 16 && format->bitsPerChannel != 24 && format->bitsPerChannel != 32)
+		return kMySamplerError_UnsupportedSampleFormat;
+	if (format->bytesPerFrame != format->channelCount * format->bitsPerChannel / 8 || format->frames < 0)
+		return kMySamplerError_UnsupportedSampleFormat;
+	return noErr;
+}
+
+// the format of a CAF or WAV file of PCM, and where its frames are, from its
+// first size bytes (enough to reach the start of the audio data)
+static inline OSStatus MySamplerParseAudioFile(const Byte *bytes, size_t size, SInt64 fileSize,
+											   MySamplerFileFormat *format)
+{
+	memset(format, 0, sizeof(MySamplerFileFormat));
+	if (size >= 8 && !memcmp(bytes, "caff", 4)) {
+		// big-endian chunks: type, 64-bit size, contents
+		Boolean haveDescription = false;
+		size_t at = 8;
+		while (at + 12 <= size) {
+			const Byte *chunk = bytes + at;
+			SInt64 chunkSize = (SInt64)MySamplerBig64(chunk + 4);
+			if (!memcmp(chunk, "desc", 4) && at + 12 + 32 <= size) {
+				const Byte *description = chunk + 12;
+				UInt64 sampleRateBits = MySamplerBig64(description);
+				memcpy(&format->sampleRate, &sampleRateBits, sizeof(Float64));
+				if (memcmp(description + 8, "lpcm", 4))
+					return kMySamplerError_UnsupportedSampleFormat;
+				UInt32 flags = MySamplerBig32(description + 12);
+				format->isFloat = (flags & 1) != 0;
+				format->isBigEndian = (flags & 2) == 0;
+				format->bytesPerFrame = MySamplerBig32(description + 16);
+				format->channelCount = MySamplerBig32(description + 24);
+				format->bitsPerChannel = MySamplerBig32(description + 28);
+				haveDescription = true;
+			} else if (!memcmp(chunk, "data", 4)) {
+				if (!haveDescription || !format->bytesPerFrame)
+					return kMySamplerError_UnsupportedSampleFormat;
+				// the data starts with an edit count. a size of -1 means up to the end of the file
+				format->dataOffset = at + 12 + 4;
+				SInt64 dataBytes = chunkSize == -1 ? fileSize - format->dataOffset : chunkSize - 4;
+				if (dataBytes > fileSize - format->dataOffset)
+					dataBytes = fileSize - format->dataOffset;
+				format->frames = dataBytes / format->bytesPerFrame;
+				return MySamplerCheckFileFormat(format);
+			}
+			if (chunkSize < 0)
+				break;
+			at += 12 + chunkSize;
+		}
+		return kMySamplerError_CantReadSample;
+	}
+	if (size >= 12 && !memcmp(bytes, "RIFF", 4) && !memcmp(bytes + 8, "WAVE", 4)) {
+		// little-endian chunks: id, 32-bit size, contents padded to an even size
+		Boolean haveFormat = false;
+		size_t at = 12;
+		while (at + 8 <= size) {
+			const Byte *chunk = bytes + at;
+			UInt32 chunkSize = MySamplerLittle32(chunk + 4);
+			if (!memcmp(chunk, "fmt ", 4) && chunkSize >= 16 && at + 8 + 16 <= size) {
+				const Byte *description = chunk + 8;
+				UInt32 formatTag = MySamplerLittle16(description);
+				if (formatTag == 0xFFFE && chunkSize >= 26 && at + 8 + 26 <= size)
+					formatTag = MySamplerLittle16(description + 24); // WAVE_FORMAT_EXTENSIBLE's sub-format
+				if (formatTag != 1 && formatTag != 3)
+					return kMySamplerError_UnsupportedSampleFormat;
+				format->isFloat = formatTag == 3;
+				format->channelCount = MySamplerLittle16(description + 2);
+				format->sampleRate = MySamplerLittle32(description + 4);
+				format->bytesPerFrame = MySamplerLittle16(description + 12);
+				format->bitsPerChannel = MySamplerLittle16(description + 14);
+				haveFormat = true;
+			} else if (!memcmp(chunk, "data", 4)) {
+				if (!haveFormat || !format->bytesPerFrame)
+					return kMySamplerError_UnsupportedSampleFormat;
+				format->dataOffset = at + 8;
+				SInt64 dataBytes = chunkSize;
+				if (dataBytes > fileSize - format->dataOffset)
+					dataBytes = fileSize - format->dataOffset;
+				format->frames = dataBytes / format->bytesPerFrame;
+				return MySamplerCheckFileFormat(format);
+			}
+			at += 8 + chunkSize + (chunkSize & 1);
+		}
+		return kMySamplerError_CantReadSample;
+	}
+	return kMySamplerError_UnsupportedSampleFormat;
+}
+
+static inline Boolean MySamplerHostIsBigEndian(void)
+{
+	UInt16 one = 1;
+	return *(Byte *)&one == 0;
+}
+
+// convert frames of a file's audio data to floats, one array for each of the
+// first channelCount channels
+static inline void MySamplerConvertFrames(const Byte *src, const MySamplerFileFormat *format, UInt32 frames,
+										  Float32 *const *channels, UInt32 channelCount)
+{
+	Float32 converted[kMySamplerConvertSamples];
+	UInt32 raw[kMySamplerConvertSamples];
+	Boolean swap = format->isBigEndian != MySamplerHostIsBigEndian();
+	UInt32 bytesPerSample = format->bitsPerChannel / 8;
+	UInt32 framesPerPass = kMySamplerConvertSamples / format->channelCount;
+	UInt32 done = 0;
+	while (done < frames) {
+		UInt32 count = frames - done < framesPerPass ? frames - done : framesPerPass;
+		UInt32 samples = count * format->channelCount;
+		const Byte *bytes = src + (size_t)done * format->bytesPerFrame;
+		if (bytesPerSample == 3) {
+			MyInt24ToFloat(bytes, converted, samples, format->isBigEndian);
+		} else if (bytesPerSample == 2) {
+			memcpy(raw, bytes, samples * 2);
+			if (swap)
+				MySwapInt16((UInt16 *)raw, samples);
+			MyInt16ToFloat((const SInt16 *)raw, converted, samples);
+		} else {
+			memcpy(raw, bytes, samples * 4);
+			if (swap)
+				MySwapInt32(raw, samples);
+			if (format->isFloat) {
+				memcpy(converted, raw, samples * 4);
+			} else {
+				UInt32 i;
+				for (i = 0; i < samples; i++)
+					converted[i] = (SInt32)raw[i] * (1.0f / 2147483648.0f);
+			}
+		}
+		UInt32 channel, frame;
+		for (channel = 0; channel < channelCount; channel++) {
+			Float32 *dst = channels[channel] + done;
+			const Float32 *in = converted + channel;
+			for (frame = 0; frame < count; frame++)
+				dst[frame] = in[frame * format->channelCount];
+		}
+		done += count;
+	}
+}
+
+#pragma mark - samples -
+
+// a sample with room for frames of channelCount channels, for the caller to fill
+static inline MySamplerSample *MySamplerAddSample(MySampler *sampler, UInt32 channelCount, UInt32 frames,
+												  Float64 sampleRate)
+{
+	MySamplerSample *samples = (MySamplerSample *)realloc(sampler->samples,
+														  (sampler->sampleCount + 1) * sizeof(MySamplerSample));
+	if (!samples)
+		return NULL;
+	sampler->samples = samples;
+	MySamplerSample *sample = &samples[sampler->sampleCount];
+	memset(sample, 0, sizeof(MySamplerSample));
+	sample->waveform = -1;
+	sample->channelCount = channelCount > 2 ? 2 : channelCount;
+	sample->frames = frames;
+	sample->residentFrames = frames;
+	sample->fd = -1;
+	sample->sampleRate = sampleRate;
+	UInt32 channel;
+	for (channel = 0; channel < sample->channelCount; channel++) {
+		sample->data[channel] = (Float32 *)calloc(frames + 1, sizeof(Float32));
+		if (!sample->data[channel]) {
+			free(sample->data[0]);
+			return NULL;
+		}
+	}
+	sampler->sampleBytes += (size_t)sample->channelCount * (frames + 1) * sizeof(Float32);
+	sampler->sampleCount++;
+	return sample;
+}
+
+// take back the sample MySamplerAddSample() just returned, if it couldn't be filled
+static inline void MySamplerRemoveLastSample(MySampler *sampler)
+{
+	MySamplerSample *sample = &sampler->samples[--sampler->sampleCount];
+	sampler->sampleBytes -= (size_t)sample->channelCount * (sample->residentFrames + 1) * sizeof(Float32);
+	free(sample->data[0]);
+	free(sample->data[1]);
+	if (sample->fd >= 0)
+		close(sample->fd);
+}
+
+static inline OSStatus MySamplerMapSampleFile(MySampler *sampler, const char *path, MySamplerSample **outSample)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return kMySamplerError_CantReadSample;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		close(fd);
+		return kMySamplerError_CantReadSample;
+	}
+	void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+		return kMySamplerError_CantReadSample;
+	MySamplerFileFormat format;
+	OSStatus err = MySamplerParseAudioFile((const Byte *)mapped, info.st_size, info.st_size, &format);
+	if (err == noErr && format.frames > 0xFFFFFFF0)
+		err = kMySamplerError_UnsupportedSampleFormat;
+	if (err == noErr) {
+		MySamplerSample *sample = MySamplerAddSample(sampler, format.channelCount, (UInt32)format.frames,
+													 format.sampleRate);
+		if (sample) {
+			MySamplerConvertFrames((const Byte *)mapped + format.dataOffset, &format, sample->frames,
+								   sample->data, sample->channelCount);
+			*outSample = sample;
+		} else {
+			err = kMySamplerError_OutOfMemory;
+		}
+	}
+	munmap(mapped, info.st_size);
+	return err;
+}
+
+#ifndef MY_SAMPLER_PORTABLE
+
+// any other format Core Audio can read
+static inline OSStatus MySamplerReadExtAudioFile(MySampler *sampler, const char *path, MySamplerSample **outSample)
+{
+	CFURLRef url = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)path,
+														   strlen(path), false);
+	ExtAudioFileRef file;
+	OSStatus err = ExtAudioFileOpenURL(url, &file);
+	CFRelease(url);
+	if (err != noErr)
+		return err;
+	AudioStreamBasicDescription fileFormat;
+	UInt32 propSize = sizeof(fileFormat);
+	SInt64 fileFrames = 0;
+	err = ExtAudioFileGetProperty(file, kExtAudioFileProperty_FileDataFormat, &propSize, &fileFormat);
+	if (err == noErr) {
+		propSize = sizeof(fileFrames);
+		err = ExtAudioFileGetProperty(file, kExtAudioFileProperty_FileLengthFrames, &propSize, &fileFrames);
+	}
+	UInt32 channelCount = fileFormat.mChannelsPerFrame > 2 ? 2 : fileFormat.mChannelsPerFrame;
+	if (err == noErr) {
+		AudioStreamBasicDescription clientFormat = {0};
+		clientFormat.mSampleRate = fileFormat.mSampleRate;
+		clientFormat.mFormatID = kAudioFormatLinearPCM;
+		clientFormat.mFormatFlags = kAudioFormatFlagsNativeFloatPacked | kAudioFormatFlagIsNonInterleaved;
+		clientFormat.mBytesPerPacket = sizeof(Float32);
+		clientFormat.mFramesPerPacket = 1;
+		clientFormat.mBytesPerFrame = sizeof(Float32);
+		clientFormat.mChannelsPerFrame = channelCount;
+		clientFormat.mBitsPerChannel = 32;
+		err = ExtAudioFileSetProperty(file, kExtAudioFileProperty_ClientDataFormat,
+									  sizeof(clientFormat), &clientFormat);
+	}
+	MySamplerSample *sample = NULL;
+	if (err == noErr) {
+		sample = MySamplerAddSample(sampler, channelCount, (UInt32)fileFrames, fileFormat.mSampleRate);
+		if (!sample)
+			err = kMySamplerError_OutOfMemory;
+	}
+	UInt32 done = 0;
+	while (err == noErr && done < sample->frames) {
+		struct {
+			AudioBufferList	list;
+			AudioBuffer		second;
+		} buffers;
+		UInt32 frames = sample->frames - done;
+		UInt32 channel;
+		buffers.list.mNumberBuffers = sample->channelCount;
+		for (channel = 0; channel < sample->channelCount; channel++) {
+			buffers.list.mBuffers[channel].mNumberChannels = 1;
+			buffers.list.mBuffers[channel].mDataByteSize = frames * sizeof(Float32);
+			buffers.list.mBuffers[channel].mData = sample->data[channel] + done;
+		}
+		err = ExtAudioFileRead(file, &frames, &buffers.list);
+		if (frames == 0)
+			break;
+		done += frames;
+	}
+	if (sample)
+		sample->frames = done; // the file's length can be an estimate
+	ExtAudioFileDispose(file);
+	if (err == noErr)
+		*outSample = sample;
+	else if (sample)
+		MySamplerRemoveLastSample(sampler);
+	return err;
+}
+
+#endif
+
+// a CAF or WAV file of PCM, of which only the first streamHeadFrames are read
+// now. the file stays open for the I/O thread to read the rest
+static inline OSStatus MySamplerOpenStreamedSample(MySampler *sampler, const char *path, MySamplerSample **outSample)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return kMySamplerError_CantReadSample;
+	struct stat info;
+	Byte *header = (Byte *)malloc(kMySamplerHeaderBytes);
+	ssize_t headerBytes = header && fstat(fd, &info) == 0 ? pread(fd, header, kMySamplerHeaderBytes, 0) : -1;
+	MySamplerFileFormat format;
+	OSStatus err = headerBytes > 0 ?
+		MySamplerParseAudioFile(header, headerBytes, info.st_size, &format) : kMySamplerError_CantReadSample;
+	free(header);
+	if (err == noErr && format.frames > 0xFFFFFFF0)
+		err = kMySamplerError_UnsupportedSampleFormat;
+	if (err == noErr && format.frames <= sampler->streamHeadFrames) {
+		// short enough to keep all of
+		close(fd);
+		return MySamplerMapSampleFile(sampler, path, outSample);
+	}
+	UInt32 channelCount = format.channelCount > 2 ? 2 : format.channelCount;
+	size_t headBytes = (size_t)channelCount * (sampler->streamHeadFrames + 1) * sizeof(Float32);
+	if (err == noErr && sampler->sampleBytes + headBytes > sampler->preloadLimit)
+		err = kMySamplerError_PreloadLimit;
+	MySamplerSample *sample = NULL;
+	if (err == noErr) {
+		sample = MySamplerAddSample(sampler, channelCount, sampler->streamHeadFrames, format.sampleRate);
+		if (!sample)
+			err = kMySamplerError_OutOfMemory;
+	}
+	if (err == noErr) {
+		// the head, and the frame after it to interpolate into
+		size_t bytes = (size_t)(sampler->streamHeadFrames + 1) * format.bytesPerFrame;
+		Byte *raw = (Byte *)malloc(bytes);
+		if (raw && pread(fd, raw, bytes, format.dataOffset) == (ssize_t)bytes)
+			MySamplerConvertFrames(raw, &format, sampler->streamHeadFrames + 1, sample->data, sample->channelCount);
+		else
+			err = kMySamplerError_CantReadSample;
+		free(raw);
+	}
+	if (err != noErr) {
+		if (sample)
+			MySamplerRemoveLastSample(sampler);
+		close(fd);
+		return err;
+	}
+	sample->frames = (UInt32)format.frames;
+	sample->residentFrames = sampler->streamHeadFrames;
+	sample->fd = fd;
+	sample->format = format;
+	*outSample = sample;
+	return noErr;
+}
+
+// a sample file, all in memory or streamed. sampleIndex is its place in samples
+static inline OSStatus MySamplerOpenSample(MySampler *sampler, const char *path, UInt32 *outSampleIndex)
+{
+	MySamplerSample *sample = NULL;
+	OSStatus err = sampler->streamHeadFrames ?
+		MySamplerOpenStreamedSample(sampler, path, &sample) :
+		MySamplerMapSampleFile(sampler, path, &sample);
+#ifndef MY_SAMPLER_PORTABLE
+	if (err == kMySamplerError_UnsupportedSampleFormat)
+		err = MySamplerReadExtAudioFile(sampler, path, &sample);
+#endif
+	if (err == noErr && sampler->streamHeadFrames && sampler->sampleBytes > sampler->preloadLimit) {
+		MySamplerRemoveLastSample(sampler);
+		err = kMySamplerError_PreloadLimit;
+	}
+	if (err == noErr)
+		*outSampleIndex = (UInt32)(sample - sampler->samples);
+	return err;
+}
+
+// path if there's a file there, otherwise the same file name next to the
+// preset, or in a Sounds folder next to it
+static inline Boolean MySamplerFindFile(const char *presetPath, const char *path, char *found, size_t foundSize)
+{
+	if (access(path, R_OK) == 0) {
+		snprintf(found, foundSize, "%s", path);
+		return true;
+	}
+	const char *name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+	const char *presetName = strrchr(presetPath, '/');
+	int directoryLength = presetName ? (int)(presetName - presetPath) : 1;
+	const char *directory = presetName ? presetPath : ".";
+	snprintf(found, foundSize, "%.*s/%s", directoryLength, directory, name);
+	if (access(found, R_OK) == 0)
+		return true;
+	snprintf(found, foundSize, "%.*s/Sounds/%s", directoryLength, directory, name);
+	return access(found, R_OK) == 0;
+}
+
+// the sample for a preset's waveform number, loaded the first time it's asked for
+static inline OSStatus MySamplerLoadWaveform(MySampler *sampler, const char *presetPath,
+											 const MyPlistNode *fileReferences, SInt32 waveform,
+											 UInt32 *outSampleIndex)
+{
+	UInt32 i;
+	for (i = 0; i < sampler->sampleCount; i++) {
+		if (sampler->samples[i].waveform == waveform) {
+			*outSampleIndex = i;
+			return noErr;
+		}
+	}
+	char key[32];
+	snprintf(key, sizeof(key), "Sample:%d", (int)waveform);
+	const MyPlistNode *reference = MyPlistGet(fileReferences, key);
+	char path[kMySamplerMaxPath];
+	if (!reference || !reference->string ||
+		!MySamplerFindFile(presetPath, reference->string, path, sizeof(path))) {
+		fprintf(stderr, "MySampler: no file for %s\n", key);
+		return kMySamplerError_CantReadSample;
+	}
+	OSStatus err = MySamplerOpenSample(sampler, path, outSampleIndex);
+	if (err != noErr) {
+		fprintf(stderr, "MySampler: couldn't read %s (%d)\n", path, (int)err);
+		return err;
+	}
+	sampler->samples[*outSampleIndex].waveform = waveform;
+	return noErr;
+}
+
+#pragma mark - zones -
+
+static inline OSStatus MySamplerAddZone(MySampler *sampler, const MySamplerZone *zone)
+{
+	MySamplerZone *zones = (MySamplerZone *)realloc(sampler->zones, (sampler->zoneCount + 1) * sizeof(MySamplerZone));
+	if (!zones)
+		return kMySamplerError_OutOfMemory;
+	sampler->zones = zones;
+	zones[sampler->zoneCount++] = *zone;
+	return noErr;
+}
+
+// a layer's first envelope. stage 6, AUSampler's fast release, isn't used
+static inline void MySamplerReadEnvelope(const MyPlistNode *layer, MySamplerEnvelope *envelope)
+{
+	memset(envelope, 0, sizeof(MySamplerEnvelope));
+	envelope->sustainLevel = 1.0f;
+	const MyPlistNode *envelopes = MyPlistGet(layer, "Envelopes");
+	const MyPlistNode *stages = envelopes && envelopes->child ? MyPlistGet(envelopes->child, "Stages") : NULL;
+	const MyPlistNode *stage;
+	for (stage = stages ? stages->child : NULL; stage; stage = stage->next) {
+		Float64 seconds = MyPlistGetNumber(stage, "time", 0.0);
+		switch ((int)MyPlistGetNumber(stage, "stage", -1)) {
+			case kMySamplerStage_Delay: envelope->delaySeconds = seconds; break;
+			case kMySamplerStage_Attack: envelope->attackSeconds = seconds; break;
+			case kMySamplerStage_Hold: envelope->holdSeconds = seconds; break;
+			case kMySamplerStage_Decay: envelope->decaySeconds = seconds; break;
+			case kMySamplerStage_Sustain: envelope->sustainLevel = MyPlistGetNumber(stage, "level", 1.0); break;
+			case kMySamplerStage_Release: envelope->releaseSeconds = seconds; break;
+		}
+	}
+}
+
+static inline OSStatus MySamplerReadZones(MySampler *sampler, const char *presetPath, const MyPlistNode *preset)
+{
+	const MyPlistNode *fileReferences = MyPlistGet(preset, "file-references");
+	const MyPlistNode *layers = MyPlistGet(MyPlistGet(preset, "Instrument"), "Layers");
+	Float64 presetCents = MyPlistGetNumber(preset, "coarse tune", 0.0) * 100.0 +
+		MyPlistGetNumber(preset, "fine tune", 0.0);
+	Float64 presetGain = pow(10.0, MyPlistGetNumber(preset, "gain", 0.0) / 20.0);
+	const MyPlistNode *layer;
+	for (layer = layers ? layers->child : NULL; layer; layer = layer->next) {
+		MySamplerEnvelope envelope;
+		MySamplerReadEnvelope(layer, &envelope);
+		const MyPlistNode *zones = MyPlistGet(layer, "Zones");
+		const MyPlistNode *zoneNode;
+		for (zoneNode = zones ? zones->child : NULL; zoneNode; zoneNode = zoneNode->next) {
+			if (!MyPlistGetNumber(zoneNode, "enabled", 1.0))
+				continue;
+			MySamplerZone zone;
+			memset(&zone, 0, sizeof(zone));
+			zone.rootKey = (Byte)MyPlistGetNumber(zoneNode, "root key", 60);
+			zone.minKey = (Byte)MyPlistGetNumber(zoneNode, "min key", 0);
+			zone.maxKey = (Byte)MyPlistGetNumber(zoneNode, "max key", 127);
+			zone.minVelocity = (Byte)MyPlistGetNumber(zoneNode, "min vel", 0);
+			zone.maxVelocity = (Byte)MyPlistGetNumber(zoneNode, "max vel", 127);
+			zone.tuneCents = presetCents + MyPlistGetNumber(zoneNode, "coarse tune", 0.0) * 100.0 +
+				MyPlistGetNumber(zoneNode, "fine tune", 0.0);
+			zone.gain = presetGain * pow(10.0, MyPlistGetNumber(zoneNode, "gain", 0.0) / 20.0);
+			zone.envelope = envelope;
+			OSStatus err = MySamplerLoadWaveform(sampler, presetPath, fileReferences,
+												 (SInt32)MyPlistGetNumber(zoneNode, "waveform", -1),
+												 &zone.sampleIndex);
+			if (err != noErr)
+				return err;
+			const MySamplerSample *sample = &sampler->samples[zone.sampleIndex];
+			zone.loop = MyPlistGetNumber(zoneNode, "loop enabled", 0.0) != 0.0;
+			zone.loopStart = (UInt32)MyPlistGetNumber(zoneNode, "loop start", 0);
+			zone.loopEnd = (UInt32)MyPlistGetNumber(zoneNode, "loop end", sample->frames);
+			if (zone.loopEnd > sample->frames || zone.loopEnd <= zone.loopStart) {
+				zone.loopStart = 0;
+				zone.loopEnd = sample->frames;
+			}
+			err = MySamplerAddZone(sampler, &zone);
+			if (err != noErr)
+				return err;
+		}
+	}
+	return sampler->zoneCount ? noErr : kMySamplerError_BadPreset;
+}
+
+#pragma mark - I/O thread -
+
+// safe from the render thread
+static inline void MySamplerWakeIO(MySampler *sampler)
+{
+#if defined(__APPLE__)
+	semaphore_signal(sampler->wakeSemaphore);
+#else
+	sem_post(&sampler->wakeSemaphore);
+#endif
+}
+
+// wait for a wake, or a few milliseconds, whichever comes first
+static inline void MySamplerIOWait(MySampler *sampler)
+{
+#if defined(__APPLE__)
+	mach_timespec_t timeout = { 0, 5000000 };
+	semaphore_timedwait(sampler->wakeSemaphore, timeout);
+#else
+	struct timespec until;
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_nsec += 5000000;
+	if (until.tv_nsec >= 1000000000) {
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000;
+	}
+	while (sem_timedwait(&sampler->wakeSemaphore, &until) != 0 && errno == EINTR)
+		;
+#endif
+}
+
+// read and convert a block's frames, and the frame after them. a short read
+// leaves silence
+static inline void MySamplerRead(MySampler *sampler, const MySamplerStreamRequest *request)
+{
+	const MySamplerSample *sample = request->sample;
+	const MySamplerFileFormat *format = &sample->format;
+	MySamplerStreamBlock *block = request->block;
+	if (format->bytesPerFrame > sampler->readBufferBytesPerFrame) {
+		Byte *readBuffer = (Byte *)realloc(sampler->readBuffer,
+										   (size_t)(kMySamplerStreamBlockFrames + 1) * format->bytesPerFrame);
+		if (!readBuffer)
+			return;
+		sampler->readBuffer = readBuffer;
+		sampler->readBufferBytesPerFrame = format->bytesPerFrame;
+	}
+	UInt32 frames = request->start + request->frames < sample->frames ? request->frames + 1 : request->frames;
+	ssize_t bytes = pread(sample->fd, sampler->readBuffer, (size_t)frames * format->bytesPerFrame,
+						  format->dataOffset + (off_t)request->start * format->bytesPerFrame);
+	UInt32 framesRead = bytes > 0 ? (UInt32)(bytes / format->bytesPerFrame) : 0;
+	MySamplerConvertFrames(sampler->readBuffer, format, framesRead, block->data, sample->channelCount);
+	UInt32 channel;
+	for (channel = 0; channel < sample->channelCount; channel++)
+		memset(block->data[channel] + framesRead, 0, (request->frames + 1 - framesRead) * sizeof(Float32));
+
+	// the data has to be there before the render thread can see the block's ready
+	__sync_synchronize();
+	if (__sync_bool_compare_and_swap(&block->ticket, request->ticket,
+									 (request->ticket & ~3u) | kMySamplerBlock_Ready)) {
+		UInt64 ticks = MySamplerClock() - request->requestTime;
+		sampler->streamReads++;
+		sampler->readTicks += ticks;
+		if (ticks > sampler->maxReadTicks)
+			sampler->maxReadTicks = ticks;
+		if (sampler->renderedFrames > request->deadline)
+			sampler->lateReads++;
+	}
+}
+
+// reads requested blocks, the one whose voice will need it first first
+static void *MySamplerIOProc(void *refCon)
+{
+	MySampler *sampler = (MySampler *)refCon;
+	while (!sampler->stopStreaming) {
+		UInt32 read = sampler->requestsRead;
+		UInt32 written = sampler->requestsWritten;
+		__sync_synchronize();
+		while (read != written && sampler->pendingCount < kMySamplerRequestCapacity)
+			sampler->pending[sampler->pendingCount++] = sampler->requests[read++ & (kMySamplerRequestCapacity - 1)];
+		// done with the requests before the render thread can reuse their slots
+		__sync_synchronize();
+		sampler->requestsRead = read;
+
+		// requests for blocks that have been reused since are dropped
+		UInt32 best = kMySamplerRequestCapacity;
+		UInt32 i = 0;
+		while (i < sampler->pendingCount) {
+			const MySamplerStreamRequest *request = &sampler->pending[i];
+			if (request->block->ticket != request->ticket) {
+				sampler->pending[i] = sampler->pending[--sampler->pendingCount];
+				continue;
+			}
+			if (best == kMySamplerRequestCapacity || request->deadline < sampler->pending[best].deadline)
+				best = i;
+			i++;
+		}
+		if (best == kMySamplerRequestCapacity) {
+			MySamplerIOWait(sampler);
+			continue;
+		}
+		MySamplerStreamRequest request = sampler->pending[best];
+		sampler->pending[best] = sampler->pending[--sampler->pendingCount];
+		MySamplerRead(sampler, &request);
+	}
+	return NULL;
+}
+
+static inline void MySamplerStopIOThread(MySampler *sampler)
+{
+	if (sampler->ioThread) {
+		sampler->stopStreaming = true;
+		__sync_synchronize();
+		MySamplerWakeIO(sampler);
+		pthread_join(sampler->ioThread, NULL);
+#if defined(__APPLE__)
+		semaphore_destroy(mach_task_self(), sampler->wakeSemaphore);
+#else
+		sem_destroy(&sampler->wakeSemaphore);
+#endif
+		sampler->ioThread = 0;
+	}
+	free(sampler->pending);
+	free(sampler->readBuffer);
+	sampler->pending = NULL;
+	sampler->pendingCount = 0;
+	sampler->readBuffer = NULL;
+	sampler->readBufferBytesPerFrame = 0;
+	sampler->requestsRead = sampler->requestsWritten = 0;
+	sampler->stopStreaming = false;
+}
+
+static inline OSStatus MySamplerStartIOThread(MySampler *sampler)
+{
+	sampler->pending = (MySamplerStreamRequest *)malloc(kMySamplerRequestCapacity * sizeof(MySamplerStreamRequest));
+	if (!sampler->pending)
+		return kMySamplerError_OutOfMemory;
+#if defined(__APPLE__)
+	if (semaphore_create(mach_task_self(), &sampler->wakeSemaphore, SYNC_POLICY_FIFO, 0) != KERN_SUCCESS)
+		return kMySamplerError_Thread;
+#else
+	if (sem_init(&sampler->wakeSemaphore, 0, 0) != 0)
+		return kMySamplerError_Thread;
+#endif
+	if (pthread_create(&sampler->ioThread, NULL, MySamplerIOProc, sampler) != 0) {
+#if defined(__APPLE__)
+		semaphore_destroy(mach_task_self(), sampler->wakeSemaphore);
+#else
+		sem_destroy(&sampler->wakeSemaphore);
+#endif
+		sampler->ioThread = 0;
+		return kMySamplerError_Thread;
+	}
+	return noErr;
+}
+
+#pragma mark - sampler -
+
+static inline void MySamplerResetVoices(MySampler *sampler)
+{
+	memset(sampler->voices, 0, (sampler->voiceCount + kMySamplerFadeVoices) * sizeof(MySamplerVoice));
+	int channel;
+	for (channel = 0; channel < 16; channel++) {
+		sampler->sustainPedal[channel] = false;
+		sampler->pitchBend[channel] = 1.0;
+		sampler->volume[channel] = 1.0f;
+	}
+	sampler->eventCount = 0;
+	sampler->renderedFrames = 0;
+	sampler->playingVoices = sampler->maxPlayingVoices = 0;
+	sampler->steals = sampler->droppedEvents = sampler->unmappedNotes = 0;
+	sampler->dropouts = sampler->droppedRequests = 0;
+	sampler->underrunFrames = 0;
+	sampler->streamReads = sampler->lateReads = 0;
+	sampler->readTicks = sampler->maxReadTicks = 0;
+}
+
+// each voice's blocks, all in one allocation
+static inline OSStatus MySamplerAllocateStreams(MySampler *sampler)
+{
+	UInt32 slots = sampler->voiceCount + kMySamplerFadeVoices;
+	size_t blockFloats = kMySamplerStreamBlockFrames + 1;
+	sampler->streams = (MySamplerStream *)calloc(slots, sizeof(MySamplerStream));
+	sampler->streamBytes = (size_t)slots * kMySamplerStreamBlocks * 2 * blockFloats * sizeof(Float32);
+	sampler->streamMemory = (Float32 *)malloc(sampler->streamBytes);
+	if (!sampler->streams || !sampler->streamMemory)
+		return kMySamplerError_OutOfMemory;
+	Float32 *memory = sampler->streamMemory;
+	UInt32 slot, block;
+	for (slot = 0; slot < slots; slot++) {
+		for (block = 0; block < kMySamplerStreamBlocks; block++) {
+			sampler->streams[slot].blocks[block].data[0] = memory;
+			sampler->streams[slot].blocks[block].data[1] = memory + blockFloats;
+			memory += 2 * blockFloats;
+		}
+	}
+	return noErr;
+}
+
+// not while rendering: the voices are reallocated, and all of them stop
+static inline OSStatus MySamplerSetVoiceCount(MySampler *sampler, UInt32 voiceCount)
+{
+	// the I/O thread mustn't be reading into the streams while they're replaced
+	MySamplerStopIOThread(sampler);
+	free(sampler->streams);
+	free(sampler->streamMemory);
+	sampler->streams = NULL;
+	sampler->streamMemory = NULL;
+	sampler->streamBytes = 0;
+
+	MySamplerVoice *voices = (MySamplerVoice *)malloc((voiceCount + kMySamplerFadeVoices) * sizeof(MySamplerVoice));
+	if (!voices)
+		return kMySamplerError_OutOfMemory;
+	free(sampler->voices);
+	sampler->voices = voices;
+	sampler->voiceCount = voiceCount;
+	MySamplerResetVoices(sampler);
+	if (sampler->streamHeadFrames) {
+		OSStatus err = MySamplerAllocateStreams(sampler);
+		if (err == noErr)
+			err = MySamplerStartIOThread(sampler);
+		if (err != noErr)
+			return err;
+	}
+	return noErr;
+}
+
+// from now on, samples longer than headFrames keep only their first headFrames
+// in memory and the rest is read from disk as it plays. loading fails if the
+// heads and any short samples would take more than preloadLimit bytes. call
+// before loading any samples
+static inline OSStatus MySamplerSetStreaming(MySampler *sampler, UInt32 headFrames, size_t preloadLimit)
+{
+	sampler->streamHeadFrames = headFrames;
+	sampler->preloadLimit = preloadLimit;
+	return MySamplerSetVoiceCount(sampler, sampler->voiceCount);
+}
+
+static inline void MySamplerDispose(MySampler *sampler)
+{
+	MySamplerStopIOThread(sampler);
+	UInt32 i;
+	for (i = 0; i < sampler->sampleCount; i++) {
+		free(sampler->samples[i].data[0]);
+		free(sampler->samples[i].data[1]);
+		if (sampler->samples[i].fd >= 0)
+			close(sampler->samples[i].fd);
+	}
+	free(sampler->samples);
+	free(sampler->zones);
+	free(sampler->voices);
+	free(sampler->streams);
+	free(sampler->streamMemory);
+	memset(sampler, 0, sizeof(MySampler));
+}
+
+static inline OSStatus MySamplerInit(MySampler *sampler, Float64 sampleRate)
+{
+	memset(sampler, 0, sizeof(MySampler));
+	sampler->sampleRate = sampleRate;
+	sampler->presetVoiceCount = kMySamplerDefaultVoices;
+	return MySamplerSetVoiceCount(sampler, kMySamplerDefaultVoices);
+}
+
+// replaces the zones with the preset's, and sets the voice count it asks for.
+// streaming stays as it was
+static inline OSStatus MySamplerLoadPreset(MySampler *sampler, const char *presetPath)
+{
+	FILE *file = fopen(presetPath, "rb");
+	if (!file)
+		return kMySamplerError_CantReadPreset;
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	char *text = length > 0 ? (char *)malloc(length) : NULL;
+	Boolean didRead = text && fread(text, 1, length, file) == (size_t)length;
+	fclose(file);
+	if (!didRead) {
+		free(text);
+		return kMySamplerError_CantReadPreset;
+	}
+	MyPlistNode *preset = length >= 6 && memcmp(text, "bplist", 6) ? MyPlistParse(text, length) : NULL;
+	free(text);
+	if (!preset)
+		return kMySamplerError_BadPreset;
+
+	Float64 sampleRate = sampler->sampleRate;
+	UInt32 streamHeadFrames = sampler->streamHeadFrames;
+	size_t preloadLimit = sampler->preloadLimit;
+	MySamplerDispose(sampler);
+	OSStatus err = MySamplerInit(sampler, sampleRate);
+	if (err == noErr && streamHeadFrames)
+		err = MySamplerSetStreaming(sampler, streamHeadFrames, preloadLimit);
+	if (err == noErr)
+		err = MySamplerReadZones(sampler, presetPath, preset);
+	if (err == noErr) {
+		sampler->presetVoiceCount = (UInt32)MyPlistGetNumber(preset, "voice count", kMySamplerDefaultVoices);
+		if (sampler->presetVoiceCount == 0)
+			sampler->presetVoiceCount = kMySamplerDefaultVoices;
+		err = MySamplerSetVoiceCount(sampler, sampler->presetVoiceCount);
+	}
+	MyPlistFree(preset);
+	return err;
+}
+
+#pragma mark - streams -
+
+// ask the I/O thread to read the next stretch of the voice's sample into block.
+// false if the request queue is full, and the block should be asked for again
+static inline Boolean MySamplerRequestBlock(MySampler *sampler, MySamplerVoice *voice, MySamplerStreamBlock *block)
+{
+	MySamplerStream *stream = &sampler->streams[voice - sampler->voices];
+	const MySamplerZone *zone = voice->zone;
+	const MySamplerSample *sample = voice->sample;
+	UInt32 generation = (block->ticket >> 2) + 1;
+	block->ticket = generation << 2 | kMySamplerBlock_Empty;
+	UInt32 start = stream->nextStart;
+	UInt32 end = zone->loop && start < zone->loopEnd ? zone->loopEnd : sample->frames;
+	if (start >= end)
+		return true; // nothing left to read
+	UInt32 written = sampler->requestsWritten;
+	if (written - sampler->requestsRead >= kMySamplerRequestCapacity) {
+		sampler->droppedRequests++;
+		return false;
+	}
+	block->start = start;
+	block->frames = end - start < kMySamplerStreamBlockFrames ? end - start : kMySamplerStreamBlockFrames;
+	block->ticket = generation << 2 | kMySamplerBlock_Requested;
+
+	// the voice needs it once it has played up to its start, at the pitch it has
+	// now, going round the loop if the start is behind it
+	MySamplerStreamRequest *request = &sampler->requests[written & (kMySamplerRequestCapacity - 1)];
+	UInt32 playFrame = (UInt32)(voice->position >> 32);
+	UInt32 ahead = start > playFrame ? start - playFrame :
+		zone->loop && playFrame < zone->loopEnd ? zone->loopEnd - playFrame + start - zone->loopStart : 0;
+	request->block = block;
+	request->ticket = block->ticket;
+	request->sample = sample;
+	request->start = block->start;
+	request->frames = block->frames;
+	request->deadline = sampler->renderedFrames + (UInt64)(ahead / voice->increment);
+	request->requestTime = MySamplerClock();
+	// the request has to be there before the I/O thread can see it
+	__sync_synchronize();
+	sampler->requestsWritten = written + 1;
+	sampler->requestsToWake = true;
+
+	stream->nextStart = start + block->frames;
+	if (zone->loop && stream->nextStart == zone->loopEnd)
+		stream->nextStart = zone->loopStart > sample->residentFrames ? zone->loopStart : sample->residentFrames;
+	return true;
+}
+
+// forget a voice's blocks. reads already asked for are dropped
+static inline void MySamplerCancelStream(MySampler *sampler, MySamplerVoice *voice)
+{
+	MySamplerStream *stream = &sampler->streams[voice - sampler->voices];
+	UInt32 block;
+	for (block = 0; block < kMySamplerStreamBlocks; block++)
+		stream->blocks[block].ticket = ((stream->blocks[block].ticket >> 2) + 1) << 2 | kMySamplerBlock_Empty;
+}
+
+// a new note: if it will play past its sample's head, start reading what comes
+// after the head straight away, so it's there by the time the head's played
+static inline void MySamplerStartStream(MySampler *sampler, MySamplerVoice *voice)
+{
+	MySamplerStream *stream = &sampler->streams[voice - sampler->voices];
+	const MySamplerZone *zone = voice->zone;
+	const MySamplerSample *sample = voice->sample;
+	MySamplerCancelStream(sampler, voice);
+	stream->playBlock = 0;
+	stream->underran = false;
+	stream->nextStart = sample->residentFrames;
+	if (sample->residentFrames >= (zone->loop ? zone->loopEnd : sample->frames))
+		return;
+	UInt32 block;
+	for (block = 0; block < kMySamplerStreamBlocks; block++)
+		MySamplerRequestBlock(sampler, voice, &stream->blocks[block]);
+}
+
+#pragma mark - voices -
+
+static inline void MySamplerEndVoice(MySampler *sampler, MySamplerVoice *voice)
+{
+	voice->zone = NULL;
+	if (sampler->streams)
+		MySamplerCancelStream(sampler, voice);
+}
+
+static inline void MySamplerEnterStage(MySampler *sampler, MySamplerVoice *voice, UInt32 stage)
+{
+	const MySamplerEnvelope *envelope = &voice->zone->envelope;
+	Float64 seconds = 0.0;
+	Float32 target = voice->level;
+	voice->stage = stage;
+	switch (stage) {
+		case kMySamplerStage_Delay:
+			seconds = envelope->delaySeconds;
+			break;
+		case kMySamplerStage_Attack:
+			seconds = envelope->attackSeconds > kMySamplerMinRampSeconds ?
+				envelope->attackSeconds : kMySamplerMinRampSeconds;
+			target = 1.0f;
+			break;
+		case kMySamplerStage_Hold:
+			seconds = envelope->holdSeconds;
+			break;
+		case kMySamplerStage_Decay:
+			seconds = envelope->decaySeconds;
+			target = envelope->sustainLevel;
+			break;
+		case kMySamplerStage_Sustain:
+			if (voice->level <= 0.0f) {
+				MySamplerEndVoice(sampler, voice); // nothing left to sustain
+				return;
+			}
+			voice->step = 0.0f;
+			voice->stageFrames = 0xFFFFFFFF;
+			return;
+		case kMySamplerStage_Release:
+			seconds = voice->stolen ? kMySamplerStealSeconds :
+				envelope->releaseSeconds > kMySamplerMinRampSeconds ?
+				envelope->releaseSeconds : kMySamplerMinRampSeconds;
+			target = 0.0f;
+			break;
+		default:
+			MySamplerEndVoice(sampler, voice);
+			return;
+	}
+	voice->stageFrames = (UInt32)(seconds * sampler->sampleRate + 0.5);
+	if (voice->stageFrames == 0) {
+		voice->level = target;
+		voice->step = 0.0f;
+	} else {
+		voice->step = (target - voice->level) / voice->stageFrames;
+	}
+}
+
+static inline void MySamplerReleaseVoice(MySampler *sampler, MySamplerVoice *voice)
+{
+	voice->released = true;
+	voice->sustained = false;
+	if (voice->stage < kMySamplerStage_Release)
+		MySamplerEnterStage(sampler, voice, kMySamplerStage_Release);
+}
+
+// make room for a new note if all voiceCount voices are playing, and return a free voice
+static inline MySamplerVoice *MySamplerFindVoice(MySampler *sampler)
+{
+	UInt32 slots = sampler->voiceCount + kMySamplerFadeVoices;
+	UInt32 playing = 0;
+	MySamplerVoice *freeVoice = NULL;
+	MySamplerVoice *victim = NULL; // quietest released voice, or the oldest
+	MySamplerVoice *quietestFading = NULL;
+	UInt32 i;
+	for (i = 0; i < slots; i++) {
+		MySamplerVoice *voice = &sampler->voices[i];
+		if (!voice->zone) {
+			if (!freeVoice)
+				freeVoice = voice;
+		} else if (voice->stolen) {
+			if (!quietestFading || voice->level < quietestFading->level)
+				quietestFading = voice;
+		} else {
+			playing++;
+			if (!victim ||
+				(voice->released && (!victim->released || voice->level < victim->level)) ||
+				(!voice->released && !victim->released && voice->age < victim->age))
+				victim = voice;
+		}
+	}
+	if (playing >= sampler->voiceCount && victim) {
+		victim->stolen = true;
+		victim->released = true;
+		MySamplerEnterStage(sampler, victim, kMySamplerStage_Release);
+		sampler->steals++;
+	}
+	if (!freeVoice) {
+		// every spare voice is still fading: cut the quietest off
+		freeVoice = quietestFading ? quietestFading : victim;
+		if (freeVoice)
+			MySamplerEndVoice(sampler, freeVoice);
+	}
+	return freeVoice;
+}
+
+static inline void MySamplerNoteOn(MySampler *sampler, Byte channel, Byte note, Byte velocity)
+{
+	Boolean mapped = false;
+	UInt32 i;
+	for (i = 0; i < sampler->zoneCount; i++) {
+		const MySamplerZone *zone = &sampler->zones[i];
+		if (note < zone->minKey || note > zone->maxKey ||
+			velocity < zone->minVelocity || velocity > zone->maxVelocity)
+			continue;
+		mapped = true;
+		MySamplerVoice *voice = MySamplerFindVoice(sampler);
+		if (!voice)
+			return;
+		const MySamplerSample *sample = &sampler->samples[zone->sampleIndex];
+		memset(voice, 0, sizeof(MySamplerVoice));
+		voice->zone = zone;
+		voice->sample = sample;
+		voice->channel = channel;
+		voice->note = note;
+		voice->age = sampler->noteCount++;
+		voice->increment = pow(2.0, (note - zone->rootKey + zone->tuneCents / 100.0) / 12.0) *
+			sample->sampleRate / sampler->sampleRate;
+		Float32 loudness = velocity / 127.0f;
+		voice->gain = zone->gain * loudness * loudness;
+		MySamplerEnterStage(sampler, voice, kMySamplerStage_Delay);
+		if (sampler->streams)
+			MySamplerStartStream(sampler, voice);
+	}
+	if (!mapped)
+		sampler->unmappedNotes++;
+}
+
+static inline void MySamplerNoteOff(MySampler *sampler, Byte channel, Byte note)
+{
+	UInt32 slots = sampler->voiceCount + kMySamplerFadeVoices;
+	UInt32 i;
+	for (i = 0; i < slots; i++) {
+		MySamplerVoice *voice = &sampler->voices[i];
+		if (!voice->zone || voice->released || voice->sustained || voice->channel != channel || voice->note != note)
+			continue;
+		if (sampler->sustainPedal[channel])
+			voice->sustained = true;
+		else
+			MySamplerReleaseVoice(sampler, voice);
+	}
+}
+
+static inline void MySamplerControlChange(MySampler *sampler, Byte channel, Byte controller, Byte value)
+{
+	UInt32 slots = sampler->voiceCount + kMySamplerFadeVoices;
+	UInt32 i;
+	switch (controller) {
+		case 7: // volume
+			sampler->volume[channel] = (value / 127.0f) * (value / 127.0f);
+			break;
+		case 64: // sustain pedal
+			sampler->sustainPedal[channel] = value >= 64;
+			if (value < 64)
+				for (i = 0; i < slots; i++)
+					if (sampler->voices[i].zone && sampler->voices[i].sustained && sampler->voices[i].channel == channel)
+						MySamplerReleaseVoice(sampler, &sampler->voices[i]);
+			break;
+		case 120: // all sound off
+			for (i = 0; i < slots; i++)
+				if (sampler->voices[i].zone && sampler->voices[i].channel == channel)
+					MySamplerEndVoice(sampler, &sampler->voices[i]);
+			break;
+		case 123: // all notes off
+			for (i = 0; i < slots; i++)
+				if (sampler->voices[i].zone && !sampler->voices[i].released && sampler->voices[i].channel == channel)
+					MySamplerReleaseVoice(sampler, &sampler->voices[i]);
+			break;
+	}
+}
+
+// play a channel message now. others are ignored
+static inline void MySamplerMIDIEvent(MySampler *sampler, Byte status, Byte data1, Byte data2)
+{
+	Byte channel = status & 0x0F;
+	switch (status & 0xF0) {
+		case 0x90:
+			// a velocity of 0 is a note off
+			if (data2)
+				MySamplerNoteOn(sampler, channel, data1, data2);
+			else
+				MySamplerNoteOff(sampler, channel, data1);
+			break;
+		case 0x80:
+			MySamplerNoteOff(sampler, channel, data1);
+			break;
+		case 0xB0:
+			MySamplerControlChange(sampler, channel, data1, data2);
+			break;
+		case 0xE0:
+			sampler->pitchBend[channel] = pow(2.0, (((SInt32)data2 << 7 | data1) - 8192) / 8192.0 *
+											  kMySamplerPitchBendRange / 12.0);
+			break;
+	}
+}
+
+// play a channel message offsetSampleFrame frames into the next render
+static inline void MySamplerScheduleMIDIEvent(MySampler *sampler, Byte status, Byte data1, Byte data2,
+											  UInt32 offsetSampleFrame)
+{
+	if (sampler->eventCount == kMySamplerMaxEvents) {
+		sampler->droppedEvents++;
+		return;
+	}
+	// events mostly come in order, so this is usually a straight append
+	UInt32 i = sampler->eventCount;
+	while (i > 0 && sampler->events[i - 1].offset > offsetSampleFrame) {
+		sampler->events[i] = sampler->events[i - 1];
+		i--;
+	}
+	sampler->events[i].offset = offsetSampleFrame;
+	sampler->events[i].status = status;
+	sampler->events[i].data1 = data1;
+	sampler->events[i].data2 = data2;
+	sampler->eventCount++;
+}
+
+#pragma mark - rendering -
+
+// add frames of a voice into left and right, moving its envelope and sample
+// position along. past a streamed sample's head, frames come from the voice's
+// blocks. if the next one hasn't been read yet, the voice is silent and waits
+// where it is, so the stream can catch up
+static inline void MySamplerRenderVoice(MySampler *sampler, MySamplerVoice *voice,
+										Float32 *left, Float32 *right, UInt32 frames)
+{
+	const MySamplerSample *sample = voice->sample;
+	Float32 volume = sampler->volume[voice->channel];
+	UInt64 increment = (UInt64)(voice->increment * sampler->pitchBend[voice->channel] * 4294967296.0);
+	if (increment == 0)
+		increment = 1;
+	UInt32 done = 0;
+	while (done < frames && voice->zone) {
+		if (voice->stageFrames == 0) {
+			MySamplerEnterStage(sampler, voice, voice->stage + 1);
+			continue;
+		}
+		const MySamplerZone *zone = voice->zone;
+		UInt32 endFrame = zone->loop ? zone->loopEnd : sample->frames;
+		if (voice->position >= (UInt64)endFrame << 32) {
+			if (!zone->loop || zone->loopEnd <= zone->loopStart) {
+				MySamplerEndVoice(sampler, voice); // played to the end
+				break;
+			}
+			voice->position -= (UInt64)(zone->loopEnd - zone->loopStart) << 32;
+			continue;
+		}
+
+		// where the frames come from: the head, or one of the voice's blocks
+		Float32 *const *data = sample->data;
+		UInt32 dataStart = 0;
+		UInt32 dataEnd = endFrame;
+		MySamplerStream *stream = NULL;
+		UInt32 playFrame = (UInt32)(voice->position >> 32);
+		if (playFrame >= sample->residentFrames) {
+			stream = &sampler->streams[voice - sampler->voices];
+			MySamplerStreamBlock *block = &stream->blocks[stream->playBlock];
+			UInt32 state = block->ticket & 3;
+			if (state == kMySamplerBlock_Ready &&
+				(playFrame < block->start || playFrame >= block->start + block->frames)) {
+				// played: read the stretch after the other blocks into it, and move on
+				MySamplerRequestBlock(sampler, voice, block);
+				stream->playBlock = (stream->playBlock + 1) % kMySamplerStreamBlocks;
+				continue;
+			}
+			if (state == kMySamplerBlock_Empty)
+				MySamplerRequestBlock(sampler, voice, block); // the queue was full before
+			if (state == kMySamplerBlock_Ready) {
+				// the block's ready before its data is read
+				__sync_synchronize();
+				data = block->data;
+				dataStart = block->start;
+				dataEnd = block->start + block->frames;
+				stream = NULL;
+			}
+		} else if (dataEnd > sample->residentFrames) {
+			dataEnd = sample->residentFrames;
+		}
+
+		UInt32 count = frames - done;
+		if (count > kMySamplerChunkFrames)
+			count = kMySamplerChunkFrames;
+		if (count > voice->stageFrames)
+			count = voice->stageFrames;
+		if (stream) {
+			// underrun
+			sampler->underrunFrames += count;
+			if (!stream->underran) {
+				stream->underran = true;
+				sampler->dropouts++;
+			}
+		} else {
+			UInt64 untilEnd = (((UInt64)dataEnd << 32) - voice->position + increment - 1) / increment;
+			if (count > untilEnd)
+				count = (UInt32)untilEnd;
+			if (voice->stage != kMySamplerStage_Delay) {
+				UInt64 position = voice->position - ((UInt64)dataStart << 32);
+				Float32 gain = voice->gain * volume;
+				MyInterpolateLinear(data[0], position, increment, sampler->scratch, count);
+				MyMixWithGainRamp(sampler->scratch, left + done, count, voice->level * gain, voice->step * gain);
+				if (sample->channelCount > 1)
+					MyInterpolateLinear(data[1], position, increment, sampler->scratch, count);
+				MyMixWithGainRamp(sampler->scratch, right + done, count, voice->level * gain, voice->step * gain);
+				voice->position += increment * count;
+			}
+		}
+		voice->level += voice->step * count;
+		if (voice->stage != kMySamplerStage_Sustain)
+			voice->stageFrames -= count;
+		done += count;
+	}
+}
+
+// frames of every voice into left and right, which are overwritten. events
+// scheduled since the last render are played at their offsets
+static inline void MySamplerRender(MySampler *sampler, Float32 *left, Float32 *right, UInt32 frames)
+{
+	memset(left, 0, frames * sizeof(Float32));
+	memset(right, 0, frames * sizeof(Float32));
+	UInt32 slots = sampler->voiceCount + kMySamplerFadeVoices;
+	UInt32 nextEvent = 0;
+	UInt32 done = 0;
+	while (done < frames) {
+		while (nextEvent < sampler->eventCount && sampler->events[nextEvent].offset <= done) {
+			const MySamplerEvent *event = &sampler->events[nextEvent++];
+			MySamplerMIDIEvent(sampler, event->status, event->data1, event->data2);
+		}
+		UInt32 count = frames - done;
+		if (nextEvent < sampler->eventCount && sampler->events[nextEvent].offset < frames)
+			count = sampler->events[nextEvent].offset - done;
+		UInt32 i;
+		for (i = 0; i < slots; i++)
+			if (sampler->voices[i].zone)
+				MySamplerRenderVoice(sampler, &sampler->voices[i], left + done, right + done, count);
+		done += count;
+	}
+	// events scheduled past the end of the slice play at its end
+	while (nextEvent < sampler->eventCount) {
+		const MySamplerEvent *event = &sampler->events[nextEvent++];
+		MySamplerMIDIEvent(sampler, event->status, event->data1, event->data2);
+	}
+	sampler->eventCount = 0;
+	sampler->renderedFrames += frames;
+	if (sampler->requestsToWake) {
+		sampler->requestsToWake = false;
+		MySamplerWakeIO(sampler);
+	}
+
+	UInt32 playing = 0;
+	UInt32 i;
+	for (i = 0; i < slots; i++)
+		if (sampler->voices[i].zone)
+			playing++;
+	sampler->playingVoices = playing;
+	if (playing > sampler->maxPlayingVoices)
+		sampler->maxPlayingVoices = playing;
+}
+
+static inline void MySamplerPrintStats(const MySampler *sampler, FILE *out)
+{
+	fprintf(out, "MySampler: %u voices playing (%u at most), %u stolen, %u notes with no zone, %u events dropped\n",
+			(unsigned)sampler->playingVoices, (unsigned)sampler->maxPlayingVoices, (unsigned)sampler->steals,
+			(unsigned)sampler->unmappedNotes, (unsigned)sampler->droppedEvents);
+	if (sampler->streamHeadFrames && sampler->streamReads)
+		fprintf(out, "MySampler streaming: %u reads, %.2f ms on average (%.2f ms at most), %u late; "
+				"%u notes dropped out for %llu frames, %u requests dropped\n",
+				(unsigned)sampler->streamReads,
+				MySamplerClockSeconds(sampler->readTicks) * 1000.0 / sampler->streamReads,
+				MySamplerClockSeconds(sampler->maxReadTicks) * 1000.0, (unsigned)sampler->lateReads,
+				(unsigned)sampler->dropouts, (unsigned long long)sampler->underrunFrames,
+				(unsigned)sampler->droppedRequests);
+}
+
+#endif
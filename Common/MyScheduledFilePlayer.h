@@ -0,0 +1,738 @@
+//
+//  MyScheduledFilePlayer.h
+//  Common
+//
+//  Copyright 2026 Subsequently and Furthermore, Inc. All rights reserved.
+//
+
+// A file player in the style of AUAudioFilePlayer, whose parts can be seen and
+// timed. Regions of a file are queued to start at given sample times and
+// played back to back, each looping as many times as it asks. A thread decodes
+// ahead of the render thread into a ring of float frames, so the render
+// callback only copies. It never reads the file, locks or allocates.
+//
+// Times are counted in frames this player has rendered, starting at 0. A region
+// starts on exactly the frame it was scheduled for. A region scheduled with
+// kMyFilePlayerStartAfterPrevious starts on the frame after the region before
+// it ends. Loops and back-to-back regions are decoded into the ring one after
+// another, so there is never a gap between them.
+//
+// MyFilePlayerReset() drops everything queued. Nothing is taken back from the
+// render thread. The decode thread notes where in the ring its new audio begins
+// and which region comes first, and the render thread jumps there at the start
+// of its next render. Until then, the old audio keeps playing. A seek is a reset
+// followed by one region from the new position. How quickly it can be heard is
+// up to the source's seek and read, and each one is timed.
+//
+// Audio comes from a MyFilePlayerSource: a seek and a read callback, producing
+// non-interleaved Float32. MyFilePlayerInitWithExtAudioFile() wraps an
+// ExtAudioFile. ExtAudioFileSeek() finds the packet holding the frame in the
+// file's packet table, so seeking in a VBR file doesn't walk the data. Define
+// MY_FILE_PLAYER_PORTABLE to leave the ExtAudioFile part out.
+//
+// One thread schedules, resets and seeks. One thread renders. Without an output
+// device, that can be the same thread, using MyFilePlayerWaitForGeneration() and
+// MyFilePlayerWaitForFrames() to sleep while the decode thread catches up.
+
+#ifndef Common_MyScheduledFilePlayer_h
+#define Common_MyScheduledFilePlayer_h
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#include <errno.h>
+#include <semaphore.h>
+#endif
+
+#define kMyFilePlayerMaxRegions			256 // queued and not finished playing
+#define kMyFilePlayerMaxChannels		8
+#define kMyFilePlayerDecodeFrames		4096 // frames read from the source at a time
+#define kMyFilePlayerStartAfterPrevious	-1
+#define kMyFilePlayerLoopForever		0xFFFFFFFF
+
+#if defined(__APPLE__)
+typedef semaphore_t MyFilePlayerSemaphore;
+#else
+typedef sem_t MyFilePlayerSemaphore;
+#endif
+
+enum {
+	kMyFilePlayerError_QueueFull = 1,		// kMyFilePlayerMaxRegions still to play
+	kMyFilePlayerError_BadRegion = 2,		// nothing of it is inside the file
+	kMyFilePlayerError_TooManyChannels = 3,	// more than kMyFilePlayerMaxChannels
+	kMyFilePlayerError_Thread = 4			// couldn't start the decode thread
+};
+
+typedef struct MyFilePlayerRegion {
+	SInt64				startTime; // player sample time of its first frame, or kMyFilePlayerStartAfterPrevious
+	SInt64				startFrame; // in the file
+	SInt64				framesToPlay;
+	UInt32				loopCount; // times to play it again after the first. 0 plays it once
+} MyFilePlayerRegion;
+
+// read fills ioData (non-interleaved Float32, one buffer per channel) with up to
+// *ioFrames frames, and sets *ioFrames to how many it read: fewer only at the end
+typedef struct MyFilePlayerSource {
+	OSStatus			(*seek)(void *refCon, SInt64 frame);
+	OSStatus			(*read)(void *refCon, UInt32 *ioFrames, AudioBufferList *ioData);
+	void				*refCon;
+	SInt64				frameCount;
+} MyFilePlayerSource;
+
+typedef struct MyFilePlayer {
+	Float64				sampleRate;
+	UInt32				channelCount;
+	MyFilePlayerSource	source;
+
+	// regions[i % kMyFilePlayerMaxRegions] is the i'th region ever scheduled
+	MyFilePlayerRegion	regions[kMyFilePlayerMaxRegions];
+	volatile UInt32		regionsScheduled;
+
+	// decoded audio, one ring per channel. positions count frames and wrap at 2^32
+	Float32				*ring;
+	UInt32				ringFrames; // a power of two
+	volatile UInt32		ringWritten;
+	volatile UInt32		ringRead;
+
+	// resets. each one is a new generation
+	volatile UInt32		requestedGeneration;
+	volatile UInt32		resetRegion; // first region of the requested generation
+	volatile UInt64		resetTime; // MyFilePlayerClock() when it was requested
+	volatile UInt32		decodeGeneration; // the newest one the decode thread has started
+	volatile UInt32		generationRingStart; // where its audio starts in the ring
+	volatile UInt32		generationFirstRegion;
+	volatile UInt32		renderGeneration; // the one being played
+
+	// decode thread
+	pthread_t			decodeThread;
+	MyFilePlayerSemaphore wakeSemaphore;
+	volatile Boolean	stopDecoding;
+	AudioBufferList		*decodeBuffers;
+	volatile UInt32		decodeRegion;
+	UInt32				decodeLoop;
+	SInt64				decodeFrame; // within the region
+	Boolean				decodeNeedsSeek;
+	volatile UInt32		stagedFrames; // decoded, not yet in the ring
+	UInt32				stagedOffset;
+	Boolean				generationHasAudio; // false until a reset's first frames reach the ring
+
+	// a thread in MyFilePlayerWaitForGeneration() or MyFilePlayerWaitForFrames()
+	MyFilePlayerSemaphore progressSemaphore;
+	volatile UInt32		progressCount; // bumped when a generation starts or frames reach the ring
+	volatile Boolean	progressWanted;
+
+	// render thread
+	volatile SInt64		sampleTime;
+	volatile UInt32		renderRegion;
+	UInt32				renderLoop;
+	SInt64				renderFrame; // within the region
+	Boolean				renderRegionStarted;
+	SInt64				previousRegionEnd; // sample time after the last region played
+
+	// stats, in MyFilePlayerClock() ticks
+	UInt64				decodeTime;
+	UInt64				decodedFrames;
+	UInt64				renderTime;
+	UInt64				renderedFrames;
+	UInt32				seekCount;
+	UInt64				seekTime; // reset requested -> first new frame in the ring
+	UInt64				maxSeekTime;
+	volatile UInt32		underruns; // slices where the ring ran dry mid-region
+	volatile UInt32		lateStarts; // regions that started after their startTime
+} MyFilePlayer;
+
+#pragma mark - clock -
+
+static inline UInt64 MyFilePlayerClock(void)
+{
+#if defined(__APPLE__)
+	return mach_absolute_time();
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (UInt64)now.tv_sec * 1000000000ull + now.tv_nsec;
+#endif
+}
+
+static inline Float64 MyFilePlayerClockSeconds(UInt64 ticks)
+{
+#if defined(__APPLE__)
+	mach_timebase_info_data_t timebase;
+	mach_timebase_info(&timebase);
+	return ticks * ((Float64)timebase.numer / timebase.denom) / 1000000000.0;
+#else
+	return ticks / 1000000000.0;
+#endif
+}
+
+#pragma mark - semaphores -
+
+static inline Boolean MyFilePlayerSemaphoreCreate(MyFilePlayerSemaphore *semaphore)
+{
+#if defined(__APPLE__)
+	return semaphore_create(mach_task_self(), semaphore, SYNC_POLICY_FIFO, 0) == KERN_SUCCESS;
+#else
+	return sem_init(semaphore, 0, 0) == 0;
+#endif
+}
+
+static inline void MyFilePlayerSemaphoreDestroy(MyFilePlayerSemaphore *semaphore)
+{
+#if defined(__APPLE__)
+	semaphore_destroy(mach_task_self(), *semaphore);
+#else
+	sem_destroy(semaphore);
+#endif
+}
+
+static inline void MyFilePlayerSemaphoreSignal(MyFilePlayerSemaphore *semaphore)
+{
+#if defined(__APPLE__)
+	semaphore_signal(*semaphore);
+#else
+	sem_post(semaphore);
+#endif
+}
+
+// wait for a signal, or a few milliseconds, whichever comes first
+static inline void MyFilePlayerSemaphoreWait(MyFilePlayerSemaphore *semaphore)
+{
+#if defined(__APPLE__)
+	mach_timespec_t timeout = { 0, 5000000 };
+	semaphore_timedwait(*semaphore, timeout);
+#else
+	struct timespec until;
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_nsec += 5000000;
+	if (until.tv_nsec >= 1000000000) {
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000;
+	}
+	while (sem_timedwait(semaphore, &until) != 0 && errno == EINTR)
+		;
+#endif
+}
+
+#pragma mark - decode thread -
+
+// safe from the render thread
+static inline void MyFilePlayerWakeDecoder(MyFilePlayer *player)
+{
+	MyFilePlayerSemaphoreSignal(&player->wakeSemaphore);
+}
+
+static inline void MyFilePlayerDecoderWait(MyFilePlayer *player)
+{
+	MyFilePlayerSemaphoreWait(&player->wakeSemaphore);
+}
+
+// let a thread waiting in MyFilePlayerWaitForProgress() look again
+static inline void MyFilePlayerSignalProgress(MyFilePlayer *player)
+{
+	player->progressCount++;
+	__sync_synchronize();
+	if (player->progressWanted) {
+		player->progressWanted = false;
+		MyFilePlayerSemaphoreSignal(&player->progressSemaphore);
+	}
+}
+
+// read the next stretch of the current region into decodeBuffers. false if
+// there's nothing to decode
+static inline Boolean MyFilePlayerDecodeNext(MyFilePlayer *player)
+{
+	if (player->decodeRegion == player->regionsScheduled)
+		return false;
+	__sync_synchronize();
+	const MyFilePlayerRegion *region = &player->regions[player->decodeRegion % kMyFilePlayerMaxRegions];
+
+	UInt64 start = MyFilePlayerClock();
+	if (player->decodeNeedsSeek) {
+		player->source.seek(player->source.refCon, region->startFrame + player->decodeFrame);
+		player->decodeNeedsSeek = false;
+	}
+	UInt32 frames = kMyFilePlayerDecodeFrames;
+	if (frames > region->framesToPlay - player->decodeFrame)
+		frames = (UInt32)(region->framesToPlay - player->decodeFrame);
+	UInt32 channel;
+	for (channel = 0; channel < player->channelCount; channel++)
+		player->decodeBuffers->mBuffers[channel].mDataByteSize = frames * sizeof(Float32);
+	UInt32 read = frames;
+	if (player->source.read(player->source.refCon, &read, player->decodeBuffers) != noErr)
+		read = 0;
+	// the render thread counts on every region being as long as it said, so a
+	// short file is made up with silence
+	if (read < frames)
+		for (channel = 0; channel < player->channelCount; channel++)
+			memset((Float32 *)player->decodeBuffers->mBuffers[channel].mData + read, 0,
+				   (frames - read) * sizeof(Float32));
+	player->decodeTime += MyFilePlayerClock() - start;
+	player->decodedFrames += frames;
+
+	player->stagedOffset = 0;
+	player->stagedFrames = frames;
+	__sync_synchronize();
+	player->decodeFrame += frames;
+	if (player->decodeFrame == region->framesToPlay) {
+		player->decodeFrame = 0;
+		player->decodeNeedsSeek = true;
+		if (region->loopCount == kMyFilePlayerLoopForever || player->decodeLoop < region->loopCount) {
+			player->decodeLoop++;
+		} else {
+			player->decodeRegion++;
+			player->decodeLoop = 0;
+		}
+	}
+	return true;
+}
+
+// copy as much of the staged audio into the ring as fits. false if none did
+static inline Boolean MyFilePlayerFillRing(MyFilePlayer *player)
+{
+	UInt32 space = player->ringFrames - (player->ringWritten - player->ringRead);
+	UInt32 frames = player->stagedFrames < space ? player->stagedFrames : space;
+	if (frames == 0)
+		return false;
+	const UInt32 mask = player->ringFrames - 1;
+	UInt32 position = player->ringWritten & mask;
+	UInt32 first = player->ringFrames - position < frames ? player->ringFrames - position : frames;
+	UInt32 channel;
+	for (channel = 0; channel < player->channelCount; channel++) {
+		const Float32 *staged = (const Float32 *)player->decodeBuffers->mBuffers[channel].mData + player->stagedOffset;
+		Float32 *ring = player->ring + channel * player->ringFrames;
+		memcpy(ring + position, staged, first * sizeof(Float32));
+		memcpy(ring, staged + first, (frames - first) * sizeof(Float32));
+	}
+	__sync_synchronize();
+	player->ringWritten += frames;
+	player->stagedFrames -= frames;
+	player->stagedOffset += frames;
+	MyFilePlayerSignalProgress(player);
+
+	if (!player->generationHasAudio) {
+		UInt64 seekTime = MyFilePlayerClock() - player->resetTime;
+		player->seekCount++;
+		player->seekTime += seekTime;
+		if (seekTime > player->maxSeekTime)
+			player->maxSeekTime = seekTime;
+		player->generationHasAudio = true;
+	}
+	return true;
+}
+
+static void *MyFilePlayerDecodeProc(void *refCon)
+{
+	MyFilePlayer *player = (MyFilePlayer *)refCon;
+	while (!player->stopDecoding) {
+		UInt32 generation = player->requestedGeneration;
+		if (generation != player->decodeGeneration) {
+			// the render thread reads the last generation's start once, when it
+			// picks it up. it mustn't change under it before then
+			if (player->renderGeneration != player->decodeGeneration) {
+				MyFilePlayerDecoderWait(player);
+				continue;
+			}
+			__sync_synchronize();
+			player->decodeRegion = player->resetRegion;
+			player->decodeLoop = 0;
+			player->decodeFrame = 0;
+			player->decodeNeedsSeek = true;
+			player->stagedFrames = 0;
+			player->generationHasAudio = false;
+			player->generationRingStart = player->ringWritten;
+			player->generationFirstRegion = player->decodeRegion;
+			__sync_synchronize();
+			player->decodeGeneration = generation;
+			MyFilePlayerSignalProgress(player);
+		}
+
+		if (player->stagedFrames == 0 && !MyFilePlayerDecodeNext(player)) {
+			MyFilePlayerDecoderWait(player);
+			continue;
+		}
+		// new audio waits until the render thread has moved to its generation
+		if (player->renderGeneration != player->decodeGeneration || !MyFilePlayerFillRing(player))
+			MyFilePlayerDecoderWait(player);
+	}
+	return NULL;
+}
+
+#pragma mark - player -
+
+static inline void MyFilePlayerDispose(MyFilePlayer *player)
+{
+	if (player->decodeThread) {
+		player->stopDecoding = true;
+		__sync_synchronize();
+		MyFilePlayerWakeDecoder(player);
+		pthread_join(player->decodeThread, NULL);
+		MyFilePlayerSemaphoreDestroy(&player->wakeSemaphore);
+		MyFilePlayerSemaphoreDestroy(&player->progressSemaphore);
+	}
+	free(player->ring);
+	free(player->decodeBuffers); // the channels' memory is in the same block
+	memset(player, 0, sizeof(MyFilePlayer));
+}
+
+// source frames come out at sampleRate, with channelCount channels. the ring
+// holds at least ringFrames frames (rounded up to a power of two), which is how
+// far the decode thread can get ahead
+static inline OSStatus MyFilePlayerInit(MyFilePlayer *player, Float64 sampleRate, UInt32 channelCount,
+										const MyFilePlayerSource *source, UInt32 ringFrames)
+{
+	memset(player, 0, sizeof(MyFilePlayer));
+	if (channelCount == 0 || channelCount > kMyFilePlayerMaxChannels)
+		return kMyFilePlayerError_TooManyChannels;
+	player->sampleRate = sampleRate;
+	player->channelCount = channelCount;
+	player->source = *source;
+	player->generationHasAudio = true;
+	player->decodeNeedsSeek = true;
+
+	player->ringFrames = kMyFilePlayerDecodeFrames;
+	while (player->ringFrames < ringFrames)
+		player->ringFrames <<= 1;
+	player->ring = (Float32 *)calloc((size_t)player->ringFrames * channelCount, sizeof(Float32));
+
+	size_t listSize = offsetof(AudioBufferList, mBuffers) + channelCount * sizeof(AudioBuffer);
+	player->decodeBuffers = (AudioBufferList *)calloc(1, listSize + channelCount * kMyFilePlayerDecodeFrames * sizeof(Float32));
+	player->decodeBuffers->mNumberBuffers = channelCount;
+	Float32 *memory = (Float32 *)((char *)player->decodeBuffers + listSize);
+	UInt32 channel;
+	for (channel = 0; channel < channelCount; channel++) {
+		player->decodeBuffers->mBuffers[channel].mNumberChannels = 1;
+		player->decodeBuffers->mBuffers[channel].mData = memory + channel * kMyFilePlayerDecodeFrames;
+	}
+
+	if (!MyFilePlayerSemaphoreCreate(&player->wakeSemaphore)) {
+		MyFilePlayerDispose(player);
+		return kMyFilePlayerError_Thread;
+	}
+	if (!MyFilePlayerSemaphoreCreate(&player->progressSemaphore)) {
+		MyFilePlayerSemaphoreDestroy(&player->wakeSemaphore);
+		MyFilePlayerDispose(player);
+		return kMyFilePlayerError_Thread;
+	}
+	if (pthread_create(&player->decodeThread, NULL, MyFilePlayerDecodeProc, player) != 0) {
+		MyFilePlayerSemaphoreDestroy(&player->wakeSemaphore);
+		MyFilePlayerSemaphoreDestroy(&player->progressSemaphore);
+		player->decodeThread = 0;
+		MyFilePlayerDispose(player);
+		return kMyFilePlayerError_Thread;
+	}
+	return noErr;
+}
+
+// queue a region after the ones already queued. framesToPlay is cut short at
+// the end of the file
+static inline OSStatus MyFilePlayerScheduleRegion(MyFilePlayer *player, const MyFilePlayerRegion *region)
+{
+	MyFilePlayerRegion clipped = *region;
+	if (clipped.startFrame < 0 || clipped.framesToPlay <= 0)
+		return kMyFilePlayerError_BadRegion;
+	if (player->source.frameCount > 0) {
+		if (clipped.startFrame >= player->source.frameCount)
+			return kMyFilePlayerError_BadRegion;
+		if (clipped.framesToPlay > player->source.frameCount - clipped.startFrame)
+			clipped.framesToPlay = player->source.frameCount - clipped.startFrame;
+	}
+	if (player->regionsScheduled - player->renderRegion >= kMyFilePlayerMaxRegions)
+		return kMyFilePlayerError_QueueFull;
+
+	player->regions[player->regionsScheduled % kMyFilePlayerMaxRegions] = clipped;
+	__sync_synchronize();
+	player->regionsScheduled++;
+	MyFilePlayerWakeDecoder(player);
+	return noErr;
+}
+
+// drop every region queued, including the one playing. the render thread lets
+// go of them at the start of its next render after the decode thread catches up
+static inline void MyFilePlayerReset(MyFilePlayer *player)
+{
+	player->resetRegion = player->regionsScheduled;
+	player->resetTime = MyFilePlayerClock();
+	__sync_synchronize();
+	player->requestedGeneration++;
+	MyFilePlayerWakeDecoder(player);
+}
+
+// play from frame to the end of the file, as soon as it's decoded
+static inline OSStatus MyFilePlayerSeek(MyFilePlayer *player, SInt64 frame)
+{
+	MyFilePlayerReset(player);
+	MyFilePlayerRegion region = {0};
+	region.startTime = kMyFilePlayerStartAfterPrevious;
+	region.startFrame = frame;
+	region.framesToPlay = player->source.frameCount - frame;
+	return MyFilePlayerScheduleRegion(player, &region);
+}
+
+// roughly where the render thread is, for scheduling ahead of it
+static inline SInt64 MyFilePlayerGetSampleTime(const MyFilePlayer *player)
+{
+	return player->sampleTime;
+}
+
+// frames decoded and waiting for the render thread
+static inline UInt32 MyFilePlayerFramesBuffered(const MyFilePlayer *player)
+{
+	return player->ringWritten - player->ringRead;
+}
+
+// true while there is scheduled audio the decode thread hasn't put in the ring yet
+static inline Boolean MyFilePlayerIsDecoding(const MyFilePlayer *player)
+{
+	if (player->decodeGeneration != player->requestedGeneration)
+		return true;
+	UInt32 region = player->decodeRegion;
+	__sync_synchronize();
+	return region != player->regionsScheduled || player->stagedFrames > 0;
+}
+
+// true once everything scheduled has played
+static inline Boolean MyFilePlayerIsIdle(const MyFilePlayer *player)
+{
+	return player->renderGeneration == player->requestedGeneration &&
+		player->renderRegion == player->regionsScheduled;
+}
+
+// sleep until the decode thread has done something, or a few milliseconds. seen
+// is the progressCount read before checking whatever is being waited for
+static inline void MyFilePlayerWaitForProgress(MyFilePlayer *player, UInt32 seen)
+{
+	player->progressWanted = true;
+	__sync_synchronize();
+	if (player->progressCount == seen)
+		MyFilePlayerSemaphoreWait(&player->progressSemaphore);
+	player->progressWanted = false;
+}
+
+// with no device pulling the player, the scheduling thread can render it too.
+// these block it until the decode thread is ready, rather than spinning:
+// until the last reset has been started...
+static inline void MyFilePlayerWaitForGeneration(MyFilePlayer *player)
+{
+	for (;;) {
+		UInt32 seen = player->progressCount;
+		__sync_synchronize();
+		if (player->decodeGeneration == player->requestedGeneration)
+			return;
+		MyFilePlayerWaitForProgress(player, seen);
+	}
+}
+
+// ...and until frames are in the ring, or there's nothing more to decode
+static inline void MyFilePlayerWaitForFrames(MyFilePlayer *player, UInt32 frames)
+{
+	for (;;) {
+		UInt32 seen = player->progressCount;
+		__sync_synchronize();
+		if (MyFilePlayerFramesBuffered(player) >= frames || !MyFilePlayerIsDecoding(player))
+			return;
+		MyFilePlayerWaitForProgress(player, seen);
+	}
+}
+
+#pragma mark - render -
+
+// the format MyFilePlayerRender() fills, for the unit that pulls it
+static inline void MyFilePlayerGetStreamFormat(const MyFilePlayer *player, AudioStreamBasicDescription *outFormat)
+{
+	memset(outFormat, 0, sizeof(AudioStreamBasicDescription));
+	outFormat->mSampleRate = player->sampleRate;
+	outFormat->mFormatID = kAudioFormatLinearPCM;
+	outFormat->mFormatFlags = kAudioFormatFlagIsFloat | kAudioFormatFlagIsPacked | kAudioFormatFlagIsNonInterleaved;
+	outFormat->mChannelsPerFrame = player->channelCount;
+	outFormat->mFramesPerPacket = 1;
+	outFormat->mBitsPerChannel = 32;
+	outFormat->mBytesPerFrame = sizeof(Float32);
+	outFormat->mBytesPerPacket = sizeof(Float32);
+}
+
+
+// copy frames out of the ring into each channel of ioData, starting at offset
+static inline void MyFilePlayerCopyFromRing(MyFilePlayer *player, AudioBufferList *ioData, UInt32 offset, UInt32 frames)
+{
+	const UInt32 mask = player->ringFrames - 1;
+	UInt32 position = player->ringRead & mask;
+	UInt32 first = player->ringFrames - position < frames ? player->ringFrames - position : frames;
+	UInt32 channel;
+	for (channel = 0; channel < ioData->mNumberBuffers && channel < player->channelCount; channel++) {
+		Float32 *out = (Float32 *)ioData->mBuffers[channel].mData + offset;
+		const Float32 *ring = player->ring + channel * player->ringFrames;
+		memcpy(out, ring + position, first * sizeof(Float32));
+		memcpy(out + first, ring, (frames - first) * sizeof(Float32));
+	}
+}
+
+// render the next frames into ioData (non-interleaved Float32). silence where
+// nothing is scheduled
+static inline void MyFilePlayerRender(MyFilePlayer *player, UInt32 frames, AudioBufferList *ioData)
+{
+	UInt64 start = MyFilePlayerClock();
+	UInt32 channel;
+	for (channel = 0; channel < ioData->mNumberBuffers; channel++)
+		memset(ioData->mBuffers[channel].mData, 0, frames * sizeof(Float32));
+
+	// catch up with a reset
+	UInt32 generation = player->decodeGeneration;
+	if (generation != player->renderGeneration) {
+		__sync_synchronize();
+		player->ringRead = player->generationRingStart;
+		player->renderRegion = player->generationFirstRegion;
+		player->renderLoop = 0;
+		player->renderFrame = 0;
+		player->renderRegionStarted = false;
+		player->previousRegionEnd = player->sampleTime;
+		__sync_synchronize();
+		player->renderGeneration = generation;
+	}
+
+	const SInt64 sliceStart = player->sampleTime;
+	UInt32 done = 0;
+	while (done < frames && player->renderRegion != player->regionsScheduled) {
+		__sync_synchronize();
+		const MyFilePlayerRegion *region = &player->regions[player->renderRegion % kMyFilePlayerMaxRegions];
+		if (!player->renderRegionStarted) {
+			SInt64 startTime = region->startTime;
+			if (startTime == kMyFilePlayerStartAfterPrevious || startTime < player->previousRegionEnd)
+				startTime = player->previousRegionEnd;
+			SInt64 wait = startTime - (sliceStart + done);
+			if (wait >= (SInt64)(frames - done))
+				break; // not in this slice
+			if (wait > 0)
+				done += (UInt32)wait;
+			else if (wait < 0 && region->startTime != kMyFilePlayerStartAfterPrevious)
+				player->lateStarts++;
+			player->renderRegionStarted = true;
+		}
+
+		UInt32 available = player->ringWritten - player->ringRead;
+		__sync_synchronize();
+		UInt32 count = frames - done;
+		if (count > region->framesToPlay - player->renderFrame)
+			count = (UInt32)(region->framesToPlay - player->renderFrame);
+		if (count > available)
+			count = available;
+		if (count == 0) {
+			player->underruns++;
+			break;
+		}
+		MyFilePlayerCopyFromRing(player, ioData, done, count);
+		__sync_synchronize();
+		player->ringRead += count;
+		player->renderFrame += count;
+		done += count;
+
+		if (player->renderFrame == region->framesToPlay) {
+			player->renderFrame = 0;
+			if (region->loopCount == kMyFilePlayerLoopForever || player->renderLoop < region->loopCount) {
+				player->renderLoop++;
+			} else {
+				player->renderLoop = 0;
+				player->renderRegionStarted = false;
+				player->previousRegionEnd = sliceStart + done;
+				player->renderRegion++;
+			}
+		}
+	}
+
+	player->sampleTime = sliceStart + frames;
+	player->renderTime += MyFilePlayerClock() - start;
+	player->renderedFrames += frames;
+	MyFilePlayerWakeDecoder(player);
+}
+
+// an AURenderCallback with the player as inRefCon
+static OSStatus MyFilePlayerRenderProc(void *inRefCon,
+									   AudioUnitRenderActionFlags *ioActionFlags,
+									   const AudioTimeStamp *inTimeStamp,
+									   UInt32 inBusNumber,
+									   UInt32 inNumberFrames,
+									   AudioBufferList *ioData)
+{
+	MyFilePlayerRender((MyFilePlayer *)inRefCon, inNumberFrames, ioData);
+	return noErr;
+}
+
+static inline void MyFilePlayerPrintStats(const MyFilePlayer *player, FILE *out)
+{
+	Float64 decodedSeconds = player->decodedFrames / player->sampleRate;
+	Float64 renderedSeconds = player->renderedFrames / player->sampleRate;
+	fprintf(out, "decode: %.3f ms per second of audio\n",
+			decodedSeconds > 0.0 ? MyFilePlayerClockSeconds(player->decodeTime) * 1000.0 / decodedSeconds : 0.0);
+	fprintf(out, "render: %.3f ms per second of audio\n",
+			renderedSeconds > 0.0 ? MyFilePlayerClockSeconds(player->renderTime) * 1000.0 / renderedSeconds : 0.0);
+	if (player->seekCount > 0)
+		fprintf(out, "seeks: %u, %.3f ms average, %.3f ms longest\n", (unsigned)player->seekCount,
+				MyFilePlayerClockSeconds(player->seekTime) * 1000.0 / player->seekCount,
+				MyFilePlayerClockSeconds(player->maxSeekTime) * 1000.0);
+	fprintf(out, "underruns: %u, late starts: %u\n", (unsigned)player->underruns, (unsigned)player->lateStarts);
+}
+
+#ifndef MY_FILE_PLAYER_PORTABLE
+
+#pragma mark - ExtAudioFile source -
+
+static OSStatus MyFilePlayerExtAudioFileSeek(void *refCon, SInt64 frame)
+{
+	return ExtAudioFileSeek((ExtAudioFileRef)refCon, frame);
+}
+
+static OSStatus MyFilePlayerExtAudioFileRead(void *refCon, UInt32 *ioFrames, AudioBufferList *ioData)
+{
+	return ExtAudioFileRead((ExtAudioFileRef)refCon, ioFrames, ioData);
+}
+
+// play an open ExtAudioFile at its own sample rate and channel count, decoding
+// up to ringSeconds ahead. its client format is set to non-interleaved float,
+// which is also what the player renders
+static inline OSStatus MyFilePlayerInitWithExtAudioFile(MyFilePlayer *player, ExtAudioFileRef file, Float64 ringSeconds)
+{
+	AudioStreamBasicDescription fileFormat;
+	UInt32 propSize = sizeof(fileFormat);
+	OSStatus err = ExtAudioFileGetProperty(file, kExtAudioFileProperty_FileDataFormat, &propSize, &fileFormat);
+	if (err)
+		return err;
+
+	AudioStreamBasicDescription clientFormat = {0};
+	clientFormat.mSampleRate = fileFormat.mSampleRate;
+	clientFormat.mFormatID = kAudioFormatLinearPCM;
+	clientFormat.mFormatFlags = kAudioFormatFlagIsFloat | kAudioFormatFlagIsPacked | kAudioFormatFlagIsNonInterleaved;
+	clientFormat.mChannelsPerFrame = fileFormat.mChannelsPerFrame;
+	clientFormat.mFramesPerPacket = 1;
+	clientFormat.mBitsPerChannel = 32;
+	clientFormat.mBytesPerFrame = sizeof(Float32);
+	clientFormat.mBytesPerPacket = sizeof(Float32);
+	err = ExtAudioFileSetProperty(file, kExtAudioFileProperty_ClientDataFormat, sizeof(clientFormat), &clientFormat);
+	if (err)
+		return err;
+
+	SInt64 frameCount = 0;
+	propSize = sizeof(frameCount);
+	err = ExtAudioFileGetProperty(file, kExtAudioFileProperty_FileLengthFrames, &propSize, &frameCount);
+	if (err)
+		return err;
+
+	MyFilePlayerSource source;
+	source.seek = MyFilePlayerExtAudioFileSeek;
+	source.read = MyFilePlayerExtAudioFileRead;
+	source.refCon = file;
+	source.frameCount = frameCount;
+	return MyFilePlayerInit(player, clientFormat.mSampleRate, clientFormat.mChannelsPerFrame, &source,
+							(UInt32)(ringSeconds * clientFormat.mSampleRate));
+}
+
+#endif
+
+#endif
@@ -0,0 +1,147 @@
+//
+//  MySpatialMixer.h
+//  Common
+//
+//  Copyright 2026 Subsequently and Furthermore, Inc. All rights reserved.
+//
+
+// A small software stand-in for what OpenAL does with a listener at the origin
+// facing down -z: mono 16-bit sources with a gain, a position and optional
+// looping are mixed to interleaved stereo float. Distance attenuation follows
+// AL_INVERSE_DISTANCE_CLAMPED (OpenAL's default model) and left/right placement
+// is an equal-power pan on the source's x position. It doesn't need a device,
+// so a scene can be rendered straight to a file as fast as the CPU allows, and
+// the same scene always renders the same samples.
+//
+// Gains are worked out once per render call and ramped across it, so call
+// MySpatialMixerRender() once per position update.
+
+#ifndef Common_MySpatialMixer_h
+#define Common_MySpatialMixer_h
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "MyAudioKernels.h"
+
+#define kMySpatialMixerBlockFrames	1024 // source frames converted to float at a time
+
+typedef struct MySpatialMixerSource {
+	const SInt16		*samples; // mono, not owned by the mixer. sources may share them
+	UInt32				frameCount;
+	UInt32				playPosition; // next frame to mix
+	Boolean				looping;
+	Boolean				playing;
+	Float32				gain;
+	Float32				x;
+	Float32				y;
+	Float32				z;
+	Float32				lastGainLeft; // where the previous render call's ramp ended
+	Float32				lastGainRight;
+	Boolean				hasLastGains;
+} MySpatialMixerSource;
+
+typedef struct MySpatialMixer {
+	MySpatialMixerSource	*sources;
+	UInt32					sourceCount;
+	Float32					referenceDistance; // AL_REFERENCE_DISTANCE
+	Float32					rolloffFactor; // AL_ROLLOFF_FACTOR
+	Float32					maxDistance; // AL_MAX_DISTANCE
+	Float32					scratch[kMySpatialMixerBlockFrames];
+} MySpatialMixer;
+
+// sources start stopped, with gain 1 at the origin, like a new AL source
+static inline void MySpatialMixerInit(MySpatialMixer *mixer, UInt32 sourceCount)
+{
+	mixer->sources = (MySpatialMixerSource *)calloc(sourceCount, sizeof(MySpatialMixerSource));
+	mixer->sourceCount = sourceCount;
+	UInt32 i;
+	for (i = 0; i < sourceCount; i++)
+		mixer->sources[i].gain = 1.0f;
+	mixer->referenceDistance = 1.0f;
+	mixer->rolloffFactor = 1.0f;
+	mixer->maxDistance = 1.0e30f;
+}
+
+static inline void MySpatialMixerDispose(MySpatialMixer *mixer)
+{
+	free(mixer->sources);
+	mixer->sources = NULL;
+	mixer->sourceCount = 0;
+}
+
+static inline void MySpatialMixerSourceGains(const MySpatialMixer *mixer, const MySpatialMixerSource *source,
+											 Float32 *outLeft, Float32 *outRight)
+{
+	Float32 distance = sqrtf(source->x * source->x + source->y * source->y + source->z * source->z);
+
+	// AL_INVERSE_DISTANCE_CLAMPED
+	Float32 clamped = distance;
+	if (clamped < mixer->referenceDistance)
+		clamped = mixer->referenceDistance;
+	if (clamped > mixer->maxDistance)
+		clamped = mixer->maxDistance;
+	Float32 attenuation = mixer->referenceDistance /
+		(mixer->referenceDistance + mixer->rolloffFactor * (clamped - mixer->referenceDistance));
+
+	// -1 is hard left, 1 hard right. a source right on top of the listener is centered
+	Float32 pan = distance > 0.0f ? source->x / distance : 0.0f;
+	Float32 angle = (pan + 1.0f) * (Float32)M_PI_4;
+	Float32 gain = source->gain * attenuation;
+	*outLeft = gain * cosf(angle);
+	*outRight = gain * sinf(angle);
+}
+
+// mix frames of every playing source into out (interleaved stereo), replacing what was there
+static inline void MySpatialMixerRender(MySpatialMixer *mixer, Float32 *out, UInt32 frames)
+{
+	memset(out, 0, frames * 2 * sizeof(Float32));
+	if (frames == 0)
+		return;
+
+	UInt32 i;
+	for (i = 0; i < mixer->sourceCount; i++) {
+		MySpatialMixerSource *source = &mixer->sources[i];
+		if (!source->playing || source->frameCount == 0)
+			continue;
+
+		// ramp from the last call's gains to this position's, so moving sources don't click
+		Float32 targetLeft, targetRight;
+		MySpatialMixerSourceGains(mixer, source, &targetLeft, &targetRight);
+		if (!source->hasLastGains) {
+			source->lastGainLeft = targetLeft;
+			source->lastGainRight = targetRight;
+			source->hasLastGains = true;
+		}
+		Float32 stepLeft = (targetLeft - source->lastGainLeft) / frames;
+		Float32 stepRight = (targetRight - source->lastGainRight) / frames;
+
+		UInt32 mixed = 0;
+		while (mixed < frames) {
+			if (source->playPosition >= source->frameCount) {
+				if (!source->looping) {
+					source->playing = false;
+					break;
+				}
+				source->playPosition = 0;
+			}
+			UInt32 blockFrames = frames - mixed;
+			if (blockFrames > kMySpatialMixerBlockFrames)
+				blockFrames = kMySpatialMixerBlockFrames;
+			if (blockFrames > source->frameCount - source->playPosition)
+				blockFrames = source->frameCount - source->playPosition;
+
+			MyInt16ToFloat(source->samples + source->playPosition, mixer->scratch, blockFrames);
+			MyMixMonoIntoStereo(mixer->scratch, out + mixed * 2, blockFrames,
+								source->lastGainLeft + mixed * stepLeft, stepLeft,
+								source->lastGainRight + mixed * stepRight, stepRight);
+			source->playPosition += blockFrames;
+			mixed += blockFrames;
+		}
+		source->lastGainLeft = targetLeft;
+		source->lastGainRight = targetRight;
+	}
+}
+
+#endif